@@ -88,6 +88,7 @@ static gpointer send_thread_func(gpointer data) {
 
                 if (json_object_object_get_ex(root, "client", &client_obj)) {
                     struct json_object *chunk_obj=NULL, *cto_obj=NULL, *mr_obj=NULL, *rb_obj=NULL;
+                    struct json_object *early_obj=NULL, *ktls_obj=NULL;
                     if (json_object_object_get_ex(client_obj, "chunk_size", &chunk_obj))
                         cfg.chunk_size = json_object_get_int(chunk_obj);
                     if (json_object_object_get_ex(client_obj, "connect_timeout", &cto_obj))
@@ -96,6 +97,10 @@ static gpointer send_thread_func(gpointer data) {
                         cfg.max_retries = json_object_get_int(mr_obj);
                     if (json_object_object_get_ex(client_obj, "retry_backoff_ms", &rb_obj))
                         cfg.retry_backoff_ms = json_object_get_int(rb_obj);
+                    if (json_object_object_get_ex(client_obj, "tls_early_data", &early_obj))
+                        cfg.tls_early_data = json_object_get_int(early_obj) ? 1 : 0;
+                    if (json_object_object_get_ex(client_obj, "tls_ktls", &ktls_obj))
+                        cfg.tls_ktls = json_object_get_int(ktls_obj) ? 1 : 0;
                 }
 
                 json_object_put(root);
@@ -13,6 +13,9 @@
 #include <sys/socket.h>
 #include <sys/types.h>
 #include <time.h>
+#include <poll.h>
+#include <signal.h>
+#include <uuid/uuid.h>
 
 #include "network.h"
 #include "protocol.h"
@@ -24,8 +27,21 @@
 typedef struct {
     int   fd;
     SSL*  ssl;   // NULL si no TLS
+    char  peer[300];              // "host:port", clave de la sesión TLS guardada
+    unsigned char* early_buf;     // datos 0-RTT enviados (NULL = handshake terminado)
+    size_t early_len, early_cap;  // early_cap = límite de early data de la sesión
 } NetStream;
 
+// Contexto TLS de larga vida: las sesiones (tickets) de conexiones
+// anteriores se reanudan, así que sólo la primera conexión a un
+// servidor paga el handshake completo
+static SSL_CTX*     g_tls_ctx = NULL;
+static SSL_SESSION* g_tls_session = NULL;   // último ticket recibido de g_tls_peer
+static char         g_tls_peer[300];
+static GMutex       g_tls_lock;
+
+#define MAX_EARLY_DATA 16384   // bytes enviados como 0-RTT como máximo
+
 // Utiles
 /*
  * Byte-order helpers
@@ -42,11 +58,25 @@ static uint32_t from_be32(uint32_t v) { return ntohl(v); }
  * Thin wrappers that send/receive data over either a plain socket
  * file descriptor or an OpenSSL SSL object when TLS is enabled.
  */
+static int finish_handshake(NetStream* ns);
+
 static ssize_t ns_send(NetStream* ns, const void* buf, size_t len) {
+    if (ns->early_buf) {
+        // 0-RTT mientras quepa en el límite de la sesión; si no, terminar el handshake
+        size_t w = 0;
+        if (len <= ns->early_cap - ns->early_len &&
+            SSL_write_early_data(ns->ssl, buf, len, &w) == 1) {
+            memcpy(ns->early_buf + ns->early_len, buf, w);
+            ns->early_len += w;
+            return (ssize_t)w;
+        }
+        if (finish_handshake(ns) != 0) return -1;
+    }
     if (ns->ssl) return SSL_write(ns->ssl, buf, (int)len);
-    return send(ns->fd, buf, len, 0);
+    return send(ns->fd, buf, len, MSG_NOSIGNAL);
 }
 static ssize_t ns_recv(NetStream* ns, void* buf, size_t len) {
+    if (ns->early_buf && finish_handshake(ns) != 0) return -1;
     if (ns->ssl) return SSL_read(ns->ssl, buf, (int)len);
     return recv(ns->fd, buf, len, 0);
 }
@@ -78,6 +108,32 @@ static int recv_all(NetStream* ns, void* buf, size_t len) {
     return 0;
 }
 
+/*
+ * ns_ktls_send
+ * ------------
+ * True when the kernel encrypts this stream (kTLS transmit offload), so
+ * file data can be sent with SSL_sendfile instead of read + SSL_write.
+ */
+static int ns_ktls_send(NetStream* ns) {
+    return ns->ssl && !ns->early_buf && BIO_get_ktls_send(SSL_get_wbio(ns->ssl));
+}
+
+/*
+ * sendfile_all
+ * ------------
+ * Send `len` bytes of file `fd` starting at `off` over a kTLS stream.
+ * Returns 0 on success, -1 on error.
+ */
+static int sendfile_all(NetStream* ns, int fd, off_t off, size_t len) {
+    while (len > 0) {
+        ossl_ssize_t n = SSL_sendfile(ns->ssl, fd, off, len, 0);
+        if (n <= 0) return -1;
+        off += n;
+        len -= (size_t)n;
+    }
+    return 0;
+}
+
 /*
  * send_header / recv_header
  * --------------------------
@@ -119,17 +175,103 @@ static int send_message(NetStream* ns, uint8_t type, const char* image_id,
     return 0;
 }
 
+/*
+ * on_new_session
+ * --------------
+ * OpenSSL callback for each session ticket the server issues: keep the
+ * newest one (with the "host:port" it belongs to) for the next
+ * connection. Returns 1 because the reference is kept.
+ */
+static int on_new_session(SSL* ssl, SSL_SESSION* sess) {
+    const char* peer = (const char*)SSL_get_app_data(ssl);
+    g_mutex_lock(&g_tls_lock);
+    if (g_tls_session) SSL_SESSION_free(g_tls_session);
+    g_tls_session = sess;
+    g_strlcpy(g_tls_peer, peer ? peer : "", sizeof(g_tls_peer));
+    g_mutex_unlock(&g_tls_lock);
+    return 1;
+}
+
+/*
+ * tls_client_ctx
+ * --------------
+ * Return the process-wide client SSL_CTX, creating it on first use.
+ * Sessions are stored by on_new_session rather than in OpenSSL's
+ * internal client cache. Returns NULL on failure.
+ */
+static SSL_CTX* tls_client_ctx(void) {
+    g_mutex_lock(&g_tls_lock);
+    if (!g_tls_ctx) {
+        SSL_library_init();
+        SSL_load_error_strings();
+        OpenSSL_add_all_algorithms();
+
+        g_tls_ctx = SSL_CTX_new(TLS_client_method());
+        if (g_tls_ctx) {
+            SSL_CTX_set_session_cache_mode(g_tls_ctx,
+                SSL_SESS_CACHE_CLIENT | SSL_SESS_CACHE_NO_INTERNAL_STORE);
+            SSL_CTX_sess_set_new_cb(g_tls_ctx, on_new_session);
+        }
+    }
+    SSL_CTX* ctx = g_tls_ctx;
+    g_mutex_unlock(&g_tls_lock);
+    return ctx;
+}
+
+/*
+ * saved_session
+ * -------------
+ * Return a new reference to the stored session for `peer`, or NULL.
+ */
+static SSL_SESSION* saved_session(const char* peer) {
+    SSL_SESSION* sess = NULL;
+    g_mutex_lock(&g_tls_lock);
+    if (g_tls_session && strcmp(g_tls_peer, peer) == 0 &&
+        SSL_SESSION_is_resumable(g_tls_session)) {
+        sess = g_tls_session;
+        SSL_SESSION_up_ref(sess);
+    }
+    g_mutex_unlock(&g_tls_lock);
+    return sess;
+}
+
+/*
+ * finish_handshake
+ * ----------------
+ * Complete a handshake that was left open to send 0-RTT data. If the
+ * server rejected the early data it was discarded, so it is sent again
+ * as regular application data. Returns 0 on success, -1 on failure.
+ */
+static int finish_handshake(NetStream* ns) {
+    int ok = (SSL_connect(ns->ssl) == 1);
+    if (ok && SSL_get_early_data_status(ns->ssl) != SSL_EARLY_DATA_ACCEPTED) {
+        for (size_t off = 0; ok && off < ns->early_len; ) {
+            int n = SSL_write(ns->ssl, ns->early_buf + off, (int)(ns->early_len - off));
+            if (n <= 0) ok = 0;
+            else off += (size_t)n;
+        }
+    }
+    free(ns->early_buf);
+    ns->early_buf = NULL;
+    ns->early_len = ns->early_cap = 0;
+    return ok ? 0 : -1;
+}
+
 /*
  * connect_with_retry
  * ------------------
  * Resolve and connect to `host:port`, retrying on failure up to
- * `max_retries`. If `use_tls` is true, perform a TLS handshake and
- * attach an SSL object to the returned NetStream. Returns 0 on
+ * `max_retries`. If `use_tls` is true, perform a TLS handshake (resuming
+ * the last session with this server when there is one) and attach an
+ * SSL object to the returned NetStream. With `early_data` and a session
+ * that allows it, the handshake is left open so the first messages go
+ * out as TLS 1.3 0-RTT data. `ktls` asks OpenSSL to offload the record
+ * layer to the kernel (ignored when unsupported). Returns 0 on
  * successful connection, -1 on failure.
  */
 static int connect_with_retry(const char* host, int port, int timeout_sec,
                               int max_retries, int backoff_ms, NetStream* out_ns,
-                              gboolean use_tls) {
+                              gboolean use_tls, gboolean early_data, gboolean ktls) {
     memset(out_ns, 0, sizeof(*out_ns));
     out_ns->fd = -1;
 
@@ -168,26 +310,46 @@ static int connect_with_retry(const char* host, int port, int timeout_sec,
         freeaddrinfo(res);
 
         if (fd != -1) {
-            // TLS si aplica
+            // TLS si aplica (reanudando la sesión anterior con este servidor)
             if (use_tls) {
-                SSL_library_init();
-                SSL_load_error_strings();
-                OpenSSL_add_all_algorithms();
-
-                SSL_CTX* ctx = SSL_CTX_new(TLS_client_method());
+                SSL_CTX* ctx = tls_client_ctx();
                 if (!ctx) { close(fd); return -1; }
 
                 SSL* ssl = SSL_new(ctx);
-                SSL_CTX_free(ctx); // ctx refcount se mantiene por ssl
                 if (!ssl) { close(fd); return -1; }
 
+                g_snprintf(out_ns->peer, sizeof(out_ns->peer), "%s:%d", host, port);
+                SSL_set_app_data(ssl, out_ns->peer);
                 SSL_set_fd(ssl, fd);
+
+                SSL_SESSION* sess = saved_session(out_ns->peer);
+                if (sess) SSL_set_session(ssl, sess);
+
+                uint32_t max_early = sess ? SSL_SESSION_get_max_early_data(sess) : 0;
+                if (sess) SSL_SESSION_free(sess);   // ssl keeps its own reference
+                out_ns->ssl = ssl;
+#ifdef SSL_OP_ENABLE_KTLS
+                // kTLS: OpenSSL hands the keys to the kernel after the handshake if it can
+                if (ktls) SSL_set_options(ssl, SSL_OP_ENABLE_KTLS);
+#endif
+
+                if (early_data && max_early > 0) {
+                    // 0-RTT: the handshake finishes on the first read or oversized write
+                    out_ns->early_cap = max_early < MAX_EARLY_DATA ? max_early : MAX_EARLY_DATA;
+                    out_ns->early_buf = (unsigned char*)malloc(out_ns->early_cap);
+                    if (out_ns->early_buf) {
+                        SSL_set_connect_state(ssl);
+                        return 0;
+                    }
+                    out_ns->early_cap = 0;
+                }
                 if (SSL_connect(ssl) != 1) {
                     SSL_free(ssl);
+                    out_ns->ssl = NULL;
                     close(fd);
+                    out_ns->fd = -1;
                     return -1;
                 }
-                out_ns->ssl = ssl;
             }
             return 0; // conectado
         }
@@ -207,6 +369,9 @@ static int connect_with_retry(const char* host, int port, int timeout_sec,
  */
 static void close_stream(NetStream* ns) {
     if (!ns) return;
+    free(ns->early_buf);
+    ns->early_buf = NULL;
+    ns->early_len = ns->early_cap = 0;
     if (ns->ssl) {
         SSL_shutdown(ns->ssl);
         SSL_free(ns->ssl);
@@ -251,30 +416,46 @@ static const char* base_from_path(const char* path) {
     return slash ? slash + 1 : path;
 }
 
+#define PIPELINE_DEPTH 16   // images sent ahead of their final ACK
+#define RETRY_LIMIT   100   // MSG_RETRY_AFTER answers accepted per image
+
+// An image whose messages were sent but whose ACK has not arrived yet
+typedef struct {
+    char        image_id[37];
+    const char* path;
+    int         retries;    // times the server already deferred it
+} InFlight;
+
+// An image the server deferred, waiting to be sent again
+typedef struct {
+    const char* path;
+    int         retries;
+} Pending;
+
+// Uploads deferred by the server's memory admission control
+typedef struct {
+    GQueue queue;           // Pending* to resend
+    gint64 resume_at;       // monotonic time (us) before which nothing is sent
+    int    gave_up;         // images dropped after RETRY_LIMIT deferrals
+} RetryState;
+
 /*
- * send_one_image
- * --------------
- * Connect to the server, perform the handshake (HELLO -> IMAGE_ID_RESP),
- * send an ImageInfo header and stream the file in chunks. Waits for a
- * final ACK. Uses `cfg` for connection parameters and invokes `cb`
- * for progress updates. Returns 0 on success, -1 on error.
+ * open_stream
+ * -----------
+ * Connect (and handshake, for https) using the settings in `cfg`.
+ * Returns 0 on success, -1 on failure (reported through `cb`).
  */
-static int send_one_image(const char* filepath,
-                          const NetConfig* cfg,
-                          ProcessingType proc_type,
-                          ProgressCallback cb) {
-    // 1) Conectar
+static int open_stream(const NetConfig* cfg, NetStream* ns, ProgressCallback cb) {
     if (cb) cb("Connecting to server...", 0.0);
 
     // Ahora protocol es un buffer propio, no un puntero del JSON.
     gboolean want_tls = (g_ascii_strcasecmp(cfg->protocol, "https") == 0);
 
-    NetStream ns;
     if (connect_with_retry(cfg->host, cfg->port,
                            cfg->connect_timeout,
                            cfg->max_retries,
                            cfg->retry_backoff_ms,
-                           &ns, want_tls) != 0) {
+                           ns, want_tls, cfg->tls_early_data, cfg->tls_ktls) != 0) {
         if (cb) {
             char dbg[256];
             g_snprintf(dbg, sizeof(dbg),
@@ -285,34 +466,32 @@ static int send_one_image(const char* filepath,
         }
         return -1;
     }
+    return 0;
+}
 
-    // 2) HELLO -> IMAGE_ID_RESPONSE
-    if (send_message(&ns, MSG_HELLO, NULL, NULL, 0) != 0) {
-        if (cb) cb("Failed to send HELLO", 0.0);
-        close_stream(&ns);
-        return -1;
-    }
-
-    MessageHeader hdr;
-    if (recv_header(&ns, &hdr) != 0 || hdr.type != MSG_IMAGE_ID_RESPONSE) {
-        if (cb) cb("Invalid response to HELLO", 0.0);
-        close_stream(&ns);
-        return -1;
-    }
-    char image_id[37];
-    strncpy(image_id, hdr.image_id, sizeof(image_id));
-    image_id[36] = '\0';
+/*
+ * send_image_messages
+ * -------------------
+ * Send one image as HELLO (proposing `image_id`), IMAGE_INFO, the
+ * chunks and IMAGE_COMPLETE, without waiting for any response; the
+ * server's replies are collected later by collect_responses. Returns
+ * 0 on success, -1 on error (`*conn_lost` tells whether the stream is
+ * still usable).
+ */
+static int send_image_messages(NetStream* ns, const char* filepath, const char* image_id,
+                               const NetConfig* cfg, ProcessingType proc_type,
+                               ProgressCallback cb, int* conn_lost) {
+    *conn_lost = 0;
 
-    // 3) Preparar ImageInfo
+    // 1) Preparar ImageInfo
     FILE* f = fopen(filepath, "rb");
     if (!f) {
         if (cb) cb("Failed to open image file", 0.0);
-        close_stream(&ns);
         return -1;
     }
-    if (fseek(f, 0, SEEK_END) != 0) { fclose(f); close_stream(&ns); return -1; }
+    if (fseek(f, 0, SEEK_END) != 0) { fclose(f); return -1; }
     long total_size_l = ftell(f);
-    if (total_size_l < 0) { fclose(f); close_stream(&ns); return -1; }
+    if (total_size_l < 0) { fclose(f); return -1; }
     rewind(f);
 
     int chunk = cfg->chunk_size > 0 ? cfg->chunk_size : DEFAULT_CHUNK_SIZE;
@@ -334,31 +513,51 @@ static int send_one_image(const char* filepath,
     info.processing_type = (uint8_t)proc_type;
     strncpy(info.format, ext_from_filename(filepath), sizeof(info.format)-1);
 
-    if (send_message(&ns, MSG_IMAGE_INFO, image_id, &info, sizeof(info)) != 0) {
-        if (cb) cb("Failed to send IMAGE_INFO", 0.0);
-        fclose(f);
-        close_stream(&ns);
+    unsigned char* buf = (unsigned char*)malloc((size_t)chunk);
+    if (!buf) { fclose(f); return -1; }
+
+    // 2) HELLO (con el id propuesto) + IMAGE_INFO, sin esperar respuesta
+    if (send_message(ns, MSG_HELLO, image_id, NULL, 0) != 0 ||
+        send_message(ns, MSG_IMAGE_INFO, image_id, &info, sizeof(info)) != 0) {
+        if (cb) cb("Failed to send HELLO/IMAGE_INFO", 0.0);
+        free(buf); fclose(f);
+        *conn_lost = 1;
         return -1;
     }
 
-    // 4) Enviar por chunks
-    unsigned char* buf = (unsigned char*)malloc((size_t)chunk);
-    if (!buf) { fclose(f); close_stream(&ns); return -1; }
-
+    // 3) Enviar por chunks
     long sent = 0;
     while (!feof(f)) {
-        size_t n = fread(buf, 1, (size_t)chunk, f);
-        if (ferror(f)) {
-            if (cb) cb("Read error", 0.0);
-            free(buf); fclose(f); close_stream(&ns);
-            return -1;
-        }
-        if (n == 0) break;
+        size_t n;
+        if (ns_ktls_send(ns)) {
+            // kTLS: el kernel cifra, así que el chunk va del archivo al socket sin copia
+            long left = total_size_l - sent;
+            if (left <= 0) break;
+            n = left < chunk ? (size_t)left : (size_t)chunk;
+            if (send_header(ns, MSG_IMAGE_CHUNK, (uint32_t)n, image_id) != 0 ||
+                sendfile_all(ns, fileno(f), (off_t)sent, n) != 0) {
+                if (cb) cb("Failed to send CHUNK", 0.0);
+                free(buf); fclose(f);
+                *conn_lost = 1;
+                return -1;
+            }
+        } else {
+            n = fread(buf, 1, (size_t)chunk, f);
+            if (ferror(f)) {
+                // The server already holds a buffer for this image: drop the connection
+                if (cb) cb("Read error", 0.0);
+                free(buf); fclose(f);
+                *conn_lost = 1;
+                return -1;
+            }
+            if (n == 0) break;
 
-        if (send_message(&ns, MSG_IMAGE_CHUNK, image_id, buf, (uint32_t)n) != 0) {
-            if (cb) cb("Failed to send CHUNK", 0.0);
-            free(buf); fclose(f); close_stream(&ns);
-            return -1;
+            if (send_message(ns, MSG_IMAGE_CHUNK, image_id, buf, (uint32_t)n) != 0) {
+                if (cb) cb("Failed to send CHUNK", 0.0);
+                free(buf); fclose(f);
+                *conn_lost = 1;
+                return -1;
+            }
         }
         sent += (long)n;
 
@@ -372,45 +571,218 @@ static int send_one_image(const char* filepath,
     free(buf);
     fclose(f);
 
-    // 5) Completar (incluye el formato en el payload)
+    // 4) Completar (incluye el formato en el payload)
     const char* fmt = ext_from_filename(filepath);
-    if (send_message(&ns, MSG_IMAGE_COMPLETE, image_id, fmt, (uint32_t)(strlen(fmt)+1)) != 0) {
+    if (send_message(ns, MSG_IMAGE_COMPLETE, image_id, fmt, (uint32_t)(strlen(fmt)+1)) != 0) {
         if (cb) cb("Failed to send IMAGE_COMPLETE", 1.0);
-        close_stream(&ns);
+        *conn_lost = 1;
         return -1;
     }
+    return 0;
+}
+
+/*
+ * response_ready
+ * --------------
+ * True when a response can be read without waiting for the network.
+ */
+static int response_ready(NetStream* ns) {
+    if (ns->ssl && SSL_pending(ns->ssl) > 0) return 1;
+    struct pollfd p = { .fd = ns->fd, .events = POLLIN, .revents = 0 };
+    return poll(&p, 1, 0) > 0;
+}
 
-    // 6) Esperar ACK final del servidor
-    {
-        MessageHeader ackhdr;
-        if (recv_header(&ns, &ackhdr) != 0 || ackhdr.type != MSG_ACK) {
+/*
+ * defer_image
+ * -----------
+ * The server refused win[i] for lack of memory (MSG_RETRY_AFTER): queue
+ * it again and hold every upload for `delay_ms`. An image deferred more
+ * than RETRY_LIMIT times is reported as failed.
+ */
+static void defer_image(InFlight* win, int i, uint32_t delay_ms, RetryState* rs,
+                        ProgressCallback cb) {
+    char msg[256];
+    gint64 until = g_get_monotonic_time() + (gint64)delay_ms * 1000;
+    if (until > rs->resume_at) rs->resume_at = until;
+
+    if (win[i].retries >= RETRY_LIMIT) {
+        rs->gave_up++;
+        g_snprintf(msg, sizeof(msg), "Server busy, giving up on %s", base_from_path(win[i].path));
+        if (cb) cb(msg, 0.0);
+        return;
+    }
+    Pending* p = g_new(Pending, 1);
+    p->path = win[i].path;
+    p->retries = win[i].retries + 1;
+    g_queue_push_tail(&rs->queue, p);
+    g_snprintf(msg, sizeof(msg), "Server busy, retrying %s in %u ms",
+               base_from_path(win[i].path), delay_ms);
+    if (cb) cb(msg, 0.0);
+}
+
+/*
+ * collect_responses
+ * -----------------
+ * Read server responses until at most `keep` images are unacknowledged,
+ * then also take any that have already arrived. Final ACKs and
+ * RETRY_AFTER deferrals are matched to the in-flight images by
+ * image_id. Returns 0, or -1 if the connection failed.
+ */
+static int collect_responses(NetStream* ns, InFlight* win, int* nwin, int keep,
+                             RetryState* rs, ProgressCallback cb) {
+    while (*nwin > 0 && (*nwin > keep || response_ready(ns))) {
+        MessageHeader hdr;
+        if (recv_header(ns, &hdr) != 0) {
             if (cb) cb("Missing/invalid final ACK from server", 1.0);
-            close_stream(&ns);
             return -1;
         }
+        // Only RETRY_AFTER carries a payload (the delay); skip anything else
+        uint32_t delay_be = 0;
+        uint32_t left = hdr.length;
+        if (hdr.type == MSG_RETRY_AFTER && left >= sizeof(delay_be)) {
+            if (recv_all(ns, &delay_be, sizeof(delay_be)) != 0) return -1;
+            left -= sizeof(delay_be);
+        }
+        while (left > 0) {
+            char sink[256];
+            uint32_t n = left < sizeof(sink) ? left : (uint32_t)sizeof(sink);
+            if (recv_all(ns, sink, n) != 0) return -1;
+            left -= n;
+        }
+        // IMAGE_ID_RESPONSE echoes the proposed id
+        if (hdr.type != MSG_ACK && hdr.type != MSG_RETRY_AFTER) continue;
+
+        for (int i = 0; i < *nwin; ++i) {
+            if (strcmp(win[i].image_id, hdr.image_id) != 0) continue;
+            if (hdr.type == MSG_RETRY_AFTER) {
+                defer_image(win, i, from_be32(delay_be), rs, cb);
+            } else if (cb) {
+                char msg[256];
+                g_snprintf(msg, sizeof(msg), "Finished %s", base_from_path(win[i].path));
+                cb(msg, 1.0);
+            }
+            memmove(&win[i], &win[i + 1], (size_t)(*nwin - i - 1) * sizeof(InFlight));
+            (*nwin)--;
+            break;
+        }
     }
+    return 0;
+}
 
-    // 7) Cerrar
-    close_stream(&ns);
-    if (cb) {
-        char msg[256];
-        g_snprintf(msg, sizeof(msg), "Finished %s", base);
-        cb(msg, 1.0);
+/*
+ * fail_in_flight
+ * --------------
+ * Report every unacknowledged image as failed after a connection loss.
+ */
+static void fail_in_flight(InFlight* win, int* nwin, ProgressCallback cb) {
+    for (int i = 0; i < *nwin; ++i) {
+        if (cb) {
+            char msg[256];
+            g_snprintf(msg, sizeof(msg), "Upload of %s not acknowledged", base_from_path(win[i].path));
+            cb(msg, 0.0);
+        }
     }
-    return 0;
+    *nwin = 0;
 }
 
+/*
+ * send_all_images
+ * ---------------
+ * Upload every image over one connection: each image's messages are
+ * sent without waiting for the previous ACK, with at most
+ * PIPELINE_DEPTH images unacknowledged. The client proposes each
+ * image_id in its HELLO, so ACKs can be matched as they arrive. Images
+ * the server defers with MSG_RETRY_AFTER are sent again (after the new
+ * ones) once the requested delay has passed. After a connection failure
+ * the in-flight images are reported as failed and the next image
+ * reconnects. Returns 0 if every image was acknowledged, otherwise the
+ * first error.
+ */
 int send_all_images(GSList* image_list,
                     const NetConfig* cfg,
                     ProcessingType proc_type,
                     ProgressCallback callback) {
     int overall = 0;
-    for (GSList* it = image_list; it != NULL; it = it->next) {
-        const char* path = (const char*)it->data;
-        if (!path) continue;
+    NetStream ns;
+    int connected = 0;
+    InFlight win[PIPELINE_DEPTH];
+    int nwin = 0;
+    RetryState rs = { G_QUEUE_INIT, 0, 0 };
+    GSList* it = image_list;
+
+    // A dropped connection (EPIPE) must not kill the GUI
+    signal(SIGPIPE, SIG_IGN);
+
+    for (;;) {
+        // Next image: new ones first, then the deferred ones
+        const char* path = NULL;
+        int retries = 0;
+        if (it) {
+            path = (const char*)it->data;
+            it = it->next;
+            if (!path) continue;
+        } else if (!g_queue_is_empty(&rs.queue)) {
+            Pending* p = (Pending*)g_queue_pop_head(&rs.queue);
+            path = p->path;
+            retries = p->retries;
+            g_free(p);
+        } else if (connected && nwin > 0) {
+            // Wait for one more answer; a deferral refills the queue
+            if (collect_responses(&ns, win, &nwin, nwin - 1, &rs, callback) != 0) {
+                fail_in_flight(win, &nwin, callback);
+                close_stream(&ns);
+                connected = 0;
+                if (overall == 0) overall = -1;
+            }
+            continue;
+        } else {
+            break;
+        }
+
+        if (!connected) {
+            if (open_stream(cfg, &ns, callback) != 0) {
+                if (overall == 0) overall = -1; // conserva primer error
+                continue;
+            }
+            connected = 1;
+        }
 
-        int rc = send_one_image(path, cfg, proc_type, callback);
-        if (rc != 0 && overall == 0) overall = rc; // conserva primer error
+        // Make room in the pipeline (and pick up ACKs that already arrived)
+        if (collect_responses(&ns, win, &nwin, PIPELINE_DEPTH - 1, &rs, callback) != 0) {
+            fail_in_flight(win, &nwin, callback);
+            close_stream(&ns);
+            connected = 0;
+            if (overall == 0) overall = -1;
+            if (open_stream(cfg, &ns, callback) != 0) continue;
+            connected = 1;
+        }
+
+        // Honor the server's RETRY_AFTER before sending anything new
+        gint64 wait_us = rs.resume_at - g_get_monotonic_time();
+        if (wait_us > 0) g_usleep((gulong)wait_us);
+
+        InFlight* slot = &win[nwin];
+        uuid_t uu;
+        uuid_generate(uu);
+        uuid_unparse_lower(uu, slot->image_id);
+        slot->path = path;
+        slot->retries = retries;
+
+        int conn_lost = 0;
+        if (send_image_messages(&ns, path, slot->image_id, cfg, proc_type,
+                                callback, &conn_lost) != 0) {
+            if (overall == 0) overall = -1;
+            if (conn_lost) {
+                fail_in_flight(win, &nwin, callback);
+                close_stream(&ns);
+                connected = 0;
+            }
+            continue;
+        }
+        nwin++;
     }
+
+    if (connected) close_stream(&ns);
+    if (rs.gave_up && overall == 0) overall = -1;
     return overall;
-}
\ No newline at end of file
+}
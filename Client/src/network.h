@@ -18,9 +18,12 @@ typedef struct {
     int  connect_timeout;      // seg
     int  max_retries;          // reintentos para conectar
     int  retry_backoff_ms;     // ms
+    int  tls_early_data;       // 1 = enviar los primeros mensajes como 0-RTT (TLS 1.3)
+    int  tls_ktls;             // 1 = cifrado en el kernel (kTLS) y chunks con SSL_sendfile
 } NetConfig;
 
-// Envía todas las imágenes secuencialmente (UNA A LA VEZ)
+// Envía todas las imágenes por una sola conexión, en pipeline
+// (hasta PIPELINE_DEPTH imágenes sin ACK; los ACK llevan el image_id)
 int send_all_images(GSList* image_list,
                     const NetConfig* cfg,
                     ProcessingType proc_type,
@@ -110,16 +110,16 @@ install_dependencies() {
   case "$OS_ID" in
     ubuntu|debian)
       sudo apt update
-      sudo apt install -y build-essential uuid-dev libssl-dev libjson-c-dev
+      sudo apt install -y build-essential uuid-dev libssl-dev libjson-c-dev libpng-dev libjpeg-dev zlib1g-dev
       ;;
     fedora)
-      sudo dnf install -y gcc libuuid-devel openssl-devel json-c-devel make
+      sudo dnf install -y gcc libuuid-devel openssl-devel json-c-devel libpng-devel libjpeg-turbo-devel zlib-devel make
       ;;
     arch)
-      sudo pacman -Syu --noconfirm base-devel util-linux-libs openssl json-c
+      sudo pacman -Syu --noconfirm base-devel util-linux-libs openssl json-c libpng libjpeg-turbo zlib
       ;;
     *)
-      echo "Install manually: gcc, make, libuuid-dev, libssl-dev, libjson-c-dev"
+      echo "Install manually: gcc, make, libuuid-dev, libssl-dev, libjson-c-dev, libpng-dev, libjpeg-dev"
       ;;
   esac
   echo "Dependencies installed successfully!"
@@ -0,0 +1,156 @@
+#include "bench.h"
+#include "scheduler.h"
+#include "buffer_pool.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <pthread.h>
+#include <sched.h>
+
+typedef struct {
+    int id;
+    int jobs;
+    int failed;
+} BenchProducer;
+
+// Start gate: producers block until every one of them has been created
+static pthread_mutex_t g_gate_mtx = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t  g_gate_cv  = PTHREAD_COND_INITIALIZER;
+static int             g_gate_open = 0;
+
+static double now_sec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+/*
+ * bench_job
+ * ---------
+ * No-op job handler: the benchmark measures queueing overhead only.
+ */
+static JobResult bench_job(const ProcJob* job) {
+    (void)job;
+    return JOB_DONE;
+}
+
+/*
+ * producer_main
+ * -------------
+ * Enqueue `jobs` jobs with pseudo-random sizes (xorshift32) so the
+ * heaps see realistic ordering work.
+ */
+static void* producer_main(void* arg) {
+    BenchProducer* p = (BenchProducer*)arg;
+    uint32_t x = 2463534242u ^ (uint32_t)(p->id * 2654435761u);
+
+    pthread_mutex_lock(&g_gate_mtx);
+    while (!g_gate_open) pthread_cond_wait(&g_gate_cv, &g_gate_mtx);
+    pthread_mutex_unlock(&g_gate_mtx);
+
+    for (int i = 0; i < p->jobs; ++i) {
+        x ^= x << 13; x ^= x >> 17; x ^= x << 5;
+
+        ProcJob job;
+        memset(&job, 0, sizeof(job));
+        job.data = (unsigned char*)bp_alloc(1);
+        if (!job.data) { p->failed++; continue; }
+        job.size = 1;
+        job.total_size = x % (64u * 1024 * 1024);
+        job.processing_type = PROC_BOTH;
+        job.client_id = (uint32_t)p->id;
+        snprintf(job.filename, sizeof(job.filename), "bench-%d-%d", p->id, i);
+
+        if (scheduler_enqueue(&job) != 0) {
+            bp_free(job.data);
+            p->failed++;
+        }
+    }
+    return NULL;
+}
+
+/*
+ * run_scheduler_bench
+ * -------------------
+ * Start the scheduler with a no-op handler, release all producers at
+ * once and time (a) how long the enqueues take and (b) how long until
+ * every job has been dequeued by a worker.
+ */
+int run_scheduler_bench(int workers, int producers, int jobs_per_producer) {
+    if (producers <= 0 || jobs_per_producer <= 0) return -1;
+
+    scheduler_set_job_handler(bench_job);
+    if (scheduler_init(workers) != 0) {
+        fprintf(stderr, "bench: failed to start scheduler\n");
+        return -1;
+    }
+
+    BenchProducer* ps = (BenchProducer*)calloc((size_t)producers, sizeof(BenchProducer));
+    pthread_t* th = (pthread_t*)calloc((size_t)producers, sizeof(pthread_t));
+    if (!ps || !th) {
+        free(ps); free(th);
+        scheduler_shutdown();
+        return -1;
+    }
+
+    g_gate_open = 0;
+    int spawned = 0;
+    for (int i = 0; i < producers; ++i) {
+        ps[i].id = i;
+        ps[i].jobs = jobs_per_producer;
+        if (pthread_create(&th[i], NULL, producer_main, &ps[i]) != 0) break;
+        spawned++;
+    }
+    if (spawned < producers) {
+        fprintf(stderr, "bench: could only start %d of %d producers\n", spawned, producers);
+    }
+
+    double t0 = now_sec();
+    pthread_mutex_lock(&g_gate_mtx);
+    g_gate_open = 1;
+    pthread_cond_broadcast(&g_gate_cv);
+    pthread_mutex_unlock(&g_gate_mtx);
+    for (int i = 0; i < spawned; ++i) pthread_join(th[i], NULL);
+    double t_enq = now_sec();
+
+    unsigned long long failed = 0;
+    for (int i = 0; i < spawned; ++i) failed += (unsigned long long)ps[i].failed;
+    unsigned long long expected = (unsigned long long)spawned * (unsigned long long)jobs_per_producer - failed;
+
+    SchedulerStats st;
+    for (;;) {
+        scheduler_get_stats(&st);
+        if (st.processed >= expected) break;
+        sched_yield();
+    }
+    double t_done = now_sec();
+    scheduler_shutdown();
+
+    double enq_s = t_enq - t0, all_s = t_done - t0;
+    printf("scheduler bench: workers=%d producers=%d jobs=%llu failed=%llu\n",
+           scheduler_resolve_workers(workers), spawned, expected, failed);
+    printf("  enqueue:  %.3f s  %.0f jobs/s\n", enq_s, enq_s > 0 ? (double)expected / enq_s : 0.0);
+    printf("  drained:  %.3f s  %.0f jobs/s (enqueue -> dequeue)\n", all_s, all_s > 0 ? (double)expected / all_s : 0.0);
+    printf("  steals:   %llu (%.1f%%)\n", st.steals,
+           expected ? 100.0 * (double)st.steals / (double)expected : 0.0);
+
+    SchedulerWaitHistogram wh;
+    scheduler_get_wait_histogram(&wh);
+    static const char* const classes[SCHED_CLASSES] = { "<1MiB", "1-16MiB", ">=16MiB" };
+    printf("  queue wait by size (policy %s), ms upper bound: count\n",
+           scheduler_policy_name(wh.policy));
+    for (int c = 0; c < SCHED_CLASSES; ++c) {
+        printf("    %-8s max %.1f ms |", classes[c], (double)wh.max_us[c] / 1000.0);
+        for (int b = 0; b < SCHED_WAIT_BUCKETS; ++b) {
+            if (wh.count[c][b]) printf(" %llu:%llu", 1ull << b, wh.count[c][b]);
+        }
+        printf("\n");
+    }
+
+    free(ps);
+    free(th);
+    scheduler_set_job_handler(NULL);
+    return 0;
+}
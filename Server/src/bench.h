@@ -0,0 +1,10 @@
+#ifndef BENCH_H
+#define BENCH_H
+
+// Scheduler micro-benchmark: `producers` threads enqueue
+// `jobs_per_producer` no-op jobs each while `workers` workers drain them.
+// Prints enqueue and end-to-end throughput to stdout.
+// Returns: 0 on success, -1 on failure
+int run_scheduler_bench(int workers, int producers, int jobs_per_producer);
+
+#endif // BENCH_H
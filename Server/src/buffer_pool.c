@@ -0,0 +1,315 @@
+#include "buffer_pool.h"
+#include "logging.h"
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Pooled blocks are 2^BP_MIN_SHIFT .. 2^BP_MAX_SHIFT bytes (header
+// included); anything smaller or larger is a plain malloc.
+#define BP_MIN_SHIFT 13                      // 8 KiB
+#define BP_MAX_SHIFT 30                      // 1 GiB
+#define BP_CLASSES   (BP_MAX_SHIFT - BP_MIN_SHIFT + 1)
+#define BP_DIRECT    (-1)
+
+// Per-thread cache: a couple of blocks per class, small total budget.
+// Larger blocks go to the shared pool, where any thread can reuse them
+// (incoming buffers are allocated by connection threads and released
+// by scheduler workers).
+#define TC_MAX_PER_CLASS 2
+#define TC_MAX_BYTES     ((size_t)16 << 20)
+
+typedef union {
+    struct {
+        size_t size;    // requested payload bytes
+        int    cls;     // size class index or BP_DIRECT
+    } h;
+    max_align_t align;  // keep payloads malloc-aligned
+} BlockHeader;
+
+typedef struct FreeBlock {
+    struct FreeBlock* next;
+} FreeBlock;
+
+typedef struct {
+    FreeBlock* head[BP_CLASSES];
+    int        count[BP_CLASSES];
+    size_t     bytes;
+    int        registered;   // destructor key set for this thread
+} ThreadCache;
+
+static __thread ThreadCache t_cache;
+
+static pthread_mutex_t g_bp_mtx = PTHREAD_MUTEX_INITIALIZER;
+static FreeBlock*      g_free[BP_CLASSES];
+static pthread_key_t   g_bp_key;
+static pthread_once_t  g_bp_once = PTHREAD_ONCE_INIT;
+
+static atomic_size_t         g_cap = 0;
+static atomic_uint_least64_t g_hits = 0, g_misses = 0, g_direct = 0;
+static atomic_uint_least64_t g_in_use = 0, g_peak = 0, g_cached = 0;
+
+static size_t class_bytes(int cls) {
+    return (size_t)1 << (cls + BP_MIN_SHIFT);
+}
+
+/*
+ * size_class
+ * ----------
+ * Smallest class whose block holds `size` payload bytes plus the
+ * header, or BP_DIRECT when the request is outside the pooled range.
+ */
+static int size_class(size_t size) {
+    if (size > ((size_t)1 << BP_MAX_SHIFT) - sizeof(BlockHeader)) return BP_DIRECT;
+    size_t need = size + sizeof(BlockHeader);
+    if (need <= ((size_t)1 << (BP_MIN_SHIFT - 1))) return BP_DIRECT;
+    if (need <= ((size_t)1 << BP_MIN_SHIFT)) return 0;
+    int shift = 64 - __builtin_clzll((unsigned long long)(need - 1));
+    return shift - BP_MIN_SHIFT;
+}
+
+static void track_in_use_add(uint64_t bytes) {
+    uint64_t now = atomic_fetch_add_explicit(&g_in_use, bytes, memory_order_relaxed) + bytes;
+    uint64_t peak = atomic_load_explicit(&g_peak, memory_order_relaxed);
+    while (now > peak &&
+           !atomic_compare_exchange_weak_explicit(&g_peak, &peak, now,
+                                                  memory_order_relaxed, memory_order_relaxed)) {
+    }
+}
+
+static void track_in_use_sub(uint64_t bytes) {
+    atomic_fetch_sub_explicit(&g_in_use, bytes, memory_order_relaxed);
+}
+
+/*
+ * reserve_cached
+ * --------------
+ * Account `bytes` of idle memory against the cap. Returns 1 when the
+ * block may be cached, 0 when it must be released to the system.
+ */
+static int reserve_cached(size_t bytes) {
+    size_t cap = atomic_load_explicit(&g_cap, memory_order_relaxed);
+    if (cap == 0) return 0;
+    uint64_t prev = atomic_fetch_add_explicit(&g_cached, bytes, memory_order_relaxed);
+    if (prev + bytes > cap) {
+        atomic_fetch_sub_explicit(&g_cached, bytes, memory_order_relaxed);
+        return 0;
+    }
+    return 1;
+}
+
+// ---- Shared pool (mutex-protected free lists) ----
+static void global_push(int cls, FreeBlock* b) {
+    pthread_mutex_lock(&g_bp_mtx);
+    b->next = g_free[cls];
+    g_free[cls] = b;
+    pthread_mutex_unlock(&g_bp_mtx);
+}
+
+static FreeBlock* global_pop(int cls) {
+    pthread_mutex_lock(&g_bp_mtx);
+    FreeBlock* b = g_free[cls];
+    if (b) g_free[cls] = b->next;
+    pthread_mutex_unlock(&g_bp_mtx);
+    return b;
+}
+
+/*
+ * thread_cache_flush
+ * ------------------
+ * pthread_key destructor: hand the exiting thread's idle blocks to the
+ * shared pool (they are already accounted in g_cached).
+ */
+static void thread_cache_flush(void* arg) {
+    ThreadCache* tc = (ThreadCache*)arg;
+    for (int cls = 0; cls < BP_CLASSES; ++cls) {
+        while (tc->head[cls]) {
+            FreeBlock* b = tc->head[cls];
+            tc->head[cls] = b->next;
+            global_push(cls, b);
+        }
+        tc->count[cls] = 0;
+    }
+    tc->bytes = 0;
+    tc->registered = 0;
+}
+
+static void make_key(void) {
+    pthread_key_create(&g_bp_key, thread_cache_flush);
+}
+
+static int thread_cache_push(int cls, FreeBlock* b) {
+    ThreadCache* tc = &t_cache;
+    size_t bytes = class_bytes(cls);
+    if (tc->count[cls] >= TC_MAX_PER_CLASS || tc->bytes + bytes > TC_MAX_BYTES) return 0;
+
+    if (!tc->registered) {
+        pthread_once(&g_bp_once, make_key);
+        if (pthread_setspecific(g_bp_key, tc) != 0) return 0;
+        tc->registered = 1;
+    }
+    b->next = tc->head[cls];
+    tc->head[cls] = b;
+    tc->count[cls]++;
+    tc->bytes += bytes;
+    return 1;
+}
+
+static FreeBlock* thread_cache_pop(int cls) {
+    ThreadCache* tc = &t_cache;
+    FreeBlock* b = tc->head[cls];
+    if (!b) return NULL;
+    tc->head[cls] = b->next;
+    tc->count[cls]--;
+    tc->bytes -= class_bytes(cls);
+    return b;
+}
+
+/*
+ * bp_init
+ * -------
+ * Set the cap on idle cached memory. Lowering it does not trim blocks
+ * that are already cached.
+ */
+void bp_init(size_t cap_bytes) {
+    atomic_store(&g_cap, cap_bytes);
+    pthread_once(&g_bp_once, make_key);
+    log_line("Buffer pool: cap %zu MiB", cap_bytes >> 20);
+}
+
+/*
+ * bp_shutdown
+ * -----------
+ * Log the counters, stop caching and free every idle block of the
+ * shared pool and of the calling thread. Call after the worker threads
+ * have been joined, so their caches were already flushed.
+ */
+void bp_shutdown(void) {
+    BufferPoolStats st;
+    bp_get_stats(&st);
+    log_line("Buffer pool: hits=%llu misses=%llu direct=%llu peak=%llu KiB",
+             (unsigned long long)st.hits, (unsigned long long)st.misses,
+             (unsigned long long)st.direct, (unsigned long long)(st.peak_bytes >> 10));
+
+    atomic_store(&g_cap, 0);
+    thread_cache_flush(&t_cache);
+
+    pthread_mutex_lock(&g_bp_mtx);
+    for (int cls = 0; cls < BP_CLASSES; ++cls) {
+        while (g_free[cls]) {
+            FreeBlock* b = g_free[cls];
+            g_free[cls] = b->next;
+            atomic_fetch_sub_explicit(&g_cached, class_bytes(cls), memory_order_relaxed);
+            free(b);
+        }
+    }
+    pthread_mutex_unlock(&g_bp_mtx);
+}
+
+/*
+ * bp_alloc
+ * --------
+ * Allocate `size` bytes. Pooled classes are served from the thread
+ * cache, then the shared pool, then malloc. Returns NULL on OOM.
+ */
+void* bp_alloc(size_t size) {
+    int cls = size_class(size);
+    BlockHeader* hdr;
+
+    if (cls == BP_DIRECT) {
+        if (size > SIZE_MAX - sizeof(BlockHeader)) return NULL;
+        hdr = (BlockHeader*)malloc(sizeof(BlockHeader) + size);
+        if (!hdr) return NULL;
+        atomic_fetch_add_explicit(&g_direct, 1, memory_order_relaxed);
+        track_in_use_add(size);
+    } else {
+        FreeBlock* b = thread_cache_pop(cls);
+        if (!b) b = global_pop(cls);
+        if (b) {
+            atomic_fetch_sub_explicit(&g_cached, class_bytes(cls), memory_order_relaxed);
+            atomic_fetch_add_explicit(&g_hits, 1, memory_order_relaxed);
+            hdr = (BlockHeader*)b;
+        } else {
+            hdr = (BlockHeader*)malloc(class_bytes(cls));
+            if (!hdr) return NULL;
+            atomic_fetch_add_explicit(&g_misses, 1, memory_order_relaxed);
+        }
+        track_in_use_add(class_bytes(cls));
+    }
+
+    hdr->h.size = size;
+    hdr->h.cls = cls;
+    return hdr + 1;
+}
+
+/*
+ * bp_free
+ * -------
+ * Release a bp_alloc'd block: keep it in the thread cache or the shared
+ * pool while under the cap, otherwise return it to the system.
+ */
+void bp_free(void* ptr) {
+    if (!ptr) return;
+    BlockHeader* hdr = (BlockHeader*)ptr - 1;
+    int cls = hdr->h.cls;
+
+    if (cls == BP_DIRECT) {
+        track_in_use_sub(hdr->h.size);
+        free(hdr);
+        return;
+    }
+
+    size_t bytes = class_bytes(cls);
+    track_in_use_sub(bytes);
+    if (!reserve_cached(bytes)) {
+        free(hdr);
+        return;
+    }
+    FreeBlock* b = (FreeBlock*)hdr;
+    if (!thread_cache_push(cls, b)) global_push(cls, b);
+}
+
+/*
+ * bp_realloc
+ * ----------
+ * Grow or shrink a block. Pooled blocks stay in place while the new
+ * size fits their class; direct blocks use realloc.
+ */
+void* bp_realloc(void* ptr, size_t size) {
+    if (!ptr) return bp_alloc(size);
+    if (size == 0) { bp_free(ptr); return NULL; }
+
+    BlockHeader* hdr = (BlockHeader*)ptr - 1;
+    int cls = hdr->h.cls;
+
+    if (cls == BP_DIRECT && size_class(size) == BP_DIRECT) {
+        if (size > SIZE_MAX - sizeof(BlockHeader)) return NULL;
+        size_t old = hdr->h.size;
+        BlockHeader* nh = (BlockHeader*)realloc(hdr, sizeof(BlockHeader) + size);
+        if (!nh) return NULL;
+        nh->h.size = size;
+        if (size > old) track_in_use_add(size - old);
+        else            track_in_use_sub(old - size);
+        return nh + 1;
+    }
+
+    if (cls != BP_DIRECT && size <= class_bytes(cls) - sizeof(BlockHeader)) {
+        hdr->h.size = size;
+        return ptr;
+    }
+
+    void* np = bp_alloc(size);
+    if (!np) return NULL;
+    memcpy(np, ptr, hdr->h.size < size ? hdr->h.size : size);
+    bp_free(ptr);
+    return np;
+}
+
+void bp_get_stats(BufferPoolStats* out) {
+    out->hits         = atomic_load_explicit(&g_hits, memory_order_relaxed);
+    out->misses       = atomic_load_explicit(&g_misses, memory_order_relaxed);
+    out->direct       = atomic_load_explicit(&g_direct, memory_order_relaxed);
+    out->in_use_bytes = atomic_load_explicit(&g_in_use, memory_order_relaxed);
+    out->peak_bytes   = atomic_load_explicit(&g_peak, memory_order_relaxed);
+    out->cached_bytes = atomic_load_explicit(&g_cached, memory_order_relaxed);
+}
@@ -0,0 +1,36 @@
+#ifndef BUFFER_POOL_H
+#define BUFFER_POOL_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Size-class allocator for large, short-lived pixel and file buffers
+// (incoming images, decoder output, encoder scratch). Blocks are
+// rounded up to a power of two and recycled through a small per-thread
+// cache backed by a shared pool whose idle memory is capped. Requests
+// outside the pooled range go straight to malloc. Every pointer from
+// bp_alloc/bp_realloc must be released with bp_free.
+
+typedef struct {
+    uint64_t hits;          // served from a thread cache or the shared pool
+    uint64_t misses;        // pooled size class, but a fresh malloc was needed
+    uint64_t direct;        // outside the pooled range (plain malloc)
+    uint64_t in_use_bytes;  // currently handed out (block sizes)
+    uint64_t peak_bytes;    // high-water mark of in_use_bytes
+    uint64_t cached_bytes;  // idle in thread caches and the shared pool
+} BufferPoolStats;
+
+// Set the cap on idle cached memory (0 disables caching). Safe to call
+// before any allocation; the pool works as a pass-through until then.
+void bp_init(size_t cap_bytes);
+
+// Log the counters and release the shared pool's idle blocks
+void bp_shutdown(void);
+
+void* bp_alloc(size_t size);
+void* bp_realloc(void* ptr, size_t size);
+void  bp_free(void* ptr);
+
+void bp_get_stats(BufferPoolStats* out);
+
+#endif // BUFFER_POOL_H
@@ -19,12 +19,47 @@
 void set_default_config(ServerConfig* c) {
     c->port = DEFAULT_PORT;
     c->tls_enabled = 0;
+    c->tls_session_cache = 20480;
+    c->tls_ticket_rotate_sec = 3600;
+    c->tls_early_data = 0;
+    c->tls_ktls = 0;
+    c->worker_threads = 0;
+    c->io_engine = IO_ENGINE_EPOLL;
+    c->reactor_threads = 0;
+    c->sched_policy = SCHED_SMALLEST_FIRST;
+    c->order_by_cost = 1;
+    c->aging_mb_per_sec = 1.0;
+    c->aging_ms_per_sec = 100.0;
+    c->deadline_base_ms = 1000;
+    c->deadline_ms_per_mb = 200;
+    c->deadline_cost_factor = 4.0;
+    c->pool_threads = 0;
+    c->parallel_min_pixels = 2000000;
+    c->classify_early_exit = 0;
+    c->gif_passthrough = 1;
+    c->gif_quantizer = GIF_QUANT_AUTO;
+    c->gif_fast_min_pixels = 20000000;
+    c->gif_global_palette = 1;
+    c->gif_global_max_error = 6.0;
+    c->classify_confidence = 0.999;
+    c->stream_decode = 1;
+    c->stream_decode_min_bytes = 1048576;
+    c->stream_decoders = 4;
+    c->buffer_pool_mb = 256;
+    c->max_working_set_mb = 1024;
+    c->memory_budget_mb = 2048;
+    c->retry_after_ms = 250;
+    c->queue_memory_mb = 512;
+    c->journal_enabled = 1;
+    c->journal_segment_mb = 64;
     strncpy(c->tls_dir,      "assets/tls",        sizeof(c->tls_dir));
     strncpy(c->log_file,     "assets/log.txt",    sizeof(c->log_file));
     strncpy(c->histogram_dir,"assets/histogram",  sizeof(c->histogram_dir));
     strncpy(c->colors_red,   "assets/colors/red", sizeof(c->colors_red));
     strncpy(c->colors_green, "assets/colors/green", sizeof(c->colors_green));
     strncpy(c->colors_blue,  "assets/colors/blue", sizeof(c->colors_blue));
+    strncpy(c->spool_dir,    "assets/spool",      sizeof(c->spool_dir));
+    strncpy(c->journal_dir,  "assets/journal",    sizeof(c->journal_dir));
 
     c->tls_dir[sizeof(c->tls_dir)-1] = '\0';
     c->log_file[sizeof(c->log_file)-1] = '\0';
@@ -32,6 +67,8 @@ void set_default_config(ServerConfig* c) {
     c->colors_red[sizeof(c->colors_red)-1] = '\0';
     c->colors_green[sizeof(c->colors_green)-1] = '\0';
     c->colors_blue[sizeof(c->colors_blue)-1] = '\0';
+    c->spool_dir[sizeof(c->spool_dir)-1] = '\0';
+    c->journal_dir[sizeof(c->journal_dir)-1] = '\0';
 }
 
 /*
@@ -77,7 +114,9 @@ int load_config_json(const char* path, ServerConfig* c) {
     // Parse server section
     struct json_object *js_server = NULL, *js_paths = NULL;
     if (json_object_object_get_ex(root, "server", &js_server)) {
-        struct json_object *jport = NULL, *jtls = NULL, *jtlsdir = NULL;
+        struct json_object *jport = NULL, *jtls = NULL, *jtlsdir = NULL, *jworkers = NULL;
+        struct json_object *jengine = NULL, *jreactors = NULL;
+        struct json_object *jcache = NULL, *jrotate = NULL, *j0rtt = NULL, *jktls = NULL;
         
         if (json_object_object_get_ex(js_server, "port", &jport))
             c->port = json_object_get_int(jport);
@@ -92,11 +131,210 @@ int load_config_json(const char* path, ServerConfig* c) {
                 c->tls_dir[sizeof(c->tls_dir)-1] = '\0'; 
             }
         }
+
+        if (json_object_object_get_ex(js_server, "tls_session_cache", &jcache)) {
+            int n = json_object_get_int(jcache);
+            if (n > 0) c->tls_session_cache = n;
+        }
+
+        if (json_object_object_get_ex(js_server, "tls_ticket_rotate_sec", &jrotate)) {
+            int n = json_object_get_int(jrotate);
+            if (n > 0) c->tls_ticket_rotate_sec = n;
+        }
+
+        if (json_object_object_get_ex(js_server, "tls_early_data", &j0rtt))
+            c->tls_early_data = json_object_get_int(j0rtt) ? 1 : 0;
+
+        if (json_object_object_get_ex(js_server, "tls_ktls", &jktls))
+            c->tls_ktls = json_object_get_int(jktls) ? 1 : 0;
+
+        // "worker_threads": <n> or "auto" (any non-numeric value means auto)
+        if (json_object_object_get_ex(js_server, "worker_threads", &jworkers)) {
+            int n = json_object_get_int(jworkers);
+            c->worker_threads = (n > 0) ? n : 0;
+        }
+
+        // "io_engine": "epoll" (default), "io_uring" or "threads"; unknown names keep the default
+        if (json_object_object_get_ex(js_server, "io_engine", &jengine)) {
+            const char* s = json_object_get_string(jengine);
+            if (s && strcmp(s, "threads") == 0) c->io_engine = IO_ENGINE_THREADS;
+            else if (s && strcmp(s, "epoll") == 0) c->io_engine = IO_ENGINE_EPOLL;
+            else if (s && strcmp(s, "io_uring") == 0) c->io_engine = IO_ENGINE_URING;
+        }
+
+        // "reactor_threads": <n> or "auto"
+        if (json_object_object_get_ex(js_server, "reactor_threads", &jreactors)) {
+            int n = json_object_get_int(jreactors);
+            c->reactor_threads = (n > 0) ? n : 0;
+        }
+    }
+
+    // Parse scheduler section
+    struct json_object* js_sched = NULL;
+    if (json_object_object_get_ex(root, "scheduler", &js_sched)) {
+        struct json_object *jpolicy = NULL, *jaging = NULL, *jdbase = NULL, *jdmb = NULL;
+        struct json_object *jorder = NULL, *jaging_ms = NULL, *jdfactor = NULL;
+
+        // "order_by": "cost" (default) or "size"
+        if (json_object_object_get_ex(js_sched, "order_by", &jorder)) {
+            const char* s = json_object_get_string(jorder);
+            if (s && strcmp(s, "cost") == 0) c->order_by_cost = 1;
+            else if (s && strcmp(s, "size") == 0) c->order_by_cost = 0;
+        }
+
+        // "policy": "smallest" (default), "aging", "fair" or "deadline"; unknown names keep the default
+        if (json_object_object_get_ex(js_sched, "policy", &jpolicy)) {
+            const char* s = json_object_get_string(jpolicy);
+            if (s && strcmp(s, "smallest") == 0) c->sched_policy = SCHED_SMALLEST_FIRST;
+            else if (s && strcmp(s, "aging") == 0) c->sched_policy = SCHED_AGING;
+            else if (s && strcmp(s, "fair") == 0) c->sched_policy = SCHED_FAIR_SHARE;
+            else if (s && strcmp(s, "deadline") == 0) c->sched_policy = SCHED_DEADLINE;
+        }
+
+        if (json_object_object_get_ex(js_sched, "aging_mb_per_sec", &jaging)) {
+            double v = json_object_get_double(jaging);
+            if (v > 0.0) c->aging_mb_per_sec = v;
+        }
+
+        if (json_object_object_get_ex(js_sched, "aging_ms_per_sec", &jaging_ms)) {
+            double v = json_object_get_double(jaging_ms);
+            if (v > 0.0) c->aging_ms_per_sec = v;
+        }
+
+        if (json_object_object_get_ex(js_sched, "deadline_base_ms", &jdbase)) {
+            long long v = (long long)json_object_get_int64(jdbase);
+            if (v >= 0) c->deadline_base_ms = (long)v;
+        }
+
+        if (json_object_object_get_ex(js_sched, "deadline_ms_per_mb", &jdmb)) {
+            long long v = (long long)json_object_get_int64(jdmb);
+            if (v >= 0) c->deadline_ms_per_mb = (long)v;
+        }
+
+        if (json_object_object_get_ex(js_sched, "deadline_cost_factor", &jdfactor)) {
+            double v = json_object_get_double(jdfactor);
+            if (v >= 0.0) c->deadline_cost_factor = v;
+        }
+    }
+
+    // Parse processing section
+    struct json_object* js_proc = NULL;
+    if (json_object_object_get_ex(root, "processing", &js_proc)) {
+        struct json_object *jpool = NULL, *jmin = NULL, *jearly = NULL, *jconf = NULL;
+        struct json_object *jsd = NULL, *jsdmin = NULL, *jsdmax = NULL, *jgifpass = NULL;
+        struct json_object *jgifq = NULL, *jgifmin = NULL, *jgifpal = NULL, *jgiferr = NULL;
+
+        if (json_object_object_get_ex(js_proc, "pool_threads", &jpool)) {
+            int n = json_object_get_int(jpool);
+            c->pool_threads = (n > 0) ? n : 0;
+        }
+
+        if (json_object_object_get_ex(js_proc, "parallel_min_pixels", &jmin)) {
+            long long v = (long long)json_object_get_int64(jmin);
+            if (v > 0) c->parallel_min_pixels = (long)v;
+        }
+
+        if (json_object_object_get_ex(js_proc, "classify_early_exit", &jearly))
+            c->classify_early_exit = json_object_get_int(jearly) ? 1 : 0;
+
+        if (json_object_object_get_ex(js_proc, "classify_confidence", &jconf)) {
+            double v = json_object_get_double(jconf);
+            if (v >= 0.5 && v < 1.0) c->classify_confidence = v;
+        }
+
+        if (json_object_object_get_ex(js_proc, "gif_passthrough", &jgifpass))
+            c->gif_passthrough = json_object_get_int(jgifpass) ? 1 : 0;
+
+        // "gif_quantizer": "median", "fast" or "auto" (default); unknown names keep the default
+        if (json_object_object_get_ex(js_proc, "gif_quantizer", &jgifq)) {
+            const char* s = json_object_get_string(jgifq);
+            if (s && strcmp(s, "median") == 0) c->gif_quantizer = GIF_QUANT_MEDIAN;
+            else if (s && strcmp(s, "fast") == 0) c->gif_quantizer = GIF_QUANT_FAST;
+            else if (s && strcmp(s, "auto") == 0) c->gif_quantizer = GIF_QUANT_AUTO;
+        }
+
+        if (json_object_object_get_ex(js_proc, "gif_fast_min_pixels", &jgifmin)) {
+            long long v = (long long)json_object_get_int64(jgifmin);
+            if (v >= 0) c->gif_fast_min_pixels = (long)v;
+        }
+
+        // "gif_palette": "global" (default) or "local"
+        if (json_object_object_get_ex(js_proc, "gif_palette", &jgifpal)) {
+            const char* s = json_object_get_string(jgifpal);
+            if (s && strcmp(s, "global") == 0) c->gif_global_palette = 1;
+            else if (s && strcmp(s, "local") == 0) c->gif_global_palette = 0;
+        }
+
+        if (json_object_object_get_ex(js_proc, "gif_global_max_error", &jgiferr)) {
+            double v = json_object_get_double(jgiferr);
+            if (v >= 0.0) c->gif_global_max_error = v;
+        }
+
+        if (json_object_object_get_ex(js_proc, "stream_decode", &jsd))
+            c->stream_decode = json_object_get_int(jsd) ? 1 : 0;
+
+        if (json_object_object_get_ex(js_proc, "stream_decode_min_bytes", &jsdmin)) {
+            long long v = (long long)json_object_get_int64(jsdmin);
+            if (v >= 0) c->stream_decode_min_bytes = (long)v;
+        }
+
+        if (json_object_object_get_ex(js_proc, "stream_decoders", &jsdmax)) {
+            int n = json_object_get_int(jsdmax);
+            if (n > 0) c->stream_decoders = n;
+        }
+    }
+
+    // Parse memory section
+    struct json_object* js_mem = NULL;
+    if (json_object_object_get_ex(root, "memory", &js_mem)) {
+        struct json_object *jpool_mb = NULL, *jws = NULL, *jbudget = NULL, *jretry = NULL;
+        struct json_object *jqueue = NULL;
+
+        if (json_object_object_get_ex(js_mem, "buffer_pool_mb", &jpool_mb)) {
+            long long v = (long long)json_object_get_int64(jpool_mb);
+            if (v >= 0) c->buffer_pool_mb = (long)v;
+        }
+
+        if (json_object_object_get_ex(js_mem, "max_working_set_mb", &jws)) {
+            long long v = (long long)json_object_get_int64(jws);
+            if (v >= 0) c->max_working_set_mb = (long)v;
+        }
+
+        if (json_object_object_get_ex(js_mem, "budget_mb", &jbudget)) {
+            long long v = (long long)json_object_get_int64(jbudget);
+            if (v >= 0) c->memory_budget_mb = (long)v;
+        }
+
+        if (json_object_object_get_ex(js_mem, "retry_after_ms", &jretry)) {
+            int n = json_object_get_int(jretry);
+            if (n > 0) c->retry_after_ms = n;
+        }
+
+        if (json_object_object_get_ex(js_mem, "queue_memory_mb", &jqueue)) {
+            long long v = (long long)json_object_get_int64(jqueue);
+            if (v >= 0) c->queue_memory_mb = (long)v;
+        }
+    }
+
+    // Parse journal section
+    struct json_object* js_journal = NULL;
+    if (json_object_object_get_ex(root, "journal", &js_journal)) {
+        struct json_object *jen = NULL, *jseg = NULL;
+
+        if (json_object_object_get_ex(js_journal, "enabled", &jen)) {
+            c->journal_enabled = json_object_get_int(jen) ? 1 : 0;
+        }
+
+        if (json_object_object_get_ex(js_journal, "segment_mb", &jseg)) {
+            long long v = (long long)json_object_get_int64(jseg);
+            if (v > 0) c->journal_segment_mb = (long)v;
+        }
     }
 
     // Parse paths section
     if (json_object_object_get_ex(root, "paths", &js_paths)) {
-        struct json_object *jlog = NULL, *jhist = NULL, *jcolors = NULL;
+        struct json_object *jlog = NULL, *jhist = NULL, *jcolors = NULL, *jspool = NULL;
+        struct json_object *jjournal = NULL;
 
         if (json_object_object_get_ex(js_paths, "log_file", &jlog)) {
             const char* s = json_object_get_string(jlog);
@@ -114,6 +352,22 @@ int load_config_json(const char* path, ServerConfig* c) {
             }
         }
 
+        if (json_object_object_get_ex(js_paths, "spool_dir", &jspool)) {
+            const char* s = json_object_get_string(jspool);
+            if (s) {
+                strncpy(c->spool_dir, s, sizeof(c->spool_dir)-1);
+                c->spool_dir[sizeof(c->spool_dir)-1] = '\0';
+            }
+        }
+
+        if (json_object_object_get_ex(js_paths, "journal_dir", &jjournal)) {
+            const char* s = json_object_get_string(jjournal);
+            if (s) {
+                strncpy(c->journal_dir, s, sizeof(c->journal_dir)-1);
+                c->journal_dir[sizeof(c->journal_dir)-1] = '\0';
+            }
+        }
+
         if (json_object_object_get_ex(js_paths, "colors_dir", &jcolors)) {
             struct json_object *jr=NULL, *jg=NULL, *jb=NULL;
 
@@ -157,7 +411,8 @@ int load_config_json(const char* path, ServerConfig* c) {
  *  - 0 on success, -1 if any required directory could not be created.
  * Notes:
  *  - This will create parent directories for the log file and create
- *    directories for histograms, color buckets and TLS assets.
+ *    directories for histograms, color buckets, TLS assets, the
+ *    queue spool and the job journal.
  */
 int ensure_dirs_from_config(const ServerConfig* c) {
     if (ensure_parent_dir(c->log_file) != 0) return -1;
@@ -166,5 +421,7 @@ int ensure_dirs_from_config(const ServerConfig* c) {
     if (mkdir_p(c->colors_green, 0755) != 0) return -1;
     if (mkdir_p(c->colors_blue, 0755) != 0) return -1;
     if (mkdir_p(c->tls_dir, 0755) != 0) return -1;
+    if (mkdir_p(c->spool_dir, 0700) != 0) return -1;
+    if (mkdir_p(c->journal_dir, 0700) != 0) return -1;
     return 0;
 }
\ No newline at end of file
@@ -3,15 +3,72 @@
 
 #include <stdint.h>
 
+// Connection engines (server.io_engine)
+typedef enum {
+    IO_ENGINE_THREADS = 0,          // "threads": one blocking thread per connection
+    IO_ENGINE_EPOLL,                // "epoll": edge-triggered reactor threads
+    IO_ENGINE_URING                 // "io_uring": one completion ring (plain TCP only)
+} IoEngine;
+
+// Dispatch order of queued jobs (scheduler.policy)
+typedef enum {
+    SCHED_SMALLEST_FIRST = 0,       // "smallest": ascending total_size
+    SCHED_AGING,                    // "aging": total_size minus a credit that grows with the wait
+    SCHED_FAIR_SHARE,               // "fair": per-client fair queuing on bytes
+    SCHED_DEADLINE                  // "deadline": earliest deadline first (size-based target)
+} SchedPolicy;
+
+// Palette backend for re-encoded GIFs (processing.gif_quantizer)
+typedef enum {
+    GIF_QUANT_MEDIAN = 0,           // "median": gif.h median split over the pixels, k-d tree lookups
+    GIF_QUANT_FAST,                 // "fast": 5-5-5 histogram median cut, cached inverse colormap
+    GIF_QUANT_AUTO                  // "auto": fast from gif_fast_min_pixels (all frames) up
+} GifQuantizer;
+
 typedef struct {
     int   port;
     int   tls_enabled;              // 1 = enabled, 0 = disabled
     char  tls_dir[512];             // Directory for TLS certificates
+    int   tls_session_cache;        // Server session cache entries
+    int   tls_ticket_rotate_sec;    // Session ticket key lifetime before rotation
+    int   tls_early_data;           // 1 = accept TLS 1.3 0-RTT data on resumed sessions
+    int   tls_ktls;                 // 1 = offload TLS records to the kernel (kTLS) when possible
+    int   worker_threads;           // Scheduler workers (0 = auto, one per online CPU)
+    IoEngine io_engine;             // Connection engine
+    int   reactor_threads;          // epoll reactor threads (0 = auto)
+    SchedPolicy sched_policy;       // Queue ordering
+    int   order_by_cost;            // 1 = weigh jobs by predicted processing time, 0 = by upload size
+    double aging_mb_per_sec;        // "aging": priority credit per second of waiting (size weights)
+    double aging_ms_per_sec;        // "aging": priority credit per second of waiting (cost weights)
+    long  deadline_base_ms;         // "deadline": target wait for any job
+    long  deadline_ms_per_mb;       // "deadline": extra target wait per MiB of upload (size weights)
+    double deadline_cost_factor;    // "deadline": extra target wait per predicted processing time (cost weights)
     char  log_file[512];            // Path to log file
     char  histogram_dir[512];       // Directory for histogram processed images
     char  colors_red[512];          // Directory for red-dominant images
     char  colors_green[512];        // Directory for green-dominant images
     char  colors_blue[512];         // Directory for blue-dominant images
+    int   pool_threads;             // Shared helper pool for intra-image work (0 = auto)
+    long  parallel_min_pixels;      // Band-parallel equalization from this many pixels up
+    int   classify_early_exit;      // 1 = decide the dominant color from a sample when possible
+    double classify_confidence;     // Confidence required to stop sampling (0.5 .. 1)
+    int   gif_passthrough;          // 1 = classified GIFs are stored as uploaded (no re-encode)
+    GifQuantizer gif_quantizer;     // Palette backend for re-encoded GIFs
+    long  gif_fast_min_pixels;      // "auto": animations with this many pixels use the fast backend
+    int   gif_global_palette;       // 1 = one palette for all frames where it fits
+    double gif_global_max_error;    // Mean |error| per channel above which frames get their own palette
+    int   stream_decode;            // 1 = start decoding large uploads while they arrive
+    long  stream_decode_min_bytes;  // Uploads smaller than this decode in the worker
+    int   stream_decoders;          // Cap on concurrently live streaming decoders
+    long  buffer_pool_mb;           // Cap on idle pooled buffer memory (0 = no caching)
+    long  max_working_set_mb;       // Larger decoded bitmaps are processed in strips (0 = never)
+    long  memory_budget_mb;         // Uploads are deferred while charged memory exceeds this (0 = unlimited)
+    int   retry_after_ms;           // Delay suggested to clients whose upload was deferred
+    long  queue_memory_mb;          // Queued payloads beyond this spill to spool_dir (0 = never)
+    char  spool_dir[512];           // Directory for spilled queue payloads
+    int   journal_enabled;          // 1 = journal accepted jobs and replay them after a restart
+    long  journal_segment_mb;       // Journal file size before moving on to a new one
+    char  journal_dir[512];         // Directory for the journal segments
 } ServerConfig;
 
 void set_default_config(ServerConfig* c);
@@ -1,14 +1,50 @@
 #include "connection.h"
 #include "utils.h"
 #include "logging.h"
+#include <limits.h>
 #include <unistd.h>
 #include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <stdatomic.h>
 #include <sys/socket.h>
 #include <openssl/err.h>
+#include <openssl/rand.h>
+#include <openssl/evp.h>
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+#include <openssl/core_names.h>
+#else
+#include <openssl/hmac.h>
+#endif
 
 // Global SSL context
 static SSL_CTX* g_ssl_ctx = NULL;
 
+// Session ticket keys, newest first. Tickets sealed with an older key
+// are still accepted (and re-issued) until that key rotates out.
+#define TICKET_KEYS 3
+typedef struct {
+    unsigned char name[16];
+    unsigned char aes[32];
+    unsigned char hmac[32];
+    time_t        created;
+    int           valid;
+} TicketKey;
+
+static TicketKey       g_ticket_keys[TICKET_KEYS];
+static pthread_mutex_t g_ticket_mtx = PTHREAD_MUTEX_INITIALIZER;
+static int             g_ticket_rotate_sec = 0;
+static int             g_early_data = 0;
+
+static atomic_ullong   g_hs_full = 0;
+static atomic_ullong   g_hs_resumed = 0;
+static atomic_ullong   g_hs_ktls_tx = 0;
+static atomic_ullong   g_hs_ktls_rx = 0;
+static int             g_ktls_requested = 0;
+static atomic_int      g_ktls_logged = 0;
+static atomic_ullong   g_early_bytes = 0;
+
 /*
  * tls_init_ctx
  * ------------
@@ -44,16 +80,241 @@ int tls_init_ctx(const char* tls_dir) {
     return 0;
 }
 
+/*
+ * new_ticket_key
+ * --------------
+ * Generate a fresh random ticket key in slot 0, shifting the older keys
+ * down (the oldest is forgotten). Caller holds g_ticket_mtx.
+ */
+static int new_ticket_key(time_t now) {
+    TicketKey k;
+    if (RAND_bytes(k.name, sizeof(k.name)) != 1 ||
+        RAND_bytes(k.aes, sizeof(k.aes)) != 1 ||
+        RAND_bytes(k.hmac, sizeof(k.hmac)) != 1) return -1;
+    k.created = now;
+    k.valid = 1;
+
+    OPENSSL_cleanse(&g_ticket_keys[TICKET_KEYS - 1], sizeof(TicketKey));
+    memmove(&g_ticket_keys[1], &g_ticket_keys[0], sizeof(TicketKey) * (TICKET_KEYS - 1));
+    g_ticket_keys[0] = k;
+    OPENSSL_cleanse(&k, sizeof(k));
+    return 0;
+}
+
+/*
+ * ticket_key_cb
+ * -------------
+ * Session ticket callback. Encryption uses the newest key (rotating it
+ * first when it is older than server.tls_ticket_rotate_sec); decryption
+ * looks the key up by name. Returns 1 to accept, 2 to accept and issue
+ * a ticket under the current key, 0 for an unknown/expired key (full
+ * handshake) and -1 on error.
+ */
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+static int ticket_key_cb(SSL* s, unsigned char key_name[16], unsigned char* iv,
+                         EVP_CIPHER_CTX* cctx, EVP_MAC_CTX* hctx, int enc) {
+#else
+static int ticket_key_cb(SSL* s, unsigned char key_name[16], unsigned char* iv,
+                         EVP_CIPHER_CTX* cctx, HMAC_CTX* hctx, int enc) {
+#endif
+    (void)s;
+    TicketKey k;
+    int ret = 1;
+
+    pthread_mutex_lock(&g_ticket_mtx);
+    time_t now = time(NULL);
+    if (!g_ticket_keys[0].valid || now - g_ticket_keys[0].created >= g_ticket_rotate_sec) {
+        if (new_ticket_key(now) != 0 && !g_ticket_keys[0].valid) {
+            pthread_mutex_unlock(&g_ticket_mtx);
+            return -1;
+        }
+    }
+    if (enc) {
+        k = g_ticket_keys[0];
+    } else {
+        int i = 0;
+        while (i < TICKET_KEYS &&
+               !(g_ticket_keys[i].valid && memcmp(g_ticket_keys[i].name, key_name, 16) == 0)) i++;
+        if (i == TICKET_KEYS) {
+            pthread_mutex_unlock(&g_ticket_mtx);
+            return 0;
+        }
+        k = g_ticket_keys[i];
+        if (i > 0) ret = 2;
+    }
+    pthread_mutex_unlock(&g_ticket_mtx);
+
+    if (enc) {
+        memcpy(key_name, k.name, 16);
+        if (RAND_bytes(iv, EVP_CIPHER_iv_length(EVP_aes_256_cbc())) != 1) ret = -1;
+    }
+    if (ret > 0 && EVP_CipherInit_ex(cctx, EVP_aes_256_cbc(), NULL, k.aes, iv, enc) != 1) ret = -1;
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+    if (ret > 0) {
+        OSSL_PARAM params[3];
+        params[0] = OSSL_PARAM_construct_octet_string(OSSL_MAC_PARAM_KEY, k.hmac, sizeof(k.hmac));
+        params[1] = OSSL_PARAM_construct_utf8_string(OSSL_MAC_PARAM_DIGEST, (char*)"SHA256", 0);
+        params[2] = OSSL_PARAM_construct_end();
+        if (EVP_MAC_CTX_set_params(hctx, params) != 1) ret = -1;
+    }
+#else
+    if (ret > 0 && HMAC_Init_ex(hctx, k.hmac, sizeof(k.hmac), EVP_sha256(), NULL) != 1) ret = -1;
+#endif
+    OPENSSL_cleanse(&k, sizeof(k));
+    return ret;
+}
+
+/*
+ * tls_enable_resumption
+ * ---------------------
+ * Configure session resumption on the server context: a server-side
+ * session cache of `cache_size` entries (TLS 1.2 session ids, and the
+ * replay protection of TLS 1.3 early data), stateless session tickets
+ * whose keys rotate every `ticket_rotate_sec` seconds, and, when
+ * `early_data` is set, acceptance of up to TLS_MAX_EARLY_DATA bytes of
+ * 0-RTT data on resumed connections.
+ * Returns 0 on success, -1 on failure.
+ */
+int tls_enable_resumption(int cache_size, int ticket_rotate_sec, int early_data) {
+    if (!g_ssl_ctx) return -1;
+
+    static const unsigned char sid_ctx[] = "ImageServer";
+    if (SSL_CTX_set_session_id_context(g_ssl_ctx, sid_ctx, sizeof(sid_ctx) - 1) != 1)
+        return -1;
+    SSL_CTX_set_session_cache_mode(g_ssl_ctx, SSL_SESS_CACHE_SERVER);
+#ifdef SSL_OP_IGNORE_UNEXPECTED_EOF
+    // Clients often close without close_notify. That must not be a fatal
+    // alert, which would evict the session from the cache; the framed
+    // protocol already detects truncated messages.
+    SSL_CTX_set_options(g_ssl_ctx, SSL_OP_IGNORE_UNEXPECTED_EOF);
+#endif
+    SSL_CTX_sess_set_cache_size(g_ssl_ctx, cache_size > 0 ? cache_size : 1);
+
+    // A ticket stays usable while its key is among the TICKET_KEYS kept
+    g_ticket_rotate_sec = ticket_rotate_sec > 0 ? ticket_rotate_sec : 3600;
+    SSL_CTX_set_timeout(g_ssl_ctx, (long)g_ticket_rotate_sec * (TICKET_KEYS - 1));
+
+    pthread_mutex_lock(&g_ticket_mtx);
+    int rc = g_ticket_keys[0].valid ? 0 : new_ticket_key(time(NULL));
+    pthread_mutex_unlock(&g_ticket_mtx);
+    if (rc != 0) return -1;
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+    if (SSL_CTX_set_tlsext_ticket_key_evp_cb(g_ssl_ctx, ticket_key_cb) != 1) return -1;
+#else
+    if (SSL_CTX_set_tlsext_ticket_key_cb(g_ssl_ctx, ticket_key_cb) != 1) return -1;
+#endif
+
+    g_early_data = early_data ? 1 : 0;
+    uint32_t max_early = g_early_data ? TLS_MAX_EARLY_DATA : 0;
+    if (SSL_CTX_set_max_early_data(g_ssl_ctx, max_early) != 1 ||
+        SSL_CTX_set_recv_max_early_data(g_ssl_ctx, max_early) != 1) return -1;
+    return 0;
+}
+
+int tls_early_data_enabled(void) {
+    return g_early_data;
+}
+
+/*
+ * tls_read_early
+ * --------------
+ * Server side of 0-RTT: drive the handshake and read early data into
+ * `buf`. Returns bytes read (> 0), 0 once the early data (if any) is
+ * over and the handshake can be finished with SSL_accept, CS_AGAIN when
+ * the socket would block, or CS_ERR.
+ */
+long tls_read_early(Conn* c, void* buf, size_t len) {
+    size_t got = 0;
+    int ret = SSL_read_early_data(c->ssl, buf, len, &got);
+    if (ret == SSL_READ_EARLY_DATA_SUCCESS) {
+        if (got > 0) atomic_fetch_add(&g_early_bytes, got);
+        return got > 0 ? (long)got : CS_AGAIN;
+    }
+    if (ret == SSL_READ_EARLY_DATA_FINISH) return 0;
+
+    int err = SSL_get_error(c->ssl, ret);
+    if (err == SSL_ERROR_WANT_READ || err == SSL_ERROR_WANT_WRITE) return CS_AGAIN;
+    return CS_ERR;
+}
+
+/*
+ * tls_enable_ktls
+ * ---------------
+ * Set SSL_OP_ENABLE_KTLS on the server context. OpenSSL then installs
+ * the session keys in the kernel once the handshake is done, if the
+ * kernel has the tls module and supports the negotiated cipher;
+ * otherwise the connection silently stays on userspace records.
+ */
+int tls_enable_ktls(void) {
+#ifdef SSL_OP_ENABLE_KTLS
+    if (!g_ssl_ctx) return -1;
+    SSL_CTX_set_options(g_ssl_ctx, SSL_OP_ENABLE_KTLS);
+    g_ktls_requested = 1;
+    return 0;
+#else
+    return -1;
+#endif
+}
+
+/*
+ * tls_note_handshake
+ * ------------------
+ * Count a completed server handshake as full or resumed; the running
+ * resumption hit rate is logged every 100 handshakes. Also detect
+ * whether kTLS took over each direction: with receive offload,
+ * cs_recv_some reads decrypted data straight from the socket. The
+ * first handshake logs which directions were offloaded.
+ */
+void tls_note_handshake(Conn* c) {
+    SSL* ssl = c->ssl;
+    unsigned long long full, resumed;
+    if (SSL_session_reused(ssl)) {
+        resumed = atomic_fetch_add(&g_hs_resumed, 1) + 1;
+        full = atomic_load(&g_hs_full);
+    } else {
+        full = atomic_fetch_add(&g_hs_full, 1) + 1;
+        resumed = atomic_load(&g_hs_resumed);
+    }
+    if ((full + resumed) % 100 == 0) {
+        log_line("TLS: %llu handshakes, %llu resumed (%.1f%% hit rate)",
+                 full + resumed, resumed, 100.0 * (double)resumed / (double)(full + resumed));
+    }
+
+    int tx = BIO_get_ktls_send(SSL_get_wbio(ssl)) ? 1 : 0;
+    int rx = BIO_get_ktls_recv(SSL_get_rbio(ssl)) ? 1 : 0;
+    c->ktls_rx = rx;
+    if (tx) atomic_fetch_add(&g_hs_ktls_tx, 1);
+    if (rx) atomic_fetch_add(&g_hs_ktls_rx, 1);
+    if (g_ktls_requested && !atomic_exchange(&g_ktls_logged, 1)) {
+        log_line("TLS: kTLS offload %s/%s for %s %s%s",
+                 tx ? "tx" : "-", rx ? "rx" : "-", SSL_get_version(ssl), SSL_get_cipher_name(ssl),
+                 (tx || rx) ? "" : " (kernel tls module or cipher unsupported; using userspace TLS)");
+    }
+}
+
 /*
  * tls_cleanup
  * -----------
- * Free global SSL_CTX and cleanup TLS resources.
+ * Log the session resumption statistics, free the global SSL_CTX and
+ * wipe the ticket keys.
  */
 void tls_cleanup(void) {
     if (g_ssl_ctx) {
+        unsigned long long full = atomic_load(&g_hs_full);
+        unsigned long long resumed = atomic_load(&g_hs_resumed);
+        if (full + resumed > 0) {
+            log_line("TLS: %llu handshakes, %llu resumed (%.1f%% hit rate), %llu early-data bytes, "
+                     "kTLS tx/rx on %llu/%llu",
+                     full + resumed, resumed, 100.0 * (double)resumed / (double)(full + resumed),
+                     atomic_load(&g_early_bytes), atomic_load(&g_hs_ktls_tx),
+                     atomic_load(&g_hs_ktls_rx));
+        }
         SSL_CTX_free(g_ssl_ctx);
         g_ssl_ctx = NULL;
     }
+    pthread_mutex_lock(&g_ticket_mtx);
+    OPENSSL_cleanse(g_ticket_keys, sizeof(g_ticket_keys));
+    pthread_mutex_unlock(&g_ticket_mtx);
 }
 
 /*
@@ -97,20 +358,18 @@ int cs_send_all(Conn* c, const void* buf, size_t len) {
 /*
  * cs_recv_all
  * -----------
- * Receive exactly `len` bytes into `buf` from the connection. Uses
- * SSL_read if `c->ssl` is set or `recv` otherwise. Handles short reads.
- * Returns 0 on success, -1 on error, or -2 on orderly EOF (peer closed).
+ * Receive exactly `len` bytes into `buf` from the connection, handling
+ * short reads (TLS, kTLS and plain TCP alike, via cs_recv_some).
+ * Returns 0 on success, -1 on error (including a receive timeout), or
+ * -2 on orderly EOF (peer closed).
  */
 int cs_recv_all(Conn* c, void* buf, size_t len) {
     unsigned char* p = (unsigned char*)buf;
     size_t r = 0;
 
     while (r < len) {
-        ssize_t n = c->ssl
-            ? SSL_read(c->ssl, p + r, (int)(len - r))
-            : recv(c->fd, p + r, len - r, 0);
-
-        if (n == 0) {
+        long n = cs_recv_some(c, p + r, len - r);
+        if (n == CS_EOF) {
             // orderly close from peer (EOF)
             return -2; // NEW: signal EOF with a distinct return code
         }
@@ -123,6 +382,96 @@ int cs_recv_all(Conn* c, void* buf, size_t len) {
     return 0; // éxito
 }
 
+/*
+ * ssl_io_status
+ * -------------
+ * Map a failed SSL_read/SSL_write result to a CS_* code.
+ */
+static long ssl_io_status(SSL* ssl, int ret) {
+    switch (SSL_get_error(ssl, ret)) {
+        case SSL_ERROR_WANT_READ:
+        case SSL_ERROR_WANT_WRITE:
+            return CS_AGAIN;
+        case SSL_ERROR_ZERO_RETURN:
+            return CS_EOF;
+        case SSL_ERROR_SYSCALL:
+            if (ret == 0) return CS_EOF;
+            return (errno == EAGAIN || errno == EWOULDBLOCK) ? CS_AGAIN : CS_ERR;
+        default:
+            return CS_ERR;
+    }
+}
+
+static long ssl_recv_some(Conn* c, void* buf, size_t len) {
+    int want = len > INT_MAX ? INT_MAX : (int)len;
+    int n = SSL_read(c->ssl, buf, want);
+    return n > 0 ? n : ssl_io_status(c->ssl, n);
+}
+
+/*
+ * cs_recv_some
+ * ------------
+ * Single receive of at most `len` bytes. On non-blocking sockets
+ * CS_AGAIN means "wait for readiness"; on blocking sockets with
+ * SO_RCVTIMEO it means the receive timed out.
+ */
+long cs_recv_some(Conn* c, void* buf, size_t len) {
+    // kTLS: the socket yields decrypted application data, unless OpenSSL
+    // still buffers bytes read before the kernel took over
+    if (c->ssl && !(c->ktls_rx && !SSL_has_pending(c->ssl))) return ssl_recv_some(c, buf, len);
+
+    for (;;) {
+        ssize_t n = recv(c->fd, buf, len, 0);
+        if (n > 0) return (long)n;
+        if (n == 0) return CS_EOF;
+        if (errno == EINTR) continue;
+        // kTLS: a non-data record (alert, key update) needs SSL_read's control message
+        if (errno == EIO && c->ssl) return ssl_recv_some(c, buf, len);
+        return (errno == EAGAIN || errno == EWOULDBLOCK) ? CS_AGAIN : CS_ERR;
+    }
+}
+
+/*
+ * cs_send_some
+ * ------------
+ * Single send of at most `len` bytes. A TLS write that returned
+ * CS_AGAIN must be retried with the same length.
+ */
+long cs_send_some(Conn* c, const void* buf, size_t len) {
+    if (c->ssl) {
+        int want = len > INT_MAX ? INT_MAX : (int)len;
+        int n = SSL_write(c->ssl, buf, want);
+        return n > 0 ? n : ssl_io_status(c->ssl, n);
+    }
+
+    for (;;) {
+        ssize_t n = send(c->fd, buf, len, MSG_NOSIGNAL);
+        if (n >= 0) return (long)n;
+        if (errno == EINTR) continue;
+        return (errno == EAGAIN || errno == EWOULDBLOCK) ? CS_AGAIN : CS_ERR;
+    }
+}
+
+/*
+ * build_header
+ * ------------
+ * Fill a protocol MessageHeader with `type`, payload length (network
+ * order) and optional image id, ready to be written to the wire.
+ */
+void build_header(MessageHeader* h, uint8_t type, uint32_t payload_len, const char* image_id) {
+    memset(h, 0, sizeof(*h));
+    
+    h->type = type;
+    h->length = to_be32_s(payload_len);
+    
+    if (image_id) {
+        strncpy(h->image_id, image_id, sizeof(h->image_id)-1);
+        h->image_id[sizeof(h->image_id)-1] = '\0';
+    } else {
+        h->image_id[0] = '\0';
+    }
+}
+
 /*
  * send_header
  * -----------
@@ -132,18 +481,7 @@ int cs_recv_all(Conn* c, void* buf, size_t len) {
  */
 int send_header(Conn* c, uint8_t type, uint32_t payload_len, const char* image_id) {
     MessageHeader h;
-    memset(&h, 0, sizeof(h));
-    
-    h.type = type;
-    h.length = to_be32_s(payload_len);
-    
-    if (image_id) {
-        strncpy(h.image_id, image_id, sizeof(h.image_id)-1);
-        h.image_id[sizeof(h.image_id)-1] = '\0';
-    } else {
-        h.image_id[0] = '\0';
-    }
-    
+    build_header(&h, type, payload_len, image_id);
     return cs_send_all(c, &h, sizeof(h));
 }
 
@@ -7,15 +7,42 @@
 
 // Connection abstraction for both plain TCP and TLS
 typedef struct {
-    int  fd;    // Socket file descriptor
-    SSL* ssl;   // SSL connection (NULL for plain TCP)
+    int  fd;       // Socket file descriptor
+    SSL* ssl;      // SSL connection (NULL for plain TCP)
+    int  ktls_rx;  // kernel decrypts the stream: application data is read with recv
 } Conn;
 
 // Initialize TLS context using configuration
 // Returns: 0 on success, -1 on failure
 int tls_init_ctx(const char* tls_dir);
 
-// Clean up TLS context
+// Largest 0-RTT payload accepted on a resumed connection
+#define TLS_MAX_EARLY_DATA 16384
+
+// Enable the server session cache (`cache_size` entries), session tickets
+// with keys rotated every `ticket_rotate_sec` seconds and, optionally,
+// TLS 1.3 early data. Call after tls_init_ctx.
+// Returns: 0 on success, -1 on failure
+int tls_enable_resumption(int cache_size, int ticket_rotate_sec, int early_data);
+
+// 1 when early data was enabled by tls_enable_resumption
+int tls_early_data_enabled(void);
+
+// Read 0-RTT data while driving the server handshake
+// Returns: bytes read (> 0), 0 when the handshake can finish with
+// SSL_accept, or CS_AGAIN / CS_ERR
+long tls_read_early(Conn* c, void* buf, size_t len);
+
+// Ask OpenSSL to offload record encryption/decryption to the kernel
+// (kTLS) after each handshake, when the kernel and cipher allow it.
+// Returns: 0 if requested, -1 if this OpenSSL build lacks kTLS
+int tls_enable_ktls(void);
+
+// Record a completed server handshake (resumption and kTLS statistics)
+// and switch the connection to kTLS reads when the kernel took over
+void tls_note_handshake(Conn* c);
+
+// Log resumption statistics and clean up TLS context
 void tls_cleanup(void);
 
 // Send all data through connection
@@ -26,6 +53,22 @@ int cs_send_all(Conn* c, const void* buf, size_t len);
 // Returns: 0 on success, -1 on failure
 int cs_recv_all(Conn* c, void* buf, size_t len);
 
+// Return codes of the single-shot I/O helpers below
+#define CS_ERR   (-1)   // socket/TLS error
+#define CS_EOF   (-2)   // orderly close from the peer
+#define CS_AGAIN (-3)   // would block (non-blocking socket) or receive timeout
+
+// Receive up to `len` bytes with a single recv/SSL_read
+// Returns: bytes received (> 0) or CS_ERR / CS_EOF / CS_AGAIN
+long cs_recv_some(Conn* c, void* buf, size_t len);
+
+// Send up to `len` bytes with a single send/SSL_write
+// Returns: bytes sent (> 0) or CS_ERR / CS_AGAIN
+long cs_send_some(Conn* c, const void* buf, size_t len);
+
+// Fill `h` with a wire-format header (length in network order)
+void build_header(MessageHeader* h, uint8_t type, uint32_t payload_len, const char* image_id);
+
 // Send protocol message header
 // Returns: 0 on success, -1 on failure
 int send_header(Conn* c, uint8_t type, uint32_t payload_len, const char* image_id);
@@ -0,0 +1,112 @@
+#include "cost_model.h"
+#include "logging.h"
+#include <math.h>
+#include <pthread.h>
+#include <strings.h>
+
+enum { CODEC_PNG = 0, CODEC_JPEG, CODEC_GIF, CODEC_OTHER, CODECS };
+#define TYPES 3                     // PROC_HISTOGRAM .. PROC_BOTH
+
+static const char* const k_codec_names[CODECS] = { "png", "jpeg", "gif", "other" };
+
+#define OVERHEAD_US   300.0         // per job: output files, logging, queue hand-off
+#define EWMA_ALPHA    0.2
+
+// Nanoseconds per work unit (pixel x channel x frame), by codec and
+// processing type (histogram, color, both). Starting points measured on
+// one x86 core with the default build; encoding the outputs dominates,
+// so "both" costs about the sum of the single operations minus the
+// shared decode.
+static double g_ns_per_unit[CODECS][TYPES] = {
+    /* png  */ { 150.0, 125.0, 250.0 },
+    /* jpeg */ {  85.0,  70.0, 140.0 },
+    /* gif  */ {  90.0,  75.0, 150.0 },
+    /* other*/ { 150.0, 125.0, 250.0 },
+};
+
+typedef struct {
+    uint64_t jobs;
+    double   abs_log2_err;          // sum of |log2(actual / predicted)|
+    uint64_t within_2x;             // predictions within a factor of two
+    double   predicted_ms, actual_ms;
+} CodecAccuracy;
+
+static pthread_mutex_t g_mtx = PTHREAD_MUTEX_INITIALIZER;
+static CodecAccuracy   g_acc[CODECS];
+
+static int codec_of(const char* format) {
+    if (!format) return CODEC_OTHER;
+    if (strcasecmp(format, "png") == 0) return CODEC_PNG;
+    if (strcasecmp(format, "jpg") == 0 || strcasecmp(format, "jpeg") == 0) return CODEC_JPEG;
+    if (strcasecmp(format, "gif") == 0) return CODEC_GIF;
+    return CODEC_OTHER;
+}
+
+static int type_index(ProcessingType type) {
+    int t = (int)type - 1;
+    return (t < 0 || t >= TYPES) ? TYPES - 1 : t;
+}
+
+static double work_units(const ImageHeader* hdr, int codec) {
+    if (!hdr || hdr->width <= 0 || hdr->height <= 0) return 0.0;
+    int channels = codec == CODEC_GIF ? 4 : (hdr->channels > 0 ? hdr->channels : 3); // GIFs decode to RGBA
+    int frames = hdr->frames > 0 ? hdr->frames : 1;
+    return (double)hdr->width * (double)hdr->height * (double)channels * (double)frames;
+}
+
+uint64_t cost_predict_us(const ImageHeader* hdr, const char* format, ProcessingType type) {
+    int codec = codec_of(format);
+    double units = work_units(hdr, codec);
+
+    pthread_mutex_lock(&g_mtx);
+    double ns = g_ns_per_unit[codec][type_index(type)];
+    pthread_mutex_unlock(&g_mtx);
+
+    double us = OVERHEAD_US + units * ns / 1000.0;
+    return us >= 1.8e19 ? UINT64_MAX - 1 : (uint64_t)us;
+}
+
+/*
+ * cost_observe
+ * ------------
+ * Move the coefficient toward the measured per-unit time and account
+ * the prediction error.
+ */
+void cost_observe(const ImageHeader* hdr, const char* format, ProcessingType type,
+                  uint64_t predicted_us, uint64_t actual_us) {
+    int codec = codec_of(format);
+    double units = work_units(hdr, codec);
+    if (predicted_us == 0) return;
+
+    pthread_mutex_lock(&g_mtx);
+    if (units > 0.0) {
+        double sample = ((double)actual_us - OVERHEAD_US) * 1000.0 / units;
+        if (sample < 0.0) sample = 0.0;
+        double* ns = &g_ns_per_unit[codec][type_index(type)];
+        *ns += EWMA_ALPHA * (sample - *ns);
+    }
+
+    CodecAccuracy* a = &g_acc[codec];
+    double ratio = (double)(actual_us ? actual_us : 1) / (double)predicted_us;
+    a->jobs++;
+    a->abs_log2_err += fabs(log2(ratio));
+    if (ratio >= 0.5 && ratio <= 2.0) a->within_2x++;
+    a->predicted_ms += (double)predicted_us / 1000.0;
+    a->actual_ms += (double)actual_us / 1000.0;
+    pthread_mutex_unlock(&g_mtx);
+}
+
+void cost_model_log(void) {
+    pthread_mutex_lock(&g_mtx);
+    for (int c = 0; c < CODECS; ++c) {
+        const CodecAccuracy* a = &g_acc[c];
+        if (!a->jobs) continue;
+        log_line("Cost model %s: jobs=%llu within 2x=%.0f%% mean |log2 err|=%.2f "
+                 "predicted=%.0fms actual=%.0fms ns/unit hist=%.1f color=%.1f both=%.1f",
+                 k_codec_names[c], (unsigned long long)a->jobs,
+                 100.0 * (double)a->within_2x / (double)a->jobs,
+                 a->abs_log2_err / (double)a->jobs, a->predicted_ms, a->actual_ms,
+                 g_ns_per_unit[c][0], g_ns_per_unit[c][1], g_ns_per_unit[c][2]);
+    }
+    pthread_mutex_unlock(&g_mtx);
+}
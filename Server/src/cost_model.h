@@ -0,0 +1,28 @@
+#ifndef COST_MODEL_H
+#define COST_MODEL_H
+
+#include <stdint.h>
+#include "protocol.h"
+#include "image_processing.h"
+
+// Processing-time model used to order the queue. A job's work is
+// width x height x channels x frames; the predicted time is that times a
+// per-unit coefficient for its codec and processing type, plus a fixed
+// per-job overhead. Coefficients start from built-in defaults and follow
+// the measured times (exponential moving average), so the model
+// calibrates itself to the host; prediction accuracy and the learned
+// coefficients are logged at shutdown.
+
+// Predicted processing time in microseconds (>= 1). An unreadable
+// header predicts the fixed overhead only: such jobs fail fast.
+uint64_t cost_predict_us(const ImageHeader* hdr, const char* format, ProcessingType type);
+
+// Feed back the measured time of a job predicted with the same inputs.
+// Only jobs the worker decoded and processed in full are comparable.
+void cost_observe(const ImageHeader* hdr, const char* format, ProcessingType type,
+                  uint64_t predicted_us, uint64_t actual_us);
+
+// Log prediction accuracy and the current coefficients
+void cost_model_log(void);
+
+#endif // COST_MODEL_H
@@ -0,0 +1,162 @@
+#include "gif_lzw.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define LZW_MAX_CODE   4095
+#define LZW_HASH_BITS  13                       // 8192 slots for at most 4096 codes
+#define LZW_HASH_SIZE  (1u << LZW_HASH_BITS)
+
+// A slot holds key << 12 | code, key = prefix << 8 | byte (20 bits);
+// codes start above the clear code, so 0 marks a free slot
+struct GifLzw {
+    uint32_t  table[LZW_HASH_SIZE];
+    uint8_t*  raw;                  // code stream of the current image
+    size_t    raw_cap;
+    uint8_t*  out;                  // frame output
+    size_t    out_len, out_cap;
+};
+
+GifLzw* glzw_create(void) {
+    return (GifLzw*)calloc(1, sizeof(GifLzw));
+}
+
+void glzw_destroy(GifLzw* e) {
+    if (!e) return;
+    free(e->raw);
+    free(e->out);
+    free(e);
+}
+
+void glzw_reset(GifLzw* e) {
+    e->out_len = 0;
+}
+
+static int grow(uint8_t** buf, size_t* cap, size_t need) {
+    if (need <= *cap) return 0;
+    size_t n = *cap ? *cap : 4096;
+    while (n < need) n *= 2;
+    uint8_t* p = (uint8_t*)realloc(*buf, n);
+    if (!p) return -1;
+    *buf = p;
+    *cap = n;
+    return 0;
+}
+
+int glzw_put(GifLzw* e, const void* data, size_t len) {
+    if (grow(&e->out, &e->out_cap, e->out_len + len) != 0) return -1;
+    memcpy(e->out + e->out_len, data, len);
+    e->out_len += len;
+    return 0;
+}
+
+const uint8_t* glzw_output(const GifLzw* e, size_t* len) {
+    *len = e->out_len;
+    return e->out;
+}
+
+static inline uint32_t slot_of(uint32_t key) {
+    return (key * 2654435761u) >> (32 - LZW_HASH_BITS);
+}
+
+// Code stored for `key`, or 0 with *free_slot set to where it would go
+static inline uint32_t lookup(const GifLzw* e, uint32_t key, uint32_t* free_slot) {
+    uint32_t i = slot_of(key);
+    for (;;) {
+        uint32_t v = e->table[i];
+        if (v == 0) { *free_slot = i; return 0; }
+        if ((v >> 12) == key) return v & 0xfff;
+        i = (i + 1) & (LZW_HASH_SIZE - 1);
+    }
+}
+
+/*
+ * glzw_encode
+ * -----------
+ * Same decisions as gif.h, code for code: the code size grows once the
+ * next code reaches 2^size, a clear code (at the current size) resets
+ * the dictionary when code 4095 is assigned, and the stream ends with
+ * the pending run, a clear code and the end code at the minimum size.
+ */
+int glzw_encode(GifLzw* e, const uint8_t* rgba, size_t stride, uint32_t width, uint32_t height,
+                int min_code_size) {
+    const uint32_t clear_code = 1u << min_code_size;
+
+    // Each pixel ends at most one run, plus the clears and the footer
+    size_t pixels = (size_t)width * height;
+    size_t bound = (pixels + pixels / 2048 + 8) * 12 / 8 + 16;
+    if (grow(&e->raw, &e->raw_cap, bound) != 0) return -1;
+
+    uint8_t* raw = e->raw;
+    size_t n = 0;
+    uint64_t acc = 0;
+    int nbits = 0;
+#define PUT_CODE(code, size) do {                                   \
+        acc |= (uint64_t)(code) << nbits;                           \
+        nbits += (int)(size);                                       \
+        if (nbits >= 32) {                                          \
+            raw[n] = (uint8_t)acc;         raw[n + 1] = (uint8_t)(acc >> 8);  \
+            raw[n + 2] = (uint8_t)(acc >> 16); raw[n + 3] = (uint8_t)(acc >> 24); \
+            n += 4;                                                 \
+            acc >>= 32;                                             \
+            nbits -= 32;                                            \
+        }                                                           \
+    } while (0)
+
+    memset(e->table, 0, sizeof(e->table));
+    uint32_t code_size = (uint32_t)min_code_size + 1;
+    uint32_t max_code = clear_code + 1;
+    int32_t cur = -1;
+
+    PUT_CODE(clear_code, code_size);     // start with a fresh dictionary
+
+    for (uint32_t y = 0; y < height; ++y) {
+        const uint8_t* row = rgba + (size_t)y * stride * 4 + 3;
+        for (uint32_t x = 0; x < width; ++x) {
+            uint32_t v = row[(size_t)x * 4];
+            if (cur < 0) {
+                cur = (int32_t)v;
+                continue;
+            }
+
+            uint32_t key = ((uint32_t)cur << 8) | v, slot = 0;
+            uint32_t code = lookup(e, key, &slot);
+            if (code) {
+                cur = (int32_t)code;
+                continue;
+            }
+
+            PUT_CODE((uint32_t)cur, code_size);
+            ++max_code;
+            if (max_code >= (1u << code_size)) code_size++;
+            if (max_code == LZW_MAX_CODE) {
+                PUT_CODE(clear_code, code_size);
+                memset(e->table, 0, sizeof(e->table));
+                code_size = (uint32_t)min_code_size + 1;
+                max_code = clear_code + 1;
+            } else {
+                e->table[slot] = (key << 12) | max_code;
+            }
+            cur = (int32_t)v;
+        }
+    }
+
+    PUT_CODE((uint32_t)cur, code_size);
+    PUT_CODE(clear_code, code_size);
+    PUT_CODE(clear_code + 1, (uint32_t)min_code_size + 1);
+#undef PUT_CODE
+    for (; nbits > 0; nbits -= 8, acc >>= 8) raw[n++] = (uint8_t)acc;
+
+    // Frame the stream: code size, 255-byte sub-blocks, terminator
+    if (grow(&e->out, &e->out_cap, e->out_len + n + n / 255 + 3) != 0) return -1;
+    uint8_t* o = e->out + e->out_len;
+    *o++ = (uint8_t)min_code_size;
+    for (size_t i = 0; i < n; i += 255) {
+        size_t len = n - i < 255 ? n - i : 255;
+        *o++ = (uint8_t)len;
+        memcpy(o, raw + i, len);
+        o += len;
+    }
+    *o++ = 0;
+    e->out_len = (size_t)(o - e->out);
+    return 0;
+}
@@ -0,0 +1,39 @@
+#ifndef GIF_LZW_H
+#define GIF_LZW_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// GIF frame encoder writing into memory. The LZW dictionary is an
+// open-addressing hash of (prefix code, byte) pairs, cleared with one
+// small memset instead of gif.h's 2 MB code tree; codes go into a 64-bit
+// bit accumulator that is stored 32 bits at a time. The output of a
+// frame (header bytes added with glzw_put, then the image data) is
+// collected in one buffer and written with a single call. Buffers only
+// grow, so one encoder serves every frame of an animation. The code
+// stream is the same as gif.h's GifWriteLzwImage (gif_check_lzw
+// in gif_processing.c compares the two).
+
+typedef struct GifLzw GifLzw;
+
+// Returns NULL on OOM
+GifLzw* glzw_create(void);
+void glzw_destroy(GifLzw* e);
+
+// Drop the previous output and start a new frame
+void glzw_reset(GifLzw* e);
+
+// Append raw bytes (block headers, color tables)
+int glzw_put(GifLzw* e, const void* data, size_t len);
+
+// Append the LZW image data of a width x height region whose palette
+// indices are the alpha bytes of an RGBA buffer with rows `stride`
+// pixels apart: minimum code size, data sub-blocks and the terminator.
+// Returns 0, or -1 on OOM (the output is then incomplete).
+int glzw_encode(GifLzw* e, const uint8_t* rgba, size_t stride, uint32_t width, uint32_t height,
+                int min_code_size);
+
+// Bytes produced since the last glzw_reset
+const uint8_t* glzw_output(const GifLzw* e, size_t* len);
+
+#endif // GIF_LZW_H
@@ -3,6 +3,10 @@
 #include "config.h"
 #include "logging.h"
 #include "utils.h"
+#include "thread_pool.h"
+#include "gif_quantize.h"
+#include "gif_lzw.h"
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdbool.h>
@@ -11,7 +15,12 @@
 // Include STB for GIF loading
 #include "stb_image.h"
 
-// Include gif.h for writing animated GIFs
+// Include gif.h for writing animated GIFs (frame scratch from the buffer pool)
+#include "buffer_pool.h"
+#define GIF_MALLOC      bp_alloc
+#define GIF_FREE        bp_free
+#define GIF_TEMP_MALLOC bp_alloc
+#define GIF_TEMP_FREE   bp_free
 #include "gif.h"
 
 // External access to global config
@@ -57,21 +66,410 @@ unsigned char* to_rgba(const unsigned char* src, int w, int h, int comp) {
     return out;
 }
 
+// Skip a chain of data sub-blocks starting at `pos`; returns the offset
+// after the terminator, or 0 when the data ends first
+static size_t gif_skip_sub_blocks(const unsigned char* data, size_t len, size_t pos) {
+    while (pos < len) {
+        size_t n = data[pos++];
+        if (n == 0) return pos;
+        pos += n;
+    }
+    return 0;
+}
+
+/*
+ * gif_count_frames
+ * ----------------
+ * Walk the GIF block structure (header, logical screen descriptor,
+ * color tables, extensions and image descriptors) and count the frames.
+ * Only block lengths are read, so this costs a fraction of a decode.
+ * A truncated stream returns the frames seen so far.
+ */
+int gif_count_frames(const unsigned char* data, size_t len) {
+    if (!data || len < 13 || memcmp(data, "GIF8", 4) != 0) return 0;
+
+    size_t pos = 13;
+    if (data[10] & 0x80) pos += 3u * (1u << ((data[10] & 7) + 1));  // global color table
+
+    int frames = 0;
+    while (pos < len) {
+        unsigned char b = data[pos++];
+        if (b == 0x21) {                       // extension: label + sub-blocks
+            if (pos >= len) break;
+            pos = gif_skip_sub_blocks(data, len, pos + 1);
+        } else if (b == 0x2C) {                // image descriptor
+            if (pos + 9 > len) break;
+            unsigned char packed = data[pos + 8];
+            pos += 9;
+            if (packed & 0x80) pos += 3u * (1u << ((packed & 7) + 1));   // local color table
+            pos = gif_skip_sub_blocks(data, len, pos + 1);               // LZW code size + data
+            frames++;
+        } else {                               // trailer (0x3B) or garbage
+            break;
+        }
+        if (pos == 0) break;
+    }
+    return frames;
+}
+
+// Delay of frame `i` in centiseconds, clamped to what viewers honour
+static uint32_t gif_frame_delay(const int* delays_in, int i, int assume_ms) {
+    int d_in = delays_in ? delays_in[i] : 50; // Default 50ms
+
+    // Normalize to centiseconds
+    int d_cs = assume_ms ? (d_in + 5) / 10 : d_in; // Round up if in ms
+
+    // Apply common viewer/browser clamps: minimum 2cs (20ms)
+    if (d_cs < 2) d_cs = 2;
+
+    // Maximum reasonable value: 50 seconds per frame
+    if (d_cs > 5000) d_cs = 5000;
+    return (uint32_t)d_cs;
+}
+
+#define GIF_GLOBAL_SAMPLE_FRAMES  16         // frames feeding the shared palette
+#define GIF_SAMPLE_PIXELS         262144     // pixels sampled per frame (at most)
+
+// Palette state of one animation being written
+typedef struct {
+    GifQuant*  fast;                // per-frame histogram backend (NULL = gif.h)
+    GifQuant*  global;              // shared palette (NULL = a palette per frame)
+    GifPalette global_pal;
+    double     max_error;           // mean |error| per channel before a frame gets its own palette
+    int        local_frames;        // frames that fell back to their own palette
+} GifFrameQuant;
+
+// Mean absolute per-channel error of the shared palette on `frame`
+static double gif_global_error(GifFrameQuant* fq, const uint8_t* frame, size_t pixels) {
+    size_t step = pixels / GIF_SAMPLE_PIXELS + 1;
+    size_t samples = (pixels + step - 1) / step;
+    if (samples == 0) return 0.0;
+    return (double)gq_sample_error(fq->global, frame, pixels, step) / (3.0 * (double)samples);
+}
+
+/*
+ * gif_build_global_palette
+ * ------------------------
+ * One palette for the whole animation: a histogram of up to
+ * GIF_GLOBAL_SAMPLE_FRAMES evenly spaced frames (pixels subsampled)
+ * cut into 255 colors. Returns 0 and leaves per-frame palettes on when
+ * the palette misses processing.gif_global_max_error on those frames.
+ */
+static int gif_build_global_palette(GifFrameQuant* fq, unsigned char** frames, int frame_count,
+                                    int w, int h) {
+    size_t pixels = (size_t)w * h;
+    size_t step = pixels / GIF_SAMPLE_PIXELS + 1;
+    int samples = frame_count < GIF_GLOBAL_SAMPLE_FRAMES ? frame_count : GIF_GLOBAL_SAMPLE_FRAMES;
+
+    fq->global = gq_create();
+    if (!fq->global) return 0;
+    for (int k = 0; k < samples; ++k)
+        gq_add_frame(fq->global, NULL, frames[(size_t)k * frame_count / samples], pixels, step);
+
+    memset(&fq->global_pal, 0, sizeof(fq->global_pal));
+    fq->global_pal.bitDepth = 8;
+    gq_finish_palette(fq->global, fq->global_pal.r, fq->global_pal.g, fq->global_pal.b);
+
+    double err = 0.0;
+    for (int k = 0; k < samples; ++k)
+        err += gif_global_error(fq, frames[(size_t)k * frame_count / samples], pixels);
+    if (err / samples > fq->max_error) {
+        gq_destroy(fq->global);
+        fq->global = NULL;
+        return 0;
+    }
+    return 1;
+}
+
+/*
+ * gif_quantize_frame
+ * ------------------
+ * Build the palette of `frame` and threshold it into `out`, exactly as
+ * GifWriteFrame does: the palette covers the pixels that differ from
+ * the previous quantized frame `prev` (NULL for the first frame), and
+ * unchanged pixels get the transparent index. `out` may equal `prev`.
+ * With `fq->fast` the histogram backend of gif_quantize.c is used
+ * instead. With a shared palette the frame is mapped to it unless its
+ * error is over the limit. Returns 1 when the frame needs its own color
+ * table, 0 when it uses the global one.
+ */
+static int gif_quantize_frame(GifFrameQuant* fq, const uint8_t* prev, const uint8_t* frame,
+                              uint8_t* out, int w, int h, GifPalette* pal) {
+    size_t pixels = (size_t)w * h;
+    if (fq->global) {
+        if (gif_global_error(fq, frame, pixels) <= fq->max_error) {
+            *pal = fq->global_pal;
+            gq_map_fixed(fq->global, prev, frame, out, pixels);
+            return 0;
+        }
+        fq->local_frames++;
+    }
+
+    // zero the palette: GifSplitPalette leaves the nodes of empty subtrees
+    // untouched, and GifGetClosestPaletteColor may still visit them
+    memset(pal, 0, sizeof(*pal));
+    if (fq->fast) {
+        pal->bitDepth = 8;
+        gq_build_palette(fq->fast, prev, frame, pixels, pal->r, pal->g, pal->b);
+        gq_map_frame(fq->fast, prev, frame, out, pixels);
+        return 1;
+    }
+    GifMakePalette(prev, frame, (uint32_t)w, (uint32_t)h, 8, false, pal);
+    GifThresholdImage(prev, frame, out, (uint32_t)w, (uint32_t)h, pal);
+    return 1;
+}
+
+// Bounding box of the non-transparent pixels of quantized frame `q`;
+// a single pixel at the origin when every pixel is transparent
+static void gif_frame_bounds(const uint8_t* q, int w, int h, int* x0, int* y0, int* bw, int* bh) {
+    int left = w, top = h, right = -1, bottom = -1;
+    for (int y = 0; y < h; ++y) {
+        const uint8_t* row = q + (size_t)y * w * 4;
+        int first = -1, last = -1;
+        for (int x = 0; x < w; ++x) {
+            if (row[x * 4 + 3] != kGifTransIndex) {
+                if (first < 0) first = x;
+                last = x;
+            }
+        }
+        if (first < 0) continue;
+        if (top == h) top = y;
+        bottom = y;
+        if (first < left) left = first;
+        if (last > right) right = last;
+    }
+    if (right < 0) { left = top = right = bottom = 0; }
+    *x0 = left;
+    *y0 = top;
+    *bw = right - left + 1;
+    *bh = bottom - top + 1;
+}
+
+/*
+ * gif_encode_frame_delta
+ * ----------------------
+ * Encode quantized frame `q` into `e` as the bounding box of its
+ * non-transparent pixels only. Everything outside is transparent, and
+ * frames keep the previous one in place, so the displayed animation is
+ * the same as for a full-canvas frame while the LZW encoder sees fewer
+ * pixels. A frame without changes becomes a single transparent pixel
+ * that carries the delay. Without `local` the frame refers to the
+ * global color table. With `local` the bytes are those gif.h's
+ * GifWriteLzwImage writes for the same sub-rectangle, which
+ * gif_check_lzw verifies.
+ * Returns 0, or -1 on OOM.
+ */
+static int gif_encode_frame_delta(GifLzw* e, const uint8_t* q, int w, int h, uint32_t delay,
+                                  const GifPalette* pal, int local) {
+    int x0, y0, bw, bh;
+    gif_frame_bounds(q, w, h, &x0, &y0, &bw, &bh);
+
+    // graphics control extension (keep the previous frame, transparency)
+    // and image descriptor
+    uint8_t hdr[] = {
+        0x21, 0xf9, 0x04, 0x05, (uint8_t)(delay & 0xff), (uint8_t)((delay >> 8) & 0xff),
+        (uint8_t)kGifTransIndex, 0,
+        0x2c, (uint8_t)(x0 & 0xff), (uint8_t)((x0 >> 8) & 0xff),
+        (uint8_t)(y0 & 0xff), (uint8_t)((y0 >> 8) & 0xff),
+        (uint8_t)(bw & 0xff), (uint8_t)((bw >> 8) & 0xff),
+        (uint8_t)(bh & 0xff), (uint8_t)((bh >> 8) & 0xff),
+        (uint8_t)(local ? 0x80 + pal->bitDepth - 1 : 0),
+    };
+    glzw_reset(e);
+    if (glzw_put(e, hdr, sizeof(hdr)) != 0) return -1;
+
+    if (local) {
+        // local color table; entry 0 (transparency) is written black
+        uint8_t table[256 * 3];
+        int colors = 1 << pal->bitDepth;
+        memset(table, 0, 3);
+        for (int i = 1; i < colors; ++i) {
+            table[i * 3]     = pal->r[i];
+            table[i * 3 + 1] = pal->g[i];
+            table[i * 3 + 2] = pal->b[i];
+        }
+        if (glzw_put(e, table, (size_t)colors * 3) != 0) return -1;
+    }
+
+    return glzw_encode(e, q + ((size_t)y0 * w + x0) * 4, (size_t)w, (uint32_t)bw, (uint32_t)bh,
+                       pal->bitDepth);
+}
+
+// A quantized frame in flight: thresholded pixels (palette index in
+// alpha) and palette, encoded on the pool by the slot's own encoder
+typedef struct {
+    uint8_t*   image;
+    GifLzw*    lzw;                 // encoded frame, reused by the slot's next frames
+    GifPalette pal;
+    int        local;               // own color table (0 = the global one)
+    uint32_t   delay;
+    int        w, h;
+    int        ok;
+    TpGroup    group;
+} GifFrameSlot;
+
+static void gif_lzw_task(void* arg) {
+    GifFrameSlot* s = (GifFrameSlot*)arg;
+    s->ok = (gif_encode_frame_delta(s->lzw, s->image, s->w, s->h, s->delay, &s->pal, s->local) == 0);
+}
+
+/*
+ * gif_write_frames_pipelined
+ * --------------------------
+ * Frame-parallel variant of the serial frame loop. Each frame's palette
+ * is built from the pixels that differ from the previous quantized
+ * frame, so palette building and thresholding stay a chain on the
+ * calling thread; the LZW encode of every quantized frame runs on the
+ * pool while the chain moves on. A ring of slots bounds the frames in
+ * flight, and encoded frames are appended in frame order when their
+ * slot is reused, so the file is byte-identical to the serial loop.
+ * Returns 1 on success, 0 on a write failure, -1 when the slots could
+ * not be allocated (nothing was written).
+ */
+static int gif_write_frames_pipelined(GifWriter* writer, unsigned char** frames,
+                                      const int* delays_in, int assume_ms,
+                                      int frame_count, int w, int h, GifFrameQuant* fq) {
+    int nslots = tp_size() + 2;
+    if (nslots > frame_count) nslots = frame_count;
+    GifFrameSlot* slots = (GifFrameSlot*)calloc((size_t)nslots, sizeof(GifFrameSlot));
+    if (!slots) return -1;
+
+    int ready = 0;
+    for (; ready < nslots; ++ready) {
+        slots[ready].image = (uint8_t*)GIF_MALLOC((size_t)w * h * 4);
+        slots[ready].lzw = glzw_create();
+        if (!slots[ready].image || !slots[ready].lzw) {
+            if (slots[ready].image) GIF_FREE(slots[ready].image);
+            glzw_destroy(slots[ready].lzw);
+            break;
+        }
+        tp_group_init(&slots[ready].group);
+    }
+
+    int ok = (ready == nslots) ? 1 : -1;
+    if (ok == 1) {
+        for (int i = 0; i < frame_count + nslots; ++i) {
+            GifFrameSlot* s = &slots[i % nslots];
+
+            // Reusing a slot: its frame (i - nslots) is next in file order
+            if (i >= nslots) {
+                tp_group_wait(&s->group);
+                size_t len = 0;
+                const uint8_t* out = glzw_output(s->lzw, &len);
+                if (ok && (!s->ok || fwrite(out, 1, len, writer->f) != len))
+                    ok = 0;
+            }
+            if (i >= frame_count) continue;
+
+            const uint8_t* prev = i ? slots[(i - 1) % nslots].image : NULL;
+            s->local = gif_quantize_frame(fq, prev, frames[i], s->image, w, h, &s->pal);
+            s->delay = gif_frame_delay(delays_in, i, assume_ms);
+            s->w = w;
+            s->h = h;
+            s->ok = 0;
+            tp_group_submit(&s->group, gif_lzw_task, s);
+        }
+    }
+
+    for (int k = 0; k < ready; ++k) {
+        tp_group_destroy(&slots[k].group);
+        GIF_FREE(slots[k].image);
+        glzw_destroy(slots[k].lzw);
+    }
+    free(slots);
+    return ok;
+}
+
+/*
+ * gif_begin_animation
+ * -------------------
+ * Create the GIF at `path` like gif.h's GifBegin (looping animation),
+ * but with `global_pal`, when given, as the global color table instead
+ * of GifBegin's two-entry dummy. Returns false if the file or the
+ * previous-frame buffer cannot be created.
+ */
+static bool gif_begin_animation(GifWriter* writer, const char* path, int w, int h,
+                                const GifPalette* global_pal) {
+    if (!global_pal) return GifBegin(writer, path, (uint32_t)w, (uint32_t)h, 0xFFFF, 8, false);
+
+    writer->f = fopen(path, "wb");
+    if (!writer->f) return false;
+    writer->firstFrame = true;
+    writer->oldImage = (uint8_t*)GIF_MALLOC((size_t)w * h * 4);
+    if (!writer->oldImage) {
+        fclose(writer->f);
+        writer->f = NULL;
+        return false;
+    }
+
+    // header, screen descriptor with an unsorted global color table of
+    // 2 ^ bitDepth entries, the table itself, then the NETSCAPE2.0 loop
+    uint8_t screen[] = {
+        'G', 'I', 'F', '8', '9', 'a',
+        (uint8_t)(w & 0xff), (uint8_t)((w >> 8) & 0xff),
+        (uint8_t)(h & 0xff), (uint8_t)((h >> 8) & 0xff),
+        (uint8_t)(0xf0 + global_pal->bitDepth - 1), 0, 0,
+    };
+    static const uint8_t loop[] = {
+        0x21, 0xff, 11, 'N', 'E', 'T', 'S', 'C', 'A', 'P', 'E', '2', '.', '0',
+        3, 1, 0, 0, 0,
+    };
+    fwrite(screen, 1, sizeof(screen), writer->f);
+    GifWritePalette(global_pal, writer->f);
+    fwrite(loop, 1, sizeof(loop), writer->f);
+    return true;
+}
+
+// Close the file and release the palette state
+static void gif_end_animation(GifWriter* writer, GifFrameQuant* fq, int global, int frame_count,
+                              const char* path) {
+    if (global)
+        log_line("GIF palette: %s uses the global palette for %d of %d frames",
+                 path, frame_count - fq->local_frames, frame_count);
+    gq_destroy(fq->fast);
+    gq_destroy(fq->global);
+    GifEnd(writer);
+}
+
+// Palette backend for an animation of `frame_count` w x h frames
+static GifQuantizer gif_pick_quantizer(GifQuantizer quant, int w, int h, int frame_count) {
+    if (quant != GIF_QUANT_AUTO) return quant;
+    double pixels = (double)w * (double)h * (double)frame_count;
+    return pixels >= (double)g_cfg.gif_fast_min_pixels ? GIF_QUANT_FAST : GIF_QUANT_MEDIAN;
+}
+
 /*
  * write_gif_animation
  * -------------------
  * Write an animated GIF at `path` composed of `frame_count` frames.
  * The frames are provided as pointers to RGBA buffers. `delays_in`
  * may be NULL; when present delays are interpreted heuristically as
- * either milliseconds or centiseconds and normalized.
+ * either milliseconds or centiseconds and normalized. Frames after the
+ * first are written as the changed sub-rectangle over the previous one.
+ * With a helper pool, frames are LZW-encoded in parallel (same bytes as
+ * serial). `quant` picks the palette backend (GIF_QUANT_AUTO decides by
+ * the animation's size). With processing.gif_palette = "global" one
+ * palette made from sampled frames is written as the global color
+ * table; frames it does not fit carry their own.
  * Returns 1 on success, 0 on failure.
  */
 int write_gif_animation(const char* path, unsigned char** frames_rgba,
                        const int* delays_in, int frame_count, 
-                       int w, int h) {
+                       int w, int h, GifQuantizer quant) {
     GifWriter writer = {0};
-    
-    if (!GifBegin(&writer, path, w, h, 0xFFFF, 8, false)) {
+
+    // Histogram state is reused by every frame; without it the gif.h
+    // backend is used
+    GifFrameQuant fq;
+    memset(&fq, 0, sizeof(fq));
+    fq.max_error = g_cfg.gif_global_max_error;
+    if (gif_pick_quantizer(quant, w, h, frame_count) == GIF_QUANT_FAST) fq.fast = gq_create();
+    int global = (g_cfg.gif_global_palette && frame_count > 1 &&
+                  gif_build_global_palette(&fq, frames_rgba, frame_count, w, h));
+
+    if (!gif_begin_animation(&writer, path, w, h, global ? &fq.global_pal : NULL)) {
+        gq_destroy(fq.fast);
+        gq_destroy(fq.global);
         return 0;
     }
 
@@ -88,26 +486,193 @@ int write_gif_animation(const char* path, unsigned char** frames_rgba,
         }
     }
 
-    for (int i = 0; i < frame_count; ++i) {
-        int d_in = delays_in ? delays_in[i] : 50; // Default 50ms
-        
-        // Normalize to centiseconds
-        int d_cs = assume_ms ? (d_in + 5) / 10 : d_in; // Round up if in ms
-        
-        // Apply common viewer/browser clamps: minimum 2cs (20ms)
-        if (d_cs < 2) d_cs = 2;
-        
-        // Maximum reasonable value: 50 seconds per frame
-        if (d_cs > 5000) d_cs = 5000;
+    if (frame_count > 1 && tp_size() > 1) {
+        int rc = gif_write_frames_pipelined(&writer, frames_rgba, delays_in, assume_ms,
+                                            frame_count, w, h, &fq);
+        if (rc >= 0) {
+            if (ferror(writer.f)) rc = 0;
+            gif_end_animation(&writer, &fq, global, frame_count, path);
+            return rc;
+        }
+    }
 
-        if (!GifWriteFrame(&writer, frames_rgba[i], w, h, (uint32_t)d_cs, 8, false)) {
-            GifEnd(&writer);
-            return 0;
+    GifLzw* lzw = glzw_create();
+    if (!lzw) {
+        gif_end_animation(&writer, &fq, global, frame_count, path);
+        return 0;
+    }
+
+    // Quantized in place over the previous frame, as GifWriteFrame does
+    int ok = 1;
+    for (int i = 0; i < frame_count && ok; ++i) {
+        GifPalette pal;
+        int local = gif_quantize_frame(&fq, i ? writer.oldImage : NULL, frames_rgba[i],
+                                       writer.oldImage, w, h, &pal);
+        size_t len = 0;
+        const uint8_t* out = NULL;
+        if (gif_encode_frame_delta(lzw, writer.oldImage, w, h,
+                                   gif_frame_delay(delays_in, i, assume_ms), &pal, local) == 0)
+            out = glzw_output(lzw, &len);
+        if (!out || fwrite(out, 1, len, writer.f) != len) ok = 0;
+    }
+    glzw_destroy(lzw);
+
+    if (ferror(writer.f)) ok = 0;
+    gif_end_animation(&writer, &fq, global, frame_count, path);
+    return ok;
+}
+
+// Per-frame equalization work spread over the pool by frame index
+typedef struct {
+    unsigned char**  frames;
+    unsigned char  (*luts)[3][256];
+    int              w, h;
+} GifEqualizeJob;
+
+static void gif_build_luts_task(void* ctx, int f) {
+    GifEqualizeJob* j = (GifEqualizeJob*)ctx;
+    equalization_build_luts(j->frames[f], j->w, j->h, 4, j->luts[f]);
+}
+
+static void gif_apply_luts_task(void* ctx, int f) {
+    GifEqualizeJob* j = (GifEqualizeJob*)ctx;
+    if (j->luts) equalization_apply_luts(j->frames[f], j->w, j->h, 4,
+                                         (const unsigned char (*)[256])j->luts[f]);
+    else         apply_histogram_equalization(j->frames[f], j->w, j->h, 4);
+}
+
+// Classified animation encoded on the shared pool while the caller
+// builds the per-frame equalization tables from the same frames
+typedef struct {
+    const char*     path;
+    unsigned char** frames;
+    const int*      delays;
+    int             frame_count, w, h;
+    int             ok;
+} GifEncodeTask;
+
+static void gif_encode_task(void* arg) {
+    GifEncodeTask* t = (GifEncodeTask*)arg;
+    t->ok = write_gif_animation(t->path, t->frames, t->delays, t->frame_count, t->w, t->h,
+                                g_cfg.gif_quantizer);
+}
+
+/*
+ * process_gif_frames
+ * ------------------
+ * Shared GIF pipeline over the decoded RGBA frames in `all` (stored
+ * back to back), which are equalized in place. Classification only
+ * reads the frames; for PROC_BOTH the classified animation is encoded
+ * on the pool while the per-frame equalization tables are built, and
+ * frames are remapped only after that encode finished. Sums or tables
+ * already present in `pre` (may be NULL) are used instead of scanning
+ * the frames again. Classification leaves the pixels unchanged, so with
+ * processing.gif_passthrough the uploaded bytes `src` (may be NULL) are
+ * written as the classified animation instead of encoding the frames.
+ * `origin` tags the log lines.
+ */
+void process_gif_frames(unsigned char* all, const int* delays, int w, int h, int frames,
+                        const unsigned char* src, size_t src_len,
+                        const PixelStats* pre, const char* image_id, const char* filename,
+                        ProcessingType processing_type, const char* origin) {
+    int do_color = (processing_type == PROC_COLOR_CLASSIFICATION || processing_type == PROC_BOTH);
+    int do_hist  = (processing_type == PROC_HISTOGRAM || processing_type == PROC_BOTH);
+
+    // Each frame is w*h*4 bytes (RGBA)
+    int rgba_comp = 4;
+    size_t frame_stride = (size_t)w * h * rgba_comp;
+    const char* ext = (strstr(filename, ".gif") || strstr(filename, ".GIF")) ? "" : ".gif";
+
+    // Frame pointer array for gif.h, shared by both outputs
+    unsigned char** frame_ptrs = (unsigned char**)malloc(sizeof(unsigned char*) * frames);
+    if (!frame_ptrs) {
+        log_line("GIF%s: OOM frame_ptrs", origin);
+        return;
+    }
+    for (int f = 0; f < frames; ++f) {
+        frame_ptrs[f] = all + f * frame_stride;
+    }
+
+    char color_path[1024];
+    const char* cname = "red";
+    int passthrough = (g_cfg.gif_passthrough && src && src_len > 0);
+    GifEncodeTask enc;
+    TpGroup group;
+    tp_group_init(&group);
+
+    // Color classification across ALL frames (read-only)
+    if (do_color) {
+        uint64_t sums[3];
+        if (pre && pre->have_sums) memcpy(sums, pre->sums, sizeof(sums));
+        else color_channel_sums(all, (size_t)w * h * frames, rgba_comp, sums);
+        uint64_t r_sum = sums[0], g_sum = sums[1], b_sum = sums[2];
+
+        // Determine dominant color
+        const char* color_dir = g_cfg.colors_red;
+        if (g_sum >= r_sum && g_sum >= b_sum) { 
+            color_dir = g_cfg.colors_green; 
+            cname = "green"; 
+        } else if (b_sum >= r_sum && b_sum >= g_sum) { 
+            color_dir = g_cfg.colors_blue; 
+            cname = "blue"; 
         }
+
+        snprintf(color_path, sizeof(color_path), "%s/%s_%s%s",
+                 color_dir, image_id, filename, ext);
+
+        enc.path = color_path;
+        enc.frames = frame_ptrs;
+        enc.delays = delays;
+        enc.frame_count = frames;
+        enc.w = w;
+        enc.h = h;
+        enc.ok = 0;
+        if (passthrough) enc.ok = (write_file_fully(color_path, src, src_len) == 0);
+        else if (do_hist) tp_group_submit(&group, gif_encode_task, &enc);
+        else              gif_encode_task(&enc);
     }
 
-    GifEnd(&writer);
-    return 1;
+    // Per-frame equalization tables overlap the encode
+    GifEqualizeJob eq = { frame_ptrs, NULL, w, h };
+    if (do_hist && pre && pre->luts) {
+        eq.luts = malloc(sizeof(*eq.luts) * (size_t)frames);
+        if (eq.luts) memcpy(eq.luts, pre->luts, sizeof(*eq.luts) * (size_t)frames);
+    } else if (do_hist) {
+        eq.luts = malloc(sizeof(*eq.luts) * (size_t)frames);
+        if (eq.luts) tp_parallel_for(frames, gif_build_luts_task, &eq);
+    }
+
+    tp_group_wait(&group);
+    tp_group_destroy(&group);
+    if (do_color) {
+        if (enc.ok) {
+            log_line("Color classification GIF%s: saved to %s (dominant %s%s)",
+                     origin, color_path, cname, passthrough ? ", original bytes" : "");
+        } else {
+            log_line("Color classification GIF%s: failed to write %s", origin, color_path);
+        }
+    }
+
+    // Histogram equalization per frame, in place (RGB only; alpha
+    // preserved), frames in parallel
+    if (do_hist) {
+        tp_parallel_for(frames, gif_apply_luts_task, &eq);
+        free(eq.luts);
+
+        char out_path[1024];
+        snprintf(out_path, sizeof(out_path), "%s/%s_%s%s",
+                 g_cfg.histogram_dir, image_id, filename, ext);
+
+        GifQuantizer quant = gif_pick_quantizer(g_cfg.gif_quantizer, w, h, frames);
+        if (write_gif_animation(out_path, frame_ptrs, delays, frames, w, h, quant)) {
+            log_line("Histogram equalization GIF%s: saved to %s (%s quantizer)", origin, out_path,
+                     quant == GIF_QUANT_FAST ? "fast" : "median");
+        } else {
+            log_line("Histogram equalization GIF%s: failed to write %s", origin, out_path);
+        }
+    }
+
+    free(frame_ptrs);
 }
 
 /*
@@ -133,122 +698,21 @@ void process_gif_image(const char* input_path, const char* image_id,
     unsigned char* all = stbi_load_gif_from_memory(filebuf, len, &delays, 
                                                    &w, &h, &frames, &comp, 
                                                    4 /* req_comp RGBA */);
-    free(filebuf);
 
     if (!all || frames <= 0 || w <= 0 || h <= 0) {
         log_line("GIF: failed to decode frames: %s", input_path);
+        free(filebuf);
         if (all) stbi_image_free(all);
-        if (delays) free(delays);
+        if (delays) stbi_image_free(delays);
         return;
     }
 
-    // Each frame is w*h*4 bytes (RGBA)
-    int rgba_comp = 4;
-    size_t frame_stride = (size_t)w * h * rgba_comp;
-
-    // Color classification (copy entire animation)
-    if (processing_type == PROC_COLOR_CLASSIFICATION || processing_type == PROC_BOTH) {
-        // Calculate dominant color across ALL frames
-        unsigned long long r_sum = 0, g_sum = 0, b_sum = 0;
-        size_t pixcount = (size_t)w * h;
-        
-        for (int f = 0; f < frames; ++f) {
-            unsigned char* frame = all + f * frame_stride;
-            for (size_t i = 0; i < pixcount; ++i) {
-                r_sum += frame[i*4 + 0];
-                g_sum += frame[i*4 + 1];
-                b_sum += frame[i*4 + 2];
-            }
-        }
-        
-        // Determine dominant color
-        const char* color_dir = g_cfg.colors_red;
-        const char* cname = "red";
-        
-        if (g_sum >= r_sum && g_sum >= b_sum) { 
-            color_dir = g_cfg.colors_green; 
-            cname = "green"; 
-        } else if (b_sum >= r_sum && b_sum >= g_sum) { 
-            color_dir = g_cfg.colors_blue; 
-            cname = "blue"; 
-        }
-
-        // Build output path
-        char out_path[1024];
-        const char* ext = ".gif";
-        snprintf(out_path, sizeof(out_path), "%s/%s_%s%s",
-                 color_dir, image_id, filename, 
-                 (strstr(filename, ".gif") || strstr(filename, ".GIF")) ? "" : ext);
-
-        // Create frame pointer array for gif.h
-        unsigned char** frame_ptrs = (unsigned char**)malloc(sizeof(unsigned char*) * frames);
-        if (!frame_ptrs) {
-            log_line("GIF: OOM frame_ptrs (classification)");
-        } else {
-            for (int f = 0; f < frames; ++f) {
-                frame_ptrs[f] = all + f * frame_stride;
-            }
-            
-            if (write_gif_animation(out_path, frame_ptrs, delays, frames, w, h)) {
-                log_line("Color classification GIF: saved to %s (dominant %s)", 
-                         out_path, cname);
-            } else {
-                log_line("Color classification GIF: failed to write %s", out_path);
-            }
-            
-            free(frame_ptrs);
-        }
-    }
-
-    // Histogram equalization per frame
-    if (processing_type == PROC_HISTOGRAM || processing_type == PROC_BOTH) {
-        // Copy frames, equalize RGB, and write animation
-        unsigned char** out_frames = (unsigned char**)malloc(sizeof(unsigned char*) * frames);
-        
-        if (!out_frames) {
-            log_line("GIF: OOM out_frames (histogram)");
-        } else {
-            for (int f = 0; f < frames; ++f) {
-                unsigned char* src = all + f * frame_stride;
-                unsigned char* dst = (unsigned char*)malloc(frame_stride);
-                
-                if (!dst) { 
-                    out_frames[f] = NULL; 
-                    continue; 
-                }
-                
-                memcpy(dst, src, frame_stride);
-                
-                // Equalize only RGB channels; preserve alpha
-                apply_histogram_equalization(dst, w, h, 4);
-                out_frames[f] = dst;
-            }
-
-            // Build output path
-            char out_path[1024];
-            const char* ext = ".gif";
-            snprintf(out_path, sizeof(out_path), "%s/%s_%s%s",
-                     g_cfg.histogram_dir, image_id, filename, 
-                     (strstr(filename, ".gif") || strstr(filename, ".GIF")) ? "" : ext);
-
-            int ok = write_gif_animation(out_path, out_frames, delays, frames, w, h);
-            
-            if (ok) {
-                log_line("Histogram equalization GIF: saved to %s", out_path);
-            } else {
-                log_line("Histogram equalization GIF: failed to write %s", out_path);
-            }
-
-            // Free allocated frames
-            for (int f = 0; f < frames; ++f) {
-                free(out_frames[f]);
-            }
-            free(out_frames);
-        }
-    }
+    process_gif_frames(all, delays, w, h, frames, filebuf, (size_t)len, NULL,
+                       image_id, filename, processing_type, "");
+    free(filebuf);
 
     stbi_image_free(all);
-    if (delays) free(delays);
+    if (delays) stbi_image_free(delays);
 }
 
 /*
@@ -256,12 +720,13 @@ void process_gif_image(const char* input_path, const char* image_id,
  * ------------------------------
  * Like process_gif_image but operates on an in-memory buffer `data`
  * of length `len`. Used when the image is received over the network
- * and already available in memory.
+ * and already available in memory. Returns 0, or -1 when the frames
+ * could not be decoded.
  */
-void process_gif_image_from_memory(const unsigned char* data, int len,
-                                  const char* image_id, const char* filename,
-                                  ProcessingType processing_type) {
-    if (!data || len <= 0) return;
+int process_gif_image_from_memory(const unsigned char* data, int len,
+                                 const char* image_id, const char* filename,
+                                 ProcessingType processing_type) {
+    if (!data || len <= 0) return -1;
 
     int w = 0, h = 0, frames = 0, comp = 0;
     int* delays = NULL; // centiseconds
@@ -270,78 +735,114 @@ void process_gif_image_from_memory(const unsigned char* data, int len,
     if (!all || frames <= 0 || w <= 0 || h <= 0) {
         log_line("GIF (memory): failed to decode frames");
         if (all) stbi_image_free(all);
-        if (delays) free(delays);
-        return;
+        if (delays) stbi_image_free(delays);
+        return -1;
     }
 
-    size_t frame_stride = (size_t)w * h * 4;
-
-    if (processing_type == PROC_COLOR_CLASSIFICATION || processing_type == PROC_BOTH) {
-        unsigned long long r_sum = 0, g_sum = 0, b_sum = 0;
-        size_t pixcount = (size_t)w * h;
-        for (int f = 0; f < frames; ++f) {
-            unsigned char* frame = all + f * frame_stride;
-            for (size_t i = 0; i < pixcount; ++i) {
-                r_sum += frame[i*4 + 0];
-                g_sum += frame[i*4 + 1];
-                b_sum += frame[i*4 + 2];
-            }
-        }
-
-        const char* color_dir = g_cfg.colors_red;
-        const char* cname = "red";
-        if (g_sum >= r_sum && g_sum >= b_sum) { color_dir = g_cfg.colors_green; cname = "green"; }
-        else if (b_sum >= r_sum && b_sum >= g_sum) { color_dir = g_cfg.colors_blue; cname = "blue"; }
+    process_gif_frames(all, delays, w, h, frames, data, (size_t)len, NULL,
+                       image_id, filename, processing_type, " (memory)");
 
-        char out_path[1024];
-        const char* ext = ".gif";
-        snprintf(out_path, sizeof(out_path), "%s/%s_%s%s",
-                 color_dir, image_id, filename,
-                 (strstr(filename, ".gif") || strstr(filename, ".GIF")) ? "" : ext);
+    stbi_image_free(all);
+    if (delays) stbi_image_free(delays);
+    return 0;
+}
 
-        unsigned char** frame_ptrs = (unsigned char**)malloc(sizeof(unsigned char*) * frames);
-        if (!frame_ptrs) {
-            log_line("GIF (memory): OOM frame_ptrs (classification)");
-        } else {
-            for (int f = 0; f < frames; ++f) frame_ptrs[f] = all + f * frame_stride;
-            if (write_gif_animation(out_path, frame_ptrs, delays, frames, w, h)) {
-                log_line("Color classification GIF (memory): saved to %s (dominant %s)", out_path, cname);
-            } else {
-                log_line("Color classification GIF (memory): failed to write %s", out_path);
-            }
-            free(frame_ptrs);
-        }
+// Reference bytes for gif_check_lzw: gif.h's own frame writer on the
+// same sub-rectangle, copied out of a temporary file
+static uint8_t* gif_reference_frame(const uint8_t* q, int w, int h, uint32_t delay,
+                                    GifPalette* pal, size_t* len) {
+    int x0, y0, bw, bh;
+    gif_frame_bounds(q, w, h, &x0, &y0, &bw, &bh);
+    uint8_t* crop = (uint8_t*)malloc((size_t)bw * bh * 4);
+    FILE* f = tmpfile();
+    uint8_t* out = NULL;
+    if (crop && f) {
+        for (int y = 0; y < bh; ++y)
+            memcpy(crop + (size_t)y * bw * 4, q + ((size_t)(y0 + y) * w + x0) * 4, (size_t)bw * 4);
+        GifWriteLzwImage(f, crop, (uint32_t)x0, (uint32_t)y0, (uint32_t)bw, (uint32_t)bh, delay, pal);
+        long n = ftell(f);
+        out = (n > 0) ? (uint8_t*)malloc((size_t)n) : NULL;
+        rewind(f);
+        if (out && fread(out, 1, (size_t)n, f) != (size_t)n) { free(out); out = NULL; }
+        *len = out ? (size_t)n : 0;
     }
+    if (f) fclose(f);
+    free(crop);
+    return out;
+}
 
-    if (processing_type == PROC_HISTOGRAM || processing_type == PROC_BOTH) {
-        unsigned char** out_frames = (unsigned char**)malloc(sizeof(unsigned char*) * frames);
-        if (!out_frames) {
-            log_line("GIF (memory): OOM out_frames (histogram)");
-        } else {
-            for (int f = 0; f < frames; ++f) {
-                unsigned char* src = all + f * frame_stride;
-                unsigned char* dst = (unsigned char*)malloc(frame_stride);
-                if (!dst) { out_frames[f] = NULL; continue; }
-                memcpy(dst, src, frame_stride);
-                apply_histogram_equalization(dst, w, h, 4);
-                out_frames[f] = dst;
+/*
+ * gif_check_lzw
+ * -------------
+ * Encode synthetic frames with gif_lzw.c (through gif_encode_frame_delta)
+ * and with gif.h's GifWriteLzwImage and compare the bytes. The cases
+ * cover every palette depth, noise that fills the dictionary and forces
+ * clear codes, long runs, transparent borders (a sub-rectangle read
+ * with the canvas stride) and a frame without changes. Prints one line
+ * per case to stdout. Returns 0 when every case matches.
+ */
+int gif_check_lzw(void) {
+    static const struct { int w, h, depth, pattern; } cases[] = {
+        {   1,   1, 8, 0 }, { 317, 211, 8, 0 }, { 640, 480, 8, 0 },
+        { 640, 480, 8, 1 }, { 640, 480, 8, 2 }, { 257, 129, 8, 3 },
+        { 200, 150, 1, 0 }, { 200, 150, 2, 0 }, { 200, 150, 4, 0 },
+        { 300, 200, 5, 3 }, { 300, 200, 7, 2 }, {  64,  48, 8, 4 },
+    };
+    static const char* names[] = { "noise", "runs", "gradient", "border", "unchanged" };
+    const int ncases = (int)(sizeof(cases) / sizeof(cases[0]));
+
+    GifLzw* lzw = glzw_create();
+    if (!lzw) return -1;
+    int failed = 0;
+    uint32_t x = 2463534242u;
+    for (int c = 0; c < ncases; ++c) {
+        int w = cases[c].w, h = cases[c].h, depth = cases[c].depth;
+        uint8_t* q = (uint8_t*)calloc((size_t)w * h, 4);
+        if (!q) { failed++; continue; }
+
+        // Palette indices in alpha, as gif_quantize_frame leaves them;
+        // index 0 is transparent
+        int colors = 1 << depth;
+        for (int y = 0; y < h; ++y) {
+            for (int i = 0; i < w; ++i) {
+                x ^= x << 13; x ^= x >> 17; x ^= x << 5;
+                int v;
+                switch (cases[c].pattern) {
+                    case 0:  v = (int)(x % (uint32_t)colors); break;
+                    case 1:  v = 1 + ((y * w + i) / 97) % (colors - 1); break;
+                    case 2:  v = 1 + (i + y) % (colors - 1); break;
+                    case 3:  v = (i < w / 5 || i >= w - w / 7 || y < h / 3 || y >= h - 9)
+                                 ? 0 : 1 + (int)(x % (uint32_t)(colors - 1)); break;
+                    default: v = 0; break;
+                }
+                q[((size_t)y * w + i) * 4 + 3] = (uint8_t)v;
             }
+        }
+        GifPalette pal;
+        memset(&pal, 0, sizeof(pal));
+        pal.bitDepth = depth;
+        for (int i = 1; i < colors; ++i) {
+            pal.r[i] = (uint8_t)(i * 7);
+            pal.g[i] = (uint8_t)(i * 13);
+            pal.b[i] = (uint8_t)(255 - i);
+        }
 
-            char out_path[1024];
-            const char* ext = ".gif";
-            snprintf(out_path, sizeof(out_path), "%s/%s_%s%s",
-                     g_cfg.histogram_dir, image_id, filename,
-                     (strstr(filename, ".gif") || strstr(filename, ".GIF")) ? "" : ext);
-
-            int ok = write_gif_animation(out_path, out_frames, delays, frames, w, h);
-            if (ok) log_line("Histogram equalization GIF (memory): saved to %s", out_path);
-            else    log_line("Histogram equalization GIF (memory): failed to write %s", out_path);
-
-            for (int f = 0; f < frames; ++f) free(out_frames[f]);
-            free(out_frames);
+        size_t ref_len = 0, len = 0;
+        uint8_t* ref = gif_reference_frame(q, w, h, 10, &pal, &ref_len);
+        const uint8_t* out = NULL;
+        if (gif_encode_frame_delta(lzw, q, w, h, 10, &pal, 1) == 0) out = glzw_output(lzw, &len);
+        int same = ref && out && len == ref_len && memcmp(ref, out, len) == 0;
+        printf("%-9s %4dx%-4d depth %d: %zu bytes %s\n", names[cases[c].pattern], w, h, depth,
+               len, same ? "match" : "DIFFER");
+        if (!same) {
+            if (ref && out)
+                printf("          gif.h wrote %zu bytes\n", ref_len);
+            failed++;
         }
+        free(ref);
+        free(q);
     }
-
-    stbi_image_free(all);
-    if (delays) free(delays);
-}
\ No newline at end of file
+    glzw_destroy(lzw);
+    printf("%d of %d frames match gif.h\n", ncases - failed, ncases);
+    return failed ? -1 : 0;
+}
@@ -2,20 +2,39 @@
 #define GIF_PROCESSING_H
 
 #include <stdint.h>
+#include <stddef.h>
 #include "protocol.h"
+#include "image_processing.h"
+#include "config.h"
 
 void process_gif_image(const char* input_path, const char* image_id,
                       const char* filename, ProcessingType processing_type);
 
 // NEW: version that works from an in-memory buffer
-void process_gif_image_from_memory(const unsigned char* data, int len,
-                                  const char* image_id, const char* filename,
-                                  ProcessingType processing_type);
+// Returns 0, or -1 when the frames could not be decoded
+int process_gif_image_from_memory(const unsigned char* data, int len,
+                                 const char* image_id, const char* filename,
+                                 ProcessingType processing_type);
+
+// GIF pipeline over decoded RGBA frames stored back to back; `src` is
+// the encoded upload they came from (NULL when not available)
+void process_gif_frames(unsigned char* all, const int* delays, int w, int h, int frames,
+                        const unsigned char* src, size_t src_len, const PixelStats* pre, const char* image_id, const char* filename,
+                        ProcessingType processing_type, const char* origin);
+
+// Number of frames (image descriptors) in a GIF stream, by walking its
+// blocks without decoding; 0 if the data is not a readable GIF
+int gif_count_frames(const unsigned char* data, size_t len);
 
 unsigned char* to_rgba(const unsigned char* src, int w, int h, int comp);
 
+// `quant` selects the palette backend for this animation
 int write_gif_animation(const char* path, unsigned char** frames_rgba,
                        const int* delays_in, int frame_count,
-                       int w, int h);
+                       int w, int h, GifQuantizer quant);
+
+// Compare gif_lzw.c's frame bytes with gif.h's encoder on synthetic
+// frames, printing the results to stdout. Returns 0 when all match.
+int gif_check_lzw(void);
 
 #endif // GIF_PROCESSING_H
\ No newline at end of file
@@ -0,0 +1,257 @@
+#include "gif_quantize.h"
+#include "pixel_kernels.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define GQ_BINS    32768
+#define GQ_COLORS  255              // entries 1..255; 0 is transparent
+
+#define GQ_BIN(r, g, b) ((((unsigned)(r) >> 3) << 10) | (((unsigned)(g) >> 3) << 5) | ((unsigned)(b) >> 3))
+#define GQ_COMP(bin, c) (((bin) >> (10 - 5 * (c))) & 31)      // c: 0 = r, 1 = g, 2 = b
+
+struct GifQuant {
+    uint32_t  count[GQ_BINS];
+    uint64_t  sum[GQ_BINS][3];
+    uint16_t  bins[GQ_BINS];        // non-empty bins, grouped by box
+    uint16_t  tmp[GQ_BINS];         // counting-sort scratch
+    uint8_t   inverse[GQ_BINS];     // bin -> palette index, 0 = not looked up yet
+    uint8_t   r[256], g[256], b[256];
+    PkPalette search;
+};
+
+// A median-cut box: bins[begin, end) and their bounds in 5-bit units
+typedef struct {
+    int      begin, end;
+    uint64_t count;
+    uint8_t  lo[3], hi[3];
+} GqBox;
+
+GifQuant* gq_create(void) {
+    return (GifQuant*)calloc(1, sizeof(GifQuant));
+}
+
+void gq_destroy(GifQuant* q) {
+    free(q);
+}
+
+static void box_bounds(const GifQuant* q, GqBox* box) {
+    box->count = 0;
+    for (int c = 0; c < 3; ++c) { box->lo[c] = 31; box->hi[c] = 0; }
+    for (int i = box->begin; i < box->end; ++i) {
+        unsigned bin = q->bins[i];
+        box->count += q->count[bin];
+        for (int c = 0; c < 3; ++c) {
+            uint8_t v = (uint8_t)GQ_COMP(bin, c);
+            if (v < box->lo[c]) box->lo[c] = v;
+            if (v > box->hi[c]) box->hi[c] = v;
+        }
+    }
+}
+
+// Longest side of the box (ties: r, g, b), or -1 for a single bin
+static int box_axis(const GqBox* box) {
+    int axis = -1, len = 0;
+    for (int c = 0; c < 3; ++c) {
+        int l = box->hi[c] - box->lo[c];
+        if (l > len) { len = l; axis = c; }
+    }
+    return axis;
+}
+
+/*
+ * split_box
+ * ---------
+ * Sort the box's bins along `axis` (counting sort over 32 values) and
+ * cut between two values at the pixel-weighted median, so both halves
+ * keep at least one value.
+ */
+static void split_box(GifQuant* q, GqBox* box, int axis, GqBox* out) {
+    int start[33] = {0};
+    uint64_t weight[32] = {0};
+    for (int i = box->begin; i < box->end; ++i) {
+        unsigned v = GQ_COMP(q->bins[i], axis);
+        start[v + 1]++;
+        weight[v] += q->count[q->bins[i]];
+    }
+    for (int v = 0; v < 32; ++v) start[v + 1] += start[v];
+    int pos[32];
+    memcpy(pos, start, sizeof(pos));
+    for (int i = box->begin; i < box->end; ++i)
+        q->tmp[pos[GQ_COMP(q->bins[i], axis)]++] = q->bins[i];
+    memcpy(q->bins + box->begin, q->tmp, sizeof(uint16_t) * (size_t)(box->end - box->begin));
+
+    // last value of the lower half: first one reaching half the pixels,
+    // but below the box's maximum
+    uint64_t acc = 0;
+    int cut = box->lo[axis];
+    for (int v = box->lo[axis]; v < box->hi[axis]; ++v) {
+        acc += weight[v];
+        cut = v;
+        if (acc * 2 >= box->count) break;
+    }
+
+    int mid = box->begin + start[cut + 1];
+    out->begin = mid;
+    out->end = box->end;
+    box->end = mid;
+    box_bounds(q, box);
+    box_bounds(q, out);
+}
+
+void gq_add_frame(GifQuant* q, const uint8_t* prev, const uint8_t* frame, size_t pixels,
+                  size_t step) {
+    if (step == 0) step = 1;
+    for (size_t i = 0; i < pixels; i += step) {
+        const uint8_t* p = frame + i * 4;
+        if (prev) {
+            const uint8_t* o = prev + i * 4;
+            if (o[0] == p[0] && o[1] == p[1] && o[2] == p[2]) continue;
+        }
+        unsigned bin = GQ_BIN(p[0], p[1], p[2]);
+        q->count[bin]++;
+        q->sum[bin][0] += p[0];
+        q->sum[bin][1] += p[1];
+        q->sum[bin][2] += p[2];
+    }
+}
+
+void gq_finish_palette(GifQuant* q, uint8_t r[256], uint8_t g[256], uint8_t b[256]) {
+    int nbins = 0;
+    for (unsigned bin = 0; bin < GQ_BINS; ++bin)
+        if (q->count[bin]) q->bins[nbins++] = (uint16_t)bin;
+
+    // Median cut: split the box with the most pixels x longest side
+    GqBox boxes[GQ_COLORS];
+    int nbox = 0;
+    if (nbins > 0) {
+        boxes[0].begin = 0;
+        boxes[0].end = nbins;
+        box_bounds(q, &boxes[0]);
+        nbox = 1;
+    }
+    while (nbox < GQ_COLORS) {
+        int pick = -1;
+        uint64_t best = 0;
+        for (int k = 0; k < nbox; ++k) {
+            int axis = box_axis(&boxes[k]);
+            if (axis < 0) continue;
+            uint64_t score = boxes[k].count * (uint64_t)(boxes[k].hi[axis] - boxes[k].lo[axis]);
+            if (score > best) { best = score; pick = k; }
+        }
+        if (pick < 0) break;
+        split_box(q, &boxes[pick], box_axis(&boxes[pick]), &boxes[nbox]);
+        nbox++;
+    }
+
+    // Each entry is the mean color of its box's pixels
+    memset(q->r, 0, sizeof(q->r));
+    memset(q->g, 0, sizeof(q->g));
+    memset(q->b, 0, sizeof(q->b));
+    for (int i = 0; i < 256; ++i)
+        q->search.r[i] = q->search.g[i] = q->search.b[i] = PK_PALETTE_UNUSED;
+    for (int k = 0; k < nbox; ++k) {
+        uint64_t s[3] = {0, 0, 0};
+        for (int i = boxes[k].begin; i < boxes[k].end; ++i) {
+            unsigned bin = q->bins[i];
+            s[0] += q->sum[bin][0];
+            s[1] += q->sum[bin][1];
+            s[2] += q->sum[bin][2];
+        }
+        uint64_t n = boxes[k].count;
+        q->r[k + 1] = (uint8_t)((s[0] + n / 2) / n);
+        q->g[k + 1] = (uint8_t)((s[1] + n / 2) / n);
+        q->b[k + 1] = (uint8_t)((s[2] + n / 2) / n);
+        q->search.r[k + 1] = q->r[k + 1];
+        q->search.g[k + 1] = q->g[k + 1];
+        q->search.b[k + 1] = q->b[k + 1];
+    }
+    memcpy(r, q->r, 256);
+    memcpy(g, q->g, 256);
+    memcpy(b, q->b, 256);
+
+    // Ready for the next frame: clear only the bins used, and forget
+    // the previous palette's mappings
+    for (int i = 0; i < nbins; ++i) {
+        unsigned bin = q->bins[i];
+        q->count[bin] = 0;
+        memset(q->sum[bin], 0, sizeof(q->sum[bin]));
+    }
+    memset(q->inverse, 0, sizeof(q->inverse));
+}
+
+void gq_build_palette(GifQuant* q, const uint8_t* prev, const uint8_t* frame, size_t pixels,
+                      uint8_t r[256], uint8_t g[256], uint8_t b[256]) {
+    gq_add_frame(q, prev, frame, pixels, 1);
+    gq_finish_palette(q, r, g, b);
+}
+
+// Palette index for a 5-5-5 bin, looked up by the bin's center so the
+// mapping does not depend on which pixel of the bin came first
+static uint8_t gq_lookup(GifQuant* q, unsigned bin) {
+    uint8_t idx = q->inverse[bin];
+    if (!idx) {
+        idx = (uint8_t)pk_nearest_color(&q->search, (int)(GQ_COMP(bin, 0) << 3 | 4),
+                                        (int)(GQ_COMP(bin, 1) << 3 | 4),
+                                        (int)(GQ_COMP(bin, 2) << 3 | 4));
+        if (!idx) idx = 1;          // empty palette (no pixels were counted)
+        q->inverse[bin] = idx;
+    }
+    return idx;
+}
+
+void gq_map_frame(GifQuant* q, const uint8_t* prev, const uint8_t* frame, uint8_t* out,
+                  size_t pixels) {
+    for (size_t i = 0; i < pixels; ++i) {
+        const uint8_t* p = frame + i * 4;
+        uint8_t* o = out + i * 4;
+        if (prev) {
+            const uint8_t* l = prev + i * 4;
+            if (l[0] == p[0] && l[1] == p[1] && l[2] == p[2]) {
+                o[0] = l[0];
+                o[1] = l[1];
+                o[2] = l[2];
+                o[3] = 0;
+                continue;
+            }
+        }
+
+        uint8_t idx = gq_lookup(q, GQ_BIN(p[0], p[1], p[2]));
+        o[0] = q->r[idx];
+        o[1] = q->g[idx];
+        o[2] = q->b[idx];
+        o[3] = idx;
+    }
+}
+
+static inline unsigned gq_abs_diff(int a, int b) {
+    return (unsigned)(a > b ? a - b : b - a);
+}
+
+void gq_map_fixed(GifQuant* q, const uint8_t* prev_out, const uint8_t* frame, uint8_t* out,
+                  size_t pixels) {
+    for (size_t i = 0; i < pixels; ++i) {
+        const uint8_t* p = frame + i * 4;
+        uint8_t* o = out + i * 4;
+        uint8_t idx = gq_lookup(q, GQ_BIN(p[0], p[1], p[2]));
+        uint8_t cr = q->r[idx], cg = q->g[idx], cb = q->b[idx];
+
+        int same = prev_out && prev_out[i * 4] == cr && prev_out[i * 4 + 1] == cg &&
+                   prev_out[i * 4 + 2] == cb;
+        o[0] = cr;
+        o[1] = cg;
+        o[2] = cb;
+        o[3] = same ? 0 : idx;
+    }
+}
+
+uint64_t gq_sample_error(GifQuant* q, const uint8_t* frame, size_t pixels, size_t step) {
+    if (step == 0) step = 1;
+    uint64_t err = 0;
+    for (size_t i = 0; i < pixels; i += step) {
+        const uint8_t* p = frame + i * 4;
+        uint8_t idx = gq_lookup(q, GQ_BIN(p[0], p[1], p[2]));
+        err += gq_abs_diff(p[0], q->r[idx]) + gq_abs_diff(p[1], q->g[idx]) +
+               gq_abs_diff(p[2], q->b[idx]);
+    }
+    return err;
+}
@@ -0,0 +1,56 @@
+#ifndef GIF_QUANTIZE_H
+#define GIF_QUANTIZE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Fast palette backend for GIF output. The palette is built by median
+// cut over a 5-5-5 histogram of the pixels that changed against the
+// previous quantized frame (at most 32768 bins, however large the
+// frame), and pixels are mapped through a 32K-entry inverse colormap
+// filled on first use by a SIMD nearest-entry search. The same state
+// also makes one palette shared by all frames (histogram of sampled
+// frames, then fixed mappings). Frames are RGBA; index 0 is the
+// transparent entry, as in gif.h.
+
+typedef struct GifQuant GifQuant;
+
+// State reused across the frames of one animation (about 1.2 MB).
+// Returns NULL on OOM.
+GifQuant* gq_create(void);
+void gq_destroy(GifQuant* q);
+
+// Count every `step`-th pixel of `frame` whose RGB differs from `prev`
+// (NULL = all) into the histogram. Several frames may be added before
+// the palette is made.
+void gq_add_frame(GifQuant* q, const uint8_t* prev, const uint8_t* frame, size_t pixels,
+                  size_t step);
+
+// Median-cut the histogram into r/g/b and empty it: entry 0 is black
+// (transparent), entries 1..255 (fewer for simple images) hold colors,
+// the rest are 0. Mappings of the previous palette are forgotten.
+void gq_finish_palette(GifQuant* q, uint8_t r[256], uint8_t g[256], uint8_t b[256]);
+
+// gq_add_frame over every pixel, then gq_finish_palette
+void gq_build_palette(GifQuant* q, const uint8_t* prev, const uint8_t* frame, size_t pixels,
+                      uint8_t r[256], uint8_t g[256], uint8_t b[256]);
+
+// Threshold `frame` with the last palette built, like GifThresholdImage:
+// pixels equal to `prev` keep its color with index 0, the others get
+// their mapped palette color with the index in alpha. `out` may equal
+// `prev`.
+void gq_map_frame(GifQuant* q, const uint8_t* prev, const uint8_t* frame, uint8_t* out,
+                  size_t pixels);
+
+// Map `frame` to the last palette built, which stays fixed across
+// frames: a pixel whose mapped color equals `prev_out` (the previous
+// output, NULL for the first frame) gets index 0. `out` may equal
+// `prev_out`.
+void gq_map_fixed(GifQuant* q, const uint8_t* prev_out, const uint8_t* frame, uint8_t* out,
+                  size_t pixels);
+
+// Summed |dr| + |dg| + |db| mapping error of every `step`-th pixel of
+// `frame` against the last palette built
+uint64_t gq_sample_error(GifQuant* q, const uint8_t* frame, size_t pixels, size_t step);
+
+#endif // GIF_QUANTIZE_H
@@ -2,12 +2,24 @@
 #include "gif_processing.h"
 #include "config.h"
 #include "logging.h"
+#include "thread_pool.h"
+#include "pixel_kernels.h"
+#include "tiled_processing.h"
 #include <string.h>
 #include <strings.h>
 #include <stdlib.h>
+#include <math.h>
+#include <time.h>
 #include "protocol.h"
 
-// STB Image libraries
+// STB Image libraries (decoder/encoder memory comes from the buffer pool)
+#include "buffer_pool.h"
+#define STBI_MALLOC(sz)       bp_alloc(sz)
+#define STBI_REALLOC(p,newsz) bp_realloc(p,newsz)
+#define STBI_FREE(p)          bp_free(p)
+#define STBIW_MALLOC(sz)       bp_alloc(sz)
+#define STBIW_REALLOC(p,newsz) bp_realloc(p,newsz)
+#define STBIW_FREE(p)          bp_free(p)
 #define STB_IMAGE_IMPLEMENTATION
 #define STB_IMAGE_WRITE_IMPLEMENTATION
 #include "stb_image.h"
@@ -16,6 +28,108 @@
 // External access to global config
 extern ServerConfig g_cfg;
 
+// Early-exit sampling works on blocks of contiguous pixels so the SIMD
+// sum kernel stays efficient; each block mean is one bounded sample.
+#define CLASSIFY_BLOCK_PIXELS  1024
+#define CLASSIFY_MIN_BLOCKS    32     // never decide on fewer samples
+#define CLASSIFY_CHECK_EVERY   16     // re-test the bound every N blocks
+
+// splitmix64: seeds and steps the block shuffle
+static uint64_t mix64(uint64_t* state) {
+    uint64_t z = (*state += 0x9e3779b97f4a7c15ULL);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+/*
+ * sampled_leader_decided
+ * ----------------------
+ * Hoeffding test after `n` blocks drawn uniformly at random without
+ * replacement (the bound holds for such samples too). Every block-mean
+ * difference between two channels lies in [-255, 255], so a sampled
+ * difference exceeds the true one by more than
+ *     eps = 510 * sqrt(ln(3 * looks / (1 - confidence)) / (2n))
+ * with probability at most (1 - confidence) / (3 * looks). The 3 is a
+ * union bound over the channel pairs and `looks` one over every test
+ * the scan may run, so a wrong leader is returned with probability at
+ * most 1 - confidence however often the test is repeated. Returns 1
+ * when the leading channel beats both others by more than eps.
+ */
+static int sampled_leader_decided(const uint64_t sums[3], size_t n, size_t looks,
+                                  double confidence) {
+    int lead = 0;
+    if (sums[1] > sums[lead]) lead = 1;
+    if (sums[2] > sums[lead]) lead = 2;
+
+    double samples = (double)n * CLASSIFY_BLOCK_PIXELS;
+    double eps = 510.0 * sqrt(log(3.0 * (double)looks / (1.0 - confidence)) / (2.0 * (double)n));
+    for (int c = 0; c < 3; ++c) {
+        if (c == lead) continue;
+        if ((double)(sums[lead] - sums[c]) / samples <= eps) return 0;
+    }
+    return 1;
+}
+
+/*
+ * color_channel_sums
+ * ------------------
+ * Fill sums[] with the R/G/B totals used to pick the dominant color.
+ * Normally an exact SIMD scan. With processing.classify_early_exit the
+ * whole blocks are visited in a random order (a Fisher-Yates shuffle
+ * drawn as the scan goes, seeded per call) and the scan stops as soon
+ * as the leading channel of the whole blocks is decided at
+ * processing.classify_confidence (the partial tail block is only added
+ * by a full scan). The sums are then sample totals, which preserve the
+ * ordering but not the magnitude. Undecided images end up fully
+ * scanned, giving the exact totals.
+ */
+void color_channel_sums(const unsigned char* data, size_t pixels, int channels,
+                        uint64_t sums[3]) {
+    sums[0] = sums[1] = sums[2] = 0;
+    if (channels < 3) return;
+
+    size_t nblocks = pixels / CLASSIFY_BLOCK_PIXELS;
+    uint32_t* order = NULL;
+    if (g_cfg.classify_early_exit && nblocks >= 4 * CLASSIFY_MIN_BLOCKS && nblocks <= UINT32_MAX)
+        order = (uint32_t*)bp_alloc(nblocks * sizeof(uint32_t));
+    if (!order) {
+        pk_channel_sums(data, pixels, channels, sums);
+        return;
+    }
+    for (size_t i = 0; i < nblocks; ++i) order[i] = (uint32_t)i;
+
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    uint64_t rng = ((uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec) ^
+                   (uint64_t)(uintptr_t)data ^ ((uint64_t)pixels << 17);
+
+    // Tests the scan may run; the confidence is split across all of them
+    size_t looks = (nblocks + CLASSIFY_CHECK_EVERY - 1) / CLASSIFY_CHECK_EVERY;
+
+    const size_t block_bytes = (size_t)CLASSIFY_BLOCK_PIXELS * (size_t)channels;
+    for (size_t n = 1; n <= nblocks; ++n) {
+        size_t j = n - 1 + (size_t)(mix64(&rng) % (nblocks - n + 1));
+        uint32_t block = order[j];
+        order[j] = order[n - 1];
+        order[n - 1] = block;
+        pk_channel_sums(data + (size_t)block * block_bytes, CLASSIFY_BLOCK_PIXELS, channels, sums);
+
+        if (n < nblocks && n >= CLASSIFY_MIN_BLOCKS && n % CLASSIFY_CHECK_EVERY == 0 &&
+            sampled_leader_decided(sums, n, looks, g_cfg.classify_confidence)) {
+            log_line("Color classification: decided after sampling %zu of %zu pixels",
+                     n * CLASSIFY_BLOCK_PIXELS, pixels);
+            bp_free(order);
+            return;
+        }
+    }
+    bp_free(order);
+
+    // Every block visited: add the partial tail block for exact totals
+    size_t done = nblocks * CLASSIFY_BLOCK_PIXELS;
+    pk_channel_sums(data + done * (size_t)channels, pixels - done, channels, sums);
+}
+
 /*
  * classify_image_by_color
  * -----------------------
@@ -25,17 +139,11 @@ extern ServerConfig g_cfg;
  */
 char classify_image_by_color(unsigned char* data, int width, int height, int channels) {
     if (channels < 3) return 'r';
-    
-    unsigned long long r_sum = 0, g_sum = 0, b_sum = 0;
-    int pixel_count = width * height;
-    
-    for (int i = 0; i < pixel_count; i++) {
-        int idx = i * channels;
-        r_sum += data[idx + 0];
-        g_sum += data[idx + 1];
-        b_sum += data[idx + 2];
-    }
-    
+
+    uint64_t sums[3];
+    color_channel_sums(data, (size_t)width * (size_t)height, channels, sums);
+    uint64_t r_sum = sums[0], g_sum = sums[1], b_sum = sums[2];
+
     if (r_sum >= g_sum && r_sum >= b_sum) 
         return 'r';
     else if (g_sum >= r_sum && g_sum >= b_sum) 
@@ -44,40 +152,159 @@ char classify_image_by_color(unsigned char* data, int width, int height, int cha
         return 'b';
 }
 
+/*
+ * equalization_lut_from_histogram
+ * -------------------------------
+ * Turn a 256-bin histogram into the equalization lookup table
+ * lut[v] = cdf(v) * 255 / pixel_count. 64-bit arithmetic keeps the
+ * product exact for any image size.
+ */
+void equalization_lut_from_histogram(const uint64_t histogram[256], size_t pixel_count,
+                                     unsigned char lut[256]) {
+    uint64_t cumulative = 0;
+    for (int v = 0; v < 256; v++) {
+        cumulative += histogram[v];
+        lut[v] = (unsigned char)((cumulative * 255) / pixel_count);
+    }
+}
+
+// ---- Band-parallel equalization ----
+typedef struct {
+    unsigned char*        data;
+    int                   width, height, channels, nch;
+    int                   bands;
+    uint64_t            (*band_hist)[3][256];   // [bands][channel][value]
+    const unsigned char (*lut)[256];
+} EqualizeJob;
+
+static void band_rows(const EqualizeJob* j, int band, size_t* first, size_t* last) {
+    *first = (size_t)j->height * (size_t)band / (size_t)j->bands;
+    *last  = (size_t)j->height * (size_t)(band + 1) / (size_t)j->bands;
+}
+
+static void band_histogram_task(void* ctx, int band) {
+    EqualizeJob* j = (EqualizeJob*)ctx;
+    size_t r0, r1;
+    band_rows(j, band, &r0, &r1);
+
+    memset(j->band_hist[band], 0, sizeof(j->band_hist[band]));
+    pk_histogram(j->data + r0 * (size_t)j->width * j->channels,
+                 (r1 - r0) * (size_t)j->width, j->channels, j->nch, j->band_hist[band]);
+}
+
+static void band_apply_task(void* ctx, int band) {
+    EqualizeJob* j = (EqualizeJob*)ctx;
+    size_t r0, r1;
+    band_rows(j, band, &r0, &r1);
+
+    pk_apply_lut(j->data + r0 * (size_t)j->width * j->channels,
+                 (r1 - r0) * (size_t)j->width, j->channels, j->nch, j->lut);
+}
+
+/*
+ * equalize_bands
+ * --------------
+ * Number of row bands to split an image into, or 0 for the serial
+ * path (small image, no helper pool or too few rows).
+ */
+static int equalize_bands(int width, int height) {
+    size_t pixel_count = (size_t)width * height;
+    if ((long)pixel_count < g_cfg.parallel_min_pixels || tp_size() <= 1) return 0;
+
+    int bands = tp_size() * 2;
+    if (bands > height) bands = height;
+    return (bands >= 2) ? bands : 0;
+}
+
+/*
+ * equalization_build_luts
+ * -----------------------
+ * First phase of histogram equalization: build the histograms of the
+ * first three channels and turn them into lookup tables. Read-only, so
+ * it can run while other threads read (e.g. encode) the same buffer.
+ * Large images build per-band histograms on the shared pool; merging
+ * is exact, so the tables are identical to the serial path.
+ */
+void equalization_build_luts(const unsigned char* data, int width, int height, int channels,
+                             unsigned char lut[3][256]) {
+    size_t pixel_count = (size_t)width * height;
+    int nch = channels < 3 ? channels : 3;
+    if (pixel_count == 0 || nch <= 0) return;
+
+    uint64_t histogram[3][256];
+    memset(histogram, 0, sizeof(histogram));
+
+    int bands = equalize_bands(width, height);
+    EqualizeJob j;
+    j.band_hist = bands ? malloc(sizeof(*j.band_hist) * (size_t)bands) : NULL;
+    if (j.band_hist) {
+        j.data = (unsigned char*)data;   // histogram tasks only read
+        j.width = width;
+        j.height = height;
+        j.channels = channels;
+        j.nch = nch;
+        j.bands = bands;
+        j.lut = NULL;
+        tp_parallel_for(bands, band_histogram_task, &j);
+
+        for (int b = 0; b < bands; b++)
+            for (int ch = 0; ch < nch; ch++)
+                for (int v = 0; v < 256; v++) histogram[ch][v] += j.band_hist[b][ch][v];
+        free(j.band_hist);
+    } else {
+        // One fused pass builds every channel histogram
+        pk_histogram(data, pixel_count, channels, nch, histogram);
+    }
+
+    for (int ch = 0; ch < nch; ch++) {
+        equalization_lut_from_histogram(histogram[ch], pixel_count, lut[ch]);
+    }
+}
+
+/*
+ * equalization_apply_luts
+ * -----------------------
+ * Second phase: remap the first three channels in place through the
+ * tables from equalization_build_luts (band-parallel for large images).
+ * Alpha, if present, is preserved.
+ */
+void equalization_apply_luts(unsigned char* data, int width, int height, int channels,
+                             const unsigned char lut[3][256]) {
+    size_t pixel_count = (size_t)width * height;
+    int nch = channels < 3 ? channels : 3;
+    if (pixel_count == 0 || nch <= 0) return;
+
+    int bands = equalize_bands(width, height);
+    if (bands) {
+        EqualizeJob j;
+        j.data = data;
+        j.width = width;
+        j.height = height;
+        j.channels = channels;
+        j.nch = nch;
+        j.bands = bands;
+        j.band_hist = NULL;
+        j.lut = lut;
+        tp_parallel_for(bands, band_apply_task, &j);
+        return;
+    }
+    pk_apply_lut(data, pixel_count, channels, nch, lut);
+}
+
 /*
  * apply_histogram_equalization
  * ----------------------------
  * In-place per-channel histogram equalization for the first three
  * channels (RGB). Alpha channel, if present, is preserved.
+ * Images with at least `processing.parallel_min_pixels` pixels are
+ * processed band-parallel on the shared thread pool.
  * Parameters:
  *  - data: pixel buffer with interleaved channels (row-major).
  */
 void apply_histogram_equalization(unsigned char* data, int width, int height, int channels) {
-    int pixel_count = width * height;
-    
-    // Process each color channel separately
-    for (int ch = 0; ch < channels && ch < 3; ch++) {
-        // Build histogram
-        int histogram[256] = {0};
-        for (int i = 0; i < pixel_count; i++) {
-            histogram[data[i*channels + ch]]++;
-        }
-        
-        // Build cumulative distribution
-        int cumulative[256] = {0};
-        cumulative[0] = histogram[0];
-        for (int i = 1; i < 256; i++) {
-            cumulative[i] = cumulative[i-1] + histogram[i];
-        }
-        
-        // Apply equalization
-        for (int i = 0; i < pixel_count; i++) {
-            int idx = i*channels + ch;
-            int old_value = data[idx];
-            int new_value = (cumulative[old_value] * 255) / pixel_count;
-            data[idx] = (unsigned char)new_value;
-        }
-    }
+    unsigned char lut[3][256];
+    equalization_build_luts(data, width, height, channels, lut);
+    equalization_apply_luts(data, width, height, channels, (const unsigned char (*)[256])lut);
 }
 
 /*
@@ -106,6 +333,232 @@ int save_image(const char* path, unsigned char* data, int width, int height,
     return result;
 }
 
+// Color-classified output encoded on the shared pool while the caller
+// builds the equalization tables from the same (unmodified) pixels
+typedef struct {
+    const char*          path;
+    const unsigned char* data;
+    int                  width, height, channels;
+    const char*          format;
+    int                  ok;
+} EncodeTask;
+
+static void encode_task(void* arg) {
+    EncodeTask* t = (EncodeTask*)arg;
+    t->ok = save_image(t->path, (unsigned char*)t->data, t->width, t->height,
+                       t->channels, t->format);
+}
+
+/*
+ * process_decoded_image
+ * ---------------------
+ * Shared static-image pipeline over one decoded buffer, which is
+ * consumed (equalized in place) and must not be used afterwards.
+ * Classification only reads the pixels. For PROC_BOTH the classified
+ * copy is encoded on the pool while the equalization tables are built;
+ * the buffer is remapped in place only after that encode finished, so
+ * no second full-size buffer is needed. Sums or tables already present
+ * in `pre` (may be NULL) are used instead of scanning the pixels again.
+ * `origin` tags the log lines.
+ */
+void process_decoded_image(unsigned char* img_data, int width, int height, int channels,
+                           const PixelStats* pre, const char* image_id, const char* filename,
+                           const char* format, ProcessingType processing_type,
+                           const char* origin) {
+    int do_color = (processing_type == PROC_COLOR_CLASSIFICATION || processing_type == PROC_BOTH);
+    int do_hist  = (processing_type == PROC_HISTOGRAM || processing_type == PROC_BOTH);
+
+    char color_path[1024];
+    const char* cname = "red";
+    EncodeTask enc;
+    TpGroup group;
+    tp_group_init(&group);
+
+    // Color classification (read-only) and its encode
+    if (do_color) {
+        char dominant_color;
+        if (pre && pre->have_sums) {
+            const uint64_t* sm = pre->sums;
+            if (channels < 3) dominant_color = 'r';
+            else if (sm[0] >= sm[1] && sm[0] >= sm[2]) dominant_color = 'r';
+            else if (sm[1] >= sm[0] && sm[1] >= sm[2]) dominant_color = 'g';
+            else dominant_color = 'b';
+        } else {
+            dominant_color = classify_image_by_color(img_data, width, height, channels);
+        }
+        const char* color_dir = g_cfg.colors_red;
+        if (dominant_color == 'g') { color_dir = g_cfg.colors_green; cname = "green"; }
+        else if (dominant_color == 'b') { color_dir = g_cfg.colors_blue; cname = "blue"; }
+
+        snprintf(color_path, sizeof(color_path), "%s/%s_%s",
+                 color_dir, image_id, filename);
+
+        enc.path = color_path;
+        enc.data = img_data;
+        enc.width = width;
+        enc.height = height;
+        enc.channels = channels;
+        enc.format = format;
+        enc.ok = 0;
+        if (do_hist) tp_group_submit(&group, encode_task, &enc);
+        else         encode_task(&enc);
+    }
+
+    // Histogram equalization: tables overlap the encode, remap waits for it
+    unsigned char lut[3][256];
+    if (do_hist && pre && pre->luts) memcpy(lut, pre->luts[0], sizeof(lut));
+    else if (do_hist) equalization_build_luts(img_data, width, height, channels, lut);
+
+    tp_group_wait(&group);
+    tp_group_destroy(&group);
+    if (do_color) {
+        if (enc.ok) {
+            log_line("Color classification%s: saved to %s (dominant: %s)",
+                     origin, color_path, cname);
+        } else {
+            log_line("Failed to save color-classified image to %s", color_path);
+        }
+    }
+
+    if (do_hist) {
+        equalization_apply_luts(img_data, width, height, channels,
+                                (const unsigned char (*)[256])lut);
+
+        char hist_path[1024];
+        snprintf(hist_path, sizeof(hist_path), "%s/%s_%s",
+                 g_cfg.histogram_dir, image_id, filename);
+
+        if (save_image(hist_path, img_data, width, height, channels, format)) {
+            log_line("Histogram equalization%s: saved to %s", origin, hist_path);
+        } else {
+            log_line("Failed to save histogram-equalized image to %s", hist_path);
+        }
+    }
+}
+
+/*
+ * compute_pixel_stats
+ * -------------------
+ * Precompute what processing_type needs from freshly decoded pixels
+ * (`frames` images of width x height stored back to back): the
+ * classification sums over all frames and one set of equalization
+ * tables per frame. Lets the streaming decoder finish this work before
+ * the job reaches a worker. Tables that cannot be allocated are left
+ * NULL and get built by the pipeline instead.
+ */
+void compute_pixel_stats(const unsigned char* pixels, int width, int height, int channels,
+                         int frames, ProcessingType processing_type, PixelStats* out) {
+    memset(out, 0, sizeof(*out));
+    size_t frame_pixels = (size_t)width * (size_t)height;
+
+    if (processing_type == PROC_COLOR_CLASSIFICATION || processing_type == PROC_BOTH) {
+        color_channel_sums(pixels, frame_pixels * (size_t)frames, channels, out->sums);
+        out->have_sums = 1;
+    }
+    if (processing_type == PROC_HISTOGRAM || processing_type == PROC_BOTH) {
+        out->luts = malloc(sizeof(*out->luts) * (size_t)frames);
+        if (out->luts) {
+            for (int f = 0; f < frames; ++f)
+                equalization_build_luts(pixels + (size_t)f * frame_pixels * (size_t)channels,
+                                        width, height, channels, out->luts[f]);
+        }
+    }
+}
+
+void pixel_stats_free(PixelStats* st) {
+    free(st->luts);
+    st->luts = NULL;
+    st->have_sums = 0;
+}
+
+/*
+ * decode_from_source
+ * ------------------
+ * Decode an image pulled through `src` instead of a complete buffer.
+ * stb_image reads through the callbacks as it parses, so baseline JPEG
+ * and GIF decoding advance while the data is still arriving (PNG
+ * inflates once every IDAT chunk is in). GIFs use the same multi-frame
+ * loader as stbi_load_gif_from_memory. Returns NULL on decode failure.
+ */
+unsigned char* decode_from_source(const ImageByteSource* src, void* user, int gif,
+                                  int* width, int* height, int* frames,
+                                  int** delays, int* channels) {
+    stbi_io_callbacks io = { src->read, src->skip, src->eof };
+    *frames = 1;
+    if (delays) *delays = NULL;
+
+    if (!gif) return stbi_load_from_callbacks(&io, user, width, height, channels, 0);
+
+    stbi__context s;
+    stbi__start_callbacks(&s, &io, user);
+    unsigned char* all = (unsigned char*)stbi__load_gif_main(&s, delays, width, height,
+                                                              frames, channels, 4);
+    if (all) *channels = 4;   // frames are expanded to RGBA
+    return all;
+}
+
+/*
+ * info_from_source
+ * ----------------
+ * Read just enough of `src` to report the dimensions and channel count.
+ * Returns 0 when the header could not be parsed.
+ */
+int info_from_source(const ImageByteSource* src, void* user, int* width, int* height,
+                     int* channels) {
+    stbi_io_callbacks io = { src->read, src->skip, src->eof };
+    return stbi_info_from_callbacks(&io, user, width, height, channels);
+}
+
+void decoded_image_free(void* p) {
+    stbi_image_free(p);
+}
+
+/*
+ * image_probe
+ * -----------
+ * Dimensions, channel count and frame count from the image header.
+ * Returns 0 (and a zeroed header) when the header is unreadable.
+ */
+int image_probe(const unsigned char* data, size_t size, const char* format, ImageHeader* out) {
+    memset(out, 0, sizeof(*out));
+    if (!data || size == 0 || size > 0x7fffffff ||
+        !stbi_info_from_memory(data, (int)size, &out->width, &out->height, &out->channels)) {
+        memset(out, 0, sizeof(*out));
+        return 0;
+    }
+    out->frames = 1;
+    if (format && strcasecmp(format, "gif") == 0) {
+        int frames = gif_count_frames(data, size);
+        if (frames > 0) out->frames = frames;
+    }
+    return 1;
+}
+
+/*
+ * image_working_set_estimate
+ * --------------------------
+ * Memory the job will need on top of its upload buffer, from the image
+ * header: the decoded bitmap (every frame for GIFs, which decode to
+ * RGBA, plus the GIF writer's frame scratch) and the PNG encoder's
+ * filtered and compressed copies, which stb keeps in memory (JPEG is
+ * written out as it is encoded). Images that will be processed in strips
+ * only need their strip buffer. Returns 0 for an unreadable header.
+ */
+size_t image_working_set_estimate(const ImageHeader* hdr, const char* format) {
+    if (!hdr || hdr->width <= 0 || hdr->height <= 0) return 0;
+    int w = hdr->width, h = hdr->height, c = hdr->channels;
+    size_t frame = (size_t)w * (size_t)h;
+
+    if (format && strcasecmp(format, "gif") == 0) {
+        return frame * 4 * ((size_t)hdr->frames + 2);
+    }
+    if (tiled_exceeds_working_set(w, h, c)) return tiled_strip_bytes(w, h, c);
+
+    size_t bitmap = frame * (size_t)c;
+    int jpeg = format && (strcasecmp(format, "jpg") == 0 || strcasecmp(format, "jpeg") == 0);
+    return jpeg ? bitmap : bitmap * 2;
+}
+
 /*
  * process_static_image
  * --------------------
@@ -128,56 +581,8 @@ void process_static_image(const char* input_path, const char* image_id,
     log_line("Processing image %s: %dx%d, %d channels, type=%u (static)", 
              image_id, width, height, channels, (unsigned)processing_type);
 
-    // Color classification processing
-    if (processing_type == PROC_COLOR_CLASSIFICATION || processing_type == PROC_BOTH) {
-        char dominant_color = classify_image_by_color(img_data, width, height, channels);
-        
-        const char* color_dir = g_cfg.colors_red;
-        const char* cname = "red";
-        
-        if (dominant_color == 'g') { 
-            color_dir = g_cfg.colors_green; 
-            cname = "green"; 
-        } else if (dominant_color == 'b') { 
-            color_dir = g_cfg.colors_blue; 
-            cname = "blue"; 
-        }
-
-        char color_path[1024];
-        snprintf(color_path, sizeof(color_path), "%s/%s_%s", 
-                 color_dir, image_id, filename);
-                 
-        if (save_image(color_path, img_data, width, height, channels, format)) {
-            log_line("Color classification: saved to %s (dominant: %s)", 
-                     color_path, cname);
-        } else {
-            log_line("Failed to save color-classified image to %s", color_path);
-        }
-    }
-
-    // Histogram equalization processing
-    if (processing_type == PROC_HISTOGRAM || processing_type == PROC_BOTH) {
-        size_t img_size = (size_t)width * height * channels;
-        unsigned char* hist_data = (unsigned char*)malloc(img_size);
-        
-        if (hist_data) {
-            memcpy(hist_data, img_data, img_size);
-            apply_histogram_equalization(hist_data, width, height, channels);
-
-            char hist_path[1024];
-            snprintf(hist_path, sizeof(hist_path), "%s/%s_%s", 
-                     g_cfg.histogram_dir, image_id, filename);
-                     
-            if (save_image(hist_path, hist_data, width, height, channels, format)) {
-                log_line("Histogram equalization: saved to %s", hist_path);
-            } else {
-                log_line("Failed to save histogram-equalized image to %s", hist_path);
-            }
-            
-            free(hist_data);
-        }
-    }
-
+    process_decoded_image(img_data, width, height, channels, NULL, image_id, filename,
+                          format, processing_type, "");
     stbi_image_free(img_data);
 }
 
@@ -205,68 +610,40 @@ void process_image(const char* input_path, const char* image_id,
  * -------------------------
  * Process an image available in memory. Supports GIFs (handled by
  * GIF in-memory pipeline) and static images loaded via stb_image.
+ * Returns 0, or -1 when the image could not be decoded.
  */
-void process_image_from_memory(const unsigned char* data, size_t size,
-                               const char* image_id, const char* filename,
-                               const char* format, ProcessingType processing_type) {
-    if (!data || size == 0 || !format) return;
+int process_image_from_memory(const unsigned char* data, size_t size,
+                              const char* image_id, const char* filename,
+                              const char* format, ProcessingType processing_type) {
+    if (!data || size == 0 || !format) return -1;
 
     // GIF: canalizar a pipeline de GIF en memoria
     if (format && (strcasecmp(format, "gif") == 0)) {
-        process_gif_image_from_memory(data, (int)size, image_id, filename, processing_type);
-        return;
+        return process_gif_image_from_memory(data, (int)size, image_id, filename, processing_type);
     }
 
     // PNG/JPG/JPEG: usar stbi_load_from_memory
     int width = 0, height = 0, channels = 0;
+
+    // Bitmaps over memory.max_working_set_mb are processed in strips
+    if (stbi_info_from_memory(data, (int)size, &width, &height, &channels) &&
+        tiled_exceeds_working_set(width, height, channels)) {
+        if (process_image_tiled(data, size, image_id, filename, format, processing_type) == 0)
+            return 0;
+        log_line("Tiled processing unavailable for %s, decoding in memory", image_id);
+    }
+
     unsigned char* img_data = stbi_load_from_memory(data, (int)size, &width, &height, &channels, 0);
     if (!img_data) {
         log_line("Failed to load image from memory (fmt=%s)", format);
-        return;
+        return -1;
     }
 
     log_line("Processing (memory) %s: %dx%d, %d ch, type=%u (static)",
              image_id, width, height, channels, processing_type);
 
-    // Color classification
-    if (processing_type == PROC_COLOR_CLASSIFICATION || processing_type == PROC_BOTH) {
-        char dominant_color = classify_image_by_color(img_data, width, height, channels);
-        const char* color_dir = g_cfg.colors_red;
-        const char* cname = "red";
-        if (dominant_color == 'g') { color_dir = g_cfg.colors_green; cname = "green"; }
-        else if (dominant_color == 'b') { color_dir = g_cfg.colors_blue; cname = "blue"; }
-
-        char color_path[1024];
-        snprintf(color_path, sizeof(color_path), "%s/%s_%s",
-                 color_dir, image_id, filename);
-
-        if (save_image(color_path, img_data, width, height, channels, format)) {
-            log_line("Color classification (memory): saved to %s (dominant: %s)", color_path, cname);
-        } else {
-            log_line("Failed to save color-classified image to %s", color_path);
-        }
-    }
-
-    // Histogram equalization
-    if (processing_type == PROC_HISTOGRAM || processing_type == PROC_BOTH) {
-        size_t img_size = (size_t)width * height * channels;
-        unsigned char* hist_data = (unsigned char*)malloc(img_size);
-        if (hist_data) {
-            memcpy(hist_data, img_data, img_size);
-            apply_histogram_equalization(hist_data, width, height, channels);
-
-            char hist_path[1024];
-            snprintf(hist_path, sizeof(hist_path), "%s/%s_%s",
-                     g_cfg.histogram_dir, image_id, filename);
-
-            if (save_image(hist_path, hist_data, width, height, channels, format)) {
-                log_line("Histogram equalization (memory): saved to %s", hist_path);
-            } else {
-                log_line("Failed to save histogram-equalized image to %s", hist_path);
-            }
-            free(hist_data);
-        }
-    }
-
+    process_decoded_image(img_data, width, height, channels, NULL, image_id, filename,
+                          format, processing_type, " (memory)");
     stbi_image_free(img_data);
+    return 0;
 }
\ No newline at end of file
@@ -5,10 +5,69 @@
 #include <stddef.h>
 #include "protocol.h"
 
+// R/G/B totals for dominant-color decisions (sampled when early exit is on)
+void color_channel_sums(const unsigned char* data, size_t pixels, int channels,
+                        uint64_t sums[3]);
 char classify_image_by_color(unsigned char* data, int width, int height, int channels);
 void apply_histogram_equalization(unsigned char* data, int width, int height, int channels);
+
+// Two-phase equalization: build the per-channel tables (read-only), then
+// remap the buffer in place. apply_histogram_equalization runs both.
+void equalization_build_luts(const unsigned char* data, int width, int height, int channels,
+                             unsigned char lut[3][256]);
+void equalization_apply_luts(unsigned char* data, int width, int height, int channels,
+                             const unsigned char lut[3][256]);
+void equalization_lut_from_histogram(const uint64_t histogram[256], size_t pixel_count,
+                                     unsigned char lut[256]);
 int  save_image(const char* path, unsigned char* data, int width, int height, int channels, const char* format);
 
+// Image facts read from the header without decoding (stbi_info plus a
+// GIF frame walk)
+typedef struct {
+    int width, height, channels;
+    int frames;                     // 1 for static images
+} ImageHeader;
+
+int image_probe(const unsigned char* data, size_t size, const char* format, ImageHeader* out); // 1 = readable
+
+// Estimated peak bytes to decode and encode an image (admission control)
+size_t image_working_set_estimate(const ImageHeader* hdr, const char* format);
+
+// Statistics computed ahead of processing (by the streaming decoder).
+// Members left empty are computed by the pipeline as usual.
+typedef struct {
+    int             have_sums;
+    uint64_t        sums[3];        // color_channel_sums over all frames
+    unsigned char (*luts)[3][256];  // equalization tables, one per frame
+} PixelStats;
+
+void compute_pixel_stats(const unsigned char* pixels, int width, int height, int channels,
+                         int frames, ProcessingType processing_type, PixelStats* out);
+void pixel_stats_free(PixelStats* st);
+
+// Pull-based byte source for an upload that is still arriving (same
+// shape as stbi_io_callbacks; read returns 0 at the end of the data)
+typedef struct {
+    int  (*read)(void* user, char* data, int size);
+    void (*skip)(void* user, int n);
+    int  (*eof)(void* user);
+} ImageByteSource;
+
+// Decode from `src`; GIFs return all frames as RGBA (channels = 4) and
+// their delays. Release pixels and delays with decoded_image_free.
+unsigned char* decode_from_source(const ImageByteSource* src, void* user, int gif,
+                                  int* width, int* height, int* frames,
+                                  int** delays, int* channels);
+int  info_from_source(const ImageByteSource* src, void* user, int* width, int* height,
+                      int* channels);
+void decoded_image_free(void* p);
+
+// Static pipeline over decoded pixels (consumed: equalized in place)
+void process_decoded_image(unsigned char* img_data, int width, int height, int channels,
+                           const PixelStats* pre, const char* image_id, const char* filename,
+                           const char* format, ProcessingType processing_type,
+                           const char* origin);
+
 // EXISTING (from path)
 void process_static_image(const char* input_path, const char* image_id,
                          const char* filename, const char* format,
@@ -18,7 +77,8 @@ void process_image(const char* input_path, const char* image_id,
                   ProcessingType processing_type);
 
 // NEW: process from memory (without writing to incoming directory)
-void process_image_from_memory(const unsigned char* data, size_t size,
+// Returns 0, or -1 when the image could not be decoded
+int process_image_from_memory(const unsigned char* data, size_t size,
                                const char* image_id, const char* filename,
                                const char* format, ProcessingType processing_type);
 
@@ -0,0 +1,776 @@
+#include "journal.h"
+#include "image_processing.h"
+#include "buffer_pool.h"
+#include "mem_budget.h"
+#include "cost_model.h"
+#include "logging.h"
+#include "spool.h"
+#include <pthread.h>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <zlib.h>
+
+#define JREC_MAGIC   0x4c4e524aU   // "JRNL"
+#define JREC_ACCEPT  1
+#define JREC_DONE    2
+
+// Every record starts with this header; `len` body bytes follow. The
+// CRC covers the header (with crc = 0) and the body, so a record torn
+// by a crash is detected on replay.
+typedef struct {
+    uint32_t magic;
+    uint32_t type;
+    uint64_t seq;
+    uint64_t len;
+    uint32_t crc;
+    uint32_t reserved;
+} RecordHeader;
+
+// Body of an accept record; the payload follows it
+typedef struct {
+    char     image_id[37];
+    char     filename[MAX_FILENAME];
+    char     format[10];
+    uint8_t  processing_type;
+    uint32_t total_size;
+} AcceptMeta;
+
+// One journal file. Sequence numbers are assigned under the journal
+// lock in append order, so each segment holds a contiguous range.
+typedef struct {
+    uint64_t id;
+    uint64_t first_seq, last_seq;   // 0 while the segment has no accepts
+    uint64_t accepted, done;
+    int      unread;                // could not be scanned at startup: never deleted
+} Segment;
+
+static pthread_mutex_t g_mtx = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t  g_cv  = PTHREAD_COND_INITIALIZER;
+static char      g_dir[512];
+static size_t    g_segment_bytes;
+static int       g_fd = -1;          // current (last) segment, -1 = journal closed
+static size_t    g_seg_size;         // bytes written to the current segment
+static Segment*  g_segs;             // oldest first
+static size_t    g_nsegs, g_segcap;
+static uint64_t  g_next_seq = 1;
+
+static int       g_syncing;          // the journal thread is inside fdatasync
+
+static uint64_t  g_stat_accepted, g_stat_completed, g_stat_syncs, g_stat_replayed;
+static uint64_t  g_stat_sync_failures, g_stat_failed;
+
+static void segment_path(char* out, size_t cap, uint64_t id) {
+    snprintf(out, cap, "%s/journal-%016llx.log", g_dir, (unsigned long long)id);
+}
+
+static uint32_t record_crc(const RecordHeader* h, const struct iovec* body, int nbody) {
+    RecordHeader tmp = *h;
+    tmp.crc = 0;
+    uLong crc = crc32(0L, (const Bytef*)&tmp, sizeof(tmp));
+    for (int i = 0; i < nbody; ++i) {
+        const unsigned char* p = (const unsigned char*)body[i].iov_base;
+        size_t left = body[i].iov_len;
+        while (left > 0) {
+            uInt n = left > 0x40000000u ? 0x40000000u : (uInt)left;
+            crc = crc32(crc, p, n);
+            p += n;
+            left -= n;
+        }
+    }
+    return (uint32_t)crc;
+}
+
+static void sync_dir(void) {
+    int dfd = open(g_dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (dfd < 0) return;
+    fsync(dfd);
+    close(dfd);
+}
+
+static Segment* segment_add(uint64_t id) {
+    if (g_nsegs == g_segcap) {
+        size_t cap = g_segcap ? g_segcap * 2 : 8;
+        Segment* n = (Segment*)realloc(g_segs, cap * sizeof(Segment));
+        if (!n) return NULL;
+        g_segs = n;
+        g_segcap = cap;
+    }
+    Segment* s = &g_segs[g_nsegs++];
+    memset(s, 0, sizeof(*s));
+    s->id = id;
+    return s;
+}
+
+static Segment* segment_of(uint64_t seq) {
+    for (size_t i = 0; i < g_nsegs; ++i) {
+        if (g_segs[i].accepted && seq >= g_segs[i].first_seq && seq <= g_segs[i].last_seq)
+            return &g_segs[i];
+    }
+    return NULL;
+}
+
+/*
+ * trim_segments
+ * -------------
+ * Delete finished segments, oldest first. A completion record may live
+ * in a later segment than its accept, so deleting in order guarantees
+ * that no surviving accept loses its completion. The open segment is
+ * kept until the journal is closed, and a segment that could not be
+ * read at startup (with everything after it) until a later start reads
+ * it. Caller holds g_mtx.
+ */
+static void trim_segments(void) {
+    size_t drop = 0;
+    while (drop < g_nsegs && !g_segs[drop].unread && g_segs[drop].done == g_segs[drop].accepted &&
+           (drop + 1 < g_nsegs || g_fd < 0)) {
+        char path[600];
+        segment_path(path, sizeof(path), g_segs[drop].id);
+        if (unlink(path) != 0 && errno != ENOENT) {
+            log_line("Journal: cannot delete %s: %s", path, strerror(errno));
+            break;
+        }
+        drop++;
+    }
+    if (drop) {
+        memmove(g_segs, g_segs + drop, (g_nsegs - drop) * sizeof(Segment));
+        g_nsegs -= drop;
+    }
+}
+
+// Create the next segment file and make it current. Caller holds g_mtx.
+static int open_segment(void) {
+    uint64_t id = g_nsegs ? g_segs[g_nsegs - 1].id + 1 : 1;
+    char path[600];
+    segment_path(path, sizeof(path), id);
+    int fd = open(path, O_WRONLY | O_CREAT | O_EXCL | O_APPEND | O_CLOEXEC, 0600);
+    if (fd < 0) {
+        log_line("Journal: cannot create %s: %s", path, strerror(errno));
+        return -1;
+    }
+    if (!segment_add(id)) {
+        close(fd);
+        unlink(path);
+        return -1;
+    }
+    sync_dir();
+    g_fd = fd;
+    g_seg_size = 0;
+    return 0;
+}
+
+// fdatasync the current segment, counting the outcome. Caller holds g_mtx.
+static int sync_segment(void) {
+    if (fdatasync(g_fd) == 0) {
+        g_stat_syncs++;
+        return 0;
+    }
+    log_line("Journal: fdatasync failed: %s", strerror(errno));
+    g_stat_sync_failures++;
+    return -1;
+}
+
+// Wait until no group commit is running. Caller holds g_mtx.
+static void wait_sync_idle(void) {
+    while (g_syncing) pthread_cond_wait(&g_cv, &g_mtx);
+}
+
+/*
+ * rotate_segment
+ * --------------
+ * Make everything written so far durable, close the current segment
+ * and continue in a new one, unless another caller already did while
+ * this one waited for a running sync. A failed sync is counted, which
+ * is how the journal thread learns that its batch is not durable.
+ * Caller holds g_mtx.
+ */
+static int rotate_segment(size_t need) {
+    wait_sync_idle();
+    if (g_fd < 0) return -1;
+    if (g_seg_size == 0 || g_seg_size + need <= g_segment_bytes) return 0;
+    sync_segment();
+    close(g_fd);
+    g_fd = -1;
+    if (open_segment() != 0) return -1;
+    trim_segments();
+    return 0;
+}
+
+/*
+ * append_record
+ * -------------
+ * Write one record to the current segment. A *seq of 0 takes the next
+ * sequence number, assigned only after any rotation (which may drop the
+ * lock) so segments keep contiguous ranges. A failed or short write is
+ * cut off again so later records never follow a torn one. Caller holds
+ * g_mtx.
+ */
+static int append_record(uint32_t type, uint64_t* seq, struct iovec* body, int nbody) {
+    RecordHeader h;
+    memset(&h, 0, sizeof(h));
+    h.magic = JREC_MAGIC;
+    h.type = type;
+    for (int i = 0; i < nbody; ++i) h.len += body[i].iov_len;
+    size_t total = sizeof(h) + (size_t)h.len;
+
+    if (g_seg_size > 0 && g_seg_size + total > g_segment_bytes && rotate_segment(total) != 0)
+        return -1;
+
+    if (*seq == 0) *seq = g_next_seq++;
+    h.seq = *seq;
+
+    h.crc = record_crc(&h, body, nbody);
+
+    struct iovec iov[4];
+    iov[0].iov_base = &h;
+    iov[0].iov_len = sizeof(h);
+    for (int i = 0; i < nbody; ++i) iov[i + 1] = body[i];
+    int cnt = nbody + 1;
+
+    struct iovec* v = iov;
+    size_t left = total;
+    while (left > 0) {
+        ssize_t n = writev(g_fd, v, cnt);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            log_line("Journal: write failed: %s", strerror(errno));
+            if (ftruncate(g_fd, (off_t)g_seg_size) != 0) {
+                log_line("Journal: cannot truncate the torn record, journaling stops");
+                close(g_fd);
+                g_fd = -1;
+            }
+            return -1;
+        }
+        left -= (size_t)n;
+        while (cnt > 0 && (size_t)n >= v->iov_len) { n -= (ssize_t)v->iov_len; v++; cnt--; }
+        if (cnt > 0) {
+            v->iov_base = (char*)v->iov_base + n;
+            v->iov_len -= (size_t)n;
+        }
+    }
+    g_seg_size += total;
+    return 0;
+}
+
+// An accept waiting for the journal thread
+typedef struct JournalReq {
+    ProcJob            job;
+    JournalAcceptDone  done;
+    void*              arg;
+    struct JournalReq* next;
+} JournalReq;
+
+// Submission queue, separate from g_mtx so that submitting never waits
+// for a write or a sync in progress
+static pthread_mutex_t g_qmtx = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t  g_qcv  = PTHREAD_COND_INITIALIZER;
+static JournalReq*     g_qhead;
+static JournalReq*     g_qtail;
+static int             g_writer_running;
+static pthread_t       g_writer;
+static uint64_t        g_submitted, g_finished;
+static int             g_journal_down;   // writing failed for good: stop taking accepts
+
+// Append the accept record of `job` and note where its payload landed;
+// returns its sequence number (0 on failure). Caller holds g_mtx.
+static uint64_t append_accept(ProcJob* job) {
+    if (g_fd < 0 || !job->data || job->size == 0) return 0;
+
+    AcceptMeta meta;
+    memset(&meta, 0, sizeof(meta));
+    memcpy(meta.image_id, job->image_id, sizeof(meta.image_id));
+    memcpy(meta.filename, job->filename, sizeof(meta.filename));
+    memcpy(meta.format, job->format, sizeof(meta.format));
+    meta.processing_type = (uint8_t)job->processing_type;
+    meta.total_size = job->total_size;
+
+    struct iovec body[2];
+    body[0].iov_base = &meta;
+    body[0].iov_len = sizeof(meta);
+    body[1].iov_base = (void*)job->data;
+    body[1].iov_len = job->size;
+
+    uint64_t seq = 0;
+    if (append_record(JREC_ACCEPT, &seq, body, 2) != 0 || g_fd < 0) return 0;
+    Segment* seg = &g_segs[g_nsegs - 1];
+    job->journal_seg = seg->id;
+    job->journal_off = g_seg_size - job->size;  // the payload ends the record
+    if (!seg->accepted) seg->first_seq = seq;
+    seg->last_seq = seq;
+    seg->accepted++;
+    g_stat_accepted++;
+    return seq;
+}
+
+/*
+ * drop_batch
+ * ----------
+ * A sync of the batch failed, so none of its accepts may be reported
+ * durable. Whatever part of the failed segment reached the disk is
+ * unknown, so nothing more is written to it: journaling continues in a
+ * new segment, where completion records retire the batch's accepts
+ * (a later replay skips them, and the old segment can be deleted).
+ * Without a new segment journaling stops. Caller holds g_mtx.
+ */
+static void drop_batch(JournalReq* batch) {
+    uint64_t n = 0;
+    for (JournalReq* r = batch; r; r = r->next) if (r->job.journal_seq) n++;
+    log_line("Journal: %llu accept(s) not durable, their uploads are refused",
+             (unsigned long long)n);
+
+    if (g_fd >= 0) {
+        close(g_fd);
+        g_fd = -1;
+        if (open_segment() != 0) log_line("Journal: no segment to continue in, journaling stops");
+    }
+    for (JournalReq* r = batch; r; r = r->next) {
+        uint64_t seq = r->job.journal_seq;
+        if (!seq) continue;
+        if (g_fd >= 0) append_record(JREC_DONE, &seq, NULL, 0);
+        Segment* seg = segment_of(seq);
+        if (seg) seg->done++;
+        r->job.journal_seq = 0;
+        g_stat_failed++;
+    }
+    trim_segments();
+}
+
+/*
+ * writer_main
+ * -----------
+ * Journal thread. Takes every accept queued so far, appends them back
+ * to back and makes the batch durable with one fdatasync (group
+ * commit: accepts that arrive during a sync form the next batch), then
+ * hands each job to its callback, with journal_seq cleared for accepts
+ * that could not be written or synced. Exits once stopped and drained.
+ */
+static void* writer_main(void* arg) {
+    (void)arg;
+    for (;;) {
+        pthread_mutex_lock(&g_qmtx);
+        while (!g_qhead && g_writer_running) pthread_cond_wait(&g_qcv, &g_qmtx);
+        JournalReq* batch = g_qhead;
+        g_qhead = g_qtail = NULL;
+        pthread_mutex_unlock(&g_qmtx);
+        if (!batch) break;
+
+        pthread_mutex_lock(&g_mtx);
+        uint64_t failures = g_stat_sync_failures;   // rotations inside the batch sync too
+        int written = 0;
+        for (JournalReq* r = batch; r; r = r->next) {
+            r->job.journal_seq = append_accept(&r->job);
+            if (r->job.journal_seq) written = 1;
+            else g_stat_failed++;
+        }
+        int fd = g_fd;
+        if (written && fd >= 0) {
+            g_syncing = 1;                // rotation waits instead of closing fd
+            pthread_mutex_unlock(&g_mtx);
+            int rc = fdatasync(fd);
+            int err = errno;
+            pthread_mutex_lock(&g_mtx);
+            if (rc == 0) {
+                g_stat_syncs++;
+            } else {
+                log_line("Journal: fdatasync failed: %s", strerror(err));
+                g_stat_sync_failures++;
+            }
+            g_syncing = 0;
+            pthread_cond_broadcast(&g_cv);
+        }
+        if (written && (fd < 0 || g_stat_sync_failures != failures)) drop_batch(batch);
+        int down = g_fd < 0;
+        pthread_mutex_unlock(&g_mtx);
+
+        if (down) {
+            // later uploads are acknowledged without the journal
+            pthread_mutex_lock(&g_qmtx);
+            g_journal_down = 1;
+            pthread_mutex_unlock(&g_qmtx);
+        }
+
+        uint64_t n = 0;
+        while (batch) {
+            JournalReq* r = batch;
+            batch = r->next;
+            r->done(&r->job, r->arg);
+            free(r);
+            n++;
+        }
+        pthread_mutex_lock(&g_qmtx);
+        g_finished += n;
+        pthread_cond_broadcast(&g_qcv);
+        pthread_mutex_unlock(&g_qmtx);
+    }
+    return NULL;
+}
+
+/*
+ * journal_accept_async
+ * --------------------
+ * Queue `job` for the journal thread and return at once.
+ */
+int journal_accept_async(const ProcJob* job, JournalAcceptDone done, void* arg) {
+    if (!job || !done) return -1;
+    JournalReq* r = (JournalReq*)malloc(sizeof(JournalReq));
+    if (!r) return -1;
+    r->job = *job;
+    r->done = done;
+    r->arg = arg;
+    r->next = NULL;
+
+    pthread_mutex_lock(&g_qmtx);
+    if (!g_writer_running || g_journal_down) {
+        pthread_mutex_unlock(&g_qmtx);
+        free(r);
+        return -1;
+    }
+    if (g_qtail) g_qtail->next = r; else g_qhead = r;
+    g_qtail = r;
+    g_submitted++;
+    pthread_cond_broadcast(&g_qcv);
+    pthread_mutex_unlock(&g_qmtx);
+    return 0;
+}
+
+void journal_flush(void) {
+    pthread_mutex_lock(&g_qmtx);
+    uint64_t target = g_submitted;
+    while (g_finished < target) pthread_cond_wait(&g_qcv, &g_qmtx);
+    pthread_mutex_unlock(&g_qmtx);
+}
+
+/*
+ * journal_map_payload
+ * -------------------
+ * Map the payload of a journaled job read-only from its segment, so the
+ * bytes written once for durability also serve as its spool copy. The
+ * mapping outlives the segment file, which is only deleted once the job
+ * is complete anyway.
+ */
+unsigned char* journal_map_payload(const ProcJob* job) {
+    if (!job || !job->journal_seq || job->size == 0) return NULL;
+    char path[600];
+    segment_path(path, sizeof(path), job->journal_seg);
+    return spool_map(path, job->journal_off, job->size);
+}
+
+/*
+ * journal_complete
+ * ----------------
+ * Append a completion record. It is not synced on its own: losing it in
+ * a crash only means the job is processed once more after restart,
+ * which rewrites the same output files.
+ */
+void journal_complete(uint64_t seq) {
+    if (!seq) return;
+    pthread_mutex_lock(&g_mtx);
+    if (g_fd >= 0 && append_record(JREC_DONE, &seq, NULL, 0) == 0) {
+        Segment* seg = segment_of(seq);
+        if (seg) seg->done++;
+        g_stat_completed++;
+        trim_segments();
+    }
+    pthread_mutex_unlock(&g_mtx);
+}
+
+// ---------------- Replay ----------------
+
+typedef struct {
+    uint64_t             seq;
+    const unsigned char* body;      // AcceptMeta + payload (inside a segment mapping)
+    size_t               len;
+    uint64_t             seg_id;    // segment file and offset of `body`
+    size_t               body_off;
+    int                  done;
+} PendingJob;
+
+typedef struct {
+    PendingJob* v;
+    size_t      n, cap;
+} PendingList;
+
+static PendingJob* pending_find(PendingList* l, uint64_t seq) {
+    size_t lo = 0, hi = l->n;         // sorted: seqs grow through the segments
+    while (lo < hi) {
+        size_t mid = (lo + hi) / 2;
+        if (l->v[mid].seq < seq) lo = mid + 1;
+        else hi = mid;
+    }
+    return (lo < l->n && l->v[lo].seq == seq) ? &l->v[lo] : NULL;
+}
+
+static int cmp_u64(const void* a, const void* b) {
+    uint64_t x = *(const uint64_t*)a, y = *(const uint64_t*)b;
+    return x < y ? -1 : x > y;
+}
+
+/*
+ * scan_segment
+ * ------------
+ * Walk the records of one mapped segment, adding accepts to `l` and
+ * marking completed ones. Parsing stops at the first invalid record,
+ * which is where a crash cut the last write short.
+ */
+static void scan_segment(const unsigned char* map, size_t size, Segment* seg, PendingList* l,
+                         uint64_t* max_seq) {
+    size_t off = 0;
+    while (off + sizeof(RecordHeader) <= size) {
+        RecordHeader h;
+        memcpy(&h, map + off, sizeof(h));
+        if (h.magic != JREC_MAGIC || h.len > size - off - sizeof(h)) break;
+        struct iovec body = { (void*)(map + off + sizeof(h)), (size_t)h.len };
+        if (record_crc(&h, &body, 1) != h.crc) break;
+
+        if (h.type == JREC_ACCEPT && h.len > sizeof(AcceptMeta) &&
+            (l->n == 0 || h.seq > l->v[l->n - 1].seq)) {
+            if (l->n == l->cap) {
+                size_t cap = l->cap ? l->cap * 2 : 64;
+                PendingJob* nv = (PendingJob*)realloc(l->v, cap * sizeof(PendingJob));
+                if (!nv) break;
+                l->v = nv;
+                l->cap = cap;
+            }
+            l->v[l->n++] = (PendingJob){ h.seq, (const unsigned char*)body.iov_base, body.iov_len,
+                                         seg->id, off + sizeof(h), 0 };
+            if (!seg->accepted) seg->first_seq = h.seq;
+            seg->last_seq = h.seq;
+            seg->accepted++;
+        } else if (h.type == JREC_DONE) {
+            PendingJob* p = pending_find(l, h.seq);
+            if (p && !p->done) {
+                p->done = 1;
+                Segment* owner = segment_of(h.seq);
+                if (owner) owner->done++;
+            }
+        }
+        if (h.seq > *max_seq) *max_seq = h.seq;
+        off += sizeof(h) + (size_t)h.len;
+    }
+    if (off < size) {
+        log_line("Journal: segment %016llx: ignoring %zu bytes after offset %zu (torn write)",
+                 (unsigned long long)seg->id, size - off, off);
+    }
+}
+
+/*
+ * requeue
+ * -------
+ * Queue one unfinished job again. Its payload is mapped straight from
+ * the segment (queued as an already spilled job, charged for its working
+ * set only); a private copy is made only when the mapping fails.
+ */
+static int requeue(const PendingJob* p) {
+    AcceptMeta meta;
+    memcpy(&meta, p->body, sizeof(meta));
+    size_t size = p->len - sizeof(meta);
+
+    ProcJob job;
+    memset(&job, 0, sizeof(job));
+    job.size = size;
+    job.journal_seq = p->seq;
+    job.journal_seg = p->seg_id;
+    job.journal_off = p->body_off + sizeof(meta);
+    job.data = journal_map_payload(&job);
+    if (job.data) {
+        job.spilled = 1;
+    } else {
+        job.data = (unsigned char*)bp_alloc(size);
+        if (!job.data) return -1;
+        memcpy(job.data, p->body + sizeof(meta), size);
+    }
+    memcpy(job.image_id, meta.image_id, sizeof(job.image_id));
+    memcpy(job.filename, meta.filename, sizeof(job.filename));
+    memcpy(job.format, meta.format, sizeof(job.format));
+    job.image_id[sizeof(job.image_id)-1] = '\0';
+    job.filename[sizeof(job.filename)-1] = '\0';
+    job.format[sizeof(job.format)-1] = '\0';
+    job.processing_type = (ProcessingType)meta.processing_type;
+    job.total_size = meta.total_size;
+
+    image_probe(job.data, job.size, job.format, &job.header);
+    job.cost_us = cost_predict_us(&job.header, job.format, job.processing_type);
+    size_t work = image_working_set_estimate(&job.header, job.format);
+    job.mem_charge = job.spilled ? work : job.size + work;
+    budget_reserve(job.mem_charge);
+
+    if (scheduler_enqueue(&job) != 0) {
+        budget_release(job.mem_charge);
+        if (job.spilled) spool_release(job.data, job.size);
+        else bp_free(job.data);
+        return -1;
+    }
+    log_line("Journal: replayed id=%s file=%s (seq %llu)",
+             job.image_id, job.filename, (unsigned long long)p->seq);
+    return 0;
+}
+
+/*
+ * journal_open
+ * ------------
+ * Map every segment left by the previous run, find the accepts that
+ * have no completion record and queue them again (they keep their
+ * sequence numbers, so their completions still retire the old
+ * segments), then start a fresh segment for new uploads. A segment
+ * that cannot be read now is kept on disk untouched, and sequence
+ * numbers skip past every record it could hold.
+ */
+int journal_open(const char* dir, size_t segment_bytes) {
+    snprintf(g_dir, sizeof(g_dir), "%s", dir ? dir : "");
+    g_segment_bytes = segment_bytes ? segment_bytes : ((size_t)64 << 20);
+
+    DIR* d = opendir(g_dir);
+    if (!d) {
+        log_line("Journal: cannot open %s: %s", g_dir, strerror(errno));
+        return -1;
+    }
+    uint64_t* ids = NULL;
+    size_t nids = 0, idcap = 0;
+    struct dirent* e;
+    while ((e = readdir(d)) != NULL) {
+        unsigned long long id;
+        char tail;
+        if (sscanf(e->d_name, "journal-%16llx.lo%c", &id, &tail) != 2 || tail != 'g') continue;
+        if (nids == idcap) {
+            idcap = idcap ? idcap * 2 : 16;
+            uint64_t* n = (uint64_t*)realloc(ids, idcap * sizeof(uint64_t));
+            if (!n) break;
+            ids = n;
+        }
+        ids[nids++] = id;
+    }
+    closedir(d);
+    if (nids) qsort(ids, nids, sizeof(uint64_t), cmp_u64);
+
+    PendingList pending = { NULL, 0, 0 };
+    void** maps = (void**)calloc(nids ? nids : 1, sizeof(void*));
+    size_t* sizes = (size_t*)calloc(nids ? nids : 1, sizeof(size_t));
+    uint64_t max_seq = 0, unread_seqs = 0;
+
+    pthread_mutex_lock(&g_mtx);
+    for (size_t i = 0; i < nids && maps && sizes; ++i) {
+        Segment* seg = segment_add(ids[i]);
+        if (!seg) break;
+        char path[600];
+        segment_path(path, sizeof(path), ids[i]);
+        int fd = open(path, O_RDONLY | O_CLOEXEC);
+        struct stat st;
+        int ok = fd >= 0 && fstat(fd, &st) == 0;
+        if (ok && st.st_size > 0) {
+            void* m = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (m != MAP_FAILED) {
+                maps[i] = m;
+                sizes[i] = (size_t)st.st_size;
+                madvise(m, sizes[i], MADV_SEQUENTIAL);
+                scan_segment((const unsigned char*)m, sizes[i], seg, &pending, &max_seq);
+            } else {
+                ok = 0;
+            }
+        }
+        if (!ok) {
+            log_line("Journal: cannot read %s (%s), kept until a later start can replay it",
+                     path, strerror(errno));
+            seg->unread = 1;
+            // each record takes at least a header; without a size, leave a wide gap
+            unread_seqs += stat(path, &st) == 0 ? (uint64_t)st.st_size / sizeof(RecordHeader) + 1
+                                                : (uint64_t)1 << 32;
+        }
+        if (fd >= 0) close(fd);
+    }
+    g_next_seq = max_seq + unread_seqs + 1;
+    g_syncing = 0;
+
+    int rc = open_segment();
+    trim_segments();
+    pthread_mutex_unlock(&g_mtx);
+
+    if (rc == 0) {
+        pthread_mutex_lock(&g_qmtx);
+        g_writer_running = 1;
+        g_journal_down = 0;
+        if (pthread_create(&g_writer, NULL, writer_main, NULL) != 0) {
+            g_writer_running = 0;
+            log_line("Journal: cannot start the journal thread");
+            rc = -1;
+        }
+        pthread_mutex_unlock(&g_qmtx);
+    }
+
+    // Workers may complete replayed jobs (and take the lock) right away
+    size_t replayed = 0, failed = 0;
+    for (size_t i = 0; i < pending.n; ++i) {
+        if (pending.v[i].done) continue;
+        if (requeue(&pending.v[i]) == 0) replayed++;
+        else failed++;
+    }
+    for (size_t i = 0; i < nids && maps && sizes; ++i) {
+        if (maps[i]) munmap(maps[i], sizes[i]);
+    }
+    free(maps);
+    free(sizes);
+    free(pending.v);
+    free(ids);
+
+    pthread_mutex_lock(&g_mtx);
+    g_stat_replayed += replayed;
+    pthread_mutex_unlock(&g_mtx);
+
+    if (replayed || failed) {
+        log_line("Journal: %zu unfinished job(s) replayed from %zu segment(s)%s",
+                 replayed, nids, failed ? ", some could not be queued" : "");
+    }
+    if (rc == 0) {
+        log_line("Journal: %s (segments of %zu MiB, group commit)", g_dir, g_segment_bytes >> 20);
+    }
+    return rc;
+}
+
+void journal_close(void) {
+    // The journal thread writes what is still queued before it exits
+    pthread_mutex_lock(&g_qmtx);
+    int running = g_writer_running;
+    g_writer_running = 0;
+    pthread_cond_broadcast(&g_qcv);
+    pthread_mutex_unlock(&g_qmtx);
+    if (running) pthread_join(g_writer, NULL);
+
+    pthread_mutex_lock(&g_mtx);
+    if (g_fd >= 0) {
+        wait_sync_idle();
+        sync_segment();
+        close(g_fd);
+        g_fd = -1;
+        trim_segments();
+    }
+    if (g_stat_accepted || g_stat_failed || g_stat_sync_failures || g_nsegs) {
+        log_line("Journal: accepted=%llu completed=%llu syncs=%llu replayed=%llu "
+                 "failed=%llu sync_failures=%llu, %zu segment(s) kept",
+                 (unsigned long long)g_stat_accepted, (unsigned long long)g_stat_completed,
+                 (unsigned long long)g_stat_syncs, (unsigned long long)g_stat_replayed,
+                 (unsigned long long)g_stat_failed, (unsigned long long)g_stat_sync_failures, g_nsegs);
+    }
+    free(g_segs);
+    g_segs = NULL;
+    g_nsegs = g_segcap = 0;
+    pthread_mutex_unlock(&g_mtx);
+}
+
+void journal_get_stats(JournalStats* out) {
+    if (!out) return;
+    pthread_mutex_lock(&g_mtx);
+    out->accepted  = g_stat_accepted;
+    out->completed = g_stat_completed;
+    out->syncs     = g_stat_syncs;
+    out->replayed  = g_stat_replayed;
+    out->failed    = g_stat_failed;
+    out->sync_failures = g_stat_sync_failures;
+    out->segments  = g_nsegs;
+    pthread_mutex_unlock(&g_mtx);
+}
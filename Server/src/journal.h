@@ -0,0 +1,67 @@
+#ifndef JOURNAL_H
+#define JOURNAL_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "scheduler.h"
+
+// Crash-safe record of accepted jobs. Every upload handed to the
+// scheduler is appended (metadata and payload) to the current segment
+// file under paths.journal_dir before its ACK is sent, and a completion
+// record is appended once a worker has processed it. Accepts are
+// written by a journal thread, so the connection engines never wait on
+// the disk: it appends every accept queued since its last pass and makes
+// them durable with one fdatasync (group commit), then calls each one's
+// completion callback. Segments whose jobs are all complete are
+// deleted, oldest first. At startup the unfinished jobs of the remaining
+// segments are queued again, their payloads mapped from the segments.
+// The journal copy of a payload is also the one the scheduler spills to:
+// a journaled job that has to leave memory is mapped back from its
+// record instead of being written to the spool a second time.
+
+typedef struct {
+    uint64_t accepted;      // accept records written
+    uint64_t completed;     // completion records written
+    uint64_t syncs;         // fdatasync calls (each covers one or more accepts)
+    uint64_t replayed;      // jobs queued again from a previous run
+    uint64_t failed;        // accepts not made durable (their uploads were refused)
+    uint64_t sync_failures; // fdatasync calls that failed
+    uint64_t segments;      // segment files currently on disk
+} JournalStats;
+
+// Replay the unfinished jobs found in `dir` into the scheduler (which
+// must be running), then start a new segment. `segment_bytes` is the size
+// after which appends move on to a new file. Returns 0 on success, -1
+// when the journal is unavailable (jobs are then not journaled).
+int journal_open(const char* dir, size_t segment_bytes);
+
+// Write the pending completion records, delete finished segments and
+// log the counters
+void journal_close(void);
+
+// Runs on the journal thread once the accept record of `job` is on
+// stable storage, with job->journal_seq set. journal_seq is 0 when the
+// record could not be written or synced: the job is not durable and
+// must not be acknowledged. The callback owns the job from then on.
+typedef void (*JournalAcceptDone)(ProcJob* job, void* arg);
+
+// Queue an accept record for `job` (the descriptor is copied; `data` must
+// stay valid until `done` runs) and return at once. Returns -1 when the
+// journal is closed, or has stopped after its segment could not be
+// replaced: nothing is queued and `done` is not called.
+int journal_accept_async(const ProcJob* job, JournalAcceptDone done, void* arg);
+
+// Wait until every accept queued so far has been written and handed to
+// its callback
+void journal_flush(void);
+
+// Map the journaled payload of `job` (journal_seq set) read-only from its
+// segment; NULL when it cannot be mapped. Release with spool_release.
+unsigned char* journal_map_payload(const ProcJob* job);
+
+// Record that the job with sequence `seq` has been processed
+void journal_complete(uint64_t seq);
+
+void journal_get_stats(JournalStats* out);
+
+#endif // JOURNAL_H
@@ -10,6 +10,14 @@
 #include "connection.h"
 #include "scheduler.h"
 #include "daemon.h"   // NUEVO
+#include "bench.h"
+#include "thread_pool.h"
+#include "pixel_kernels.h"
+#include "buffer_pool.h"
+#include "mem_budget.h"
+#include "spool.h"
+#include "journal.h"
+#include "gif_processing.h"
 
 // Global configuration
 ServerConfig g_cfg;
@@ -41,7 +49,7 @@ static void handle_sighup(int sig) {
  * install_signal_handlers
  * -----------------------
  * Install process signal handlers used by the server (SIGTERM, SIGINT,
- * SIGHUP). This is called once on startup.
+ * SIGHUP) and ignore SIGPIPE. This is called once on startup.
  */
 static void install_signal_handlers(void) {
     struct sigaction sa;
@@ -54,6 +62,10 @@ static void install_signal_handlers(void) {
 
     sa.sa_handler = handle_sighup;
     sigaction(SIGHUP, &sa, NULL);
+
+    // A peer resetting mid-write must fail the send, not kill the server
+    sa.sa_handler = SIG_IGN;
+    sigaction(SIGPIPE, &sa, NULL);
 }
 
 /*
@@ -64,11 +76,17 @@ static void install_signal_handlers(void) {
 static void usage(const char* prog) {
     fprintf(stderr,
         "Usage: %s [--config <path>] [--daemon] [--pidfile <path>] [--foreground]\n"
+        "       %s [--config <path>] --bench-scheduler [producers] [jobs_per_producer]\n"
+        "       %s --check-gif-lzw\n"
         "       --config    Path to config.json (default: assets/config.json)\n"
         "       --daemon    Double-fork + PIDFile (classic daemon mode)\n"
         "       --pidfile   Path for PIDFile (default: /run/ImageService.pid)\n"
-        "       --foreground (default) run in foreground (good for systemd)\n",
-        prog);
+        "       --foreground (default) run in foreground (good for systemd)\n"
+        "       --bench-scheduler  Measure scheduler enqueue/dequeue throughput\n"
+        "                   with no-op jobs (default: 64 producers x 10000 jobs)\n"
+        "       --check-gif-lzw    Check that the GIF frame encoder writes the\n"
+        "                   same bytes as gif.h\n",
+        prog, prog, prog);
 }
 
 /*
@@ -84,6 +102,8 @@ int main(int argc, char** argv) {
     const char* cfg_path = "assets/config.json";
     int use_daemon = 0;
     const char* pidfile = "/run/ImageService.pid";
+    int bench = 0, bench_producers = 64, bench_jobs = 10000;
+    int check_gif = 0;
 
     for (int i = 1; i < argc; ++i) {
         if (!strcmp(argv[i], "--config") && i+1 < argc) {
@@ -94,6 +114,12 @@ int main(int argc, char** argv) {
             pidfile = argv[++i];
         } else if (!strcmp(argv[i], "--foreground")) {
             use_daemon = 0;
+        } else if (!strcmp(argv[i], "--bench-scheduler")) {
+            bench = 1;
+            if (i+1 < argc && atoi(argv[i+1]) > 0) bench_producers = atoi(argv[++i]);
+            if (i+1 < argc && atoi(argv[i+1]) > 0) bench_jobs = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "--check-gif-lzw")) {
+            check_gif = 1;
         } else {
             usage(argv[0]);
             return 1;
@@ -101,8 +127,28 @@ int main(int argc, char** argv) {
     }
     g_pidfile = use_daemon ? pidfile : NULL;
 
+    // Encoder self-check: no config, sockets or outputs
+    if (check_gif) return gif_check_lzw() == 0 ? 0 : 1;
+
     // Load config
     if (load_config_json(cfg_path, &g_cfg) != 0) set_default_config(&g_cfg);
+
+    // Queue ordering (also used by the benchmark)
+    SchedulerPolicy policy;
+    policy.policy = g_cfg.sched_policy;
+    policy.order_by_cost = g_cfg.order_by_cost;
+    policy.aging_bytes_per_sec = g_cfg.aging_mb_per_sec * 1024.0 * 1024.0;
+    policy.aging_cost_us_per_sec = g_cfg.aging_ms_per_sec * 1000.0;
+    policy.deadline_base_us = (uint64_t)g_cfg.deadline_base_ms * 1000u;
+    policy.deadline_us_per_mb = (uint64_t)g_cfg.deadline_ms_per_mb * 1000u;
+    policy.deadline_cost_factor = g_cfg.deadline_cost_factor;
+    scheduler_set_policy(&policy);
+
+    // Benchmark mode: no sockets, no logging, no outputs
+    if (bench) {
+        return run_scheduler_bench(g_cfg.worker_threads, bench_producers, bench_jobs) == 0 ? 0 : 1;
+    }
+
     if (ensure_dirs_from_config(&g_cfg) != 0) {
         fprintf(stderr, "Failed to create required directories from config\n");
         return 1;
@@ -125,19 +171,52 @@ int main(int argc, char** argv) {
         }
     }
 
+    // Select SIMD kernels for this CPU
+    pk_init();
+
+    // Recycled pixel/file buffers
+    bp_init((size_t)g_cfg.buffer_pool_mb << 20);
+
+    // Admission control for uploads
+    budget_init((size_t)g_cfg.memory_budget_mb << 20);
+
+    // Queued payloads beyond the limit wait on disk
+    spool_init(g_cfg.spool_dir);
+    scheduler_set_spill_limit((size_t)g_cfg.queue_memory_mb << 20);
+
+    // Shared helper pool for intra-image parallelism (optional: tasks run
+    // inline when it is unavailable)
+    if (tp_init(g_cfg.pool_threads) != 0) {
+        log_line("Thread pool unavailable; intra-image work runs serially");
+    }
+
     // Scheduler
-    if (scheduler_init() != 0) {
+    if (scheduler_init(g_cfg.worker_threads) != 0) {
         fprintf(stderr, "Failed to start scheduler worker\n");
+        tp_shutdown();
+        bp_shutdown();
         log_close();
         if (use_daemon) remove_pidfile(pidfile);
         return 1;
     }
 
+    // Jobs accepted but not processed before the last exit run first
+    if (g_cfg.journal_enabled &&
+        journal_open(g_cfg.journal_dir, (size_t)g_cfg.journal_segment_mb << 20) != 0) {
+        log_line("Journal unavailable; accepted jobs are not persisted");
+    }
+
     // Server
     int result = start_server();
 
-    // Cleanup
+    // Cleanup (accepts still being synced reach the scheduler first)
+    journal_flush();
     scheduler_shutdown();
+    journal_close();
+    tp_shutdown();
+    spool_shutdown();
+    budget_shutdown();
+    bp_shutdown();
     tls_cleanup();
     log_close();
     if (use_daemon) remove_pidfile(pidfile);
@@ -0,0 +1,76 @@
+#include "mem_budget.h"
+#include "logging.h"
+#include <stdatomic.h>
+
+static atomic_uint_least64_t g_limit = 0;
+static atomic_uint_least64_t g_used = 0, g_peak = 0;
+static atomic_uint_least64_t g_admitted = 0, g_deferred = 0;
+
+static void note_peak(uint64_t now) {
+    uint64_t peak = atomic_load_explicit(&g_peak, memory_order_relaxed);
+    while (now > peak &&
+           !atomic_compare_exchange_weak_explicit(&g_peak, &peak, now,
+                                                  memory_order_relaxed, memory_order_relaxed)) {
+    }
+}
+
+/*
+ * budget_init
+ * -----------
+ * Set the admission limit (0 = unlimited; charges are still counted).
+ */
+void budget_init(size_t limit_bytes) {
+    atomic_store(&g_limit, limit_bytes);
+    if (limit_bytes) log_line("Memory budget: limit %zu MiB", limit_bytes >> 20);
+    else             log_line("Memory budget: unlimited");
+}
+
+void budget_shutdown(void) {
+    MemBudgetStats st;
+    budget_get_stats(&st);
+    log_line("Memory budget: admitted=%llu deferred=%llu peak=%llu MiB in use=%llu KiB",
+             (unsigned long long)st.admitted, (unsigned long long)st.deferred,
+             (unsigned long long)(st.peak_bytes >> 20), (unsigned long long)(st.used_bytes >> 10));
+}
+
+/*
+ * budget_try_reserve
+ * ------------------
+ * Lock-free check-and-add so concurrent connections cannot both slip
+ * under the limit with the same headroom.
+ */
+int budget_try_reserve(size_t bytes) {
+    uint64_t limit = atomic_load_explicit(&g_limit, memory_order_relaxed);
+    uint64_t used = atomic_load_explicit(&g_used, memory_order_relaxed);
+    for (;;) {
+        if (limit && used > 0 && used + bytes > limit) {
+            atomic_fetch_add_explicit(&g_deferred, 1, memory_order_relaxed);
+            return -1;
+        }
+        if (atomic_compare_exchange_weak_explicit(&g_used, &used, used + bytes,
+                                                  memory_order_relaxed, memory_order_relaxed))
+            break;
+    }
+    atomic_fetch_add_explicit(&g_admitted, 1, memory_order_relaxed);
+    note_peak(used + bytes);
+    return 0;
+}
+
+void budget_reserve(size_t bytes) {
+    if (!bytes) return;
+    note_peak(atomic_fetch_add_explicit(&g_used, bytes, memory_order_relaxed) + bytes);
+}
+
+void budget_release(size_t bytes) {
+    if (!bytes) return;
+    atomic_fetch_sub_explicit(&g_used, bytes, memory_order_relaxed);
+}
+
+void budget_get_stats(MemBudgetStats* out) {
+    if (!out) return;
+    out->limit_bytes = atomic_load(&g_limit);
+    out->used_bytes  = atomic_load(&g_used);
+    out->peak_bytes  = atomic_load(&g_peak);
+    out->admitted    = atomic_load(&g_admitted);
+    out->deferred    = atomic_load(&g_deferred);
+}
@@ -0,0 +1,37 @@
+#ifndef MEM_BUDGET_H
+#define MEM_BUDGET_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Global memory accountant for admission control. Uploads reserve their
+// buffer size at IMAGE_INFO; a completed upload adds the estimated
+// decode and encode working set of its job. Charges are released when
+// the upload is dropped or its job finishes. New uploads are refused
+// (the client is told to retry) while the total is over the limit.
+
+typedef struct {
+    uint64_t limit_bytes;   // 0 = unlimited
+    uint64_t used_bytes;    // currently charged
+    uint64_t peak_bytes;    // high-water mark of used_bytes
+    uint64_t admitted;      // uploads accepted by budget_try_reserve
+    uint64_t deferred;      // uploads refused (retry requested)
+} MemBudgetStats;
+
+void budget_init(size_t limit_bytes);
+
+// Log the counters
+void budget_shutdown(void);
+
+// Reserve `bytes` for a new upload. Fails (-1) when the charge would
+// exceed the limit, unless nothing is charged at all, so an upload
+// larger than the whole budget still gets through on an idle server.
+int  budget_try_reserve(size_t bytes);
+
+// Charge work that is already accepted (never fails)
+void budget_reserve(size_t bytes);
+void budget_release(size_t bytes);
+
+void budget_get_stats(MemBudgetStats* out);
+
+#endif // MEM_BUDGET_H
@@ -0,0 +1,494 @@
+#include "pixel_kernels.h"
+#include "logging.h"
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define PK_X86 1
+#endif
+
+// Sub-histogram counters are 32-bit; flush them into the 64-bit result
+// before any single counter could wrap.
+#define PK_HIST_BLOCK ((size_t)1 << 30)
+
+static PkIsa g_isa = PK_ISA_SCALAR;
+
+typedef size_t (*SumsKernel)(const unsigned char* p, size_t pixels, uint64_t sums[3]);
+static SumsKernel g_sums3 = NULL;   // 3-channel SIMD kernel (NULL = scalar only)
+static SumsKernel g_sums4 = NULL;   // 4-channel SIMD kernel
+
+#ifdef PK_X86
+// ---- Channel sums: psadbw against zero adds 8 bytes into a 64-bit lane,
+// so masking one channel before the SAD sums that channel directly ----
+
+// Byte masks selecting channel c in the k-th 16-byte vector of a 48-byte
+// RGB block (16 pixels): byte j belongs to channel (16*k + j) % 3.
+static const unsigned char k_rgb_mask16[3][3][16] = {
+    { {255,0,0,255,0,0,255,0,0,255,0,0,255,0,0,255},
+      {0,255,0,0,255,0,0,255,0,0,255,0,0,255,0,0},
+      {0,0,255,0,0,255,0,0,255,0,0,255,0,0,255,0} },
+    { {0,0,255,0,0,255,0,0,255,0,0,255,0,0,255,0},
+      {255,0,0,255,0,0,255,0,0,255,0,0,255,0,0,255},
+      {0,255,0,0,255,0,0,255,0,0,255,0,0,255,0,0} },
+    { {0,255,0,0,255,0,0,255,0,0,255,0,0,255,0,0},
+      {0,0,255,0,0,255,0,0,255,0,0,255,0,0,255,0},
+      {255,0,0,255,0,0,255,0,0,255,0,0,255,0,0,255} },
+};
+
+static uint64_t hsum_epi64_128(__m128i v) {
+    return (uint64_t)_mm_cvtsi128_si64(v) + (uint64_t)_mm_cvtsi128_si64(_mm_unpackhi_epi64(v, v));
+}
+
+/*
+ * sums_rgba_sse2
+ * --------------
+ * 4 pixels per 16-byte load. Returns pixels consumed (multiple of 4).
+ */
+static size_t sums_rgba_sse2(const unsigned char* p, size_t pixels, uint64_t sums[3]) {
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i mr = _mm_set1_epi32(0x000000ff);
+    const __m128i mg = _mm_set1_epi32(0x0000ff00);
+    const __m128i mb = _mm_set1_epi32(0x00ff0000);
+    __m128i ar = zero, ag = zero, ab = zero;
+
+    size_t i = 0;
+    for (; i + 4 <= pixels; i += 4, p += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i*)p);
+        ar = _mm_add_epi64(ar, _mm_sad_epu8(_mm_and_si128(v, mr), zero));
+        ag = _mm_add_epi64(ag, _mm_sad_epu8(_mm_and_si128(v, mg), zero));
+        ab = _mm_add_epi64(ab, _mm_sad_epu8(_mm_and_si128(v, mb), zero));
+    }
+    sums[0] += hsum_epi64_128(ar);
+    sums[1] += hsum_epi64_128(ag);
+    sums[2] += hsum_epi64_128(ab);
+    return i;
+}
+
+/*
+ * sums_rgb_sse2
+ * -------------
+ * 16 pixels per 48-byte block (three loads, nine masks). Returns pixels
+ * consumed (multiple of 16).
+ */
+static size_t sums_rgb_sse2(const unsigned char* p, size_t pixels, uint64_t sums[3]) {
+    const __m128i zero = _mm_setzero_si128();
+    __m128i m[3][3];
+    for (int k = 0; k < 3; ++k)
+        for (int c = 0; c < 3; ++c)
+            m[k][c] = _mm_loadu_si128((const __m128i*)k_rgb_mask16[k][c]);
+    __m128i acc[3] = { zero, zero, zero };
+
+    size_t i = 0;
+    for (; i + 16 <= pixels; i += 16, p += 48) {
+        for (int k = 0; k < 3; ++k) {
+            __m128i v = _mm_loadu_si128((const __m128i*)(p + 16 * k));
+            for (int c = 0; c < 3; ++c)
+                acc[c] = _mm_add_epi64(acc[c], _mm_sad_epu8(_mm_and_si128(v, m[k][c]), zero));
+        }
+    }
+    for (int c = 0; c < 3; ++c) sums[c] += hsum_epi64_128(acc[c]);
+    return i;
+}
+
+__attribute__((target("avx2")))
+static uint64_t hsum_epi64_256(__m256i v) {
+    return hsum_epi64_128(_mm_add_epi64(_mm256_castsi256_si128(v), _mm256_extracti128_si256(v, 1)));
+}
+
+/*
+ * sums_rgba_avx2
+ * --------------
+ * 8 pixels per 32-byte load. Returns pixels consumed (multiple of 8).
+ */
+__attribute__((target("avx2")))
+static size_t sums_rgba_avx2(const unsigned char* p, size_t pixels, uint64_t sums[3]) {
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i mr = _mm256_set1_epi32(0x000000ff);
+    const __m256i mg = _mm256_set1_epi32(0x0000ff00);
+    const __m256i mb = _mm256_set1_epi32(0x00ff0000);
+    __m256i ar = zero, ag = zero, ab = zero;
+
+    size_t i = 0;
+    for (; i + 8 <= pixels; i += 8, p += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i*)p);
+        ar = _mm256_add_epi64(ar, _mm256_sad_epu8(_mm256_and_si256(v, mr), zero));
+        ag = _mm256_add_epi64(ag, _mm256_sad_epu8(_mm256_and_si256(v, mg), zero));
+        ab = _mm256_add_epi64(ab, _mm256_sad_epu8(_mm256_and_si256(v, mb), zero));
+    }
+    sums[0] += hsum_epi64_256(ar);
+    sums[1] += hsum_epi64_256(ag);
+    sums[2] += hsum_epi64_256(ab);
+    return i;
+}
+
+/*
+ * sums_rgb_avx2
+ * -------------
+ * 32 pixels per 96-byte block. Each 32-byte vector spans two 16-byte
+ * phases of the RGB pattern, so its masks are built from the 16-byte
+ * tables: vector k covers 16-byte phases (2k) % 3 and (2k + 1) % 3.
+ * Returns pixels consumed (multiple of 32).
+ */
+__attribute__((target("avx2")))
+static size_t sums_rgb_avx2(const unsigned char* p, size_t pixels, uint64_t sums[3]) {
+    const __m256i zero = _mm256_setzero_si256();
+    __m256i m[3][3];
+    for (int k = 0; k < 3; ++k) {
+        int lo = (2 * k) % 3, hi = (2 * k + 1) % 3;
+        for (int c = 0; c < 3; ++c) {
+            m[k][c] = _mm256_set_m128i(_mm_loadu_si128((const __m128i*)k_rgb_mask16[hi][c]),
+                                       _mm_loadu_si128((const __m128i*)k_rgb_mask16[lo][c]));
+        }
+    }
+    __m256i acc[3] = { zero, zero, zero };
+
+    size_t i = 0;
+    for (; i + 32 <= pixels; i += 32, p += 96) {
+        for (int k = 0; k < 3; ++k) {
+            __m256i v = _mm256_loadu_si256((const __m256i*)(p + 32 * k));
+            for (int c = 0; c < 3; ++c)
+                acc[c] = _mm256_add_epi64(acc[c], _mm256_sad_epu8(_mm256_and_si256(v, m[k][c]), zero));
+        }
+    }
+    for (int c = 0; c < 3; ++c) sums[c] += hsum_epi64_256(acc[c]);
+    return i;
+}
+#endif
+
+/*
+ * pk_init
+ * -------
+ * Detect SIMD support at runtime and record the widest usable ISA.
+ */
+void pk_init(void) {
+#ifdef PK_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))      g_isa = PK_ISA_AVX2;
+    else if (__builtin_cpu_supports("sse2")) g_isa = PK_ISA_SSE2;
+    else                                     g_isa = PK_ISA_SCALAR;
+#else
+    g_isa = PK_ISA_SCALAR;
+#endif
+
+    g_sums3 = g_sums4 = NULL;
+#ifdef PK_X86
+    if (g_isa == PK_ISA_AVX2) {
+        g_sums3 = sums_rgb_avx2;
+        g_sums4 = sums_rgba_avx2;
+    } else if (g_isa == PK_ISA_SSE2) {
+        g_sums3 = sums_rgb_sse2;
+        g_sums4 = sums_rgba_sse2;
+    }
+#endif
+    log_line("Pixel kernels: %s", pk_isa_name());
+}
+
+PkIsa pk_isa(void) {
+    return g_isa;
+}
+
+const char* pk_isa_name(void) {
+    switch (g_isa) {
+        case PK_ISA_AVX2: return "avx2";
+        case PK_ISA_SSE2: return "sse2";
+        default:          return "scalar";
+    }
+}
+
+/*
+ * histogram_block_rgb
+ * -------------------
+ * Fused 3-channel histogram over at most PK_HIST_BLOCK pixels. Four
+ * pixels per iteration go to four separate sub-histograms so runs of
+ * equal values do not serialize on the same counter (store-to-load
+ * forwarding stalls).
+ */
+static void histogram_block_rgb(const unsigned char* p, size_t pixels, int channels,
+                                uint64_t hist[3][256]) {
+    uint32_t sub[4][3][256];
+    memset(sub, 0, sizeof(sub));
+
+    const size_t stride = (size_t)channels;
+    size_t i = 0;
+    for (; i + 4 <= pixels; i += 4) {
+        const unsigned char* q0 = p;
+        const unsigned char* q1 = p + stride;
+        const unsigned char* q2 = p + 2 * stride;
+        const unsigned char* q3 = p + 3 * stride;
+        sub[0][0][q0[0]]++; sub[0][1][q0[1]]++; sub[0][2][q0[2]]++;
+        sub[1][0][q1[0]]++; sub[1][1][q1[1]]++; sub[1][2][q1[2]]++;
+        sub[2][0][q2[0]]++; sub[2][1][q2[1]]++; sub[2][2][q2[2]]++;
+        sub[3][0][q3[0]]++; sub[3][1][q3[1]]++; sub[3][2][q3[2]]++;
+        p += 4 * stride;
+    }
+    for (; i < pixels; ++i, p += stride) {
+        sub[0][0][p[0]]++; sub[0][1][p[1]]++; sub[0][2][p[2]]++;
+    }
+
+    for (int ch = 0; ch < 3; ++ch) {
+        for (int v = 0; v < 256; ++v) {
+            hist[ch][v] += (uint64_t)sub[0][ch][v] + sub[1][ch][v] + sub[2][ch][v] + sub[3][ch][v];
+        }
+    }
+}
+
+/*
+ * histogram_block_generic
+ * -----------------------
+ * Same as histogram_block_rgb for 1 or 2 channels (gray, gray+alpha).
+ */
+static void histogram_block_generic(const unsigned char* p, size_t pixels, int channels, int nch,
+                                    uint64_t hist[3][256]) {
+    uint32_t sub[4][2][256];
+    memset(sub, 0, sizeof(sub));
+
+    const size_t stride = (size_t)channels;
+    size_t i = 0;
+    for (; i + 4 <= pixels; i += 4) {
+        for (int ch = 0; ch < nch; ++ch) {
+            sub[0][ch][p[ch]]++;
+            sub[1][ch][p[stride + ch]]++;
+            sub[2][ch][p[2 * stride + ch]]++;
+            sub[3][ch][p[3 * stride + ch]]++;
+        }
+        p += 4 * stride;
+    }
+    for (; i < pixels; ++i, p += stride) {
+        for (int ch = 0; ch < nch; ++ch) sub[0][ch][p[ch]]++;
+    }
+
+    for (int ch = 0; ch < nch; ++ch) {
+        for (int v = 0; v < 256; ++v) {
+            hist[ch][v] += (uint64_t)sub[0][ch][v] + sub[1][ch][v] + sub[2][ch][v] + sub[3][ch][v];
+        }
+    }
+}
+
+/*
+ * pk_histogram
+ * ------------
+ * Single interleaved pass building the histograms of every equalized
+ * channel at once (instead of one strided pass per channel).
+ */
+void pk_histogram(const unsigned char* data, size_t pixels, int channels, int nch,
+                  uint64_t hist[3][256]) {
+    if (nch <= 0) return;
+    if (nch > 3) nch = 3;
+
+    while (pixels > 0) {
+        size_t n = pixels < PK_HIST_BLOCK ? pixels : PK_HIST_BLOCK;
+        if (nch == 3) histogram_block_rgb(data, n, channels, hist);
+        else          histogram_block_generic(data, n, channels, nch, hist);
+        data += n * (size_t)channels;
+        pixels -= n;
+    }
+}
+
+#ifdef PK_X86
+/*
+ * apply_lut_rgba_avx2
+ * -------------------
+ * RGBA remap, 8 pixels per iteration: each channel is looked up with
+ * one 32-bit gather from a table pre-shifted to that channel's byte
+ * position, and the results are OR-ed back together with the original
+ * alpha. Returns the number of pixels processed (a multiple of 8).
+ */
+__attribute__((target("avx2")))
+static size_t apply_lut_rgba_avx2(unsigned char* p, size_t pixels, const unsigned char lut[3][256]) {
+    uint32_t tr[256], tg[256], tb[256];
+    for (int v = 0; v < 256; ++v) {
+        tr[v] = (uint32_t)lut[0][v];
+        tg[v] = (uint32_t)lut[1][v] << 8;
+        tb[v] = (uint32_t)lut[2][v] << 16;
+    }
+
+    const __m256i byte_mask  = _mm256_set1_epi32(0xff);
+    const __m256i alpha_mask = _mm256_set1_epi32((int)0xff000000u);
+    size_t i = 0;
+    for (; i + 8 <= pixels; i += 8, p += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i*)p);
+        __m256i r = _mm256_i32gather_epi32((const int*)tr, _mm256_and_si256(v, byte_mask), 4);
+        __m256i g = _mm256_i32gather_epi32((const int*)tg, _mm256_and_si256(_mm256_srli_epi32(v, 8), byte_mask), 4);
+        __m256i b = _mm256_i32gather_epi32((const int*)tb, _mm256_and_si256(_mm256_srli_epi32(v, 16), byte_mask), 4);
+        __m256i o = _mm256_or_si256(_mm256_or_si256(r, g),
+                                    _mm256_or_si256(b, _mm256_and_si256(v, alpha_mask)));
+        _mm256_storeu_si256((__m256i*)p, o);
+    }
+    return i;
+}
+#endif
+
+/*
+ * pk_apply_lut
+ * ------------
+ * Remap all equalized channels in one pass over the buffer. RGBA uses
+ * AVX2 gathers when available; other layouts use scalar table loads
+ * unrolled four pixels at a time.
+ *
+ * Note: there is no shuffle-based variant on purpose. Each channel needs
+ * its own 256-entry byte table; pshufb only indexes 16 entries (and SSE2
+ * has no byte shuffle at all), so a nibble-split shuffle remap costs ~3x
+ * the instructions of plain table loads.
+ */
+void pk_apply_lut(unsigned char* data, size_t pixels, int channels, int nch,
+                  const unsigned char lut[3][256]) {
+    if (nch <= 0) return;
+    if (nch > 3) nch = 3;
+
+    const size_t stride = (size_t)channels;
+    unsigned char* p = data;
+    size_t i = 0;
+
+#ifdef PK_X86
+    if (g_isa == PK_ISA_AVX2 && channels == 4 && nch == 3) {
+        i = apply_lut_rgba_avx2(p, pixels, lut);
+        p += i * stride;
+    }
+#endif
+
+    if (nch == 3) {
+        const unsigned char* lr = lut[0];
+        const unsigned char* lg = lut[1];
+        const unsigned char* lb = lut[2];
+        for (; i + 4 <= pixels; i += 4) {
+            unsigned char* q1 = p + stride;
+            unsigned char* q2 = p + 2 * stride;
+            unsigned char* q3 = p + 3 * stride;
+            p[0]  = lr[p[0]];  p[1]  = lg[p[1]];  p[2]  = lb[p[2]];
+            q1[0] = lr[q1[0]]; q1[1] = lg[q1[1]]; q1[2] = lb[q1[2]];
+            q2[0] = lr[q2[0]]; q2[1] = lg[q2[1]]; q2[2] = lb[q2[2]];
+            q3[0] = lr[q3[0]]; q3[1] = lg[q3[1]]; q3[2] = lb[q3[2]];
+            p += 4 * stride;
+        }
+        for (; i < pixels; ++i, p += stride) {
+            p[0] = lr[p[0]]; p[1] = lg[p[1]]; p[2] = lb[p[2]];
+        }
+        return;
+    }
+
+    for (; i < pixels; ++i, p += stride) {
+        for (int ch = 0; ch < nch; ++ch) p[ch] = lut[ch][p[ch]];
+    }
+}
+
+/*
+ * pk_channel_sums
+ * ---------------
+ * Sum the R, G and B channels. 3- and 4-channel layouts use the SIMD
+ * kernel selected by pk_init; the tail (and other layouts) is scalar.
+ */
+void pk_channel_sums(const unsigned char* data, size_t pixels, int channels,
+                     uint64_t sums[3]) {
+    if (channels < 3) return;
+
+    const unsigned char* p = data;
+    size_t i = 0;
+    SumsKernel k = (channels == 3) ? g_sums3 : (channels == 4) ? g_sums4 : NULL;
+    if (k) {
+        i = k(p, pixels, sums);
+        p += i * (size_t)channels;
+    }
+
+    uint64_t r = 0, g = 0, b = 0;
+    for (; i < pixels; ++i, p += channels) {
+        r += p[0];
+        g += p[1];
+        b += p[2];
+    }
+    sums[0] += r;
+    sums[1] += g;
+    sums[2] += b;
+}
+
+// Lowest-index entry among per-lane minima (lane j holds the best of
+// entries j, j + lanes, ...)
+static int nearest_reduce(const int16_t* dist, const int16_t* idx, int lanes) {
+    int best = 0;
+    for (int j = 1; j < lanes; ++j) {
+        if (dist[j] < dist[best] || (dist[j] == dist[best] && idx[j] < idx[best]))
+            best = j;
+    }
+    return idx[best];
+}
+
+#ifdef PK_X86
+/*
+ * nearest_sse2 / nearest_avx2
+ * ---------------------------
+ * 8 (16) palette entries per step as 16-bit lanes: |d| is max(d, -d),
+ * and each lane keeps its first minimum (strict compare) with its index.
+ */
+static int nearest_sse2(const PkPalette* pal, int r, int g, int b) {
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i vr = _mm_set1_epi16((short)r);
+    const __m128i vg = _mm_set1_epi16((short)g);
+    const __m128i vb = _mm_set1_epi16((short)b);
+    const __m128i step = _mm_set1_epi16(8);
+    __m128i idx = _mm_setr_epi16(0, 1, 2, 3, 4, 5, 6, 7);
+    __m128i best = _mm_set1_epi16(0x7fff), best_idx = zero;
+
+    for (int i = 0; i < 256; i += 8) {
+        __m128i dr = _mm_sub_epi16(_mm_loadu_si128((const __m128i*)(pal->r + i)), vr);
+        __m128i dg = _mm_sub_epi16(_mm_loadu_si128((const __m128i*)(pal->g + i)), vg);
+        __m128i db = _mm_sub_epi16(_mm_loadu_si128((const __m128i*)(pal->b + i)), vb);
+        __m128i d = _mm_add_epi16(_mm_max_epi16(dr, _mm_sub_epi16(zero, dr)),
+                    _mm_add_epi16(_mm_max_epi16(dg, _mm_sub_epi16(zero, dg)),
+                                  _mm_max_epi16(db, _mm_sub_epi16(zero, db))));
+        __m128i lt = _mm_cmpgt_epi16(best, d);
+        best = _mm_min_epi16(best, d);
+        best_idx = _mm_or_si128(_mm_and_si128(lt, idx), _mm_andnot_si128(lt, best_idx));
+        idx = _mm_add_epi16(idx, step);
+    }
+
+    int16_t dist[8], ind[8];
+    _mm_storeu_si128((__m128i*)dist, best);
+    _mm_storeu_si128((__m128i*)ind, best_idx);
+    return nearest_reduce(dist, ind, 8);
+}
+
+__attribute__((target("avx2")))
+static int nearest_avx2(const PkPalette* pal, int r, int g, int b) {
+    const __m256i vr = _mm256_set1_epi16((short)r);
+    const __m256i vg = _mm256_set1_epi16((short)g);
+    const __m256i vb = _mm256_set1_epi16((short)b);
+    const __m256i step = _mm256_set1_epi16(16);
+    __m256i idx = _mm256_setr_epi16(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+    __m256i best = _mm256_set1_epi16(0x7fff), best_idx = _mm256_setzero_si256();
+
+    for (int i = 0; i < 256; i += 16) {
+        __m256i dr = _mm256_sub_epi16(_mm256_loadu_si256((const __m256i*)(pal->r + i)), vr);
+        __m256i dg = _mm256_sub_epi16(_mm256_loadu_si256((const __m256i*)(pal->g + i)), vg);
+        __m256i db = _mm256_sub_epi16(_mm256_loadu_si256((const __m256i*)(pal->b + i)), vb);
+        __m256i d = _mm256_add_epi16(_mm256_abs_epi16(dr),
+                    _mm256_add_epi16(_mm256_abs_epi16(dg), _mm256_abs_epi16(db)));
+        __m256i lt = _mm256_cmpgt_epi16(best, d);
+        best = _mm256_min_epi16(best, d);
+        best_idx = _mm256_blendv_epi8(best_idx, idx, lt);
+        idx = _mm256_add_epi16(idx, step);
+    }
+
+    int16_t dist[16], ind[16];
+    _mm256_storeu_si256((__m256i*)dist, best);
+    _mm256_storeu_si256((__m256i*)ind, best_idx);
+    return nearest_reduce(dist, ind, 16);
+}
+#endif
+
+/*
+ * pk_nearest_color
+ * ----------------
+ * Exhaustive search over all 256 entries; padding entries simply lose.
+ */
+int pk_nearest_color(const PkPalette* pal, int r, int g, int b) {
+#ifdef PK_X86
+    if (g_isa == PK_ISA_AVX2) return nearest_avx2(pal, r, g, b);
+    if (g_isa == PK_ISA_SSE2) return nearest_sse2(pal, r, g, b);
+#endif
+    int best = 0, best_d = 0x7fff;
+    for (int i = 0; i < 256; ++i) {
+        int dr = pal->r[i] - r, dg = pal->g[i] - g, db = pal->b[i] - b;
+        int d = (dr < 0 ? -dr : dr) + (dg < 0 ? -dg : dg) + (db < 0 ? -db : db);
+        if (d < best_d) { best_d = d; best = i; }
+    }
+    return best;
+}
@@ -0,0 +1,51 @@
+#ifndef PIXEL_KERNELS_H
+#define PIXEL_KERNELS_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Low-level per-pixel kernels shared by the image pipelines. Buffers are
+// interleaved (row-major), `channels` bytes per pixel; only the first
+// `nch` (1..3) channels are read or written.
+
+typedef enum {
+    PK_ISA_SCALAR = 0,
+    PK_ISA_SSE2,
+    PK_ISA_AVX2
+} PkIsa;
+
+// Detect the CPU features once and select kernel implementations
+void pk_init(void);
+
+// ISA selected by pk_init (PK_ISA_SCALAR before it runs)
+PkIsa pk_isa(void);
+const char* pk_isa_name(void);
+
+// Add the histograms of the first `nch` channels of `pixels` pixels
+// into hist[ch][value], in a single interleaved pass
+void pk_histogram(const unsigned char* data, size_t pixels, int channels, int nch,
+                  uint64_t hist[3][256]);
+
+// Remap the first `nch` channels through lut[ch] in a single pass;
+// remaining channels (alpha) are left untouched
+void pk_apply_lut(unsigned char* data, size_t pixels, int channels, int nch,
+                  const unsigned char lut[3][256]);
+
+// Add the sums of channels 0..2 (R, G, B) of `pixels` pixels into
+// sums[0..2]. `channels` must be >= 3. SSE2/AVX2 for 3 and 4 channels.
+void pk_channel_sums(const unsigned char* data, size_t pixels, int channels,
+                     uint64_t sums[3]);
+
+// Palette in structure-of-arrays form for nearest-color searches.
+// Entries that must never be chosen hold PK_PALETTE_UNUSED.
+#define PK_PALETTE_UNUSED 2000
+typedef struct {
+    int16_t r[256], g[256], b[256];
+} PkPalette;
+
+// Index of the entry of `pal` closest to (r, g, b) by L1 distance
+// (|dr| + |dg| + |db|, as gif.h measures it); the lowest index wins
+// ties, so every ISA returns the same entry
+int pk_nearest_color(const PkPalette* pal, int r, int g, int b);
+
+#endif // PIXEL_KERNELS_H
@@ -16,7 +16,8 @@ typedef enum {
     MSG_IMAGE_CHUNK,            // Cliente -> Server (bytes crudos)
     MSG_IMAGE_COMPLETE,         // Cliente -> Server (payload = "jpg"/"png"/"jpeg"/"gif")
     MSG_ACK,                    // Opcional (no lo usamos por chunk)
-    MSG_ERROR                   // Server -> Cliente (texto)
+    MSG_ERROR,                  // Server -> Cliente (texto)
+    MSG_RETRY_AFTER             // Server -> Cliente: IMAGE_INFO rechazado por memoria (payload = uint32 ms, network order)
 } MessageType;
 
 // Processing types
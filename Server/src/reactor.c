@@ -0,0 +1,411 @@
+#include "reactor.h"
+#include "session.h"
+#include "logging.h"
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+
+#define REACTOR_MAX_THREADS  64
+#define REACTOR_MAX_EVENTS   128
+#define REACTOR_IDLE_TIMEOUT 15                 // seconds (threaded engine: SO_RCVTIMEO)
+#define REACTOR_READ_BUDGET  ((size_t)4 << 20)  // bytes per connection per turn
+
+typedef struct RConn {
+    Conn          conn;
+    Session       sess;
+    int           handshaking;     // TLS handshake still in progress
+    int           early;           // still reading TLS 1.3 early data
+    size_t        ssl_retry_len;   // a TLS write of this length must be retried
+    int           ready;           // queued for another turn (read budget used up)
+    time_t        last_active;
+    struct RConn* prev;
+    struct RConn* next;
+    struct RConn* next_ready;
+} RConn;
+
+typedef struct {
+    int             epfd;
+    int             evfd;        // wakes the thread: new connections, journal ACKs or stop
+    SessionMailbox  mbox;        // journal ACKs for this thread's sessions
+    pthread_t       thread;
+    pthread_mutex_t mtx;
+    RConn*          incoming;    // handed over by the accept loop (guarded by mtx)
+    RConn*          conns;       // connections owned by this thread
+    RConn*          ready;       // input may be pending although no new edge will come
+} Reactor;
+
+static Reactor     g_reactors[REACTOR_MAX_THREADS];
+static int         g_nreactors = 0;
+static atomic_int  g_reactor_running = 0;
+static atomic_uint g_reactor_next = 0;
+
+static void* reactor_main(void* arg);
+
+/*
+ * reactor_start
+ * -------------
+ * Create one epoll set and wake-up eventfd per reactor thread and start
+ * the threads. Returns 0 on success, -1 if no reactor could be started.
+ */
+int reactor_start(int threads) {
+    int n = threads;
+    if (n <= 0) {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        n = (cpus > 0) ? (int)cpus : 1;
+    }
+    if (n > REACTOR_MAX_THREADS) n = REACTOR_MAX_THREADS;
+
+    atomic_store(&g_reactor_running, 1);
+    g_nreactors = 0;
+    for (int i = 0; i < n; ++i) {
+        Reactor* r = &g_reactors[i];
+        memset(r, 0, sizeof(*r));
+        r->epfd = epoll_create1(EPOLL_CLOEXEC);
+        r->evfd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        struct epoll_event ev = { .events = EPOLLIN, .data.ptr = NULL };
+        if (r->epfd < 0 || r->evfd < 0 || epoll_ctl(r->epfd, EPOLL_CTL_ADD, r->evfd, &ev) != 0) {
+            log_line("Reactor: cannot create epoll/eventfd (errno=%d)", errno);
+            if (r->epfd >= 0) close(r->epfd);
+            if (r->evfd >= 0) close(r->evfd);
+            break;
+        }
+        pthread_mutex_init(&r->mtx, NULL);
+        session_mailbox_init(&r->mbox, r->evfd);
+        if (pthread_create(&r->thread, NULL, reactor_main, r) != 0) {
+            log_line("Reactor: failed to start thread %d", i);
+            session_mailbox_destroy(&r->mbox);
+            pthread_mutex_destroy(&r->mtx);
+            close(r->epfd);
+            close(r->evfd);
+            break;
+        }
+        g_nreactors++;
+    }
+
+    if (g_nreactors == 0) {
+        atomic_store(&g_reactor_running, 0);
+        return -1;
+    }
+    log_line("Reactor: %d epoll thread(s) started", g_nreactors);
+    return 0;
+}
+
+static void reactor_wake(Reactor* r) {
+    uint64_t one = 1;
+    ssize_t w = write(r->evfd, &one, sizeof(one));
+    (void)w;   // EAGAIN only when the counter is already non-zero
+}
+
+/*
+ * reactor_add
+ * -----------
+ * Queue an accepted connection on the next reactor (round-robin); the
+ * reactor thread registers it with its epoll set.
+ */
+int reactor_add(Conn* c) {
+    if (!atomic_load(&g_reactor_running) || g_nreactors == 0) {
+        conn_close(c);
+        free(c);
+        return -1;
+    }
+
+    RConn* rc = (RConn*)calloc(1, sizeof(RConn));
+    if (!rc) {
+        log_line("Reactor: OOM for connection state");
+        conn_close(c);
+        free(c);
+        return -1;
+    }
+    rc->conn = *c;
+    free(c);
+    session_init(&rc->sess);
+    session_set_peer(&rc->sess, rc->conn.fd);
+    if (rc->conn.ssl) {
+        rc->handshaking = 1;
+        rc->early = tls_early_data_enabled();
+        // Partial writes; queued responses may move between retries
+        SSL_set_mode(rc->conn.ssl, SSL_MODE_ENABLE_PARTIAL_WRITE | SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER);
+    }
+
+    unsigned idx = atomic_fetch_add(&g_reactor_next, 1) % (unsigned)g_nreactors;
+    Reactor* r = &g_reactors[idx];
+    session_set_mailbox(&rc->sess, &r->mbox, rc);
+    pthread_mutex_lock(&r->mtx);
+    rc->next = r->incoming;
+    r->incoming = rc;
+    pthread_mutex_unlock(&r->mtx);
+    reactor_wake(r);
+    return 0;
+}
+
+/*
+ * reactor_stop
+ * ------------
+ * Signal every reactor thread, join them and release their resources.
+ * Each thread closes its connections on the way out.
+ */
+void reactor_stop(void) {
+    if (!atomic_exchange(&g_reactor_running, 0)) return;
+    for (int i = 0; i < g_nreactors; ++i) reactor_wake(&g_reactors[i]);
+    for (int i = 0; i < g_nreactors; ++i) {
+        Reactor* r = &g_reactors[i];
+        pthread_join(r->thread, NULL);
+        session_mailbox_destroy(&r->mbox);
+        close(r->epfd);
+        close(r->evfd);
+        pthread_mutex_destroy(&r->mtx);
+    }
+    log_line("Reactor: %d thread(s) stopped", g_nreactors);
+    g_nreactors = 0;
+}
+
+/*
+ * conn_free
+ * ---------
+ * Close a connection owned by `r` (closing the fd also removes it from
+ * the epoll set) and drop any half-received image.
+ */
+static void conn_free(Reactor* r, RConn* rc) {
+    if (rc->ready) {
+        for (RConn** pp = &r->ready; *pp; pp = &(*pp)->next_ready) {
+            if (*pp == rc) { *pp = rc->next_ready; break; }
+        }
+    }
+    if (rc->prev) rc->prev->next = rc->next; else if (r->conns == rc) r->conns = rc->next;
+    if (rc->next) rc->next->prev = rc->prev;
+
+    session_destroy(&rc->sess);
+    conn_close(&rc->conn);
+    free(rc);
+    log_line("Connection closed");
+}
+
+/*
+ * conn_flush
+ * ----------
+ * Write queued responses. Returns 0 when everything was sent, 1 when
+ * the socket is full (EPOLLOUT will resume it), -1 on error.
+ */
+static int conn_flush(RConn* rc) {
+    const void* out;
+    size_t n;
+    while ((n = session_pending_output(&rc->sess, &out)) > 0) {
+        if (rc->ssl_retry_len) n = rc->ssl_retry_len;   // TLS retries reuse the length
+        long w = cs_send_some(&rc->conn, out, n);
+        if (w == CS_AGAIN) {
+            if (rc->conn.ssl) rc->ssl_retry_len = n;
+            return 1;
+        }
+        if (w < 0) {
+            log_line("Failed sending response");
+            return -1;
+        }
+        rc->ssl_retry_len = 0;
+        session_consume_output(&rc->sess, (size_t)w);
+    }
+    return 0;
+}
+
+/*
+ * conn_drive
+ * ----------
+ * Make all the progress possible on a readiness edge: finish the TLS
+ * handshake, flush responses and read until the socket would block.
+ * After REACTOR_READ_BUDGET bytes the connection yields and is queued
+ * for another turn, so one fast upload cannot starve the others.
+ * Returns 0 to keep the connection, -1 to close it.
+ */
+static int conn_drive(Reactor* r, RConn* rc) {
+    rc->last_active = time(NULL);
+
+    if (rc->handshaking) {
+        // 0-RTT data (if enabled) goes to the session before SSL_accept
+        while (rc->early) {
+            void* buf;
+            size_t len;
+            session_recv_window(&rc->sess, &buf, &len);
+            if (len == 0) {
+                if (session_ack_pending(&rc->sess)) return 0;   // resumed by the ACK
+                log_line("TLS early data backlog, closing");
+                return -1;
+            }
+            long n = tls_read_early(&rc->conn, buf, len);
+            if (n == CS_AGAIN) return 0;
+            if (n < 0) {
+                log_line("TLS handshake failed");
+                return -1;
+            }
+            if (n == 0) { rc->early = 0; break; }
+            if (session_received(&rc->sess, (size_t)n) == SESSION_FAILED) return -1;
+        }
+
+        int ret = SSL_accept(rc->conn.ssl);
+        if (ret != 1) {
+            int err = SSL_get_error(rc->conn.ssl, ret);
+            if (err == SSL_ERROR_WANT_READ || err == SSL_ERROR_WANT_WRITE) return 0;
+            log_line("TLS handshake failed");
+            return -1;
+        }
+        rc->handshaking = 0;
+        tls_note_handshake(&rc->conn);
+    }
+
+    size_t budget = REACTOR_READ_BUDGET;
+    for (;;) {
+        int fr = conn_flush(rc);
+        if (fr < 0) return -1;
+        if (rc->sess.status != SESSION_OPEN) {
+            // close once flushed, after the held ACKs of a peer that stopped sending
+            if (rc->sess.status == SESSION_DONE && session_ack_pending(&rc->sess)) return 0;
+            return (fr == 0) ? -1 : 0;
+        }
+
+        void* buf;
+        size_t len;
+        session_recv_window(&rc->sess, &buf, &len);
+        if (len == 0) return 0;   // responses must drain first (EPOLLOUT) or the ACK is held
+        if (budget == 0) {
+            if (!rc->ready) {
+                rc->ready = 1;
+                rc->next_ready = r->ready;
+                r->ready = rc;
+            }
+            return 0;
+        }
+        if (len > budget) len = budget;
+
+        long n = cs_recv_some(&rc->conn, buf, len);
+        if (n == CS_AGAIN) return 0;
+        if (n < 0) {
+            session_log_disconnect(&rc->sess, n);
+            if (n != CS_EOF || !session_ack_pending(&rc->sess)) return -1;
+            session_end_input(&rc->sess);
+            continue;
+        }
+        budget -= (size_t)n;
+        if (session_received(&rc->sess, (size_t)n) == SESSION_FAILED) return -1;
+    }
+}
+
+/*
+ * adopt_incoming
+ * --------------
+ * Move connections queued by reactor_add into this thread's epoll set.
+ * Registration is edge-triggered for both directions; a socket that is
+ * already readable reports an edge right away.
+ */
+static void adopt_incoming(Reactor* r) {
+    pthread_mutex_lock(&r->mtx);
+    RConn* list = r->incoming;
+    r->incoming = NULL;
+    pthread_mutex_unlock(&r->mtx);
+
+    time_t now = time(NULL);
+    while (list) {
+        RConn* rc = list;
+        list = rc->next;
+
+        rc->prev = NULL;
+        rc->next = r->conns;
+        if (r->conns) r->conns->prev = rc;
+        r->conns = rc;
+        rc->last_active = now;
+
+        struct epoll_event ev;
+        ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+        ev.data.ptr = rc;
+        if (epoll_ctl(r->epfd, EPOLL_CTL_ADD, rc->conn.fd, &ev) != 0) {
+            log_line("Reactor: epoll_ctl ADD failed (errno=%d)", errno);
+            conn_free(r, rc);
+        }
+    }
+}
+
+/*
+ * sweep_idle
+ * ----------
+ * Close connections without any activity for REACTOR_IDLE_TIMEOUT s.
+ */
+static void sweep_idle(Reactor* r, time_t now) {
+    RConn* rc = r->conns;
+    while (rc) {
+        RConn* next = rc->next;
+        if (now - rc->last_active >= REACTOR_IDLE_TIMEOUT) {
+            log_line("Connection idle for %d s, closing", REACTOR_IDLE_TIMEOUT);
+            conn_free(r, rc);
+        }
+        rc = next;
+    }
+}
+
+// Journal ACKs were queued: send them
+static void on_session_ack(void* owner, void* ctx) {
+    Reactor* r = (Reactor*)ctx;
+    RConn* rc = (RConn*)owner;
+    if (conn_drive(r, rc) != 0) conn_free(r, rc);
+}
+
+/*
+ * reactor_main
+ * ------------
+ * Event loop of one reactor thread.
+ */
+static void* reactor_main(void* arg) {
+    Reactor* r = (Reactor*)arg;
+    struct epoll_event evs[REACTOR_MAX_EVENTS];
+    time_t last_sweep = time(NULL);
+
+    while (atomic_load(&g_reactor_running)) {
+        int n = epoll_wait(r->epfd, evs, REACTOR_MAX_EVENTS, r->ready ? 0 : 1000);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            log_line("Reactor: epoll_wait failed (errno=%d)", errno);
+            break;
+        }
+
+        int woken = 0;
+        for (int i = 0; i < n; ++i) {
+            RConn* rc = (RConn*)evs[i].data.ptr;
+            if (!rc) {
+                uint64_t v;
+                while (read(r->evfd, &v, sizeof(v)) > 0) { }
+                adopt_incoming(r);
+                woken = 1;
+                continue;
+            }
+            if (conn_drive(r, rc) != 0) conn_free(r, rc);
+        }
+
+        // Journal ACKs, once no event of this batch can refer to a
+        // connection they close
+        if (woken) session_mailbox_collect(&r->mbox, on_session_ack, r);
+
+        // Give connections that hit their read budget another turn
+        RConn* batch = r->ready;
+        r->ready = NULL;
+        while (batch) {
+            RConn* rc = batch;
+            batch = rc->next_ready;
+            rc->ready = 0;
+            if (conn_drive(r, rc) != 0) conn_free(r, rc);
+        }
+
+        time_t now = time(NULL);
+        if (now != last_sweep) {
+            sweep_idle(r, now);
+            last_sweep = now;
+        }
+    }
+
+    // Shutdown: drop pending and open connections
+    adopt_incoming(r);
+    while (r->conns) conn_free(r, r->conns);
+    return NULL;
+}
@@ -0,0 +1,24 @@
+#ifndef REACTOR_H
+#define REACTOR_H
+
+#include "connection.h"
+
+// Event-driven connection engine: N reactor threads, each with its own
+// edge-triggered epoll set, drive many non-blocking connections through
+// their protocol sessions (including the TLS handshake). Connections
+// are assigned round-robin by the accept loop.
+
+// Start `threads` reactor threads (<= 0 = one per online CPU)
+// Returns: 0 on success, -1 on failure
+int reactor_start(int threads);
+
+// Hand over an accepted connection. The socket must be non-blocking;
+// for TLS, `c->ssl` is set up in accept state and not yet handshaken.
+// Takes ownership of `c` (also on failure).
+// Returns: 0 on success, -1 on failure
+int reactor_add(Conn* c);
+
+// Stop the reactor threads and close every remaining connection
+void reactor_stop(void);
+
+#endif // REACTOR_H
@@ -1,10 +1,23 @@
 #include "scheduler.h"
 #include "image_processing.h"
 #include "logging.h"
+#include "buffer_pool.h"
+#include "mem_budget.h"
+#include "spool.h"
+#include "journal.h"
+#include "cost_model.h"
 #include <pthread.h>
 #include <stdlib.h>
+#include <stdint.h>
 #include <string.h>
+#include <unistd.h>
+#include <sched.h>
 #include <stdatomic.h>
+#include <time.h>
+
+#define MAX_WORKERS 256
+#define HEAD_EMPTY  UINT64_MAX
+#define FAIR_SLOTS  1024          // clients hash into this many fair-share accounts
 
 // ---- Min-heap ordered by ascending total_size ----
 typedef struct {
@@ -13,11 +26,45 @@ typedef struct {
     size_t   cap;
 } JobHeap;
 
-static JobHeap         g_heap = {0};
-static pthread_mutex_t g_mtx  = PTHREAD_MUTEX_INITIALIZER;
-static pthread_cond_t  g_cv   = PTHREAD_COND_INITIALIZER;
-static pthread_t       g_worker;
+// Per-worker queue. Each worker owns a local min-heap guarded by its own
+// mutex; `head_key` mirrors the key of the heap top so other workers can
+// pick the smallest visible job without taking any lock.
+typedef struct {
+    JobHeap               heap;
+    pthread_mutex_t       mtx;
+    pthread_cond_t        cv;
+    atomic_uint_least64_t head_key;  // HEAD_EMPTY when the heap is empty
+    atomic_int            idle;      // 1 while the worker is (about to be) parked
+    int                   wake;      // wake-up token, guarded by mtx
+    pthread_t             thread;
+} WorkerQueue;
+
+static WorkerQueue     g_queues[MAX_WORKERS];
+static int             g_nworkers = 0;
 static atomic_int      g_running = 0;
+static atomic_int      g_enqueuers = 0;  // producers currently inside scheduler_enqueue
+static atomic_uint     g_rr = 0;         // round-robin cursor for queue selection
+
+static atomic_ullong   g_stat_enqueued = 0;
+static atomic_ullong   g_stat_processed = 0;
+static atomic_ullong   g_stat_steals = 0;
+static atomic_ullong   g_stat_spilled = 0;
+
+static size_t          g_spill_limit = 0;    // 0 = queued payloads always stay in memory
+static atomic_size_t   g_queued_ram = 0;     // payload bytes of queued, non-spilled jobs
+
+static SchedulerJobHandler g_handler = NULL;
+
+// Dispatch policy. Every policy maps a job to a key that is fixed at
+// enqueue time, so both the per-worker heaps and the cross-queue head
+// comparison stay plain "smallest key first" with no rescans.
+static SchedulerPolicy g_policy = { SCHED_SMALLEST_FIRST, 0, 0.0, 0.0, 0, 0, 0.0 };
+static uint64_t        g_epoch_us = 0;
+static atomic_uint_least64_t g_vtime = 0;                    // fair share: start tag last dispatched
+static atomic_uint_least64_t g_fair_finish[FAIR_SLOTS];      // fair share: last finish tag per client
+
+static atomic_ullong   g_wait_count[SCHED_CLASSES][SCHED_WAIT_BUCKETS];
+static atomic_ullong   g_wait_max[SCHED_CLASSES];
 
 static int  heap_reserve(JobHeap* h, size_t need);
 static void heap_sift_up(JobHeap* h, size_t idx);
@@ -27,120 +74,604 @@ static int  heap_pop_min(JobHeap* h, ProcJob* out);
 static void free_job(ProcJob* j);
 static void* worker_main(void* arg);
 
+static uint64_t job_key(const ProcJob* j) { return j->prio_key; }
+
+static void queue_publish_head(WorkerQueue* q) {
+    atomic_store(&q->head_key, q->heap.size ? job_key(&q->heap.data[0]) : HEAD_EMPTY);
+}
+
+/*
+ * scheduler_resolve_workers
+ * -------------------------
+ * Translate a configured worker count into the number of threads to
+ * start. Values <= 0 mean "auto": one worker per online CPU. The result
+ * is clamped to [1, MAX_WORKERS].
+ */
+int scheduler_resolve_workers(int requested) {
+    int n = requested;
+    if (n <= 0) {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        n = (cpus > 0) ? (int)cpus : 1;
+    }
+    if (n > MAX_WORKERS) n = MAX_WORKERS;
+    return n;
+}
+
+/*
+ * scheduler_set_job_handler
+ * -------------------------
+ * Replace the function workers run for each dequeued job. Passing NULL
+ * restores the default image processing pipeline. Must be called
+ * before scheduler_init (used by the benchmark mode).
+ */
+void scheduler_set_job_handler(SchedulerJobHandler fn) {
+    g_handler = fn;
+}
+
+/*
+ * scheduler_set_spill_limit
+ * -------------------------
+ * Set how many payload bytes queued jobs may keep in memory before new
+ * jobs are spilled to the disk spool. 0 disables spilling. Must be
+ * called before scheduler_init.
+ */
+void scheduler_set_spill_limit(size_t bytes) {
+    g_spill_limit = bytes;
+}
+
+/*
+ * scheduler_set_policy
+ * --------------------
+ * Choose how queued jobs are ordered. NULL restores smallest first.
+ * Must be called before scheduler_init.
+ */
+void scheduler_set_policy(const SchedulerPolicy* p) {
+    if (p) g_policy = *p;
+    else memset(&g_policy, 0, sizeof(g_policy));
+}
+
+const char* scheduler_policy_name(SchedPolicy p) {
+    switch (p) {
+        case SCHED_AGING:      return "aging";
+        case SCHED_FAIR_SHARE: return "fair";
+        case SCHED_DEADLINE:   return "deadline";
+        default:               return "smallest";
+    }
+}
+
+static uint64_t now_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000u + (uint64_t)ts.tv_nsec / 1000u;
+}
+
+static uint64_t clamp_key(double k) {
+    return k >= (double)(HEAD_EMPTY - 1) ? HEAD_EMPTY - 1 : (uint64_t)k;
+}
+
+// Predicted cost (us) or upload size (bytes), see SchedulerPolicy
+static int cost_weighted(const ProcJob* j) { return g_policy.order_by_cost && j->cost_us; }
+static uint64_t job_weight(const ProcJob* j) { return cost_weighted(j) ? j->cost_us : j->total_size; }
+
+/*
+ * assign_key
+ * ----------
+ * Compute the dispatch key of a job about to be queued (smaller runs
+ * first), from its weight:
+ *  - smallest: the weight (cheapest or smallest first).
+ *  - aging: weight + rate * enqueue time. The effective priority
+ *    weight - rate * waited then improves with the wait, and since every
+ *    job ages at the same rate the order never has to be recomputed.
+ *  - fair: finish tag of start-time fair queuing. A client's next job
+ *    starts where its previous one finished, or at the current virtual
+ *    time if it was idle, so a flood from one client cannot push back
+ *    another client's jobs by more than one job each.
+ *  - deadline: enqueue time plus a target wait that grows with the
+ *    weight.
+ */
+static void assign_key(ProcJob* j) {
+    uint64_t now = now_us() - g_epoch_us;
+    uint64_t weight = job_weight(j);
+    j->enqueued_us = now;
+
+    switch (g_policy.policy) {
+    case SCHED_AGING: {
+        double rate = cost_weighted(j) ? g_policy.aging_cost_us_per_sec : g_policy.aging_bytes_per_sec;
+        j->prio_key = clamp_key((double)weight + rate * (double)now / 1e6);
+        break;
+    }
+    case SCHED_FAIR_SHARE: {
+        atomic_uint_least64_t* slot = &g_fair_finish[j->client_id % FAIR_SLOTS];
+        uint64_t prev = atomic_load(slot), finish;
+        do {
+            uint64_t v = atomic_load(&g_vtime);
+            uint64_t start = prev > v ? prev : v;
+            finish = start + weight + 1;
+        } while (!atomic_compare_exchange_weak(slot, &prev, finish));
+        j->prio_key = finish < HEAD_EMPTY ? finish : HEAD_EMPTY - 1;
+        break;
+    }
+    case SCHED_DEADLINE: {
+        double target = cost_weighted(j)
+            ? g_policy.deadline_cost_factor * (double)weight
+            : (double)g_policy.deadline_us_per_mb * (double)weight / (1024.0 * 1024.0);
+        j->prio_key = clamp_key((double)now + (double)g_policy.deadline_base_us + target);
+        break;
+    }
+    default:
+        j->prio_key = weight;
+        break;
+    }
+}
+
+static int size_class(uint32_t total_size) {
+    if (total_size < (1u << 20)) return SCHED_CLASS_SMALL;
+    if (total_size < (16u << 20)) return SCHED_CLASS_MEDIUM;
+    return SCHED_CLASS_LARGE;
+}
+
+/*
+ * note_dispatch
+ * -------------
+ * Bookkeeping when a worker takes a job: record its queue wait and, for
+ * fair share, advance the virtual time to the job's start tag.
+ */
+static void note_dispatch(const ProcJob* j) {
+    uint64_t waited = now_us() - g_epoch_us - j->enqueued_us;
+    uint64_t ms = waited / 1000;
+    int b = 0;
+    while (ms && b < SCHED_WAIT_BUCKETS - 1) { ms >>= 1; b++; }
+    int c = size_class(j->total_size);
+    atomic_fetch_add_explicit(&g_wait_count[c][b], 1, memory_order_relaxed);
+    unsigned long long mx = atomic_load_explicit(&g_wait_max[c], memory_order_relaxed);
+    while (waited > mx &&
+           !atomic_compare_exchange_weak_explicit(&g_wait_max[c], &mx, waited,
+                                                  memory_order_relaxed, memory_order_relaxed)) {
+    }
+
+    if (g_policy.policy == SCHED_FAIR_SHARE) {
+        uint64_t start = j->prio_key - job_weight(j) - 1;
+        uint64_t v = atomic_load(&g_vtime);
+        while (start > v && !atomic_compare_exchange_weak(&g_vtime, &v, start)) {
+        }
+    }
+}
+
 /*
  * scheduler_init
  * --------------
- * Initialize the background scheduler and start the worker thread.
+ * Initialize the background scheduler and start the worker pool.
+ * `num_workers` <= 0 selects one worker per online CPU. Every worker
+ * owns a local min-heap; idle workers steal from the queue whose head
+ * is smallest, so dispatch stays (approximately) smallest-first without
+ * a global lock.
  * Returns 0 on success, -1 on failure.
  */
-int scheduler_init(void) {
-    pthread_mutex_lock(&g_mtx);
-    g_heap.data = NULL;
-    g_heap.size = 0;
-    g_heap.cap  = 0;
-    g_running = 1;
-    pthread_mutex_unlock(&g_mtx);
-
-    int rc = pthread_create(&g_worker, NULL, worker_main, NULL);
-    if (rc != 0) {
-        g_running = 0;
-        log_line("Scheduler: failed to start worker thread (rc=%d)", rc);
+int scheduler_init(int num_workers) {
+    int n = scheduler_resolve_workers(num_workers);
+
+    for (int i = 0; i < n; ++i) {
+        WorkerQueue* q = &g_queues[i];
+        memset(&q->heap, 0, sizeof(q->heap));
+        pthread_mutex_init(&q->mtx, NULL);
+        pthread_cond_init(&q->cv, NULL);
+        atomic_store(&q->head_key, HEAD_EMPTY);
+        atomic_store(&q->idle, 0);
+        q->wake = 0;
+    }
+    atomic_store(&g_stat_enqueued, 0);
+    atomic_store(&g_stat_processed, 0);
+    atomic_store(&g_stat_steals, 0);
+    atomic_store(&g_stat_spilled, 0);
+    atomic_store(&g_queued_ram, 0);
+    g_epoch_us = now_us();
+    atomic_store(&g_vtime, 0);
+    for (int i = 0; i < FAIR_SLOTS; ++i) atomic_store(&g_fair_finish[i], 0);
+    for (int c = 0; c < SCHED_CLASSES; ++c) {
+        for (int b = 0; b < SCHED_WAIT_BUCKETS; ++b) atomic_store(&g_wait_count[c][b], 0);
+        atomic_store(&g_wait_max[c], 0);
+    }
+
+    // queues must be visible before any producer or thief looks at them
+    g_nworkers = n;
+    atomic_store(&g_running, 1);
+
+    int started = 0;
+    for (int i = 0; i < n; ++i) {
+        int rc = pthread_create(&g_queues[i].thread, NULL, worker_main, (void*)(intptr_t)i);
+        if (rc != 0) {
+            log_line("Scheduler: failed to start worker %d (rc=%d)", i, rc);
+            break;
+        }
+        started++;
+    }
+
+    if (started < n) {
+        // abort the partially started pool; the started workers exit at once
+        atomic_store(&g_running, 0);
+        for (int i = 0; i < started; ++i) {
+            pthread_mutex_lock(&g_queues[i].mtx);
+            pthread_cond_broadcast(&g_queues[i].cv);
+            pthread_mutex_unlock(&g_queues[i].mtx);
+        }
+        for (int i = 0; i < started; ++i) pthread_join(g_queues[i].thread, NULL);
+        for (int i = 0; i < n; ++i) {
+            pthread_mutex_destroy(&g_queues[i].mtx);
+            pthread_cond_destroy(&g_queues[i].cv);
+        }
+        g_nworkers = 0;
         return -1;
     }
-    log_line("Scheduler: worker thread started");
+    log_line("Scheduler: %d worker thread(s) started (work-stealing queues, policy %s by %s)",
+             n, scheduler_policy_name(g_policy.policy), g_policy.order_by_cost ? "cost" : "size");
     return 0;
 }
 
+/*
+ * wake_one_idle
+ * -------------
+ * Hand a wake-up token to one parked worker (other than `skip`) so it
+ * can steal a job that was queued behind a busy worker.
+ */
+static void wake_one_idle(int skip) {
+    for (int i = 0; i < g_nworkers; ++i) {
+        if (i == skip || !atomic_load(&g_queues[i].idle)) continue;
+        WorkerQueue* q = &g_queues[i];
+        pthread_mutex_lock(&q->mtx);
+        q->wake = 1;
+        pthread_cond_signal(&q->cv);
+        pthread_mutex_unlock(&q->mtx);
+        return;
+    }
+}
+
+/*
+ * spill_payload
+ * -------------
+ * Move the payload of a job that is about to wait in a queue to the disk
+ * spool when queued payloads already hold the configured amount of
+ * memory. A journaled payload is mapped back from its journal record,
+ * which already holds the bytes; others are written to a spool file. On
+ * success `j` points at the read-only mapping; the caller's buffer is
+ * released only once the job is queued. Jobs with a streaming decoder
+ * keep their buffer, which the decoder is reading.
+ */
+static void spill_payload(ProcJob* j) {
+    j->spilled = 0;
+    size_t before = atomic_fetch_add(&g_queued_ram, j->size);
+    if (!g_spill_limit || j->stream || before + j->size <= g_spill_limit) return;
+
+    unsigned char* map = journal_map_payload(j);
+    if (!map) map = spool_store(j->data, j->size);
+    if (!map) return; // keep it in memory
+    atomic_fetch_sub(&g_queued_ram, j->size);
+    j->data = map;
+    j->spilled = 1;
+}
+
 /*
  * scheduler_enqueue
  * -----------------
  * Enqueue a processing job. The ProcJob structure's `data` buffer is
  * assumed to be owned by the caller and will become owned by the
  * scheduler on successful enqueue (the worker will free it).
+ * The job goes to a parked worker when there is one, otherwise to the
+ * next round-robin queue (or its neighbour when that one is empty);
+ * only the chosen queue's lock is taken. The policy key is assigned
+ * here. A job that has to wait while
+ * the queued backlog is over the spill limit is spilled to disk first;
+ * the heap keeps only its descriptor, so ordering is unchanged. A job
+ * that arrives already spilled (replayed from the journal) is queued
+ * as is, and its mapping stays the caller's if queuing fails.
  * Returns 0 on success, -1 on error.
  */
 int scheduler_enqueue(const ProcJob* job) {
     if (!job || !job->data || job->size == 0) return -1;
 
-    pthread_mutex_lock(&g_mtx);
-    if (!g_running) { pthread_mutex_unlock(&g_mtx); return -1; }
+    atomic_fetch_add(&g_enqueuers, 1);
+    if (!atomic_load(&g_running)) {
+        atomic_fetch_sub(&g_enqueuers, 1);
+        return -1;
+    }
+
+    int n = g_nworkers;
+    int start = (int)(atomic_fetch_add(&g_rr, 1) % (unsigned)n);
+    int target = -1;
+    for (int k = 0; k < n; ++k) {
+        int i = (start + k) % n;
+        if (atomic_load(&g_queues[i].idle)) { target = i; break; }
+    }
 
-    if (heap_push(&g_heap, job) != 0) {
-        pthread_mutex_unlock(&g_mtx);
+    ProcJob j = *job;
+    int mapped = j.spilled;       // payload was never in memory
+    assign_key(&j);
+    if (target < 0) {
+        int alt = (start + 1) % n;
+        target = (atomic_load(&g_queues[alt].head_key) == HEAD_EMPTY) ? alt : start;
+        if (!mapped) spill_payload(&j);
+    } else if (!mapped) {
+        // a parked worker takes it right away
+        j.spilled = 0;
+        atomic_fetch_add(&g_queued_ram, j.size);
+    }
+    // a spilled payload no longer counts against the memory budget
+    size_t uncharged = 0;
+    if (j.spilled && !mapped) {
+        uncharged = j.size < j.mem_charge ? j.size : j.mem_charge;
+        j.mem_charge -= uncharged;
+    }
+
+    WorkerQueue* q = &g_queues[target];
+    pthread_mutex_lock(&q->mtx);
+    if (heap_push(&q->heap, &j) != 0) {
+        pthread_mutex_unlock(&q->mtx);
+        if (!j.spilled) atomic_fetch_sub(&g_queued_ram, j.size);
+        else if (!mapped) spool_release(j.data, j.size);
+        atomic_fetch_sub(&g_enqueuers, 1);
         log_line("Scheduler: heap_push failed (OOM?)");
         return -1;
     }
-    pthread_cond_signal(&g_cv);
-    pthread_mutex_unlock(&g_mtx);
+    queue_publish_head(q);
+    pthread_cond_signal(&q->cv);
+    pthread_mutex_unlock(&q->mtx);
+
+    // the owner may be busy with a long job: let a parked worker steal it
+    if (!atomic_load(&q->idle)) wake_one_idle(target);
 
-    log_line("Scheduler: enqueued id=%s size=%u file=%s fmt=%s",
-             job->image_id, job->total_size, job->filename, job->format);
+    atomic_fetch_add(&g_stat_enqueued, 1);
+    atomic_fetch_sub(&g_enqueuers, 1);
+
+    if (j.spilled && !mapped) {
+        bp_free(job->data);
+        budget_release(uncharged);
+        atomic_fetch_add(&g_stat_spilled, 1);
+    }
+
+    log_line("Scheduler: enqueued id=%s size=%u file=%s fmt=%s (queue %d%s)",
+             job->image_id, job->total_size, job->filename, job->format, target,
+             j.spilled ? ", spilled" : "");
     return 0;
 }
 
+/*
+ * take_job
+ * --------
+ * Pop the smallest job visible to worker `self`: the queue (own or a
+ * victim's) with the smallest published head is chosen, preferring the
+ * local queue on ties. Returns 1 when a job was taken, 0 when every
+ * queue is empty.
+ */
+static int take_job(int self, ProcJob* out) {
+    for (int attempt = 0; attempt < 4; ++attempt) {
+        int best = -1;
+        uint64_t best_key = HEAD_EMPTY;
+
+        uint64_t own = atomic_load(&g_queues[self].head_key);
+        if (own != HEAD_EMPTY) { best = self; best_key = own; }
+
+        for (int k = 1; k < g_nworkers; ++k) {
+            int i = (self + k) % g_nworkers;
+            uint64_t key = atomic_load(&g_queues[i].head_key);
+            if (key < best_key) { best = i; best_key = key; }
+        }
+        if (best < 0) return 0;
+
+        WorkerQueue* q = &g_queues[best];
+        pthread_mutex_lock(&q->mtx);
+        int ok = heap_pop_min(&q->heap, out);
+        if (ok) queue_publish_head(q);
+        pthread_mutex_unlock(&q->mtx);
+
+        if (ok) {
+            if (!out->spilled) atomic_fetch_sub(&g_queued_ram, out->size);
+            note_dispatch(out);
+            if (best != self) atomic_fetch_add(&g_stat_steals, 1);
+            return 1;
+        }
+        // lost the race for that head; rescan
+    }
+    return 0;
+}
+
+static int all_queues_empty(void) {
+    for (int i = 0; i < g_nworkers; ++i) {
+        if (atomic_load(&g_queues[i].head_key) != HEAD_EMPTY) return 0;
+    }
+    return 1;
+}
+
+static const char* const k_class_names[SCHED_CLASSES] = { "<1MiB", "1-16MiB", ">=16MiB" };
+
+// Upper bound (ms) of histogram bucket b
+static unsigned long long bucket_limit_ms(int b) { return 1ull << b; }
+
+static unsigned long long bucket_percentile(const unsigned long long* count, unsigned long long total,
+                                            double q) {
+    unsigned long long need = (unsigned long long)(q * (double)total + 0.5), seen = 0;
+    if (need == 0) need = 1;
+    for (int b = 0; b < SCHED_WAIT_BUCKETS; ++b) {
+        seen += count[b];
+        if (seen >= need) return bucket_limit_ms(b);
+    }
+    return bucket_limit_ms(SCHED_WAIT_BUCKETS - 1);
+}
+
+/*
+ * log_wait_histograms
+ * -------------------
+ * One line per size class: job count, bucket-resolution p50/p99, the
+ * largest wait and the non-empty buckets as "<upper bound ms>:count".
+ */
+static void log_wait_histograms(void) {
+    SchedulerWaitHistogram h;
+    scheduler_get_wait_histogram(&h);
+    for (int c = 0; c < SCHED_CLASSES; ++c) {
+        unsigned long long total = 0;
+        for (int b = 0; b < SCHED_WAIT_BUCKETS; ++b) total += h.count[c][b];
+        if (!total) continue;
+
+        char buckets[512];
+        size_t off = 0;
+        buckets[0] = '\0';
+        for (int b = 0; b < SCHED_WAIT_BUCKETS && off < sizeof(buckets); ++b) {
+            if (!h.count[c][b]) continue;
+            int n = snprintf(buckets + off, sizeof(buckets) - off, " %llu:%llu",
+                             bucket_limit_ms(b), h.count[c][b]);
+            if (n < 0) break;
+            off += (size_t)n;
+        }
+        log_line("Scheduler: queue wait (%s) %s: n=%llu p50<%llums p99<%llums max=%.1fms |%s",
+                 scheduler_policy_name(h.policy), k_class_names[c], total,
+                 bucket_percentile(h.count[c], total, 0.50),
+                 bucket_percentile(h.count[c], total, 0.99),
+                 (double)h.max_us[c] / 1000.0, buckets);
+    }
+}
+
 /*
  * scheduler_shutdown
  * ------------------
- * Stop the worker thread, drain and free any queued jobs, and release
- * scheduler resources. Safe to call multiple times.
+ * Stop accepting jobs, let the workers drain whatever is still queued,
+ * join every worker and release scheduler resources. Safe to call
+ * multiple times.
  */
 void scheduler_shutdown(void) {
-    pthread_mutex_lock(&g_mtx);
-    if (g_running) {
-        g_running = 0;
-        pthread_cond_broadcast(&g_cv);
-        pthread_mutex_unlock(&g_mtx);
-        pthread_join(g_worker, NULL);
-    } else {
-        pthread_mutex_unlock(&g_mtx);
+    if (atomic_exchange(&g_running, 0)) {
+        // producers that already passed the running check finish their push
+        while (atomic_load(&g_enqueuers) > 0) sched_yield();
+
+        for (int i = 0; i < g_nworkers; ++i) {
+            pthread_mutex_lock(&g_queues[i].mtx);
+            pthread_cond_broadcast(&g_queues[i].cv);
+            pthread_mutex_unlock(&g_queues[i].mtx);
+        }
+        for (int i = 0; i < g_nworkers; ++i) {
+            pthread_join(g_queues[i].thread, NULL);
+        }
+
+        // workers exit only once every queue is empty; free anything left
+        for (int i = 0; i < g_nworkers; ++i) {
+            WorkerQueue* q = &g_queues[i];
+            for (size_t k = 0; k < q->heap.size; ++k) {
+                if (!q->heap.data[k].spilled) atomic_fetch_sub(&g_queued_ram, q->heap.data[k].size);
+                free_job(&q->heap.data[k]);
+            }
+            free(q->heap.data);
+            memset(&q->heap, 0, sizeof(q->heap));
+            pthread_mutex_destroy(&q->mtx);
+            pthread_cond_destroy(&q->cv);
+        }
+        g_nworkers = 0;
+        log_wait_histograms();
+        cost_model_log();
     }
 
-    // drain heap and free buffers
-    pthread_mutex_lock(&g_mtx);
-    for (size_t i = 0; i < g_heap.size; ++i) {
-        free_job(&g_heap.data[i]);
+    log_line("Scheduler: worker threads stopped");
+}
+
+/*
+ * scheduler_get_stats
+ * -------------------
+ * Snapshot the scheduler counters (jobs enqueued, processed, stolen
+ * from another worker's queue and spilled to disk).
+ */
+void scheduler_get_stats(SchedulerStats* out) {
+    if (!out) return;
+    out->enqueued  = atomic_load(&g_stat_enqueued);
+    out->processed = atomic_load(&g_stat_processed);
+    out->steals    = atomic_load(&g_stat_steals);
+    out->spilled   = atomic_load(&g_stat_spilled);
+}
+
+/*
+ * scheduler_get_wait_histogram
+ * ----------------------------
+ * Snapshot the queue-wait histograms of the current policy.
+ */
+void scheduler_get_wait_histogram(SchedulerWaitHistogram* out) {
+    if (!out) return;
+    out->policy = g_policy.policy;
+    for (int c = 0; c < SCHED_CLASSES; ++c) {
+        for (int b = 0; b < SCHED_WAIT_BUCKETS; ++b) out->count[c][b] = atomic_load(&g_wait_count[c][b]);
+        out->max_us[c] = atomic_load(&g_wait_max[c]);
     }
-    free(g_heap.data);
-    g_heap.data = NULL;
-    g_heap.size = g_heap.cap = 0;
-    pthread_mutex_unlock(&g_mtx);
+}
 
-    log_line("Scheduler: worker thread stopped");
+/*
+ * run_job
+ * -------
+ * Default job handler: run the in-memory image processing pipeline,
+ * on the pixels of the streaming decoder when the upload had one.
+ */
+static JobResult run_job(const ProcJob* job) {
+    if (job->stream && sd_process(job->stream, job->image_id, job->filename,
+                                  job->format, job->processing_type) == 0) return JOB_STREAMED;
+    if (process_image_from_memory(job->data, job->size,
+                                  job->image_id, job->filename, job->format,
+                                  job->processing_type) != 0) return JOB_FAILED;
+    return JOB_DONE;
 }
 
 /*
  * worker_main
  * -----------
- * Main loop for the scheduler worker thread: wait for jobs, process
- * them using the image processing pipeline and free job buffers.
+ * Main loop for a scheduler worker thread: take the smallest visible
+ * job (local or stolen), process it and free its buffer. When nothing
+ * is queued the worker advertises itself as idle and parks on its own
+ * condition variable. After shutdown is requested workers keep taking
+ * jobs until every queue is empty, so accepted jobs are not lost.
  */
 static void* worker_main(void* arg) {
-    (void)arg;
+    int wid = (int)(intptr_t)arg;
+    WorkerQueue* self = &g_queues[wid];
+    SchedulerJobHandler handler = g_handler ? g_handler : run_job;
+
     for (;;) {
-        pthread_mutex_lock(&g_mtx);
-        while (g_running && g_heap.size == 0) {
-            pthread_cond_wait(&g_cv, &g_mtx);
-        }
-        if (!g_running && g_heap.size == 0) {
-            pthread_mutex_unlock(&g_mtx);
-            break;
-        }
         ProcJob job;
-        int ok = heap_pop_min(&g_heap, &job);
-        pthread_mutex_unlock(&g_mtx);
-        if (!ok) continue;
+        int ok = take_job(wid, &job);
 
-        log_line("Scheduler: processing id=%s size=%u file=%s fmt=%s",
-                 job.image_id, job.total_size, job.filename, job.format);
+        if (!ok) {
+            // Advertise idleness before re-checking: a producer either sees
+            // idle == 1 and wakes us, or we see its job in the re-check.
+            atomic_store(&self->idle, 1);
+            ok = take_job(wid, &job);
+            if (!ok) {
+                if (!atomic_load(&g_running) && all_queues_empty()) {
+                    atomic_store(&self->idle, 0);
+                    break;
+                }
+                pthread_mutex_lock(&self->mtx);
+                while (!self->wake && self->heap.size == 0 && atomic_load(&g_running)) {
+                    pthread_cond_wait(&self->cv, &self->mtx);
+                }
+                self->wake = 0;
+                pthread_mutex_unlock(&self->mtx);
+            }
+            atomic_store(&self->idle, 0);
+            if (!ok) continue;
+        }
+
+        log_line("Scheduler: worker %d processing id=%s size=%u file=%s fmt=%s",
+                 wid, job.image_id, job.total_size, job.filename, job.format);
 
-        // Procesar desde memoria
-        process_image_from_memory(job.data, job.size,
-                                  job.image_id, job.filename, job.format,
-                                  job.processing_type);
+        uint64_t t0 = now_us();
+        JobResult result = handler(&job);
+        uint64_t took = now_us() - t0;
+        journal_complete(job.journal_seq);
 
         // liberar buffer del trabajo
         free_job(&job);
-        log_line("Scheduler: done id=%s", job.image_id);
+        atomic_fetch_add(&g_stat_processed, 1);
+        if (job.cost_us) {
+            // A streamed job was decoded during its upload and a failed one
+            // stopped early; neither time says what the codec costs
+            if (result == JOB_DONE)
+                cost_observe(&job.header, job.format, job.processing_type, job.cost_us, took);
+            log_line("Scheduler: done id=%s (predicted %.1f ms, took %.1f ms)",
+                     job.image_id, (double)job.cost_us / 1000.0, (double)took / 1000.0);
+        } else {
+            log_line("Scheduler: done id=%s", job.image_id);
+        }
     }
     return NULL;
 }
@@ -160,6 +691,8 @@ static int heap_reserve(JobHeap* h, size_t need) {
 static void heap_swap(ProcJob* a, ProcJob* b) { ProcJob t = *a; *a = *b; *b = t; }
 
 static int cmp_job(const ProcJob* a, const ProcJob* b) {
+    if (a->prio_key < b->prio_key) return -1;
+    if (a->prio_key > b->prio_key) return 1;
     if (a->total_size < b->total_size) return -1;
     if (a->total_size > b->total_size) return 1;
     return strcmp(a->filename, b->filename);
@@ -205,7 +738,11 @@ static int heap_pop_min(JobHeap* h, ProcJob* out) {
 }
 
 static void free_job(ProcJob* j) {
-    free(j->data);
+    if (j->stream) { sd_release(j->stream); j->stream = NULL; }
+    if (j->spilled) spool_release(j->data, j->size);
+    else bp_free(j->data);
+    budget_release(j->mem_charge);
     j->data = NULL;
     j->size = 0;
-}
\ No newline at end of file
+    j->mem_charge = 0;
+}
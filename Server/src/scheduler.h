@@ -4,8 +4,11 @@
 #include <stdint.h>
 #include <stddef.h>
 #include "protocol.h"
+#include "config.h"
+#include "stream_decode.h"
+#include "image_processing.h"
 
-// In-memory processing job (smallest-first by total_size)
+// In-memory processing job (ordered by the key the policy assigns at enqueue)
 typedef struct {
     unsigned char* data;           // buffer containing the complete image (owned by the scheduler)
     size_t         size;           // bytes del buffer
@@ -14,10 +17,71 @@ typedef struct {
     char           format[10];     // "jpg","jpeg","png","gif"
     ProcessingType processing_type;
     uint32_t       total_size;     // for priority (redundant with size but explicit)
+    StreamDecode*  stream;         // decode started during the upload (NULL = decode here; owned by the scheduler)
+    size_t         mem_charge;     // memory budget charge released with the job
+    int            spilled;        // data is a read-only mapping (spool file or journal segment)
+    uint64_t       journal_seq;    // accept record in the journal (0 = not journaled)
+    uint64_t       journal_seg;    // segment holding the journaled payload
+    uint64_t       journal_off;    // payload offset in that segment
+    uint32_t       client_id;      // submitting client (fair-share policy)
+    ImageHeader    header;         // probed from the upload (zeroed when unreadable)
+    uint64_t       cost_us;        // predicted processing time (0 = unknown: ordered by total_size)
+    uint64_t       prio_key;       // dispatch key (set by scheduler_enqueue; smallest first)
+    uint64_t       enqueued_us;    // enqueue time (set by scheduler_enqueue)
 } ProcJob;
 
-int scheduler_init(void);
+// Ordering parameters (see SchedPolicy). A job's weight is its
+// predicted cost in microseconds when order_by_cost is set and the job
+// has one, otherwise its total_size in bytes.
+typedef struct {
+    SchedPolicy policy;
+    int         order_by_cost;
+    double      aging_bytes_per_sec;   // SCHED_AGING: credit per second of waiting (size weights)
+    double      aging_cost_us_per_sec; // SCHED_AGING: credit per second of waiting (cost weights)
+    uint64_t    deadline_base_us;      // SCHED_DEADLINE: target wait of an empty upload
+    uint64_t    deadline_us_per_mb;    // SCHED_DEADLINE: extra target wait per MiB (size weights)
+    double      deadline_cost_factor;  // SCHED_DEADLINE: extra target wait per predicted us (cost weights)
+} SchedulerPolicy;
+
+// Queue-wait histogram: bucket 0 counts waits under 1 ms, bucket b
+// waits in [2^(b-1), 2^b) ms; the last bucket is open-ended. Jobs are
+// split by upload size so starvation of large images shows up.
+#define SCHED_WAIT_BUCKETS 24
+enum { SCHED_CLASS_SMALL = 0, SCHED_CLASS_MEDIUM, SCHED_CLASS_LARGE, SCHED_CLASSES }; // < 1 MiB, < 16 MiB, larger
+typedef struct {
+    SchedPolicy        policy;
+    unsigned long long count[SCHED_CLASSES][SCHED_WAIT_BUCKETS];
+    unsigned long long max_us[SCHED_CLASSES];
+} SchedulerWaitHistogram;
+
+// Counters exposed for logging and the benchmark mode
+typedef struct {
+    unsigned long long enqueued;   // jobs accepted by scheduler_enqueue
+    unsigned long long processed;  // jobs completed by a worker
+    unsigned long long steals;     // jobs taken from another worker's queue
+    unsigned long long spilled;    // jobs whose payload was moved to the disk spool
+} SchedulerStats;
+
+// How a job handler finished. Only JOB_DONE times are comparable from
+// job to job, so only they feed the cost model.
+typedef enum {
+    JOB_DONE = 0,   // decoded and processed by the handler
+    JOB_STREAMED,   // decoded while the upload arrived; the time excludes the decode
+    JOB_FAILED      // the image could not be decoded
+} JobResult;
+
+// Function run by a worker for each job (the scheduler frees `data` afterwards)
+typedef JobResult (*SchedulerJobHandler)(const ProcJob* job);
+
+int scheduler_resolve_workers(int requested); // <= 0 means one worker per online CPU
+void scheduler_set_job_handler(SchedulerJobHandler fn); // NULL = image pipeline; call before scheduler_init
+void scheduler_set_spill_limit(size_t bytes); // queued payload bytes kept in memory (0 = never spill); call before scheduler_init
+void scheduler_set_policy(const SchedulerPolicy* p); // NULL = smallest first; call before scheduler_init
+const char* scheduler_policy_name(SchedPolicy p);
+int scheduler_init(int num_workers);
 int scheduler_enqueue(const ProcJob* job); // makes a shallow copy of the descriptor; `data` must be allocated by the caller and becomes owned by the scheduler
+void scheduler_get_stats(SchedulerStats* out);
+void scheduler_get_wait_histogram(SchedulerWaitHistogram* out);
 void scheduler_shutdown(void);
 
 #endif // SCHEDULER_H
\ No newline at end of file
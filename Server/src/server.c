@@ -2,9 +2,10 @@
 #include "config.h"
 #include "logging.h"
 #include "connection.h"
-#include "image_processing.h"
-#include "scheduler.h"
 #include "utils.h"
+#include "session.h"
+#include "reactor.h"
+#include "uring.h"
 #include "protocol.h"
 #include <stdio.h>
 #include <stdlib.h>
@@ -13,210 +14,148 @@
 #include <errno.h>
 #include <pthread.h>
 #include <arpa/inet.h>
-#include <uuid/uuid.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/eventfd.h>
 
-#define BACKLOG 10
+#define BACKLOG SOMAXCONN
 
 // Global configuration
 extern ServerConfig g_cfg;
 extern SSL_CTX* get_ssl_ctx(void);
 
+/*
+ * wait_for_ack
+ * ------------
+ * Block until the journal has synced every held upload and their ACKs
+ * are queued. Only this connection's thread waits.
+ */
+static SessionStatus wait_for_ack(Session* s, SessionMailbox* m) {
+    while (session_ack_pending(s)) {
+        session_mailbox_wait(m);
+        session_mailbox_collect(m, NULL, NULL);
+    }
+    return s->status;
+}
+
+/*
+ * wait_input_or_ack
+ * -----------------
+ * While ACKs are held, wait for whichever comes first: input on the
+ * socket (when `want_input`) or an ACK posted to the mailbox, which is
+ * collected. Without an eventfd the thread cannot wait for both, so it
+ * waits for the ACKs first. Returns 1 when the socket can be read, 0
+ * after collecting (or a signal), -1 on error.
+ */
+static int wait_input_or_ack(Conn* c, Session* s, SessionMailbox* m, int want_input) {
+    if (m->evfd < 0) {
+        wait_for_ack(s, m);
+        return 0;
+    }
+    if (want_input && c->ssl && !c->ktls_rx && SSL_pending(c->ssl) > 0) return 1;
+
+    struct pollfd p[2] = { { m->evfd, POLLIN, 0 }, { c->fd, POLLIN, 0 } };
+    if (poll(p, want_input ? 2 : 1, -1) < 0) return errno == EINTR ? 0 : -1;
+    if (p[0].revents) {
+        uint64_t v;
+        while (read(m->evfd, &v, sizeof(v)) > 0) { }
+        session_mailbox_collect(m, NULL, NULL);
+        return 0;
+    }
+    return 1;
+}
+
+/*
+ * tls_handshake_blocking
+ * ----------------------
+ * Complete the server handshake on a blocking socket. With early data
+ * enabled, 0-RTT bytes are fed to the session as they arrive, before
+ * SSL_accept finishes the handshake. Returns 0 on success, -1 on failure.
+ */
+static int tls_handshake_blocking(Conn* c, Session* s, SessionMailbox* m, SessionStatus* st) {
+    if (tls_early_data_enabled()) {
+        for (;;) {
+            void* buf;
+            size_t len;
+            if ((*st = wait_for_ack(s, m)) == SESSION_FAILED) return -1;
+            session_recv_window(s, &buf, &len);
+            if (len == 0) return -1;   // early data must not outrun the responses
+            long n = tls_read_early(c, buf, len);
+            if (n == 0) break;
+            if (n < 0) return -1;      // CS_AGAIN here is the receive timeout
+            *st = session_received(s, (size_t)n);
+            if (*st == SESSION_FAILED) return -1;
+        }
+    }
+    if (SSL_accept(c->ssl) != 1) return -1;
+    tls_note_handshake(c);
+    return 0;
+}
+
 /*
  * handle_client
  * -------------
- * Thread entry that implements the server-side protocol for a single
- * client connection. It receives messages, reconstructs image data in
- * memory and enqueues processing jobs. The connection struct is freed
- * before the thread exits.
+ * Thread entry of the threaded engine: finish the TLS handshake, then
+ * drive one connection's protocol session with blocking reads (bounded
+ * by SO_RCVTIMEO) until the upload completes or the peer goes away.
+ * While journal ACKs are held the thread polls the socket together
+ * with its mailbox's eventfd, so reading goes on. The connection
+ * struct is freed before the thread exits.
  */
 void* handle_client(void* arg) {
     Conn* c = (Conn*)arg;
 
-    // Client state
-    char     current_uuid[37] = {0};
-    char     current_filename[MAX_FILENAME] = {0};
-    char     current_format[10] = {0};
-    uint32_t expected_chunks = 0, received_chunks = 0;
-    uint32_t remaining_bytes = 0;
-    uint32_t total_size = 0;
-    ProcessingType  processing_type = 0;
-
-    // In-memory buffer for the complete incoming image
-    unsigned char* img_buf = NULL;
-    size_t         img_cap = 0;   // == expected total_size
-    size_t         img_off = 0;   // bytes written
-
-    int done = 0;
-    while (!done) {
-        MessageHeader h;
-
-        int hr = recv_header(c, &h);
-    if (hr == -2) { // client EOF
-            log_line("Client closed connection (EOF)");
-            break;
-        } else if (hr != 0) {
-            log_line("Connection error while waiting for header");
-            break;
-        }
-
-        if (h.type == MSG_HELLO) {
-            uuid_t uu;
-            uuid_generate(uu);
-            uuid_unparse_lower(uu, current_uuid);
-            log_line("HELLO -> new image id = %s", current_uuid);
-
-            if (send_message(c, MSG_IMAGE_ID_RESPONSE, current_uuid, NULL, 0) != 0) {
-                log_line("Failed sending IMAGE_ID_RESPONSE");
-                break;
-            }
-
-        } else if (h.type == MSG_IMAGE_INFO) {
-            if (h.length != sizeof(ImageInfo)) {
-                log_line("IMAGE_INFO wrong size %u", h.length);
-                break;
-            }
-
-            ImageInfo info;
-            int irc = cs_recv_all(c, &info, sizeof(info));
-            if (irc != 0) {
-                log_line("Failed to read IMAGE_INFO payload (rc=%d)", irc);
-                break;
-            }
-
-            total_size = from_be32_s(info.total_size);
-            expected_chunks = from_be32_s(info.total_chunks);
-            processing_type = (ProcessingType)info.processing_type;
-
-            // Safe copies
-            { size_t n = strnlen(info.filename, sizeof(current_filename)-1);
-              memcpy(current_filename, info.filename, n); current_filename[n] = '\0'; }
-            { size_t n = strnlen(info.format, sizeof(current_format)-1);
-              memcpy(current_format, info.format, n); current_format[n] = '\0'; }
-
-            // Allocate buffer in memory
-            img_buf = (unsigned char*)malloc(total_size);
-            if (!img_buf) {
-                log_line("OOM allocating %u bytes for incoming image", total_size);
-                break;
-            }
-            img_cap = total_size;
-            img_off = 0;
-            remaining_bytes = total_size;
-
-            log_line("IMAGE_INFO: id=%s file=%s size=%u bytes chunks=%u proc=%u fmt=%s",
-                     h.image_id, current_filename, total_size, expected_chunks,
-                     (unsigned)processing_type, current_format);
-
-        } else if (h.type == MSG_IMAGE_CHUNK) {
-            if (!img_buf) { log_line("CHUNK without open buffer"); break; }
-
-            size_t to_read = h.length;
-            unsigned char* tmp = (unsigned char*)malloc(to_read);
-            if (!tmp) { log_line("OOM on chunk tmp"); break; }
-
-            int crc = cs_recv_all(c, tmp, to_read);
-            if (crc != 0) {
-                free(tmp);
-                log_line("Failed to read chunk body (rc=%d)", crc);
-                break;
-            }
-
-            // Copy into the accumulated buffer
-            if (img_off + to_read > img_cap) {
-                free(tmp);
-                log_line("Chunk overflow (img_off=%zu to_read=%zu cap=%zu)", img_off, to_read, img_cap);
-                break;
-            }
-            memcpy(img_buf + img_off, tmp, to_read);
-            img_off += to_read;
-            free(tmp);
-
-            received_chunks++;
-            if (remaining_bytes >= to_read) remaining_bytes -= (uint32_t)to_read;
-            else remaining_bytes = 0;
-
-        } else if (h.type == MSG_IMAGE_COMPLETE) {
-            char fmt[32] = {0};
-            if (h.length > 0 && h.length < sizeof(fmt)) {
-                int crc = cs_recv_all(c, fmt, h.length);
-                if (crc != 0) {
-                    log_line("Failed read COMPLETE fmt (rc=%d)", crc);
-                    break;
-                }
-                fmt[sizeof(fmt)-1] = '\0';
-            } else if (h.length > 0) {
-                char* tmp = (char*)malloc(h.length);
-                if (!tmp) break;
-                int crc = cs_recv_all(c, tmp, h.length);
-                if (crc != 0) { free(tmp); break; }
-                free(tmp);
-            }
-
-            const char* final_fmt = fmt[0] ? fmt : current_format;
-
-            log_line("IMAGE_COMPLETE: id=%s file=%s fmt=%s chunks=%u remaining=%u",
-                     h.image_id, current_filename, final_fmt,
-                     received_chunks, remaining_bytes);
-
-            // Enqueue in-memory job (the buffer ownership transfers to the scheduler)
-            if (processing_type > 0 && img_buf && img_off == img_cap) {
-                ProcJob job;
-                memset(&job, 0, sizeof(job));
-                job.data = img_buf;          // transfer ownership
-                job.size = img_cap;
-                { size_t n = strnlen(h.image_id, sizeof(job.image_id)-1);
-                  memcpy(job.image_id, h.image_id, n); job.image_id[n] = '\0'; }
-                { size_t n = strnlen(current_filename, sizeof(job.filename)-1);
-                  memcpy(job.filename, current_filename, n); job.filename[n] = '\0'; }
-                { size_t n = strnlen(final_fmt, sizeof(job.format)-1);
-                  memcpy(job.format, final_fmt, n); job.format[n] = '\0'; }
-                job.processing_type = processing_type;
-                job.total_size      = total_size;
-
-                if (scheduler_enqueue(&job) != 0) {
-                    log_line("Scheduler enqueue failed for id=%s", h.image_id);
-                    // if enqueue fails, free the buffer here
-                    free(img_buf);
-                }
-                // the scheduler owns the buffer now
-                img_buf = NULL; img_cap = img_off = 0;
-            } else {
-                // If not processing, free buffer if allocated
-                free(img_buf);
-                img_buf = NULL; img_cap = img_off = 0;
-            }
+    Session s;
+    session_init(&s);
+    session_set_peer(&s, c->fd);
+    SessionMailbox mbox;
+    session_mailbox_init(&mbox, eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC));
+    session_set_mailbox(&s, &mbox, NULL);
+
+    SessionStatus st = SESSION_OPEN;
+    if (c->ssl && tls_handshake_blocking(c, &s, &mbox, &st) != 0) {
+        log_line("TLS handshake failed");
+        st = SESSION_FAILED;
+    }
 
-            // Final ACK
-            if (send_message(c, MSG_ACK, h.image_id, NULL, 0) != 0) {
-                log_line("Failed sending final ACK");
+    while (st != SESSION_FAILED) {
+        // Responses first
+        const void* out;
+        size_t pending = session_pending_output(&s, &out);
+        if (pending > 0) {
+            if (cs_send_all(c, out, pending) != 0) {
+                log_line("Failed sending response");
                 break;
             }
-
-            // Reset state
-            current_uuid[0] = 0;
-            current_filename[0] = 0;
-            current_format[0] = 0;
-            expected_chunks = received_chunks = remaining_bytes = 0;
-            total_size = 0;
-            processing_type = 0;
-
-            // Single-image-per-connection mode: close cleanly after COMPLETE
-            done = 1;
-
-        } else {
-            if (h.length > 0) {
-                char* tmp = (char*)malloc(h.length);
-                if (!tmp) break;
-                int crc = cs_recv_all(c, tmp, h.length);
-                if (crc != 0) { free(tmp); break; }
-                free(tmp);
-            }
-            log_line("Unknown msg type %u, ignored", (unsigned)h.type);
+            session_consume_output(&s, pending);
+        }
+        if (st != SESSION_OPEN && !session_ack_pending(&s)) break;
+
+        void* buf;
+        size_t len;
+        session_recv_window(&s, &buf, &len);
+        if (session_ack_pending(&s)) {
+            int w = wait_input_or_ack(c, &s, &mbox, len > 0);
+            if (w < 0) break;
+            st = s.status;
+            if (w == 0) continue;
+        }
+        long n = cs_recv_some(c, buf, len);
+        if (n < 0) {
+            session_log_disconnect(&s, n);
+            if (n != CS_EOF || !session_ack_pending(&s)) break;
+            session_end_input(&s);     // send the held ACKs, then close
+            st = s.status;
+            continue;
         }
+        st = session_received(&s, (size_t)n);
+        if (st == SESSION_FAILED) break;
     }
 
     // cleanup buffer if the connection ends midway
-    if (img_buf) { free(img_buf); img_buf = NULL; }
+    session_destroy(&s);
+    session_mailbox_destroy(&mbox);
+    if (mbox.evfd >= 0) close(mbox.evfd);
 
     conn_close(c);
     free(c);
@@ -246,8 +185,11 @@ void server_request_shutdown(void) {
  * start_server
  * ------------
  * Start the TCP (or TLS) server: create a listening socket and accept
- * incoming connections. For each accepted connection a detached thread
- * is spawned to handle the client.
+ * incoming connections. The io_uring engine (plain TCP) runs its own
+ * accept loop on the ring. With the epoll engine each accepted socket
+ * is made non-blocking and handed to a reactor thread (TLS handshakes
+ * run there too); with the threaded engine, or if the reactor cannot
+ * start, a detached thread is spawned per connection.
  * Returns 0 on clean shutdown, -1 on fatal error during startup.
  */
 int start_server(void) {
@@ -257,7 +199,15 @@ int start_server(void) {
             log_line("TLS enabled in config, but initialization failed. Check certificate and key in %s", g_cfg.tls_dir);
             return -1;
         }
-        log_line("TLS enabled (listening TLS) on port %d", g_cfg.port);
+        if (tls_enable_resumption(g_cfg.tls_session_cache, g_cfg.tls_ticket_rotate_sec,
+                                  g_cfg.tls_early_data) != 0) {
+            log_line("TLS session resumption unavailable; every connection does a full handshake");
+        }
+        if (g_cfg.tls_ktls && tls_enable_ktls() != 0) {
+            log_line("kTLS requested but this OpenSSL build has no kTLS support; using userspace TLS");
+        }
+        log_line("TLS enabled (listening TLS) on port %d (ticket keys rotate every %d s, 0-RTT %s)",
+                 g_cfg.port, g_cfg.tls_ticket_rotate_sec, g_cfg.tls_early_data ? "on" : "off");
     } else {
         log_line("Server starting (plain TCP) on port %d", g_cfg.port);
     }
@@ -298,7 +248,28 @@ int start_server(void) {
 
     log_line("Listening with image processing enabled...");
 
-    // Accept loop - one thread per connection
+    IoEngine engine = g_cfg.io_engine;
+    if (engine == IO_ENGINE_URING) {
+        if (g_cfg.tls_enabled) {
+            log_line("io_uring engine serves plain TCP only; using epoll for TLS");
+        } else if (uring_serve(srv) == 0) {
+            close(srv);
+            g_listen_fd = -1;
+            log_line("Server stop: listen socket closed");
+            return 0;
+        } else {
+            log_line("io_uring engine unavailable; falling back to epoll");
+        }
+        engine = IO_ENGINE_EPOLL;
+    }
+
+    int use_reactor = 0;
+    if (engine == IO_ENGINE_EPOLL) {
+        if (reactor_start(g_cfg.reactor_threads) == 0) use_reactor = 1;
+        else log_line("epoll engine unavailable; falling back to one thread per connection");
+    }
+
+    // Accept loop - reactor hand-off or one thread per connection
     for (;;) {
         if (g_terminate) break;
 
@@ -313,10 +284,19 @@ int start_server(void) {
             continue;
         }
 
-        // Optional: I/O timeouts to avoid permanent blocking
-        struct timeval tv = { .tv_sec = 15, .tv_usec = 0 };
-        setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
-        setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+        if (use_reactor) {
+            // Non-blocking; the reactor enforces its own idle timeout
+            int fl = fcntl(fd, F_GETFL, 0);
+            if (fl < 0 || fcntl(fd, F_SETFL, fl | O_NONBLOCK) != 0) {
+                close(fd);
+                continue;
+            }
+        } else {
+            // Optional: I/O timeouts to avoid permanent blocking
+            struct timeval tv = { .tv_sec = 15, .tv_usec = 0 };
+            setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+            setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+        }
 
         // Log client connection
         char cip[64];
@@ -350,17 +330,17 @@ int start_server(void) {
 
             SSL_set_fd(ssl, fd);
 
-            if (SSL_accept(ssl) != 1) {
-                log_line("TLS handshake failed");
-                SSL_free(ssl);
-                close(fd);
-                free(c);
-                continue;
-            }
-
+            // The handshake runs on the connection's reactor or thread,
+            // so a slow client cannot stall the accept loop
+            SSL_set_accept_state(ssl);
             c->ssl = ssl;
         }
 
+        if (use_reactor) {
+            if (reactor_add(c) != 0) log_line("Reactor hand-off failed");
+            continue;
+        }
+
         // Launch a thread to handle the client
          pthread_t th;
          int rc = pthread_create(&th, NULL, handle_client, c);
@@ -373,6 +353,8 @@ int start_server(void) {
          pthread_detach(th);
      }
 
+    if (use_reactor) reactor_stop();
+
     close(srv);
     g_listen_fd = -1;
     log_line("Server stop: listen socket closed");
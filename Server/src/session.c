@@ -0,0 +1,624 @@
+#include "session.h"
+#include "connection.h"
+#include "logging.h"
+#include "scheduler.h"
+#include "buffer_pool.h"
+#include "mem_budget.h"
+#include "journal.h"
+#include "cost_model.h"
+#include "image_processing.h"
+#include "config.h"
+#include "utils.h"
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <uuid/uuid.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+// External access to global config
+extern ServerConfig g_cfg;
+
+// An upload whose MSG_ACK is held until its journal record is synced.
+// It sits in its session's FIFO from submission until its response is
+// queued, and on the mailbox list between the journal callback and
+// collection. `sess`, `durable` and the mailbox lists are guarded by
+// g_ack_mtx. Once the session is gone, whoever holds the ack last frees
+// it: the journal callback, the collector, or session_cancel_acks for
+// an ack already collected.
+typedef struct SessionAck {
+    Session*           sess;       // NULL once the session is destroyed
+    SessionMailbox*    mbox;
+    char               image_id[37];
+    int                durable;    // 0 = the record failed: answer RETRY_AFTER instead
+    int                collected;  // taken from the mailbox: its response may go out
+    struct SessionAck* next;       // session FIFO (upload order)
+    struct SessionAck* posted;     // mailbox list
+} SessionAck;
+
+static pthread_mutex_t g_ack_mtx = PTHREAD_MUTEX_INITIALIZER;
+
+/*
+ * session_init
+ * ------------
+ * Reset a session to "waiting for the first header".
+ */
+void session_init(Session* s) {
+    memset(s, 0, sizeof(*s));
+    s->status = SESSION_OPEN;
+}
+
+/*
+ * session_set_peer
+ * ----------------
+ * FNV-1a hash of the peer IP address; 0 when it cannot be determined.
+ */
+void session_set_peer(Session* s, int fd) {
+    struct sockaddr_storage ss;
+    socklen_t len = sizeof(ss);
+    s->client_id = 0;
+    if (getpeername(fd, (struct sockaddr*)&ss, &len) != 0) return;
+
+    const unsigned char* p = NULL;
+    size_t n = 0;
+    if (ss.ss_family == AF_INET) {
+        p = (const unsigned char*)&((struct sockaddr_in*)&ss)->sin_addr;
+        n = sizeof(struct in_addr);
+    } else if (ss.ss_family == AF_INET6) {
+        p = (const unsigned char*)&((struct sockaddr_in6*)&ss)->sin6_addr;
+        n = sizeof(struct in6_addr);
+    }
+    uint32_t h = 2166136261u;
+    for (size_t i = 0; i < n; ++i) { h ^= p[i]; h *= 16777619u; }
+    s->client_id = h;
+}
+
+/*
+ * drop_upload
+ * -----------
+ * Discard the current image buffer. A streaming decoder still reading
+ * it takes the buffer over and frees it once it has stopped.
+ */
+static void drop_upload(Session* s) {
+    if (s->stream) {
+        sd_abandon(s->stream, s->img_buf);
+        s->stream = NULL;
+    } else if (s->img_buf) {
+        bp_free(s->img_buf);
+    }
+    s->img_buf = NULL;
+    s->img_cap = s->img_off = 0;
+    budget_release(s->img_charge);
+    s->img_charge = 0;
+}
+
+/*
+ * session_destroy
+ * ---------------
+ * Free the image buffer of an upload that never completed and give up
+ * on the ACKs still held for the journal (the jobs themselves are
+ * accepted).
+ */
+void session_destroy(Session* s) {
+    drop_upload(s);
+    session_cancel_acks(s);
+}
+
+/*
+ * queue_message
+ * -------------
+ * Append a response (header plus up to 4 payload bytes) to the output
+ * queue. The receive window is closed while less than
+ * SESSION_RESPONSE_MAX bytes of room are left, so this only fails on a
+ * logic error.
+ */
+static int queue_message(Session* s, uint8_t type, const char* image_id,
+                         const void* payload, uint32_t len) {
+    MessageHeader h;
+    build_header(&h, type, len, image_id);
+    size_t total = sizeof(h) + len;
+
+    if (s->out_off > 0 && s->out_len + total > SESSION_OUT_CAP) {
+        memmove(s->out, s->out + s->out_off, s->out_len - s->out_off);
+        s->out_len -= s->out_off;
+        s->out_off = 0;
+    }
+    if (len > SESSION_RESPONSE_MAX - sizeof(h) || s->out_len + total > SESSION_OUT_CAP) return -1;
+
+    memcpy(s->out + s->out_len, &h, sizeof(h));
+    if (len) memcpy(s->out + s->out_len + sizeof(h), payload, len);
+    s->out_len += total;
+    return 0;
+}
+
+// Header-only response
+static int queue_response(Session* s, uint8_t type, const char* image_id) {
+    return queue_message(s, type, image_id, NULL, 0);
+}
+
+// Forget the image being uploaded, ready for the next IMAGE_INFO
+static void reset_image_state(Session* s) {
+    s->current_uuid[0] = 0;
+    s->current_filename[0] = 0;
+    s->current_format[0] = 0;
+    s->expected_chunks = s->received_chunks = s->remaining_bytes = 0;
+    s->total_size = 0;
+    s->processing_type = 0;
+    s->img_deferred = 0;
+}
+
+/*
+ * journal_accepted
+ * ----------------
+ * Journal callback (journal thread): the accept record is durable, so
+ * queue the job and post the held ACK to the session's mailbox. A
+ * failed enqueue stays in the journal and is replayed on the next
+ * start, so the ACK is still sent. A record that could not be made
+ * durable drops the job; the client is told to upload it again.
+ */
+static void journal_accepted(ProcJob* job, void* arg) {
+    SessionAck* ack = (SessionAck*)arg;
+    int durable = job->journal_seq != 0;
+    if (!durable || scheduler_enqueue(job) != 0) {
+        if (durable) log_line("Scheduler enqueue failed for id=%s", job->image_id);
+        else log_line("Journal: id=%s not durable, asking the client to retry", job->image_id);
+        if (job->stream) sd_abandon(job->stream, job->data);
+        else bp_free(job->data);
+        budget_release(job->mem_charge);
+    }
+
+    pthread_mutex_lock(&g_ack_mtx);
+    if (!ack->sess) {
+        pthread_mutex_unlock(&g_ack_mtx);
+        free(ack);                      // the connection is gone
+        return;
+    }
+    SessionMailbox* m = ack->mbox;
+    ack->durable = durable;
+    ack->posted = m->ready;
+    m->ready = ack;
+    if (m->evfd >= 0) {
+        uint64_t one = 1;
+        ssize_t w = write(m->evfd, &one, sizeof(one));
+        (void)w;   // EAGAIN only when the counter is already non-zero
+    }
+    pthread_cond_signal(&m->cv);
+    pthread_mutex_unlock(&g_ack_mtx);
+}
+
+// Append `a` to the session's held ACKs
+static void hold_ack(Session* s, SessionAck* a) {
+    a->next = NULL;
+    if (s->acks_tail) s->acks_tail->next = a; else s->acks = a;
+    s->acks_tail = a;
+    s->acks_held++;
+}
+
+/*
+ * release_acks
+ * ------------
+ * Queue the responses of the collected ACKs at the head of the FIFO:
+ * MSG_ACK, or MSG_RETRY_AFTER for an upload the journal could not keep.
+ * An ACK collected out of order waits for the ones before it.
+ */
+static void release_acks(Session* s) {
+    while (s->acks && s->acks->collected) {
+        SessionAck* a = s->acks;
+        s->acks = a->next;
+        if (!s->acks) s->acks_tail = NULL;
+        s->acks_held--;
+
+        uint32_t ms = to_be32_s((uint32_t)g_cfg.retry_after_ms);
+        int rc = a->durable ? queue_response(s, MSG_ACK, a->image_id)
+                            : queue_message(s, MSG_RETRY_AFTER, a->image_id, &ms, sizeof(ms));
+        if (rc != 0) {
+            log_line("Failed sending final ACK");
+            s->status = SESSION_FAILED;
+        }
+        free(a);
+    }
+}
+
+/*
+ * on_image_complete
+ * -----------------
+ * Hand the finished upload to the scheduler (ownership of the buffer
+ * moves with the job), queue the final ACK (tagged with the image id)
+ * and reset the image state for the next upload on this connection.
+ * With the journal the job goes to the journal thread instead, and the
+ * ACK is held until the record is durable while the session goes on
+ * reading the next uploads. An ACK that is ready while earlier ones are
+ * still held queues behind them.
+ */
+static SessionStatus on_image_complete(Session* s) {
+    MessageHeader* h = &s->hdr;
+    s->fmt[sizeof(s->fmt)-1] = '\0';
+    const char* final_fmt = s->fmt[0] ? s->fmt : s->current_format;
+
+    if (s->img_deferred) {
+        // The client resends this image after the RETRY_AFTER delay
+        log_line("IMAGE_COMPLETE: id=%s deferred, dropped", h->image_id);
+        reset_image_state(s);
+        return SESSION_OPEN;
+    }
+
+    log_line("IMAGE_COMPLETE: id=%s file=%s fmt=%s chunks=%u remaining=%u",
+             h->image_id, s->current_filename, final_fmt,
+             s->received_chunks, s->remaining_bytes);
+
+    // Enqueue in-memory job (the buffer ownership transfers to the scheduler)
+    if (s->processing_type > 0 && s->img_buf && s->img_off == s->img_cap) {
+        ProcJob job;
+        memset(&job, 0, sizeof(job));
+        job.data = s->img_buf;          // transfer ownership
+        job.size = s->img_cap;
+        { size_t n = strnlen(h->image_id, sizeof(job.image_id)-1);
+          memcpy(job.image_id, h->image_id, n); job.image_id[n] = '\0'; }
+        { size_t n = strnlen(s->current_filename, sizeof(job.filename)-1);
+          memcpy(job.filename, s->current_filename, n); job.filename[n] = '\0'; }
+        { size_t n = strnlen(final_fmt, sizeof(job.format)-1);
+          memcpy(job.format, final_fmt, n); job.format[n] = '\0'; }
+        job.processing_type = s->processing_type;
+        job.total_size      = s->total_size;
+        job.stream          = s->stream;
+        job.client_id       = s->client_id;
+
+        // Header facts drive the queue order and the memory charge
+        image_probe(s->img_buf, s->img_cap, final_fmt, &job.header);
+        job.cost_us = cost_predict_us(&job.header, final_fmt, s->processing_type);
+
+        // The job also holds its expected decode/encode memory until it finishes
+        size_t work = image_working_set_estimate(&job.header, final_fmt);
+        budget_reserve(work);
+        job.mem_charge = s->img_charge + work;
+
+        // Durable before the ACK goes out: the journal thread writes the
+        // record, then queues the job and posts the ACK
+        SessionAck* ack = s->mbox ? (SessionAck*)calloc(1, sizeof(SessionAck)) : NULL;
+        if (ack) {
+            ack->sess = s;
+            ack->mbox = s->mbox;
+            memcpy(ack->image_id, job.image_id, sizeof(ack->image_id));
+            // collected on this thread, so holding it after the submit is safe
+            if (journal_accept_async(&job, journal_accepted, ack) == 0) {
+                hold_ack(s, ack);
+                s->stream = NULL;
+                s->img_charge = 0;
+                s->img_buf = NULL; s->img_cap = s->img_off = 0;
+                reset_image_state(s);
+                return SESSION_OPEN;
+            }
+            free(ack);
+        }
+
+        if (scheduler_enqueue(&job) != 0) {
+            log_line("Scheduler enqueue failed for id=%s", h->image_id);
+            // if enqueue fails, free the buffer here
+            drop_upload(s);
+            budget_release(work);
+        }
+        // the scheduler owns the buffer (and its decoder) now
+        s->stream = NULL;
+        s->img_charge = 0;
+    } else {
+        // If not processing, free buffer if allocated
+        drop_upload(s);
+    }
+    s->img_buf = NULL; s->img_cap = s->img_off = 0;
+
+    // Final ACK (behind the held ones, if any)
+    if (s->acks) {
+        SessionAck* ready = (SessionAck*)calloc(1, sizeof(SessionAck));
+        if (!ready) {
+            log_line("OOM holding the final ACK");
+            return SESSION_FAILED;
+        }
+        memcpy(ready->image_id, h->image_id, sizeof(ready->image_id));
+        ready->durable = 1;
+        ready->collected = 1;
+        hold_ack(s, ready);
+    } else if (queue_response(s, MSG_ACK, h->image_id) != 0) {
+        log_line("Failed sending final ACK");
+        return SESSION_FAILED;
+    }
+
+    reset_image_state(s);
+
+    // The connection stays open for the next image
+    return SESSION_OPEN;
+}
+
+/*
+ * on_message
+ * ----------
+ * Handle a fully received message (header + payload).
+ */
+static SessionStatus on_message(Session* s) {
+    MessageHeader* h = &s->hdr;
+    SessionStatus st = SESSION_OPEN;
+
+    if (h->type == MSG_HELLO) {
+        // A client that pipelines proposes its own id; otherwise assign one
+        uuid_t uu;
+        if (uuid_parse(h->image_id, uu) != 0) uuid_generate(uu);
+        uuid_unparse_lower(uu, s->current_uuid);
+        log_line("HELLO -> new image id = %s", s->current_uuid);
+
+        if (queue_response(s, MSG_IMAGE_ID_RESPONSE, s->current_uuid) != 0) {
+            log_line("Failed sending IMAGE_ID_RESPONSE");
+            st = SESSION_FAILED;
+        }
+
+    } else if (h->type == MSG_IMAGE_INFO) {
+        ImageInfo* info = &s->info;
+        s->total_size = from_be32_s(info->total_size);
+        s->expected_chunks = from_be32_s(info->total_chunks);
+        s->processing_type = (ProcessingType)info->processing_type;
+
+        // Safe copies
+        { size_t n = strnlen(info->filename, sizeof(s->current_filename)-1);
+          memcpy(s->current_filename, info->filename, n); s->current_filename[n] = '\0'; }
+        { size_t n = strnlen(info->format, sizeof(s->current_format)-1);
+          memcpy(s->current_format, info->format, n); s->current_format[n] = '\0'; }
+
+        // Admission control: without budget, ask the client to come back later
+        drop_upload(s);
+        s->img_deferred = 0;
+        if (budget_try_reserve(s->total_size) != 0) {
+            MemBudgetStats mb;
+            budget_get_stats(&mb);
+            log_line("IMAGE_INFO: id=%s size=%u deferred (memory %llu/%llu MiB), retry in %d ms",
+                     h->image_id, s->total_size, (unsigned long long)(mb.used_bytes >> 20),
+                     (unsigned long long)(mb.limit_bytes >> 20), g_cfg.retry_after_ms);
+            s->img_deferred = 1;
+            uint32_t ms = to_be32_s((uint32_t)g_cfg.retry_after_ms);
+            if (queue_message(s, MSG_RETRY_AFTER, h->image_id, &ms, sizeof(ms)) != 0) {
+                log_line("Failed sending RETRY_AFTER");
+                return SESSION_FAILED;
+            }
+            s->in_payload = 0;
+            s->got = 0;
+            return SESSION_OPEN;
+        }
+        s->img_charge = s->total_size;
+
+        // Allocate buffer in memory (replacing an abandoned upload, if any)
+        s->img_buf = (unsigned char*)bp_alloc(s->total_size);
+        if (!s->img_buf) {
+            log_line("OOM allocating %u bytes for incoming image", s->total_size);
+            return SESSION_FAILED;
+        }
+        s->img_cap = s->total_size;
+        s->img_off = 0;
+        s->remaining_bytes = s->total_size;
+        if (s->processing_type > 0)
+            s->stream = sd_start(s->img_buf, s->img_cap, s->current_format, s->processing_type);
+
+        log_line("IMAGE_INFO: id=%s file=%s size=%u bytes chunks=%u proc=%u fmt=%s",
+                 h->image_id, s->current_filename, s->total_size, s->expected_chunks,
+                 (unsigned)s->processing_type, s->current_format);
+
+    } else if (h->type == MSG_IMAGE_CHUNK) {
+        // Payload was received in place at img_buf + img_off
+        s->img_off += s->need;
+        if (s->stream) sd_feed(s->stream, s->img_off);
+        s->received_chunks++;
+        if (s->remaining_bytes >= s->need) s->remaining_bytes -= (uint32_t)s->need;
+        else s->remaining_bytes = 0;
+
+    } else if (h->type == MSG_IMAGE_COMPLETE) {
+        st = on_image_complete(s);
+
+    } else {
+        log_line("Unknown msg type %u, ignored", (unsigned)h->type);
+    }
+
+    // Next: a new header
+    s->in_payload = 0;
+    s->got = 0;
+    return st;
+}
+
+/*
+ * on_header
+ * ---------
+ * Validate a fully received header and set up where its payload goes.
+ * Messages without payload are handled immediately.
+ */
+static SessionStatus on_header(Session* s) {
+    MessageHeader* h = &s->hdr;
+    h->length = from_be32_s(h->length);
+    h->image_id[36] = '\0';
+
+    s->in_payload = 1;
+    s->got = 0;
+    s->dst = NULL;
+    s->need = 0;
+    s->skip_left = 0;
+
+    switch (h->type) {
+        case MSG_IMAGE_INFO:
+            if (h->length != sizeof(ImageInfo)) {
+                log_line("IMAGE_INFO wrong size %u", h->length);
+                return SESSION_FAILED;
+            }
+            s->dst = (unsigned char*)&s->info;
+            s->need = sizeof(ImageInfo);
+            break;
+
+        case MSG_IMAGE_CHUNK:
+            if (!s->img_buf && s->img_deferred) {
+                s->skip_left = h->length;   // deferred upload: drain
+                break;
+            }
+            if (!s->img_buf) { log_line("CHUNK without open buffer"); return SESSION_FAILED; }
+
+            // Bounds check first; the payload is then received straight into the image buffer
+            if (h->length > s->img_cap - s->img_off) {
+                log_line("Chunk overflow (img_off=%zu to_read=%zu cap=%zu)",
+                         s->img_off, (size_t)h->length, s->img_cap);
+                return SESSION_FAILED;
+            }
+            s->dst = s->img_buf + s->img_off;
+            s->need = h->length;
+            break;
+
+        case MSG_IMAGE_COMPLETE:
+            memset(s->fmt, 0, sizeof(s->fmt));
+            if (h->length < sizeof(s->fmt)) {
+                s->dst = (unsigned char*)s->fmt;
+                s->need = h->length;
+            } else {
+                s->skip_left = h->length;   // oversized format: ignore it
+            }
+            break;
+
+        default:
+            s->skip_left = h->length;      // HELLO / unknown: payload unused
+            break;
+    }
+
+    if (s->need == 0 && s->skip_left == 0) return on_message(s);
+    return SESSION_OPEN;
+}
+
+void session_recv_window(Session* s, void** buf, size_t* len) {
+    *buf = NULL;
+    *len = 0;
+    if (s->status != SESSION_OPEN) return;
+
+    // Backpressure: stop reading until the peer takes its responses, with
+    // room left for one more response besides every held ACK
+    if (SESSION_OUT_CAP - (s->out_len - s->out_off) < (s->acks_held + 1) * SESSION_RESPONSE_MAX) return;
+
+    if (!s->in_payload) {
+        *buf = (unsigned char*)&s->hdr + s->got;
+        *len = sizeof(MessageHeader) - s->got;
+    } else if (s->skip_left > 0) {
+        *buf = s->scratch;
+        *len = s->skip_left < sizeof(s->scratch) ? s->skip_left : sizeof(s->scratch);
+    } else {
+        *buf = s->dst + s->got;
+        *len = s->need - s->got;
+    }
+}
+
+SessionStatus session_received(Session* s, size_t n) {
+    if (s->status != SESSION_OPEN || n == 0) return s->status;
+
+    if (!s->in_payload) {
+        s->got += n;
+        if (s->got == sizeof(MessageHeader)) s->status = on_header(s);
+    } else if (s->skip_left > 0) {
+        s->skip_left -= n;
+        if (s->skip_left == 0) s->status = on_message(s);
+    } else {
+        s->got += n;
+        if (s->got == s->need) s->status = on_message(s);
+    }
+    return s->status;
+}
+
+size_t session_pending_output(const Session* s, const void** buf) {
+    *buf = s->out + s->out_off;
+    return s->out_len - s->out_off;
+}
+
+void session_consume_output(Session* s, size_t n) {
+    s->out_off += n;
+    if (s->out_off >= s->out_len) s->out_off = s->out_len = 0;
+}
+
+void session_log_disconnect(const Session* s, long rc) {
+    int idle = !s->in_payload && s->got == 0;
+    if (idle && rc == CS_EOF) {
+        log_line("Client closed connection (EOF)");
+    } else if (idle) {
+        log_line(rc == CS_AGAIN ? "Connection timed out while waiting for header"
+                                : "Connection error while waiting for header");
+    } else if (!s->in_payload) {
+        log_line("Connection lost inside a message header (rc=%ld)", rc);
+    } else {
+        log_line("Connection lost while receiving msg type %u payload (rc=%ld)",
+                 (unsigned)s->hdr.type, rc);
+    }
+}
+
+void session_set_mailbox(Session* s, SessionMailbox* m, void* owner) {
+    s->mbox = m;
+    s->owner = owner;
+}
+
+void session_end_input(Session* s) {
+    if (s->status == SESSION_OPEN) s->status = SESSION_DONE;
+}
+
+int session_ack_pending(const Session* s) {
+    return s->acks != NULL;
+}
+
+void session_cancel_acks(Session* s) {
+    pthread_mutex_lock(&g_ack_mtx);
+    while (s->acks) {
+        SessionAck* a = s->acks;
+        s->acks = a->next;
+        if (a->collected) free(a);
+        else a->sess = NULL;    // freed by the journal callback or the collector
+    }
+    pthread_mutex_unlock(&g_ack_mtx);
+    s->acks_tail = NULL;
+    s->acks_held = 0;
+}
+
+void session_mailbox_init(SessionMailbox* m, int evfd) {
+    pthread_cond_init(&m->cv, NULL);
+    m->evfd = evfd;
+    m->ready = NULL;
+}
+
+// Every session of the engine is destroyed by now: drop what is left
+void session_mailbox_destroy(SessionMailbox* m) {
+    pthread_mutex_lock(&g_ack_mtx);
+    while (m->ready) {
+        SessionAck* a = m->ready;
+        m->ready = a->posted;
+        free(a);
+    }
+    pthread_mutex_unlock(&g_ack_mtx);
+    pthread_cond_destroy(&m->cv);
+}
+
+/*
+ * session_mailbox_collect
+ * -----------------------
+ * Take the posted ACKs. Sessions are only destroyed on the thread that
+ * collects, so `sess` changes only through `fn` once the list is
+ * detached: a session it destroys clears `sess` of its acks still in
+ * the list, which are uncollected. An ack is freed by release_acks only
+ * after this loop has moved past it.
+ */
+void session_mailbox_collect(SessionMailbox* m, void (*fn)(void* owner, void* ctx), void* ctx) {
+    pthread_mutex_lock(&g_ack_mtx);
+    SessionAck* list = m->ready;
+    m->ready = NULL;
+    pthread_mutex_unlock(&g_ack_mtx);
+
+    while (list) {
+        SessionAck* a = list;
+        list = a->posted;
+        Session* s = a->sess;
+        if (!s) {
+            free(a);            // the session is gone
+            continue;
+        }
+        a->collected = 1;
+        release_acks(s);
+        if (fn) fn(s->owner, ctx);
+    }
+}
+
+void session_mailbox_wait(SessionMailbox* m) {
+    pthread_mutex_lock(&g_ack_mtx);
+    while (!m->ready) pthread_cond_wait(&m->cv, &g_ack_mtx);
+    pthread_mutex_unlock(&g_ack_mtx);
+}
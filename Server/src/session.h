@@ -0,0 +1,133 @@
+#ifndef SESSION_H
+#define SESSION_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <pthread.h>
+#include "protocol.h"
+#include "stream_decode.h"
+
+// Server side of the upload protocol (HELLO -> IMAGE_INFO -> CHUNK* ->
+// COMPLETE, repeated for any number of images per connection) as a
+// transport-independent state machine. The I/O engine
+// asks for the next receive window, reads into it (chunk payloads land
+// directly in the image buffer), reports how many bytes arrived, and
+// writes out the queued responses. Used by both the threaded and the
+// epoll connection engines.
+
+#define SESSION_OUT_CAP     2048   // queued response bytes
+#define SESSION_RESPONSE_MAX (sizeof(MessageHeader) + 4)   // largest response (RETRY_AFTER)
+#define SESSION_SCRATCH_CAP 1024   // sink for ignored payloads
+
+typedef enum {
+    SESSION_OPEN   = 0,    // keep reading
+    SESSION_DONE   = 1,    // flush the queued responses, then close
+    SESSION_FAILED = -1    // protocol or resource error: close now
+} SessionStatus;
+
+// Where the journal thread posts the ACKs of synced uploads for one
+// engine thread (a reactor, the ring, or one connection's thread). Each
+// post increments `evfd`, which the engine polls; without an eventfd
+// the engine stops reading and blocks in session_mailbox_wait instead.
+typedef struct SessionMailbox {
+    pthread_cond_t     cv;
+    int                evfd;           // -1 = none
+    struct SessionAck* ready;          // posted, not yet collected
+} SessionMailbox;
+
+typedef struct {
+    // Receive state of the current message
+    MessageHeader  hdr;            // header being received / being handled
+    int            in_payload;     // 0 = receiving header, 1 = payload
+    unsigned char* dst;            // payload destination
+    size_t         need;           // payload bytes expected into dst
+    size_t         got;            // bytes received of the header / payload
+    size_t         skip_left;      // ignored payload bytes still to drain
+    ImageInfo      info;
+    char           fmt[32];        // IMAGE_COMPLETE payload
+    unsigned char  scratch[SESSION_SCRATCH_CAP];
+
+    // Image being uploaded
+    char           current_uuid[37];
+    char           current_filename[MAX_FILENAME];
+    char           current_format[10];
+    uint32_t       expected_chunks, received_chunks;
+    uint32_t       remaining_bytes;
+    uint32_t       total_size;
+    ProcessingType processing_type;
+    unsigned char* img_buf;        // whole image (buffer pool)
+    size_t         img_cap;        // == expected total_size
+    size_t         img_off;        // bytes written
+    StreamDecode*  stream;         // decoder reading img_buf as it fills (NULL = none)
+    size_t         img_charge;     // memory budget reserved for img_buf
+    int            img_deferred;   // upload refused with RETRY_AFTER: drain its messages
+
+    uint32_t       client_id;      // hash of the peer address (fair-share scheduling)
+
+    // Uploads whose MSG_ACK is held, oldest first: each waits for its
+    // journal record, and the ACKs go out in upload order
+    struct SessionAck* acks;
+    struct SessionAck* acks_tail;
+    size_t             acks_held;
+    SessionMailbox*    mbox;           // NULL = ACK right away, without waiting for the journal
+    void*              owner;          // engine's connection, passed back by the mailbox
+
+    // Responses not yet written to the peer
+    unsigned char  out[SESSION_OUT_CAP];
+    size_t         out_off, out_len;
+
+    SessionStatus  status;
+} Session;
+
+void session_init(Session* s);
+
+// Identify the client behind socket `fd` (its address, not the port, so
+// parallel connections of one host share a fair-share account)
+void session_set_peer(Session* s, int fd);
+
+// Release a partially received image (and stop its streaming decoder)
+void session_destroy(Session* s);
+
+// Where the next received bytes must be stored. *len is 0 when the
+// session does not want input (done, or responses must drain first;
+// output room is kept for every held ACK).
+void session_recv_window(Session* s, void** buf, size_t* len);
+
+// Account `n` bytes stored into the current window and run the protocol
+// on message boundaries. Returns the session status.
+SessionStatus session_received(Session* s, size_t n);
+
+// Queued response bytes (0 = nothing to send)
+size_t session_pending_output(const Session* s, const void** buf);
+void   session_consume_output(Session* s, size_t n);
+
+// Log why the transport ended (CS_* code) given where the protocol stood
+void session_log_disconnect(const Session* s, long rc);
+
+// The peer will send nothing more (EOF): stop reading. The session is
+// SESSION_DONE, and closes once the held ACKs have gone out.
+void session_end_input(Session* s);
+
+// Deliver journal ACKs through `m` (the engine thread that drives `s`)
+void session_set_mailbox(Session* s, SessionMailbox* m, void* owner);
+
+// 1 while any upload's ACK is held for the journal
+int session_ack_pending(const Session* s);
+
+// Stop waiting for the held ACKs; each is dropped when it arrives (the
+// jobs themselves stay accepted). session_destroy does this too.
+void session_cancel_acks(Session* s);
+
+void session_mailbox_init(SessionMailbox* m, int evfd);
+void session_mailbox_destroy(SessionMailbox* m);
+
+// On the engine thread: take every posted ACK, queue the responses that
+// are next in their session's upload order, then call `fn` with the
+// owner of each session that got one so the engine can write them out.
+// Sessions destroyed in the meantime are skipped.
+void session_mailbox_collect(SessionMailbox* m, void (*fn)(void* owner, void* ctx), void* ctx);
+
+// Block until an ACK has been posted to `m` (engines without eventfd)
+void session_mailbox_wait(SessionMailbox* m);
+
+#endif // SESSION_H
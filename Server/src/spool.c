@@ -0,0 +1,156 @@
+#define _GNU_SOURCE
+#include "spool.h"
+#include "logging.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <stdatomic.h>
+
+static char g_dir[512] = "";
+
+static atomic_uint_least64_t g_spilled = 0, g_failed = 0;
+static atomic_uint_least64_t g_bytes = 0, g_mapped = 0, g_reused = 0;
+
+/*
+ * spool_init
+ * ----------
+ * Remember the spool directory. Nothing is created on disk until the
+ * first spill.
+ */
+void spool_init(const char* dir) {
+    snprintf(g_dir, sizeof(g_dir), "%s", dir ? dir : "");
+}
+
+void spool_shutdown(void) {
+    SpoolStats st;
+    spool_get_stats(&st);
+    if (st.spilled || st.failed || st.reused) {
+        log_line("Spool: spilled=%llu (%llu MiB) mapped-from-journal=%llu failed=%llu",
+                 (unsigned long long)st.spilled, (unsigned long long)(st.bytes >> 20),
+                 (unsigned long long)st.reused, (unsigned long long)st.failed);
+    }
+}
+
+/*
+ * spool_open
+ * ----------
+ * Create an anonymous file in the spool directory: O_TMPFILE where the
+ * filesystem supports it, otherwise a mkstemp file unlinked right away.
+ */
+static int spool_open(void) {
+    if (!g_dir[0]) return -1;
+#ifdef O_TMPFILE
+    int fd = open(g_dir, O_TMPFILE | O_RDWR | O_CLOEXEC, 0600);
+    if (fd >= 0) return fd;
+#endif
+    char path[600];
+    snprintf(path, sizeof(path), "%s/spool-XXXXXX", g_dir);
+    int tfd = mkstemp(path);
+    if (tfd < 0) return -1;
+    unlink(path);
+    return tfd;
+}
+
+static int write_all(int fd, const unsigned char* data, size_t len) {
+    size_t off = 0;
+    while (off < len) {
+        ssize_t n = pwrite(fd, data + off, len - off, (off_t)off);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        off += (size_t)n;
+    }
+    return 0;
+}
+
+/*
+ * spool_store
+ * -----------
+ * Write the payload and map it back. Writeback is started right away so
+ * the dirty pages turn into clean, droppable page cache instead of piling
+ * up until the flusher runs. The descriptor is closed once mapped; the
+ * mapping keeps the file alive.
+ */
+unsigned char* spool_store(const unsigned char* data, size_t len) {
+    if (!data || len == 0) return NULL;
+
+    int fd = spool_open();
+    if (fd < 0) {
+        atomic_fetch_add(&g_failed, 1);
+        log_line("Spool: cannot create a file in %s: %s", g_dir, strerror(errno));
+        return NULL;
+    }
+
+    void* map = MAP_FAILED;
+    if (write_all(fd, data, len) == 0) {
+#ifdef SYNC_FILE_RANGE_WRITE
+        sync_file_range(fd, 0, 0, SYNC_FILE_RANGE_WRITE);
+#endif
+        map = mmap(NULL, len, PROT_READ, MAP_SHARED, fd, 0);
+    }
+    int err = errno;
+    close(fd);
+
+    if (map == MAP_FAILED) {
+        atomic_fetch_add(&g_failed, 1);
+        log_line("Spool: failed to spill %zu bytes: %s", len, strerror(err));
+        return NULL;
+    }
+    madvise(map, len, MADV_SEQUENTIAL);
+
+    atomic_fetch_add(&g_spilled, 1);
+    atomic_fetch_add(&g_bytes, len);
+    atomic_fetch_add(&g_mapped, len);
+    return (unsigned char*)map;
+}
+
+/*
+ * spool_map
+ * ---------
+ * Map a range of a file that already holds the payload. The mapping
+ * starts at the page containing `off`; the returned pointer is moved to
+ * `off` itself and spool_release undoes the adjustment.
+ */
+unsigned char* spool_map(const char* path, uint64_t off, size_t len) {
+    if (!path || len == 0) return NULL;
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        log_line("Spool: cannot open %s: %s", path, strerror(errno));
+        return NULL;
+    }
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    size_t delta = (size_t)(off % page);
+    void* map = mmap(NULL, len + delta, PROT_READ, MAP_SHARED, fd, (off_t)(off - delta));
+    int err = errno;
+    close(fd);
+    if (map == MAP_FAILED) {
+        log_line("Spool: cannot map %zu bytes of %s: %s", len, path, strerror(err));
+        return NULL;
+    }
+    madvise(map, len + delta, MADV_SEQUENTIAL);
+
+    atomic_fetch_add(&g_reused, 1);
+    atomic_fetch_add(&g_mapped, len);
+    return (unsigned char*)map + delta;
+}
+
+void spool_release(unsigned char* map, size_t len) {
+    if (!map) return;
+    size_t delta = (size_t)((uintptr_t)map % (size_t)sysconf(_SC_PAGESIZE));
+    munmap(map - delta, len + delta);
+    atomic_fetch_sub(&g_mapped, len);
+}
+
+void spool_get_stats(SpoolStats* out) {
+    if (!out) return;
+    out->spilled      = atomic_load(&g_spilled);
+    out->failed       = atomic_load(&g_failed);
+    out->bytes        = atomic_load(&g_bytes);
+    out->mapped_bytes = atomic_load(&g_mapped);
+    out->reused       = atomic_load(&g_reused);
+}
@@ -0,0 +1,41 @@
+#ifndef SPOOL_H
+#define SPOOL_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Disk spool for queued payloads. When the scheduler's in-memory backlog
+// is over its limit, an upload buffer is written to an anonymous file
+// under paths.spool_dir and replaced by a read-only mapping of it, so
+// the queued bytes live in the page cache (clean, reclaimable) instead
+// of anonymous memory. The file has no name (O_TMPFILE, or unlinked at
+// once) and disappears with its last mapping. A payload that is already
+// on disk (a journal record) is mapped from its file instead of copied.
+
+typedef struct {
+    uint64_t spilled;       // payloads written to the spool
+    uint64_t failed;        // spill attempts that fell back to memory
+    uint64_t bytes;         // total bytes written
+    uint64_t mapped_bytes;  // currently mapped
+    uint64_t reused;        // payloads mapped from an existing file (nothing written)
+} SpoolStats;
+
+// Directory for the spool files (must exist)
+void spool_init(const char* dir);
+
+// Log the counters
+void spool_shutdown(void);
+
+// Copy `data` to a new spool file and map it back read-only. Returns the
+// mapping (release with spool_release) or NULL when the spool cannot be
+// used; the caller's buffer is never touched.
+unsigned char* spool_store(const unsigned char* data, size_t len);
+
+// Map `len` bytes at offset `off` of the file `path` read-only. Returns
+// the mapping (release with spool_release) or NULL.
+unsigned char* spool_map(const char* path, uint64_t off, size_t len);
+void spool_release(unsigned char* map, size_t len);
+
+void spool_get_stats(SpoolStats* out);
+
+#endif // SPOOL_H
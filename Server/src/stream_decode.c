@@ -0,0 +1,243 @@
+#include "stream_decode.h"
+#include "image_processing.h"
+#include "gif_processing.h"
+#include "tiled_processing.h"
+#include "buffer_pool.h"
+#include "config.h"
+#include "logging.h"
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <stdatomic.h>
+
+// External access to global config
+extern ServerConfig g_cfg;
+
+struct StreamDecode {
+    pthread_mutex_t      mtx;
+    pthread_cond_t       cv;
+    const unsigned char* buf;       // upload buffer (owned by the session, then the job)
+    size_t               total;
+    size_t               avail;     // bytes of buf received so far (guarded)
+    int                  aborted;   // stop reading: upload abandoned or owner gone (guarded)
+    int                  done;      // decoder thread finished (guarded)
+    int                  refs;      // owner + decoder thread (guarded)
+    unsigned char*       orphan;    // buffer handed over by sd_abandon
+    size_t               pos;       // read position (decoder thread only)
+    int                  gif;
+    ProcessingType       processing_type;
+
+    // Result, valid once done
+    unsigned char*       pixels;
+    int                  w, h, channels, frames;
+    int*                 delays;
+    PixelStats           stats;
+};
+
+static atomic_int g_live = 0;       // decoders not yet destroyed
+
+/*
+ * sd_read / sd_skip / sd_eof
+ * --------------------------
+ * Byte source handed to stb_image. Reads block until the session has
+ * received the requested bytes, the upload is complete or it was
+ * abandoned (which reads as end of data and makes the decode fail).
+ */
+static int sd_read(void* user, char* data, int size) {
+    StreamDecode* sd = (StreamDecode*)user;
+
+    pthread_mutex_lock(&sd->mtx);
+    while (sd->pos >= sd->avail && sd->avail < sd->total && !sd->aborted)
+        pthread_cond_wait(&sd->cv, &sd->mtx);
+    size_t avail = sd->aborted ? sd->pos : sd->avail;
+    pthread_mutex_unlock(&sd->mtx);
+
+    if (sd->pos >= avail || size <= 0) return 0;
+    size_t n = avail - sd->pos;
+    if (n > (size_t)size) n = (size_t)size;
+    memcpy(data, sd->buf + sd->pos, n);
+    sd->pos += n;
+    return (int)n;
+}
+
+static void sd_skip(void* user, int n) {
+    StreamDecode* sd = (StreamDecode*)user;
+    if (n < 0 && (size_t)-n > sd->pos) sd->pos = 0;
+    else sd->pos += (size_t)(long)n;
+    if (sd->pos > sd->total) sd->pos = sd->total;
+}
+
+static int sd_eof(void* user) {
+    StreamDecode* sd = (StreamDecode*)user;
+    pthread_mutex_lock(&sd->mtx);
+    int eof = sd->aborted || sd->pos >= sd->total;
+    pthread_mutex_unlock(&sd->mtx);
+    return eof;
+}
+
+static void sd_destroy(StreamDecode* sd) {
+    if (sd->pixels) decoded_image_free(sd->pixels);
+    if (sd->delays) decoded_image_free(sd->delays);
+    pixel_stats_free(&sd->stats);
+    if (sd->orphan) bp_free(sd->orphan);
+    pthread_mutex_destroy(&sd->mtx);
+    pthread_cond_destroy(&sd->cv);
+    free(sd);
+    atomic_fetch_sub(&g_live, 1);
+}
+
+// Drop one reference; the last one frees the decoder
+static void sd_unref(StreamDecode* sd) {
+    pthread_mutex_lock(&sd->mtx);
+    int last = (--sd->refs == 0);
+    pthread_mutex_unlock(&sd->mtx);
+    if (last) sd_destroy(sd);
+}
+
+/*
+ * sd_main
+ * -------
+ * Decoder thread: decode through the blocking byte source, then
+ * precompute the statistics the processing type needs while the job is
+ * still travelling through the protocol and the scheduler. Static images
+ * over the working-set cap are left to the worker's tiled path.
+ */
+static void* sd_main(void* arg) {
+    StreamDecode* sd = (StreamDecode*)arg;
+    ImageByteSource src = { sd_read, sd_skip, sd_eof };
+
+    unsigned char* px = NULL;
+    int iw = 0, ih = 0, ic = 0;
+    int oversized = !sd->gif && info_from_source(&src, sd, &iw, &ih, &ic) &&
+                    tiled_exceeds_working_set(iw, ih, ic);
+    sd->pos = 0;
+    if (!oversized) px = decode_from_source(&src, sd, sd->gif, &sd->w, &sd->h, &sd->frames,
+                                           sd->gif ? &sd->delays : NULL, &sd->channels);
+
+    pthread_mutex_lock(&sd->mtx);
+    int aborted = sd->aborted;
+    pthread_mutex_unlock(&sd->mtx);
+
+    if (px && !aborted && sd->w > 0 && sd->h > 0 && sd->frames > 0) {
+        compute_pixel_stats(px, sd->w, sd->h, sd->channels, sd->frames,
+                            sd->processing_type, &sd->stats);
+    }
+    sd->pixels = px;
+
+    pthread_mutex_lock(&sd->mtx);
+    sd->done = 1;
+    pthread_cond_broadcast(&sd->cv);
+    pthread_mutex_unlock(&sd->mtx);
+
+    sd_unref(sd);
+    return NULL;
+}
+
+static int is_gif(const char* format) {
+    return format && strcasecmp(format, "gif") == 0;
+}
+
+StreamDecode* sd_start(const unsigned char* buf, size_t total, const char* format,
+                       ProcessingType processing_type) {
+    if (!g_cfg.stream_decode || processing_type == 0 || !buf || !format) return NULL;
+    if ((long long)total < (long long)g_cfg.stream_decode_min_bytes || total > 0x7fffffff) return NULL;
+    if (!is_gif(format) && strcasecmp(format, "png") != 0 &&
+        strcasecmp(format, "jpg") != 0 && strcasecmp(format, "jpeg") != 0) return NULL;
+
+    if (atomic_fetch_add(&g_live, 1) >= g_cfg.stream_decoders) {
+        atomic_fetch_sub(&g_live, 1);
+        return NULL;
+    }
+
+    StreamDecode* sd = (StreamDecode*)calloc(1, sizeof(*sd));
+    if (!sd) { atomic_fetch_sub(&g_live, 1); return NULL; }
+    pthread_mutex_init(&sd->mtx, NULL);
+    pthread_cond_init(&sd->cv, NULL);
+    sd->buf = buf;
+    sd->total = total;
+    sd->refs = 2;
+    sd->gif = is_gif(format);
+    sd->processing_type = processing_type;
+
+    pthread_t th;
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    int rc = pthread_create(&th, &attr, sd_main, sd);
+    pthread_attr_destroy(&attr);
+    if (rc != 0) {
+        sd->refs = 1;
+        sd_unref(sd);
+        return NULL;
+    }
+    return sd;
+}
+
+void sd_feed(StreamDecode* sd, size_t avail) {
+    pthread_mutex_lock(&sd->mtx);
+    if (avail > sd->total) avail = sd->total;
+    if (avail > sd->avail) {
+        sd->avail = avail;
+        pthread_cond_signal(&sd->cv);
+    }
+    pthread_mutex_unlock(&sd->mtx);
+}
+
+void sd_abandon(StreamDecode* sd, unsigned char* buf) {
+    pthread_mutex_lock(&sd->mtx);
+    sd->aborted = 1;
+    sd->orphan = buf;
+    pthread_cond_broadcast(&sd->cv);
+    pthread_mutex_unlock(&sd->mtx);
+    sd_unref(sd);
+}
+
+// Block until the decoder thread has finished
+static void sd_wait(StreamDecode* sd) {
+    pthread_mutex_lock(&sd->mtx);
+    while (!sd->done) pthread_cond_wait(&sd->cv, &sd->mtx);
+    pthread_mutex_unlock(&sd->mtx);
+}
+
+/*
+ * sd_process
+ * ----------
+ * Run the pipeline on the streamed decode. The pixels are consumed
+ * (equalized in place), so a second call falls back. A failed decode or
+ * a COMPLETE that changed the format also falls back, letting the
+ * regular path decide and log the outcome.
+ */
+int sd_process(StreamDecode* sd, const char* image_id, const char* filename,
+               const char* format, ProcessingType processing_type) {
+    sd_wait(sd);
+    if (!sd->pixels || sd->w <= 0 || sd->h <= 0 || sd->frames <= 0) return -1;
+    if (sd->gif != is_gif(format) || processing_type != sd->processing_type) return -1;
+
+    const PixelStats* pre = &sd->stats;
+    if (sd->gif) {
+        log_line("Processing (stream) %s: %dx%d, %d frames, type=%u (gif)",
+                 image_id, sd->w, sd->h, sd->frames, (unsigned)processing_type);
+        process_gif_frames(sd->pixels, sd->delays, sd->w, sd->h, sd->frames,
+                           sd->buf, sd->total, pre,
+                           image_id, filename, processing_type, " (stream)");
+    } else {
+        log_line("Processing (stream) %s: %dx%d, %d ch, type=%u (static)",
+                 image_id, sd->w, sd->h, sd->channels, (unsigned)processing_type);
+        process_decoded_image(sd->pixels, sd->w, sd->h, sd->channels, pre, image_id,
+                              filename, format, processing_type, " (stream)");
+    }
+
+    decoded_image_free(sd->pixels);
+    sd->pixels = NULL;
+    return 0;
+}
+
+void sd_release(StreamDecode* sd) {
+    pthread_mutex_lock(&sd->mtx);
+    sd->aborted = 1;             // the data is complete; only wakes a stalled reader
+    pthread_cond_broadcast(&sd->cv);
+    pthread_mutex_unlock(&sd->mtx);
+    sd_wait(sd);
+    sd_unref(sd);
+}
@@ -0,0 +1,37 @@
+#ifndef STREAM_DECODE_H
+#define STREAM_DECODE_H
+
+#include <stddef.h>
+#include "protocol.h"
+
+// Streaming decode: large uploads start decoding on a helper thread
+// while their chunks are still arriving. The decoder reads the upload
+// buffer up to the bytes received so far and waits for more, then
+// precomputes the processing statistics, so the worker that later picks
+// the job only has to remap and encode.
+
+typedef struct StreamDecode StreamDecode;
+
+// Start decoding an upload of `total` bytes being received into `buf`.
+// Returns NULL when streaming does not apply (disabled, small upload,
+// no processing, unsupported format or too many decoders live); the
+// worker then decodes the complete buffer as usual.
+StreamDecode* sd_start(const unsigned char* buf, size_t total, const char* format,
+                       ProcessingType processing_type);
+
+// Publish that the first `avail` bytes of the buffer are now valid
+void sd_feed(StreamDecode* sd, size_t avail);
+
+// The upload will not complete: stop the decoder and hand it `buf`,
+// which it frees once it no longer reads from it
+void sd_abandon(StreamDecode* sd, unsigned char* buf);
+
+// Wait for the decode and run the processing pipeline on its result.
+// Returns -1 when the caller must fall back to decoding the buffer.
+int  sd_process(StreamDecode* sd, const char* image_id, const char* filename,
+                const char* format, ProcessingType processing_type);
+
+// Drop the owner's reference (waits for the decoder to stop reading)
+void sd_release(StreamDecode* sd);
+
+#endif // STREAM_DECODE_H
@@ -0,0 +1,235 @@
+#include "thread_pool.h"
+#include "logging.h"
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+
+#define TP_MAX_THREADS 256
+
+typedef struct TpTask {
+    TpTaskFn       fn;
+    void*          arg;
+    TpGroup*       group;
+    struct TpTask* next;
+} TpTask;
+
+// ---- FIFO of pending tasks ----
+static pthread_mutex_t g_tp_mtx = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t  g_tp_cv  = PTHREAD_COND_INITIALIZER;
+static TpTask*         g_head = NULL;
+static TpTask*         g_tail = NULL;
+static int             g_tp_running = 0;
+static pthread_t       g_tp_threads[TP_MAX_THREADS];
+static int             g_tp_count = 0;
+
+static void* tp_thread_main(void* arg);
+
+/*
+ * tp_init
+ * -------
+ * Start the shared helper pool. `threads` <= 0 selects one helper per
+ * online CPU. Returns 0 on success, -1 if no helper could be started
+ * (callers then fall back to running tasks inline).
+ */
+int tp_init(int threads) {
+    int n = threads;
+    if (n <= 0) {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        n = (cpus > 0) ? (int)cpus : 1;
+    }
+    if (n > TP_MAX_THREADS) n = TP_MAX_THREADS;
+
+    pthread_mutex_lock(&g_tp_mtx);
+    g_tp_running = 1;
+    pthread_mutex_unlock(&g_tp_mtx);
+
+    g_tp_count = 0;
+    for (int i = 0; i < n; ++i) {
+        if (pthread_create(&g_tp_threads[i], NULL, tp_thread_main, NULL) != 0) {
+            log_line("Thread pool: failed to start helper %d", i);
+            break;
+        }
+        g_tp_count++;
+    }
+    if (g_tp_count == 0) {
+        pthread_mutex_lock(&g_tp_mtx);
+        g_tp_running = 0;
+        pthread_mutex_unlock(&g_tp_mtx);
+        return -1;
+    }
+    log_line("Thread pool: %d helper thread(s) started", g_tp_count);
+    return 0;
+}
+
+/*
+ * tp_shutdown
+ * -----------
+ * Ask helpers to exit once the queue is empty and join them.
+ */
+void tp_shutdown(void) {
+    pthread_mutex_lock(&g_tp_mtx);
+    if (!g_tp_running) { pthread_mutex_unlock(&g_tp_mtx); return; }
+    g_tp_running = 0;
+    pthread_cond_broadcast(&g_tp_cv);
+    pthread_mutex_unlock(&g_tp_mtx);
+
+    for (int i = 0; i < g_tp_count; ++i) pthread_join(g_tp_threads[i], NULL);
+    g_tp_count = 0;
+    log_line("Thread pool: helpers stopped");
+}
+
+int tp_size(void) {
+    return g_tp_running ? g_tp_count : 0;
+}
+
+void tp_group_init(TpGroup* g) {
+    g->pending = 0;
+    pthread_mutex_init(&g->mtx, NULL);
+    pthread_cond_init(&g->cv, NULL);
+}
+
+void tp_group_destroy(TpGroup* g) {
+    pthread_mutex_destroy(&g->mtx);
+    pthread_cond_destroy(&g->cv);
+}
+
+/*
+ * run_task
+ * --------
+ * Execute a task and signal its group when it was the last one pending.
+ */
+static void run_task(TpTask* t) {
+    TpGroup* g = t->group;
+    t->fn(t->arg);
+    free(t);
+
+    pthread_mutex_lock(&g->mtx);
+    if (--g->pending == 0) pthread_cond_broadcast(&g->cv);
+    pthread_mutex_unlock(&g->mtx);
+}
+
+/*
+ * tp_group_submit
+ * ---------------
+ * Append fn(arg) to the shared FIFO, accounted to group `g`.
+ */
+void tp_group_submit(TpGroup* g, TpTaskFn fn, void* arg) {
+    TpTask* t = (TpTask*)malloc(sizeof(TpTask));
+    if (!t) { fn(arg); return; }
+    t->fn = fn;
+    t->arg = arg;
+    t->group = g;
+    t->next = NULL;
+
+    pthread_mutex_lock(&g->mtx);
+    g->pending++;
+    pthread_mutex_unlock(&g->mtx);
+
+    pthread_mutex_lock(&g_tp_mtx);
+    if (!g_tp_running) {
+        pthread_mutex_unlock(&g_tp_mtx);
+        run_task(t);
+        return;
+    }
+    if (g_tail) g_tail->next = t; else g_head = t;
+    g_tail = t;
+    pthread_cond_signal(&g_tp_cv);
+    pthread_mutex_unlock(&g_tp_mtx);
+}
+
+/*
+ * take_group_task
+ * ---------------
+ * Unlink the oldest queued task belonging to `g` (NULL if none).
+ * Must be called with g_tp_mtx held.
+ */
+static TpTask* take_group_task(TpGroup* g) {
+    TpTask* prev = NULL;
+    for (TpTask* t = g_head; t; prev = t, t = t->next) {
+        if (t->group != g) continue;
+        if (prev) prev->next = t->next; else g_head = t->next;
+        if (g_tail == t) g_tail = prev;
+        return t;
+    }
+    return NULL;
+}
+
+/*
+ * tp_group_wait
+ * -------------
+ * Wait for all tasks of `g`. While any of them is still queued the
+ * caller runs it itself, so a busy pool never stalls the submitter.
+ */
+void tp_group_wait(TpGroup* g) {
+    for (;;) {
+        pthread_mutex_lock(&g_tp_mtx);
+        TpTask* t = take_group_task(g);
+        pthread_mutex_unlock(&g_tp_mtx);
+        if (!t) break;
+        run_task(t);
+    }
+
+    pthread_mutex_lock(&g->mtx);
+    while (g->pending > 0) pthread_cond_wait(&g->cv, &g->mtx);
+    pthread_mutex_unlock(&g->mtx);
+}
+
+typedef struct {
+    void (*fn)(void* ctx, int i);
+    void* ctx;
+    int   index;
+} TpForItem;
+
+static void tp_for_trampoline(void* arg) {
+    TpForItem* it = (TpForItem*)arg;
+    it->fn(it->ctx, it->index);
+}
+
+/*
+ * tp_parallel_for
+ * ---------------
+ * Run fn(ctx, i) for every i in [0, n) using the pool and wait for
+ * completion. Runs serially when the pool is not available.
+ */
+void tp_parallel_for(int n, void (*fn)(void* ctx, int i), void* ctx) {
+    if (n <= 0) return;
+    TpForItem* items = (tp_size() > 0 && n > 1)
+        ? (TpForItem*)malloc(sizeof(TpForItem) * (size_t)n) : NULL;
+    if (!items) {
+        for (int i = 0; i < n; ++i) fn(ctx, i);
+        return;
+    }
+
+    TpGroup g;
+    tp_group_init(&g);
+    for (int i = 0; i < n; ++i) {
+        items[i].fn = fn;
+        items[i].ctx = ctx;
+        items[i].index = i;
+        tp_group_submit(&g, tp_for_trampoline, &items[i]);
+    }
+    tp_group_wait(&g);
+    tp_group_destroy(&g);
+    free(items);
+}
+
+/*
+ * tp_thread_main
+ * --------------
+ * Helper loop: pop tasks in FIFO order until shutdown drains the queue.
+ */
+static void* tp_thread_main(void* arg) {
+    (void)arg;
+    for (;;) {
+        pthread_mutex_lock(&g_tp_mtx);
+        while (g_tp_running && !g_head) pthread_cond_wait(&g_tp_cv, &g_tp_mtx);
+        TpTask* t = g_head;
+        if (!t) { pthread_mutex_unlock(&g_tp_mtx); break; }
+        g_head = t->next;
+        if (!g_head) g_tail = NULL;
+        pthread_mutex_unlock(&g_tp_mtx);
+
+        run_task(t);
+    }
+    return NULL;
+}
@@ -0,0 +1,42 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <pthread.h>
+
+// Shared pool of helper threads for intra-job parallelism (image bands,
+// concurrent encodes). Scheduler workers submit tasks grouped in a
+// TpGroup and wait for the whole group; the waiting thread runs its own
+// group's queued tasks instead of sleeping.
+
+typedef void (*TpTaskFn)(void* arg);
+
+typedef struct {
+    int             pending;   // submitted but not yet finished (guarded by mtx)
+    pthread_mutex_t mtx;
+    pthread_cond_t  cv;
+} TpGroup;
+
+// Start the pool with `threads` helpers (<= 0 = one per online CPU)
+// Returns: 0 on success, -1 on failure
+int tp_init(int threads);
+
+// Stop and join all helpers. Queued tasks are executed first.
+void tp_shutdown(void);
+
+// Number of helper threads (0 when the pool is not running)
+int tp_size(void);
+
+void tp_group_init(TpGroup* g);
+void tp_group_destroy(TpGroup* g);
+
+// Queue fn(arg) in group `g`. Runs it inline when the pool is not
+// running or the task cannot be queued.
+void tp_group_submit(TpGroup* g, TpTaskFn fn, void* arg);
+
+// Block until every task of `g` has finished
+void tp_group_wait(TpGroup* g);
+
+// Run fn(ctx, i) for i in [0, n) across the pool and wait for all
+void tp_parallel_for(int n, void (*fn)(void* ctx, int i), void* ctx);
+
+#endif // THREAD_POOL_H
@@ -0,0 +1,422 @@
+#include "tiled_processing.h"
+#include "image_processing.h"
+#include "pixel_kernels.h"
+#include "config.h"
+#include "logging.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <setjmp.h>
+#include <png.h>
+#include <jpeglib.h>
+
+// External access to global config
+extern ServerConfig g_cfg;
+
+#define TILED_STRIP_BYTES  (4u << 20)   // strip size target (capped by the budget)
+#define TILED_JPEG_QUALITY 95           // same quality as save_image
+
+enum { TILED_PNG = 0, TILED_JPEG = 1 };
+
+typedef struct {
+    struct jpeg_error_mgr pub;
+    jmp_buf               jb;
+} JpegErr;
+
+typedef struct {
+    const unsigned char* data;
+    size_t               size, off;
+} MemCursor;
+
+// Row-by-row decoder over an in-memory PNG or JPEG
+typedef struct {
+    int                           kind;
+    int                           w, h, channels;
+    png_structp                   png;
+    png_infop                     info;
+    MemCursor                     cur;
+    struct jpeg_decompress_struct jd;
+    JpegErr                       jerr;
+    int                           jd_live;
+} StripReader;
+
+// Row-by-row encoder writing a PNG or JPEG file
+typedef struct {
+    int                         kind;
+    int                         w, h, channels;
+    FILE*                       f;
+    png_structp                 png;
+    png_infop                   info;
+    struct jpeg_compress_struct jc;
+    JpegErr                     jerr;
+    int                         jc_live;
+    unsigned char*              row;      // channel conversion for JPEG
+} StripWriter;
+
+// ---- libpng / libjpeg error hooks (errors unwind to the caller's setjmp) ----
+static void png_fail(png_structp png, png_const_charp msg) {
+    log_line("Tiled: PNG error: %s", msg);
+    png_longjmp(png, 1);
+}
+
+static void png_quiet(png_structp png, png_const_charp msg) {
+    (void)png; (void)msg;
+}
+
+static void png_mem_read(png_structp png, png_bytep out, png_size_t n) {
+    MemCursor* c = (MemCursor*)png_get_io_ptr(png);
+    if (n > c->size - c->off) png_error(png, "truncated data");
+    memcpy(out, c->data + c->off, n);
+    c->off += n;
+}
+
+static void jpeg_fail(j_common_ptr cinfo) {
+    char msg[JMSG_LENGTH_MAX];
+    (*cinfo->err->format_message)(cinfo, msg);
+    log_line("Tiled: JPEG error: %s", msg);
+    longjmp(((JpegErr*)cinfo->err)->jb, 1);
+}
+
+static void jpeg_quiet(j_common_ptr cinfo) {
+    (void)cinfo;
+}
+
+/*
+ * tiled_exceeds_working_set
+ * -------------------------
+ * Whether the full decoded bitmap would exceed memory.max_working_set_mb
+ * (0 disables the tiled path).
+ */
+int tiled_exceeds_working_set(int width, int height, int channels) {
+    if (g_cfg.max_working_set_mb <= 0 || width <= 0 || height <= 0 || channels <= 0) return 0;
+    uint64_t bytes = (uint64_t)width * (uint64_t)height * (uint64_t)channels;
+    return bytes > ((uint64_t)g_cfg.max_working_set_mb << 20);
+}
+
+// ---- Strip reader ----
+static void reader_close(StripReader* r) {
+    if (r->png) png_destroy_read_struct(&r->png, r->info ? &r->info : NULL, NULL);
+    if (r->jd_live) jpeg_destroy_decompress(&r->jd);
+    r->png = NULL;
+    r->info = NULL;
+    r->jd_live = 0;
+}
+
+/*
+ * reader_open
+ * -----------
+ * Parse the headers and set up 8-bit interleaved output matching what
+ * stb_image returns for the same file (palettes and low bit depths
+ * expanded, tRNS turned into alpha, 16-bit samples reduced to 8).
+ * Interlaced PNGs and CMYK JPEGs are refused: they cannot be produced
+ * one row at a time in the same form. On failure call reader_close.
+ */
+static int reader_open(StripReader* r, const unsigned char* data, size_t size) {
+    memset(r, 0, sizeof(*r));
+
+    if (size >= 8 && png_sig_cmp(data, 0, 8) == 0) {
+        r->kind = TILED_PNG;
+        r->cur.data = data;
+        r->cur.size = size;
+        r->png = png_create_read_struct(PNG_LIBPNG_VER_STRING, NULL, png_fail, png_quiet);
+        if (!r->png) return -1;
+        r->info = png_create_info_struct(r->png);
+        if (!r->info) return -1;
+        if (setjmp(png_jmpbuf(r->png))) return -1;
+
+        png_set_read_fn(r->png, &r->cur, png_mem_read);
+        png_read_info(r->png, r->info);
+        if (png_get_interlace_type(r->png, r->info) != PNG_INTERLACE_NONE) return -1;
+        png_set_expand(r->png);
+        png_set_strip_16(r->png);
+        png_read_update_info(r->png, r->info);
+
+        r->w = (int)png_get_image_width(r->png, r->info);
+        r->h = (int)png_get_image_height(r->png, r->info);
+        r->channels = png_get_channels(r->png, r->info);
+        return 0;
+    }
+
+    if (size >= 2 && data[0] == 0xFF && data[1] == 0xD8) {
+        r->kind = TILED_JPEG;
+        r->jd.err = jpeg_std_error(&r->jerr.pub);
+        r->jerr.pub.error_exit = jpeg_fail;
+        r->jerr.pub.output_message = jpeg_quiet;
+        if (setjmp(r->jerr.jb)) return -1;
+
+        jpeg_create_decompress(&r->jd);
+        r->jd_live = 1;
+        jpeg_mem_src(&r->jd, data, (unsigned long)size);
+        jpeg_read_header(&r->jd, TRUE);
+        if (r->jd.jpeg_color_space == JCS_CMYK || r->jd.jpeg_color_space == JCS_YCCK) return -1;
+        r->jd.out_color_space = (r->jd.num_components == 1) ? JCS_GRAYSCALE : JCS_RGB;
+        jpeg_start_decompress(&r->jd);
+
+        r->w = (int)r->jd.output_width;
+        r->h = (int)r->jd.output_height;
+        r->channels = r->jd.output_components;
+        return 0;
+    }
+
+    return -1;
+}
+
+// Decode the next `rows` rows into dst (w * channels bytes per row)
+static int reader_rows(StripReader* r, unsigned char* dst, int rows) {
+    size_t stride = (size_t)r->w * (size_t)r->channels;
+
+    if (r->kind == TILED_PNG) {
+        if (setjmp(png_jmpbuf(r->png))) return -1;
+        for (int i = 0; i < rows; ++i) png_read_row(r->png, dst + (size_t)i * stride, NULL);
+        return 0;
+    }
+
+    if (setjmp(r->jerr.jb)) return -1;
+    for (int i = 0; i < rows; ) {
+        JSAMPROW row = dst + (size_t)i * stride;
+        JDIMENSION got = jpeg_read_scanlines(&r->jd, &row, 1);
+        if (got == 0) return -1;
+        i += (int)got;
+    }
+    return 0;
+}
+
+// ---- Strip writer ----
+static void writer_close(StripWriter* wr) {
+    if (wr->png) png_destroy_write_struct(&wr->png, wr->info ? &wr->info : NULL);
+    if (wr->jc_live) jpeg_destroy_compress(&wr->jc);
+    if (wr->f) fclose(wr->f);
+    free(wr->row);
+    memset(wr, 0, sizeof(*wr));
+}
+
+/*
+ * writer_open
+ * -----------
+ * Start an output file in the codec save_image would pick for `format`
+ * (JPEG for jpg/jpeg, PNG otherwise). JPEG output keeps stb's choices:
+ * quality 95 without chroma subsampling, alpha dropped, gray+alpha
+ * written as gray. On failure call writer_close.
+ */
+static int writer_open(StripWriter* wr, const char* path, const char* format,
+                       int w, int h, int channels) {
+    memset(wr, 0, sizeof(*wr));
+    wr->kind = (strcmp(format, "jpg") == 0 || strcmp(format, "jpeg") == 0) ? TILED_JPEG : TILED_PNG;
+    wr->w = w;
+    wr->h = h;
+    wr->channels = channels;
+    wr->f = fopen(path, "wb");
+    if (!wr->f) return -1;
+
+    if (wr->kind == TILED_PNG) {
+        static const int color_types[5] = {
+            0, PNG_COLOR_TYPE_GRAY, PNG_COLOR_TYPE_GRAY_ALPHA, PNG_COLOR_TYPE_RGB, PNG_COLOR_TYPE_RGB_ALPHA
+        };
+        if (channels < 1 || channels > 4) return -1;
+        wr->png = png_create_write_struct(PNG_LIBPNG_VER_STRING, NULL, png_fail, png_quiet);
+        if (!wr->png) return -1;
+        wr->info = png_create_info_struct(wr->png);
+        if (!wr->info) return -1;
+        if (setjmp(png_jmpbuf(wr->png))) return -1;
+
+        png_init_io(wr->png, wr->f);
+        png_set_IHDR(wr->png, wr->info, (png_uint_32)w, (png_uint_32)h, 8, color_types[channels],
+                     PNG_INTERLACE_NONE, PNG_COMPRESSION_TYPE_DEFAULT, PNG_FILTER_TYPE_DEFAULT);
+        png_write_info(wr->png, wr->info);
+        return 0;
+    }
+
+    if (channels != 1 && channels != 3) {
+        wr->row = (unsigned char*)malloc((size_t)w * 3);
+        if (!wr->row) return -1;
+    }
+    wr->jc.err = jpeg_std_error(&wr->jerr.pub);
+    wr->jerr.pub.error_exit = jpeg_fail;
+    wr->jerr.pub.output_message = jpeg_quiet;
+    if (setjmp(wr->jerr.jb)) return -1;
+
+    jpeg_create_compress(&wr->jc);
+    wr->jc_live = 1;
+    jpeg_stdio_dest(&wr->jc, wr->f);
+    wr->jc.image_width = (JDIMENSION)w;
+    wr->jc.image_height = (JDIMENSION)h;
+    wr->jc.input_components = channels >= 3 ? 3 : 1;
+    wr->jc.in_color_space = channels >= 3 ? JCS_RGB : JCS_GRAYSCALE;
+    jpeg_set_defaults(&wr->jc);
+    jpeg_set_quality(&wr->jc, TILED_JPEG_QUALITY, TRUE);
+    wr->jc.comp_info[0].h_samp_factor = 1;
+    wr->jc.comp_info[0].v_samp_factor = 1;
+    jpeg_start_compress(&wr->jc, TRUE);
+    return 0;
+}
+
+static int writer_rows(StripWriter* wr, const unsigned char* src, int rows) {
+    size_t stride = (size_t)wr->w * (size_t)wr->channels;
+
+    if (wr->kind == TILED_PNG) {
+        if (setjmp(png_jmpbuf(wr->png))) return -1;
+        for (int i = 0; i < rows; ++i) png_write_row(wr->png, src + (size_t)i * stride);
+        return 0;
+    }
+
+    if (setjmp(wr->jerr.jb)) return -1;
+    for (int i = 0; i < rows; ++i) {
+        const unsigned char* in = src + (size_t)i * stride;
+        JSAMPROW row = (JSAMPROW)in;
+        if (wr->row) {
+            int comps = wr->jc.input_components;
+            for (int x = 0; x < wr->w; ++x)
+                memcpy(wr->row + (size_t)x * comps, in + (size_t)x * wr->channels, (size_t)comps);
+            row = wr->row;
+        }
+        jpeg_write_scanlines(&wr->jc, &row, 1);
+    }
+    return 0;
+}
+
+static int writer_finish(StripWriter* wr) {
+    volatile int rc = 0;
+    if (wr->kind == TILED_PNG) {
+        if (setjmp(png_jmpbuf(wr->png))) rc = -1;
+        else png_write_end(wr->png, NULL);
+    } else {
+        if (setjmp(wr->jerr.jb)) rc = -1;
+        else jpeg_finish_compress(&wr->jc);
+    }
+    if (rc == 0 && fflush(wr->f) != 0) rc = -1;
+    writer_close(wr);
+    return rc;
+}
+
+/*
+ * strip_rows_for
+ * --------------
+ * Rows per strip: about TILED_STRIP_BYTES, at most half the working-set
+ * budget, at least one row.
+ */
+static int strip_rows_for(int width, int height, int channels) {
+    size_t row_bytes = (size_t)width * (size_t)channels;
+    size_t target = TILED_STRIP_BYTES;
+    size_t budget = ((size_t)g_cfg.max_working_set_mb << 20) / 2;
+    if (budget > 0 && budget < target) target = budget;
+
+    size_t rows = target / row_bytes;
+    if (rows < 1) rows = 1;
+    if (rows > (size_t)height) rows = (size_t)height;
+    return (int)rows;
+}
+
+size_t tiled_strip_bytes(int width, int height, int channels) {
+    return (size_t)width * (size_t)channels * (size_t)strip_rows_for(width, height, channels);
+}
+
+/*
+ * process_image_tiled
+ * -------------------
+ * Two passes over the encoded image. Pass 1 decodes strip by strip and
+ * accumulates the channel histograms and the color sums (exact totals,
+ * the sampling shortcut does not apply to strips). Pass 2 decodes again;
+ * each strip goes unchanged to the classified output and, remapped
+ * through the equalization tables, to the histogram output.
+ */
+int process_image_tiled(const unsigned char* data, size_t size,
+                        const char* image_id, const char* filename,
+                        const char* format, ProcessingType processing_type) {
+    int do_color = (processing_type == PROC_COLOR_CLASSIFICATION || processing_type == PROC_BOTH);
+    int do_hist  = (processing_type == PROC_HISTOGRAM || processing_type == PROC_BOTH);
+
+    StripReader rd;
+    if (reader_open(&rd, data, size) != 0) {
+        reader_close(&rd);
+        return -1;
+    }
+
+    int w = rd.w, h = rd.h, ch = rd.channels;
+    int nch = ch < 3 ? ch : 3;
+    int strip = strip_rows_for(w, h, ch);
+    size_t row_bytes = (size_t)w * (size_t)ch;
+    unsigned char* buf = (unsigned char*)malloc(row_bytes * (size_t)strip);
+    if (!buf) {
+        reader_close(&rd);
+        return -1;
+    }
+
+    log_line("Processing (tiled) %s: %dx%d, %d ch, type=%u, %d-row strips (%zu KB)",
+             image_id, w, h, ch, (unsigned)processing_type, strip,
+             (row_bytes * (size_t)strip) >> 10);
+
+    // Pass 1: statistics
+    uint64_t histogram[3][256];
+    uint64_t sums[3] = { 0, 0, 0 };
+    memset(histogram, 0, sizeof(histogram));
+    for (int y = 0; y < h; y += strip) {
+        int rows = (h - y < strip) ? h - y : strip;
+        if (reader_rows(&rd, buf, rows) != 0) {
+            reader_close(&rd);
+            free(buf);
+            return -1;
+        }
+        size_t px = (size_t)rows * (size_t)w;
+        if (do_hist) pk_histogram(buf, px, ch, nch, histogram);
+        if (do_color && ch >= 3) pk_channel_sums(buf, px, ch, sums);
+    }
+    reader_close(&rd);
+
+    unsigned char lut[3][256];
+    if (do_hist) {
+        for (int c = 0; c < nch; ++c)
+            equalization_lut_from_histogram(histogram[c], (size_t)w * (size_t)h, lut[c]);
+    }
+
+    char color_path[1024], hist_path[1024];
+    const char* cname = "red";
+    if (do_color) {
+        const char* color_dir = g_cfg.colors_red;
+        if (sums[0] >= sums[1] && sums[0] >= sums[2]) { /* red */ }
+        else if (sums[1] >= sums[0] && sums[1] >= sums[2]) { color_dir = g_cfg.colors_green; cname = "green"; }
+        else { color_dir = g_cfg.colors_blue; cname = "blue"; }
+        snprintf(color_path, sizeof(color_path), "%s/%s_%s", color_dir, image_id, filename);
+    }
+    if (do_hist) {
+        snprintf(hist_path, sizeof(hist_path), "%s/%s_%s", g_cfg.histogram_dir, image_id, filename);
+    }
+
+    // Pass 2: decode again, write both outputs strip by strip
+    StripWriter cw, hw;
+    int color_ok = do_color, hist_ok = do_hist;
+    memset(&cw, 0, sizeof(cw));
+    memset(&hw, 0, sizeof(hw));
+    if (do_color && writer_open(&cw, color_path, format, w, h, ch) != 0) color_ok = 0;
+    if (do_hist && writer_open(&hw, hist_path, format, w, h, ch) != 0) hist_ok = 0;
+
+    int decode_ok = (reader_open(&rd, data, size) == 0 && rd.w == w && rd.h == h && rd.channels == ch);
+    for (int y = 0; decode_ok && (color_ok || hist_ok) && y < h; y += strip) {
+        int rows = (h - y < strip) ? h - y : strip;
+        if (reader_rows(&rd, buf, rows) != 0) { decode_ok = 0; break; }
+        if (color_ok && writer_rows(&cw, buf, rows) != 0) color_ok = 0;
+        if (hist_ok) {
+            pk_apply_lut(buf, (size_t)rows * (size_t)w, ch, nch, (const unsigned char (*)[256])lut);
+            if (writer_rows(&hw, buf, rows) != 0) hist_ok = 0;
+        }
+    }
+    reader_close(&rd);
+    free(buf);
+
+    if (do_color) {
+        if (color_ok && decode_ok && writer_finish(&cw) == 0) {
+            log_line("Color classification (tiled): saved to %s (dominant: %s)", color_path, cname);
+        } else {
+            writer_close(&cw);
+            log_line("Failed to save color-classified image to %s", color_path);
+        }
+    }
+    if (do_hist) {
+        if (hist_ok && decode_ok && writer_finish(&hw) == 0) {
+            log_line("Histogram equalization (tiled): saved to %s", hist_path);
+        } else {
+            writer_close(&hw);
+            log_line("Failed to save histogram-equalized image to %s", hist_path);
+        }
+    }
+    return 0;
+}
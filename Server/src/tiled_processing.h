@@ -0,0 +1,27 @@
+#ifndef TILED_PROCESSING_H
+#define TILED_PROCESSING_H
+
+#include <stddef.h>
+#include "protocol.h"
+
+// Out-of-core processing for images whose decoded bitmap would exceed
+// memory.max_working_set_mb. The image is decoded in horizontal strips
+// (libpng / libjpeg row interfaces): a first pass gathers the histograms
+// and color sums, a second pass decodes again, remaps each strip and
+// encodes it straight to the output files. Peak memory is one strip plus
+// codec state, independent of the image height.
+
+// 1 when a width x height x channels bitmap is over the working-set cap
+int tiled_exceeds_working_set(int width, int height, int channels);
+
+// Bytes of the strip buffer the tiled path uses for such an image
+size_t tiled_strip_bytes(int width, int height, int channels);
+
+// Process a PNG or JPEG in strips. Returns 0 when handled, -1 when the
+// image cannot be processed this way (other codec, interlaced PNG, CMYK
+// JPEG, decode error) and the caller should use the in-memory path.
+int process_image_tiled(const unsigned char* data, size_t size,
+                        const char* image_id, const char* filename,
+                        const char* format, ProcessingType processing_type);
+
+#endif // TILED_PROCESSING_H
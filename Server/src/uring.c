@@ -0,0 +1,729 @@
+#include "uring.h"
+#include "session.h"
+#include "server.h"
+#include "logging.h"
+#include <linux/io_uring.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <errno.h>
+#include <arpa/inet.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+
+#define URING_ENTRIES       1024
+#define URING_BUF_COUNT     512          // provided receive buffers (power of two)
+#define URING_BUF_SIZE      16384        // windows at least this large bypass them
+#define URING_BUF_GROUP     1
+#define URING_IDLE_TIMEOUT  15           // seconds, as the other engines
+#define URING_DRAIN_TICKS   5            // shutdown: give in-flight I/O this many ticks
+
+// user_data = object pointer | operation (pointers are at least 8-aligned)
+enum { OP_ACCEPT = 1, OP_TICK, OP_RECV, OP_SEND, OP_CLOSE, OP_WAKE };
+#define UD_MAKE(p, op) ((uint64_t)(uintptr_t)(p) | (uint64_t)(op))
+#define UD_OP(ud)      ((int)((ud) & 7))
+#define UD_PTR(ud)     ((void*)(uintptr_t)((ud) & ~(uint64_t)7))
+
+typedef struct {
+    int                  fd;
+    unsigned             sq_entries;
+    unsigned*            sq_head;
+    unsigned*            sq_tail;
+    unsigned*            sq_mask;
+    unsigned*            sq_array;
+    unsigned*            cq_head;
+    unsigned*            cq_tail;
+    unsigned*            cq_mask;
+    struct io_uring_sqe* sqes;
+    struct io_uring_cqe* cqes;
+    void*                ring_ptr;
+    size_t               ring_sz;
+    void*                sqes_ptr;
+    size_t               sqes_sz;
+    unsigned             sqe_tail;    // local SQ tail, published on submit
+} Ring;
+
+typedef struct UConn {
+    int            fd;
+    Session        sess;
+    int            recv_inflight;
+    int            send_inflight;
+    int            close_inflight;  // linked behind the final send
+    int            fd_closed;
+    int            closing;         // no new I/O; freed once nothing is in flight
+    unsigned char  sendbuf[SESSION_OUT_CAP];
+    size_t         send_off;
+    size_t         send_len;
+    int            held_bid;        // provided buffer with bytes not yet consumed (-1: none)
+    size_t         held_off;
+    size_t         held_len;
+    int            retry;           // on the retry list
+    time_t         last_active;
+    struct UConn*  prev;
+    struct UConn*  next;
+    struct UConn*  next_retry;
+} UConn;
+
+typedef struct {
+    Ring                     ring;
+    struct io_uring_buf_ring* br;
+    size_t                   br_sz;
+    unsigned char*           bufs;
+    unsigned short           br_tail;
+    int                      listen_fd;
+    int                      multishot;      // multishot accept supported
+    int                      accept_armed;
+    int                      accepted;       // connections accepted so far
+    int                      tick_armed;
+    struct __kernel_timespec tick;
+    SessionMailbox           mbox;           // journal ACKs, signalled through evfd
+    int                      evfd;
+    int                      wake_armed;
+    uint64_t                 wake_count;     // eventfd read target
+    UConn*                   conns;
+    UConn*                   retry;          // need another progress pass
+} Uring;
+
+static Uring g_u;
+
+static void conn_progress(Uring* u, UConn* c);
+
+static int sys_uring_setup(unsigned entries, struct io_uring_params* p) {
+    return (int)syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int sys_uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags) {
+    return (int)syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, NULL, 0);
+}
+
+static int sys_uring_register(int fd, unsigned op, void* arg, unsigned nr) {
+    return (int)syscall(__NR_io_uring_register, fd, op, arg, nr);
+}
+
+/*
+ * ring_init
+ * ---------
+ * Create the ring and map its queues. Requires a single mapping for
+ * both rings and no dropped completions (Linux 5.5+).
+ */
+static int ring_init(Ring* r, unsigned entries) {
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    p.flags = IORING_SETUP_COOP_TASKRUN | IORING_SETUP_SINGLE_ISSUER;
+    int fd = sys_uring_setup(entries, &p);
+    if (fd < 0 && errno == EINVAL) {    // older kernel: plain ring
+        memset(&p, 0, sizeof(p));
+        fd = sys_uring_setup(entries, &p);
+    }
+    if (fd < 0) return -1;
+    if (!(p.features & IORING_FEAT_SINGLE_MMAP) || !(p.features & IORING_FEAT_NODROP)) {
+        close(fd);
+        errno = ENOTSUP;
+        return -1;
+    }
+
+    size_t sq_sz = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    size_t cq_sz = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    r->ring_sz = sq_sz > cq_sz ? sq_sz : cq_sz;
+    r->ring_ptr = mmap(NULL, r->ring_sz, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                       fd, IORING_OFF_SQ_RING);
+    if (r->ring_ptr == MAP_FAILED) { close(fd); return -1; }
+
+    r->sqes_sz = p.sq_entries * sizeof(struct io_uring_sqe);
+    r->sqes_ptr = mmap(NULL, r->sqes_sz, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                       fd, IORING_OFF_SQES);
+    if (r->sqes_ptr == MAP_FAILED) {
+        munmap(r->ring_ptr, r->ring_sz);
+        close(fd);
+        return -1;
+    }
+
+    char* base = (char*)r->ring_ptr;
+    r->sq_head  = (unsigned*)(base + p.sq_off.head);
+    r->sq_tail  = (unsigned*)(base + p.sq_off.tail);
+    r->sq_mask  = (unsigned*)(base + p.sq_off.ring_mask);
+    r->sq_array = (unsigned*)(base + p.sq_off.array);
+    r->cq_head  = (unsigned*)(base + p.cq_off.head);
+    r->cq_tail  = (unsigned*)(base + p.cq_off.tail);
+    r->cq_mask  = (unsigned*)(base + p.cq_off.ring_mask);
+    r->cqes     = (struct io_uring_cqe*)(base + p.cq_off.cqes);
+    r->sqes     = (struct io_uring_sqe*)r->sqes_ptr;
+    r->sq_entries = p.sq_entries;
+    r->sqe_tail = *r->sq_tail;
+    r->fd = fd;
+    return 0;
+}
+
+static void ring_exit(Ring* r) {
+    munmap(r->sqes_ptr, r->sqes_sz);
+    munmap(r->ring_ptr, r->ring_sz);
+    close(r->fd);
+}
+
+/*
+ * ring_submit
+ * -----------
+ * Publish the queued SQEs and enter the kernel, optionally waiting for
+ * `wait_nr` completions. Returns the io_uring_enter result.
+ */
+static int ring_submit(Ring* r, unsigned wait_nr) {
+    __atomic_store_n(r->sq_tail, r->sqe_tail, __ATOMIC_RELEASE);
+    unsigned to_submit = r->sqe_tail - __atomic_load_n(r->sq_head, __ATOMIC_ACQUIRE);
+    if (to_submit == 0 && wait_nr == 0) return 0;
+    return sys_uring_enter(r->fd, to_submit, wait_nr, wait_nr ? IORING_ENTER_GETEVENTS : 0);
+}
+
+static unsigned ring_space(const Ring* r) {
+    return r->sq_entries - (r->sqe_tail - __atomic_load_n(r->sq_head, __ATOMIC_ACQUIRE));
+}
+
+/*
+ * ring_get_sqes
+ * -------------
+ * Reserve `n` consecutive, zeroed SQEs (submitting the queue first if it
+ * is full, so a linked chain is never split). Returns the first or NULL.
+ */
+static struct io_uring_sqe* ring_get_sqes(Ring* r, unsigned n) {
+    if (ring_space(r) < n) {
+        ring_submit(r, 0);
+        if (ring_space(r) < n) return NULL;
+    }
+    struct io_uring_sqe* first = NULL;
+    for (unsigned i = 0; i < n; ++i) {
+        unsigned idx = r->sqe_tail & *r->sq_mask;
+        struct io_uring_sqe* sqe = &r->sqes[idx];
+        memset(sqe, 0, sizeof(*sqe));
+        r->sq_array[idx] = idx;
+        r->sqe_tail++;
+        if (!first) first = sqe;
+    }
+    return first;
+}
+
+static struct io_uring_sqe* ring_next(Ring* r, struct io_uring_sqe* sqe) {
+    return &r->sqes[((unsigned)(sqe - r->sqes) + 1) & *r->sq_mask];
+}
+
+/*
+ * bufring_add
+ * -----------
+ * Return provided buffer `bid` to the kernel.
+ */
+static void bufring_add(Uring* u, int bid) {
+    struct io_uring_buf* b = &u->br->bufs[u->br_tail & (URING_BUF_COUNT - 1)];
+    b->addr = (uint64_t)(uintptr_t)(u->bufs + (size_t)bid * URING_BUF_SIZE);
+    b->len  = URING_BUF_SIZE;
+    b->bid  = (uint16_t)bid;
+    u->br_tail++;
+    __atomic_store_n(&u->br->tail, u->br_tail, __ATOMIC_RELEASE);
+}
+
+/*
+ * bufring_init
+ * ------------
+ * Register the provided-buffer ring (Linux 5.19+) and fill it.
+ */
+static int bufring_init(Uring* u) {
+    u->br_sz = URING_BUF_COUNT * sizeof(struct io_uring_buf);
+    u->br = mmap(NULL, u->br_sz, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (u->br == MAP_FAILED) { u->br = NULL; return -1; }
+    u->bufs = mmap(NULL, (size_t)URING_BUF_COUNT * URING_BUF_SIZE, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (u->bufs == MAP_FAILED) {
+        munmap(u->br, u->br_sz);
+        u->br = NULL;
+        u->bufs = NULL;
+        return -1;
+    }
+
+    struct io_uring_buf_reg reg;
+    memset(&reg, 0, sizeof(reg));
+    reg.ring_addr    = (uint64_t)(uintptr_t)u->br;
+    reg.ring_entries = URING_BUF_COUNT;
+    reg.bgid         = URING_BUF_GROUP;
+    if (sys_uring_register(u->ring.fd, IORING_REGISTER_PBUF_RING, &reg, 1) != 0) {
+        int err = errno;
+        munmap(u->bufs, (size_t)URING_BUF_COUNT * URING_BUF_SIZE);
+        munmap(u->br, u->br_sz);
+        u->br = NULL;
+        u->bufs = NULL;
+        errno = err;
+        return -1;
+    }
+
+    u->br_tail = 0;
+    for (int i = 0; i < URING_BUF_COUNT; ++i) bufring_add(u, i);
+    return 0;
+}
+
+static void bufring_free(Uring* u) {
+    if (u->bufs) munmap(u->bufs, (size_t)URING_BUF_COUNT * URING_BUF_SIZE);
+    if (u->br) munmap(u->br, u->br_sz);
+    u->bufs = NULL;
+    u->br = NULL;
+}
+
+static void arm_accept(Uring* u) {
+    struct io_uring_sqe* sqe = ring_get_sqes(&u->ring, 1);
+    if (!sqe) return;   // re-armed on the next tick
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = u->listen_fd;
+    sqe->accept_flags = SOCK_CLOEXEC;
+    if (u->multishot) sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+    sqe->user_data = UD_MAKE(NULL, OP_ACCEPT);
+    u->accept_armed = 1;
+}
+
+static void arm_tick(Uring* u) {
+    struct io_uring_sqe* sqe = ring_get_sqes(&u->ring, 1);
+    if (!sqe) return;
+    u->tick.tv_sec = 1;
+    u->tick.tv_nsec = 0;
+    sqe->opcode = IORING_OP_TIMEOUT;
+    sqe->addr = (uint64_t)(uintptr_t)&u->tick;
+    sqe->len = 1;
+    sqe->user_data = UD_MAKE(NULL, OP_TICK);
+    u->tick_armed = 1;
+}
+
+// Read the mailbox eventfd: completes when the journal posts an ACK
+static void arm_wake(Uring* u) {
+    struct io_uring_sqe* sqe = ring_get_sqes(&u->ring, 1);
+    if (!sqe) return;   // re-armed on the next tick
+    sqe->opcode = IORING_OP_READ;
+    sqe->fd = u->evfd;
+    sqe->addr = (uint64_t)(uintptr_t)&u->wake_count;
+    sqe->len = sizeof(u->wake_count);
+    sqe->user_data = UD_MAKE(NULL, OP_WAKE);
+    u->wake_armed = 1;
+}
+
+static void queue_retry(Uring* u, UConn* c) {
+    if (c->retry) return;
+    c->retry = 1;
+    c->next_retry = u->retry;
+    u->retry = c;
+}
+
+/*
+ * conn_begin_close
+ * ----------------
+ * Stop all I/O on a connection; a pending receive is woken by shutting
+ * the socket down. The connection is freed once nothing is in flight.
+ */
+static void conn_begin_close(UConn* c) {
+    if (c->closing) return;
+    c->closing = 1;
+    if (!c->fd_closed && c->recv_inflight) shutdown(c->fd, SHUT_RDWR);
+}
+
+static void conn_maybe_free(Uring* u, UConn* c) {
+    if (!c->closing || c->recv_inflight || c->send_inflight || c->close_inflight || c->retry) return;
+
+    if (c->held_bid >= 0) bufring_add(u, c->held_bid);
+    if (c->prev) c->prev->next = c->next; else if (u->conns == c) u->conns = c->next;
+    if (c->next) c->next->prev = c->prev;
+
+    session_destroy(&c->sess);
+    if (!c->fd_closed) close(c->fd);
+    free(c);
+    log_line("Connection closed");
+}
+
+/*
+ * feed_held
+ * ---------
+ * Copy bytes from the held provided buffer into successive session
+ * windows. The buffer goes back to the kernel once it is empty, or when
+ * the session ends and the rest is of no use.
+ */
+static void feed_held(Uring* u, UConn* c) {
+    const unsigned char* src = u->bufs + (size_t)c->held_bid * URING_BUF_SIZE;
+    while (c->held_off < c->held_len) {
+        void* buf;
+        size_t len;
+        session_recv_window(&c->sess, &buf, &len);
+        if (len == 0) break;
+        size_t n = c->held_len - c->held_off;
+        if (n > len) n = len;
+        memcpy(buf, src + c->held_off, n);
+        c->held_off += n;
+        if (session_received(&c->sess, n) != SESSION_OPEN) break;
+    }
+    if (c->held_off == c->held_len || c->sess.status != SESSION_OPEN) {
+        bufring_add(u, c->held_bid);
+        c->held_bid = -1;
+    }
+}
+
+/*
+ * submit_send
+ * -----------
+ * Send the staged responses. The final ACK of a finished session is
+ * linked to the socket close, so both go out in the same submission.
+ */
+static int submit_send(Uring* u, UConn* c) {
+    const void* more;
+    int link_close = (c->sess.status == SESSION_DONE && !session_ack_pending(&c->sess) &&
+                      session_pending_output(&c->sess, &more) == 0);
+    struct io_uring_sqe* sqe = ring_get_sqes(&u->ring, link_close ? 2 : 1);
+    if (!sqe) return -1;
+
+    sqe->opcode = IORING_OP_SEND;
+    sqe->fd = c->fd;
+    sqe->addr = (uint64_t)(uintptr_t)(c->sendbuf + c->send_off);
+    sqe->len = (uint32_t)(c->send_len - c->send_off);
+    sqe->msg_flags = MSG_NOSIGNAL;
+    sqe->user_data = UD_MAKE(c, OP_SEND);
+    c->send_inflight = 1;
+
+    if (link_close) {
+        sqe->flags |= IOSQE_IO_LINK;
+        struct io_uring_sqe* cl = ring_next(&u->ring, sqe);
+        cl->opcode = IORING_OP_CLOSE;
+        cl->fd = c->fd;
+        cl->user_data = UD_MAKE(c, OP_CLOSE);
+        c->close_inflight = 1;
+    }
+    return 0;
+}
+
+static int submit_recv(Uring* u, UConn* c, void* buf, size_t len) {
+    struct io_uring_sqe* sqe = ring_get_sqes(&u->ring, 1);
+    if (!sqe) return -1;
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = c->fd;
+    if (len >= URING_BUF_SIZE) {
+        // Large payload window: straight into the image buffer
+        sqe->addr = (uint64_t)(uintptr_t)buf;
+        sqe->len = (uint32_t)(len > 0x7ffff000u ? 0x7ffff000u : len);
+    } else {
+        // Headers and small payloads: the kernel picks a provided buffer,
+        // which may also carry the start of the following messages
+        sqe->flags = IOSQE_BUFFER_SELECT;
+        sqe->buf_group = URING_BUF_GROUP;
+        sqe->len = URING_BUF_SIZE;
+    }
+    sqe->user_data = UD_MAKE(c, OP_RECV);
+    c->recv_inflight = 1;
+    return 0;
+}
+
+/*
+ * conn_progress
+ * -------------
+ * Queue whatever the connection can do next: consume held input, send
+ * responses (one send in flight at a time), close a finished session,
+ * or post the next receive.
+ */
+static void conn_progress(Uring* u, UConn* c) {
+    if (c->closing) { conn_maybe_free(u, c); return; }
+
+    if (c->held_bid >= 0) feed_held(u, c);
+
+    if (!c->send_inflight && !c->close_inflight) {
+        if (c->send_len == 0) {
+            const void* out;
+            size_t n = session_pending_output(&c->sess, &out);
+            if (n > 0) {
+                memcpy(c->sendbuf, out, n);
+                c->send_off = 0;
+                c->send_len = n;
+                session_consume_output(&c->sess, n);
+            }
+        }
+        if (c->send_len > 0) {
+            if (submit_send(u, c) != 0) { queue_retry(u, c); return; }
+        } else if (c->sess.status != SESSION_OPEN && !session_ack_pending(&c->sess)) {
+            conn_begin_close(c);     // finished (or failed) with nothing left to say
+            conn_maybe_free(u, c);
+            return;
+        }
+    }
+
+    if (c->sess.status == SESSION_FAILED) {
+        conn_begin_close(c);
+        conn_maybe_free(u, c);
+        return;
+    }
+
+    if (c->sess.status == SESSION_OPEN && !c->recv_inflight && c->held_bid < 0) {
+        void* buf;
+        size_t len;
+        session_recv_window(&c->sess, &buf, &len);
+        if (len == 0) return;        // responses must drain first
+        if (submit_recv(u, c, buf, len) != 0) queue_retry(u, c);
+    }
+}
+
+static void on_accept(Uring* u, int res, unsigned flags) {
+    if (!(flags & IORING_CQE_F_MORE)) u->accept_armed = 0;
+
+    if (res < 0) {
+        if (g_terminate) return;
+        if (res == -EINVAL && u->multishot && u->accepted == 0) {
+            log_line("io_uring: multishot accept unsupported, re-arming per connection");
+            u->multishot = 0;
+        } else if (res != -EINTR && res != -ECONNABORTED) {
+            log_line("io_uring: accept failed (errno=%d)", -res);
+            return;   // re-armed on the next tick, not in a tight loop
+        }
+        if (!u->accept_armed) arm_accept(u);
+        return;
+    }
+    if (!u->accept_armed && !g_terminate) arm_accept(u);
+    u->accepted++;
+
+    struct sockaddr_in cli;
+    socklen_t clilen = sizeof(cli);
+    char cip[64] = "?";
+    int port = 0;
+    if (getpeername(res, (struct sockaddr*)&cli, &clilen) == 0) {
+        inet_ntop(AF_INET, &cli.sin_addr, cip, sizeof(cip));
+        port = ntohs(cli.sin_port);
+    }
+    log_line("Accepted connection from %s:%d", cip, port);
+
+    if (g_reload) {
+        g_reload = 0;
+        log_line("Reload flag observed (SIGHUP)");
+    }
+
+    UConn* c = (UConn*)calloc(1, sizeof(UConn));
+    if (!c) {
+        log_line("io_uring: OOM for connection state");
+        close(res);
+        return;
+    }
+    c->fd = res;
+    c->held_bid = -1;
+    c->last_active = time(NULL);
+    session_init(&c->sess);
+    session_set_peer(&c->sess, res);
+    session_set_mailbox(&c->sess, &u->mbox, c);
+    c->next = u->conns;
+    if (u->conns) u->conns->prev = c;
+    u->conns = c;
+
+    conn_progress(u, c);
+}
+
+static void on_recv(Uring* u, UConn* c, int res, unsigned flags) {
+    c->recv_inflight = 0;
+    c->last_active = time(NULL);
+
+    if (flags & IORING_CQE_F_BUFFER) {
+        int bid = (int)(flags >> IORING_CQE_BUFFER_SHIFT);
+        if (res > 0 && !c->closing) {
+            c->held_bid = bid;
+            c->held_off = 0;
+            c->held_len = (size_t)res;
+        } else {
+            bufring_add(u, bid);
+        }
+    }
+
+    if (c->closing) { conn_maybe_free(u, c); return; }
+
+    if (res == -ENOBUFS) {          // every provided buffer is in use: try again shortly
+        queue_retry(u, c);
+        return;
+    }
+    if (res <= 0) {
+        session_log_disconnect(&c->sess, res == 0 ? CS_EOF : CS_ERR);
+        if (res == 0 && session_ack_pending(&c->sess)) {
+            session_end_input(&c->sess);     // closed once the held ACKs are sent
+            conn_progress(u, c);
+            return;
+        }
+        conn_begin_close(c);
+        conn_maybe_free(u, c);
+        return;
+    }
+
+    if (!(flags & IORING_CQE_F_BUFFER)) session_received(&c->sess, (size_t)res);
+    conn_progress(u, c);
+}
+
+static void on_send(Uring* u, UConn* c, int res) {
+    c->send_inflight = 0;
+    c->last_active = time(NULL);
+    if (res < 0) {
+        if (!c->closing) log_line("Failed sending response");
+        conn_begin_close(c);
+        conn_maybe_free(u, c);
+        return;
+    }
+    c->send_off += (size_t)res;
+    if (c->send_off >= c->send_len) c->send_off = c->send_len = 0;
+    conn_progress(u, c);   // a short send broke the link: the close is re-linked
+}
+
+static void on_close(Uring* u, UConn* c, int res) {
+    c->close_inflight = 0;
+    if (res != -ECANCELED) {
+        c->fd_closed = 1;
+        c->closing = 1;
+    }
+    conn_progress(u, c);
+}
+
+// Journal ACKs were queued: send them
+static void on_session_ack(void* owner, void* ctx) {
+    conn_progress((Uring*)ctx, (UConn*)owner);
+}
+
+static void on_wake(Uring* u, int res) {
+    u->wake_armed = 0;
+    if (res < 0 && res != -EAGAIN && res != -EINTR) {
+        log_line("io_uring: eventfd read failed (errno=%d)", -res);
+        return;   // re-armed on the next tick
+    }
+    session_mailbox_collect(&u->mbox, on_session_ack, u);
+    if (!g_terminate) arm_wake(u);
+}
+
+static void sweep_idle(Uring* u, time_t now) {
+    for (UConn* c = u->conns; c; c = c->next) {
+        if (!c->closing && now - c->last_active >= URING_IDLE_TIMEOUT) {
+            log_line("Connection idle for %d s, closing", URING_IDLE_TIMEOUT);
+            conn_begin_close(c);
+            if (!c->recv_inflight) queue_retry(u, c);
+        }
+    }
+}
+
+/*
+ * dispatch
+ * --------
+ * Route one completion to its handler.
+ */
+static void dispatch(Uring* u, uint64_t ud, int res, unsigned flags) {
+    UConn* c = (UConn*)UD_PTR(ud);
+    switch (UD_OP(ud)) {
+        case OP_ACCEPT: on_accept(u, res, flags); break;
+        case OP_TICK:   u->tick_armed = 0; break;
+        case OP_RECV:   on_recv(u, c, res, flags); break;
+        case OP_SEND:   on_send(u, c, res); break;
+        case OP_CLOSE:  on_close(u, c, res); break;
+        case OP_WAKE:   on_wake(u, res); break;
+        default: break;
+    }
+}
+
+/*
+ * reap
+ * ----
+ * Handle every completion currently in the CQ. Returns how many.
+ */
+static int reap(Uring* u) {
+    Ring* r = &u->ring;
+    unsigned head = *r->cq_head;
+    int n = 0;
+    for (;;) {
+        unsigned tail = __atomic_load_n(r->cq_tail, __ATOMIC_ACQUIRE);
+        if (head == tail) break;
+        struct io_uring_cqe* cqe = &r->cqes[head & *r->cq_mask];
+        uint64_t ud = cqe->user_data;
+        int res = cqe->res;
+        unsigned flags = cqe->flags;
+        head++;
+        __atomic_store_n(r->cq_head, head, __ATOMIC_RELEASE);
+        dispatch(u, ud, res, flags);
+        n++;
+    }
+    return n;
+}
+
+static void run_retries(Uring* u) {
+    UConn* list = u->retry;
+    u->retry = NULL;
+    while (list) {
+        UConn* c = list;
+        list = c->next_retry;
+        c->retry = 0;
+        conn_progress(u, c);
+    }
+}
+
+int uring_serve(int listen_fd) {
+    Uring* u = &g_u;
+    memset(u, 0, sizeof(*u));
+    u->listen_fd = listen_fd;
+    u->multishot = 1;
+
+    if (ring_init(&u->ring, URING_ENTRIES) != 0) {
+        log_line("io_uring: setup failed (errno=%d)", errno);
+        return -1;
+    }
+    if (bufring_init(u) != 0) {
+        log_line("io_uring: provided buffer ring unsupported (errno=%d)", errno);
+        ring_exit(&u->ring);
+        return -1;
+    }
+    u->evfd = eventfd(0, EFD_CLOEXEC);
+    if (u->evfd < 0) {
+        log_line("io_uring: cannot create eventfd (errno=%d)", errno);
+        bufring_free(u);
+        ring_exit(&u->ring);
+        return -1;
+    }
+    session_mailbox_init(&u->mbox, u->evfd);
+    log_line("io_uring engine started (%d entries, %d x %d KiB receive buffers)",
+             URING_ENTRIES, URING_BUF_COUNT, URING_BUF_SIZE / 1024);
+
+    arm_accept(u);
+    arm_tick(u);
+    arm_wake(u);
+    time_t last_sweep = time(NULL);
+
+    while (!g_terminate) {
+        run_retries(u);
+        int ret = ring_submit(&u->ring, u->retry ? 0 : 1);
+        if (ret < 0 && errno != EINTR && errno != EAGAIN && errno != EBUSY) {
+            log_line("io_uring: enter failed (errno=%d)", errno);
+            break;
+        }
+        reap(u);
+
+        if (!u->tick_armed && !g_terminate) {
+            time_t now = time(NULL);
+            if (now != last_sweep) {
+                sweep_idle(u, now);
+                last_sweep = now;
+            }
+            if (!u->accept_armed) arm_accept(u);
+            if (!u->wake_armed) arm_wake(u);
+            arm_tick(u);
+        }
+    }
+
+    // Shutdown: stop every connection and wait for its I/O to complete
+    for (UConn* c = u->conns; c; c = c->next) {
+        conn_begin_close(c);
+        queue_retry(u, c);
+    }
+    int ticks = 0;
+    while (u->conns && ticks < URING_DRAIN_TICKS) {
+        run_retries(u);
+        if (!u->tick_armed) { arm_tick(u); ticks++; }
+        if (ring_submit(&u->ring, 1) < 0 && errno != EINTR) break;
+        reap(u);
+    }
+    ring_exit(&u->ring);
+    for (UConn* c = u->conns; c; c = c->next) session_cancel_acks(&c->sess);
+    session_mailbox_destroy(&u->mbox);
+    close(u->evfd);
+    if (u->conns) {
+        // The kernel may still own their buffers: leak rather than free
+        log_line("io_uring: connections with I/O still in flight at shutdown");
+    } else {
+        bufring_free(u);
+    }
+    log_line("io_uring engine stopped");
+    return 0;
+}
@@ -0,0 +1,17 @@
+#ifndef URING_H
+#define URING_H
+
+// io_uring connection engine for plain TCP. One ring drives every
+// connection's protocol session: multishot accept, receives from a
+// provided-buffer ring (small windows, e.g. headers) or straight into
+// the image buffer (large payload windows), and the final ACK as a
+// send linked to the socket close. Submissions and completions for all
+// connections are batched into one io_uring_enter per loop iteration.
+// Uses the raw syscalls, so there is no liburing dependency.
+
+// Serve connections on the (listening) `listen_fd` until shutdown.
+// Returns: 0 after shutdown, -1 if io_uring is unavailable on this
+// kernel (nothing has been accepted; the caller falls back).
+int uring_serve(int listen_fd);
+
+#endif // URING_H
@@ -106,4 +106,18 @@ unsigned char* read_file_fully(const char* path, int* out_len) {
     fclose(f);
     *out_len = (int)sz;
     return buf;
-}
\ No newline at end of file
+}
+/*
+ * write_file_fully
+ * ----------------
+ * Write `len` bytes from `data` to `path`, replacing the file. Returns
+ * 0 on success or -1 on error.
+ */
+int write_file_fully(const char* path, const unsigned char* data, size_t len) {
+    FILE* f = fopen(path, "wb");
+    if (!f) return -1;
+
+    size_t n = len ? fwrite(data, 1, len, f) : 0;
+    if (fclose(f) != 0 || n != len) return -1;
+    return 0;
+}
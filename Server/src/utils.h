@@ -2,6 +2,7 @@
 #define UTILS_H
 
 #include <stdint.h>
+#include <stddef.h>
 #include <sys/types.h>
 
 // Network byte order conversion utilities
@@ -20,4 +21,8 @@ int ensure_parent_dir(const char* file_path);
 // Returns: allocated buffer (must be freed by caller), NULL on failure
 unsigned char* read_file_fully(const char* path, int* out_len);
 
+// Write a buffer to a file, replacing it
+// Returns: 0 on success, -1 on failure
+int write_file_fully(const char* path, const unsigned char* data, size_t len);
+
 #endif // UTILS_H
\ No newline at end of file